@@ -1,4 +1,31 @@
+# add_custom_command(DEPFILE) paths are relative to the binary dir of the caller
+if(POLICY CMP0116)
+    cmake_policy(SET CMP0116 NEW)
+endif()
+
+# src writes a depfile of every file and directory it scanned, so adding or removing
+# resources repacks without re-running CMake. Before 4.0 the other generators keep
+# removed files in their depend info and repack on every build, they glob at configure
+# time instead, CMake then has to be rerun whenever files are added or removed.
+if(CMAKE_GENERATOR MATCHES "Ninja" OR NOT CMAKE_VERSION VERSION_LESS 4.0)
+    set(SRC_USE_DEPFILE ON)
+else()
+    set(SRC_USE_DEPFILE OFF)
+endif()
+
+# Optional: INLINE_THRESHOLD <bytes> embeds resources up to that size in the generated header
+#           CHUNK_THRESHOLD <bytes> stores files of at least that size as deduplicated chunks
+#           GROUPS <file> places the resources of every group of the file contiguously
+#           GROUP_BY_DIR makes every top level directory a group
+#           RULES <file> include, exclude and set rules for the files of the directory
+#           TRANSFORMS <ext=transform>... run built-in transforms on the files of those extensions
+#           TRANSFORM_COMMANDS <ext=command>... convert the files of those extensions with commands
+#           COMPRESS compresses the resources against a dictionary trained on them
+#           DICT_SIZE <bytes> sets the size of that dictionary
+#           FRAME_SIZE <bytes> compresses larger files in frames of that size, 0 as one stream
+#           DELETED <path>... tombstones hiding these paths in lower priority archives of a src_vfs
 function(SRC_COMPILE_RESOURCES target directory name)
+    cmake_parse_arguments(SRC "GROUP_BY_DIR;COMPRESS" "INLINE_THRESHOLD;CHUNK_THRESHOLD;GROUPS;RULES;DICT_SIZE;FRAME_SIZE" "TRANSFORMS;TRANSFORM_COMMANDS;DELETED" ${ARGN})
     message("src: Target: ${target}")
     message("src: ResourceDir: ${directory}")
     message("src: Output: ${name}")
@@ -6,16 +33,62 @@ function(SRC_COMPILE_RESOURCES target directory name)
 
     set(SRC_GENERATED_HEADER "${name}.h")
 
-    # CMake will have to be rerun whenever files are added or removed
-    file(GLOB_RECURSE SRC_FILE_RESOURCES 
-        "${directory}/*")
-    message("${SRC_FILE_RESOURCES}")
+    set(SRC_EXTRA_ARGS "")
+    if(SRC_INLINE_THRESHOLD)
+        list(APPEND SRC_EXTRA_ARGS "--inline-threshold" ${SRC_INLINE_THRESHOLD})
+    endif()
+    if(SRC_CHUNK_THRESHOLD)
+        list(APPEND SRC_EXTRA_ARGS "--chunk-threshold" ${SRC_CHUNK_THRESHOLD})
+    endif()
+    set(SRC_EXTRA_DEPENDS "")
+    if(SRC_GROUPS)
+        list(APPEND SRC_EXTRA_ARGS "--groups" ${SRC_GROUPS})
+        list(APPEND SRC_EXTRA_DEPENDS ${SRC_GROUPS})
+    endif()
+    if(SRC_RULES)
+        list(APPEND SRC_EXTRA_ARGS "--rules" ${SRC_RULES})
+        list(APPEND SRC_EXTRA_DEPENDS ${SRC_RULES})
+    endif()
+    if(SRC_GROUP_BY_DIR)
+        list(APPEND SRC_EXTRA_ARGS "--group-by-dir")
+    endif()
+    foreach(SRC_TRANSFORM ${SRC_TRANSFORMS})
+        list(APPEND SRC_EXTRA_ARGS "--transform" ${SRC_TRANSFORM})
+    endforeach()
+    foreach(SRC_TRANSFORM ${SRC_TRANSFORM_COMMANDS})
+        list(APPEND SRC_EXTRA_ARGS "--transform-cmd" ${SRC_TRANSFORM})
+    endforeach()
+    if(SRC_COMPRESS)
+        list(APPEND SRC_EXTRA_ARGS "--compress")
+    endif()
+    if(DEFINED SRC_DICT_SIZE)
+        list(APPEND SRC_EXTRA_ARGS "--dict-size" ${SRC_DICT_SIZE})
+    endif()
+    if(DEFINED SRC_FRAME_SIZE)
+        list(APPEND SRC_EXTRA_ARGS "--frame-size" ${SRC_FRAME_SIZE})
+    endif()
+    foreach(SRC_DELETED_PATH ${SRC_DELETED})
+        list(APPEND SRC_EXTRA_ARGS "-d" ${SRC_DELETED_PATH})
+    endforeach()
+
+    set(SRC_FILE_RESOURCES "")
+    set(SRC_DEPFILE_ARGS "")
+    if(SRC_USE_DEPFILE)
+        set(SRC_DEPFILE "${CMAKE_CURRENT_BINARY_DIR}/${name}.d")
+        list(APPEND SRC_EXTRA_ARGS "--depfile" "${SRC_DEPFILE}")
+        set(SRC_DEPFILE_ARGS DEPFILE "${SRC_DEPFILE}")
+    else()
+        file(GLOB_RECURSE SRC_FILE_RESOURCES 
+            "${directory}/*")
+        message("${SRC_FILE_RESOURCES}")
+    endif()
 
     add_custom_command(
                     OUTPUT "${CMAKE_BINARY_DIR}/${SRC_GENERATED_HEADER}" "${CMAKE_RUNTIME_OUTPUT_DIRECTORY}/${name}"
-                    COMMAND $<TARGET_FILE:src> ARGS "-v" "-t" ${directory} "-o" ${name} "-s" "${CMAKE_BINARY_DIR}/"
+                    COMMAND $<TARGET_FILE:src> ARGS "-v" "-t" ${directory} "-o" ${name} "-s" "${CMAKE_BINARY_DIR}/" ${SRC_EXTRA_ARGS}
                     WORKING_DIRECTORY $<TARGET_FILE_DIR:src>
-                    DEPENDS ${SRC_FILE_RESOURCES}
+                    DEPENDS ${SRC_FILE_RESOURCES} ${SRC_EXTRA_DEPENDS} src
+                    ${SRC_DEPFILE_ARGS}
                     #BYPRODUCTS ${CMAKE_BINARY_DIR}/${SRC_GENERATED_HEADER}
                     COMMENT "Run SimpleResourceCompiler"
                     VERBATIM
@@ -29,4 +102,86 @@ function(SRC_COMPILE_RESOURCES target directory name)
     #set_property(TARGET ${target} APPEND PROPERTY OBJECT_DEPENDS ${SRC_GENERATED_HEADER})
     #set_property(SOURCE ${SRC_GENERATED_HEADER} APPEND PROPERTY OBJECT_DEPENDS target)
     message("================================")
-endfunction(SRC_COMPILE_RESOURCES)
\ No newline at end of file
+endfunction(SRC_COMPILE_RESOURCES)
+
+# Packs one shard per top level directory of ${directory}, files directly in it go into shard 0.
+# Every shard is its own build step, ${name} becomes the index of the shards.
+function(SRC_COMPILE_SHARDED_RESOURCES target directory name)
+    message("src: Target: ${target}")
+    message("src: ResourceDir: ${directory}")
+    message("src: Output: ${name} (sharded)")
+    message("src: Generating ${name}.h")
+
+    set(SRC_GENERATED_HEADER "${name}.h")
+    get_filename_component(SRC_NAME_BASE ${name} NAME_WLE)
+    get_filename_component(SRC_NAME_EXT ${name} LAST_EXT)
+
+    # the shards are fixed at configure time, CMake has to be rerun when top level
+    # directories are added or removed. Files within them are tracked by depfiles.
+    file(GLOB_RECURSE SRC_FILE_RESOURCES 
+        "${directory}/*")
+
+    # group the files like src --shard-by-dir, directories starting with '.' are skipped
+    set(SRC_SHARD_DIRS "")
+    set(SRC_SHARD_FILES_ROOT "")
+    foreach(SRC_FILE ${SRC_FILE_RESOURCES})
+        file(RELATIVE_PATH SRC_REL_PATH "${directory}" "${SRC_FILE}")
+        if(SRC_REL_PATH MATCHES "(^|/)\\.[^/]*/")
+            continue()
+        endif()
+        if(SRC_REL_PATH MATCHES "^([^/]+)/")
+            set(SRC_DIR "${CMAKE_MATCH_1}")
+            list(APPEND SRC_SHARD_DIRS "${SRC_DIR}")
+            list(APPEND "SRC_SHARD_FILES_DIR_${SRC_DIR}" "${SRC_FILE}")
+        else()
+            list(APPEND SRC_SHARD_FILES_ROOT "${SRC_FILE}")
+        endif()
+    endforeach()
+    list(REMOVE_DUPLICATES SRC_SHARD_DIRS)
+    list(SORT SRC_SHARD_DIRS)
+
+    set(SRC_SHARD 0)
+    set(SRC_SHARD_OUTPUTS "")
+    foreach(SRC_DIR "" ${SRC_SHARD_DIRS})
+        if(SRC_DIR STREQUAL "")
+            set(SRC_SHARD_FILES ${SRC_SHARD_FILES_ROOT})
+        else()
+            set(SRC_SHARD_FILES ${SRC_SHARD_FILES_DIR_${SRC_DIR}})
+        endif()
+        set(SRC_SHARD_OUTPUT "${CMAKE_RUNTIME_OUTPUT_DIRECTORY}/${SRC_NAME_BASE}.${SRC_SHARD}${SRC_NAME_EXT}")
+        set(SRC_DEPFILE_ARGS "")
+        set(SRC_DEPFILE_OPTION "")
+        if(SRC_USE_DEPFILE)
+            set(SRC_DEPFILE "${CMAKE_CURRENT_BINARY_DIR}/${SRC_NAME_BASE}.${SRC_SHARD}${SRC_NAME_EXT}.d")
+            set(SRC_DEPFILE_OPTION "--depfile" "${SRC_DEPFILE}")
+            set(SRC_DEPFILE_ARGS DEPFILE "${SRC_DEPFILE}")
+            set(SRC_SHARD_FILES "")
+        endif()
+        add_custom_command(
+                        OUTPUT "${SRC_SHARD_OUTPUT}"
+                        COMMAND $<TARGET_FILE:src> ARGS "-v" "-t" ${directory} "-o" ${name} "-s" "${CMAKE_BINARY_DIR}/" "--shard-by-dir" "--shard" ${SRC_SHARD} ${SRC_DEPFILE_OPTION}
+                        WORKING_DIRECTORY $<TARGET_FILE_DIR:src>
+                        DEPENDS ${SRC_SHARD_FILES} src
+                        ${SRC_DEPFILE_ARGS}
+                        COMMENT "Run SimpleResourceCompiler, shard ${SRC_SHARD} of ${name}"
+                        VERBATIM
+        )
+        list(APPEND SRC_SHARD_OUTPUTS "${SRC_SHARD_OUTPUT}")
+        math(EXPR SRC_SHARD "${SRC_SHARD} + 1")
+    endforeach()
+
+    add_custom_command(
+                    OUTPUT "${CMAKE_BINARY_DIR}/${SRC_GENERATED_HEADER}" "${CMAKE_RUNTIME_OUTPUT_DIRECTORY}/${name}"
+                    COMMAND $<TARGET_FILE:src> ARGS "-v" "-t" ${directory} "-o" ${name} "-s" "${CMAKE_BINARY_DIR}/" "--shard-by-dir" "--shard-index"
+                    WORKING_DIRECTORY $<TARGET_FILE_DIR:src>
+                    DEPENDS ${SRC_SHARD_OUTPUTS} src
+                    COMMENT "Run SimpleResourceCompiler, index of ${name}"
+                    VERBATIM
+    )
+
+    target_sources(${target}
+        PUBLIC 
+            "${CMAKE_BINARY_DIR}/${SRC_GENERATED_HEADER}"
+    )
+    message("================================")
+endfunction(SRC_COMPILE_SHARDED_RESOURCES)
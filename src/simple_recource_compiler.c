@@ -1,37 +1,40 @@
 #include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <inttypes.h>
 #include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <errno.h>
 #include <time.h>
 #include <assert.h>
 
-#define CUTE_FILES_IMPLEMENTATION
-#include "cute_files.h"
-
 #define SIMPLE_RESOURCE_COMPILER_IMPLEMENTATION
 #include "simple_resource_compiler.h"
+#include "src_tool.h"
+#include "src_thread.h"
 
-#define SRC_ID_TABLE_FILE "idTable.tmp"
-#define SRC_STRING_TABLE_FILE "stringTable.tmp"
-#define SRC_OFFSET_TABLE_FILE "offsetTable.tmp"
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
 
 #ifdef WIN32
 const char PrefPathDelimiter = '\\';
 const char OtherPathDelimiter = '/';
 #else
-const char PathDelimiter = '/';
+const char PrefPathDelimiter = '/';
 const char OtherPathDelimiter = '\\';
 #endif
 
-/// 
-/// Usage: src.exe -t "resources/" -o "data.src"
-/// 
+///
+/// Packer shared by the src executable and libsrc.
+///
 
-#define LOGR_MSG(msg) PrintHelper(msg)
-#define LOGF_MSG(fmt, ...) PrintHelper(fmt, __VA_ARGS__)
+int verbose = 1;
 
-static int verbose = 1;
-
-static void PrintHelper(const char* fmt, ...)
+void PrintHelper(const char* fmt, ...)
 {
 	if(!verbose) return;
 	va_list args;
@@ -41,124 +44,18 @@ static void PrintHelper(const char* fmt, ...)
 	puts("");
 }
 
-static void PrintUsage() {
-	LOGR_MSG("Usage:\tsrc.exe -t \"resources/\" -o \"data.src\"");
-	LOGR_MSG("\t-t : Target directory");
-	LOGR_MSG("\t-o : Output file");
-	LOGR_MSG("\t-s : Source output directory");
-	LOGR_MSG("\t-v : Verbose switch");
-}
-
-typedef struct
-{
-	// the input directory
-	const char* targetDir;
-	
-	// the file generated
-	const char* outputFilePath;
-	const char* outputFileName;
-	const char* uppercaseFilename;
-	FILE* outputFile;
-
-	// the header file generated
-	const char* outputHeaderPath;
-	FILE* outputHeaderFile;
-
-	// temporary files to assemble header
-	FILE* tmpStringTableFile;
-	FILE* tmpIdTableFile;
-	FILE* tmpOffsetTableFile;
-
-	int packedFileCount;
-	size_t lastResourceOffset;
-} src_context;
-
-
-
-static char FormatBuffer[1024];
+static char FormatBuffer[4096];
 
 #include "src_helper_impl.inl"
 
-static int StartPacking(src_context* ctx);
-static int RecurseDirectory(src_context* ctx, const char* path);
+static int PackDirectory(src_context* ctx);
 static char* GetFilename(const char* path, int withExtension);
 static char* ToUppercase(char* text);
 static char* SanitizeName(char* name);
 
-static void CopyFileToFile(FILE* dst, FILE* src, size_t bytesToCopy);
-
 static void src_write_helper_definitions(src_context* ctx);
 static void src_write_helper_implementations(src_context* ctx);
-
-int main(int argc, char** argv) {
-	if (argc <= 1) {
-		PrintUsage();
-		return -1;
-	}
-
-	src_context ctx = {0};
-	ctx.outputFilePath = "compiled.src";
-	int handledArgs = 1;
-
-	while (handledArgs < argc) {
-		const char* arg = argv[handledArgs];
-		if (arg[0] != '-' || handledArgs + 1 == argc) {
-			PrintUsage();
-			LOGF_MSG("Failed to handle \"%s\"", arg);
-			return -1;
-		}
-
-		if (strcmp(arg, "-o") == 0) {
-			ctx.outputFilePath = argv[handledArgs + 1];
-			size_t headerPathLen = strlen(ctx.outputFilePath) + 16;
-			ctx.outputFileName = GetFilename(ctx.outputFilePath, FALSE);
-			ctx.uppercaseFilename = ToUppercase(strdup(ctx.outputFileName));
-
-			handledArgs += 2;
-		}
-		else if (strcmp(arg, "-t") == 0) {
-			ctx.targetDir = argv[handledArgs + 1];
-			handledArgs += 2;
-		}
-		else if(strcmp(arg, "-s") == 0) {
-			ctx.outputHeaderPath = argv[handledArgs + 1];
-			handledArgs += 2;
-		}
-		else if(strcmp(arg, "-v") == 0) {
-			verbose = 0;
-			handledArgs += 1;
-		}
-		else {
-			LOGF_MSG("Failed to handle \"%s\"", arg);
-			return -1;
-		}
-	}
-	
-	if(!ctx.outputFilePath) {
-		return -1;
-	}
-	if(!ctx.targetDir) {
-		return -1;
-	}
-	if(!ctx.outputHeaderPath) {
-		return -1;
-	}
-	else {
-		size_t bufLen = strlen(ctx.outputHeaderPath) + strlen(ctx.outputFilePath) + 16;
-		char* headerPath = (char*)malloc(bufLen);
-		snprintf(headerPath, bufLen, "%s%c%s.h", ctx.outputHeaderPath, PrefPathDelimiter, ctx.outputFilePath);
-		ctx.outputHeaderPath = headerPath;
-	}
-
-	printf("Running with Output: \"%s\"\n", ctx.outputFilePath);
-	printf("Running with Input: \"%s\"\n", ctx.targetDir);
-	printf("Running with Header: \"%s\"\n", ctx.outputHeaderPath);
-
-	return StartPacking(&ctx);
-}
-
-#define WRITE_STRUCT(buf, file) fwrite(&buf, sizeof(buf), 1, file)
-#define WRITE_DATA(buf, len, file) fwrite(buf, 1, len, file)
+static void src_write_inline_tables(src_context* ctx);
 
 #define TMP_FORMAT(fmt, ...) format_helper(FormatBuffer, sizeof(FormatBuffer), fmt, __VA_ARGS__)
 
@@ -184,11 +81,17 @@ static void src_header_init(src_main_header* header)
 	header->version = SRC_RESOURCE_VERSION;
 }
 
-static void src_write_header(src_context* ctx, size_t resourceCount)
+void src_write_header(src_context* ctx, uint64_t resourceCount, uint64_t tocOffset)
 {
 	src_main_header header;
 	src_header_init(&header);
+	if (ctx->chunkedCount || ctx->compressedCount) {
+		header.version = SRC_RESOURCE_VERSION_ENCODED;
+	}
+	header.inlineCount = (uint32_t)ctx->inlineCount;
 	header.subResourceCount = resourceCount;
+	header.tocOffset = tocOffset;
+	src_fseek64(ctx->outputFile, 0, SEEK_SET);
 	WRITE_STRUCT(header, ctx->outputFile);
 }
 
@@ -227,91 +130,282 @@ static void src_write_header_start(src_context* ctx)
 	WRITE_TEXT("#ifdef __cplusplus\n", ctx->outputHeaderFile);
 	WRITE_TEXT("extern \"C\" {\n", ctx->outputHeaderFile);
 	WRITE_TEXT("#endif\n\n", ctx->outputHeaderFile);
+}
 
-	WRITE_TEXTF(ctx->tmpStringTableFile, "\nstatic char* %s_RESOURCE_NAMES[] = {\n", ctx->uppercaseFilename);
-	WRITE_TEXTF(ctx->tmpIdTableFile, "\nenum SRC_RESOURCE_%s_ID : int32_t {\n", ctx->uppercaseFilename);
-	WRITE_TEXTF(ctx->tmpOffsetTableFile, "\nstatic size_t %s_RESOURCE_OFFSETS[] = {\n", ctx->uppercaseFilename);
+uint16_t src_root_length(const src_context* ctx, const char* path)
+{
+	// files of the target directory are named "targetDir/relative", tombstones may be relative
+	size_t len = ctx->targetDir ? strlen(ctx->targetDir) : 0;
+	if (len == 0 || len >= UINT16_MAX || strncmp(path, ctx->targetDir, len) != 0 || path[len] != '/' || !path[len + 1]) return 0;
+	return (uint16_t)(len + 1);
 }
 
-static int src_pack_file(src_context* ctx, cf_file_t* file)
+src_packed_entry* src_add_entry(src_context* ctx, const char* path, uint64_t offset, uint64_t recordSize, uint64_t size, uint8_t flags)
 {
-	char buffer[1024];
-	FILE* fileHandle = fopen(file->path, "rb");
-	if (!fileHandle) return 0;
+	if (ctx->entryCount == ctx->entryCapacity) {
+		ctx->entryCapacity = ctx->entryCapacity ? ctx->entryCapacity * 2 : 64;
+		ctx->entries = (src_packed_entry*)realloc(ctx->entries, ctx->entryCapacity * sizeof(src_packed_entry));
+	}
+	src_packed_entry* entry = &ctx->entries[ctx->entryCount++];
+	entry->path = strdup(path);
+	entry->offset = offset;
+	entry->recordSize = recordSize;
+	entry->size = size;
+	entry->flags = flags;
+	entry->alignment = 0;
+	entry->inlineData = NULL;
+	return entry;
+}
 
-	src_resource_header header = { 0 };
-	strcpy(header.header, SRC_SUB_RESOURCE_HEADER_VALUE);
-	LOGF_MSG("Hashing: \"%s\"", file->path);
-	header.id = djb2_hash(file->path);
-	LOGF_MSG("Id: %u", header.id);
-	header.resourceSize = file->size;
-	header.nameLen = strlen(file->path) + 1; // add null terminator
-	header.flags = 0;
-	
-	ctx->lastResourceOffset = ftell(ctx->outputFile);
-	WRITE_STRUCT(header, ctx->outputFile);
-	WRITE_DATA(file->path, header.nameLen, ctx->outputFile);
+static void src_record_header_init(src_resource_header* header, const char* path, uint16_t rootLen, uint64_t size, uint8_t flags)
+{
+	memset(header, 0, sizeof(src_resource_header));
+	strcpy(header->header, SRC_SUB_RESOURCE_HEADER_VALUE);
+	header->id = djb2_hash((unsigned char*)path);
+	header->resourceSize = size;
+	header->nameLen = strlen(path) + 1; // add null terminator
+	header->flags = flags;
+	header->rootLen = rootLen;
+}
+
+// name and data are zero padded, the next record stays aligned
+static const char RecordPadding[SRC_RECORD_ALIGNMENT] = { 0 };
+
+uint64_t src_write_record_start(FILE* out, src_resource_header* header, const char* path, uint16_t rootLen, uint64_t size, uint8_t flags)
+{
+	src_record_header_init(header, path, rootLen, size, flags);
+
+	uint64_t offset = (uint64_t)src_ftell64(out);
+	WRITE_STRUCT(*header, out);
+	WRITE_DATA(path, header->nameLen, out);
+	WRITE_DATA(RecordPadding, src_record_data_offset(header) - sizeof(*header) - header->nameLen, out);
+	return offset;
+}
+
+void src_write_record_finish(FILE* out, uint64_t offset, const src_resource_header* header)
+{
+	WRITE_DATA(RecordPadding, src_record_size(header) - src_record_data_offset(header) - header->resourceSize, out);
+
+	// update header with the checksum
+	uint64_t end = (uint64_t)src_ftell64(out);
+	src_fseek64(out, offset, SEEK_SET);
+	WRITE_STRUCT(*header, out);
+	src_fseek64(out, end, SEEK_SET);
+}
+
+uint64_t src_write_record(FILE* out, const char* path, uint16_t rootLen, FILE* data, uint64_t size, uint8_t flags)
+{
+	src_resource_header header;
+	uint64_t offset = src_write_record_start(out, &header, path, rootLen, size, flags);
 
 	// copy the actual resource file content
-	CopyFileToFile(ctx->outputFile, fileHandle, header.resourceSize);
-
-#if 0
-	SimpleResourceSubResourceHeader foo = {0};
-	size_t currentPos = ftell(ctx->outputFile);
-	fseek(ctx->outputFile, ctx->lastResourceOffset, SEEK_SET);
-	fread(&foo, sizeof(SimpleResourceSubResourceHeader), 1, ctx->outputFile);
-	assert(foo.id == header.id);
-	fseek(ctx->outputFile, currentPos, SEEK_SET);
-#endif
+	header.checksum = data ? CopyFileToFileCrc(out, data, header.resourceSize) : 0;
+	src_write_record_finish(out, offset, &header);
+	return offset;
+}
 
-	fclose(fileHandle);
+uint64_t src_write_record_memory(FILE* out, const char* path, uint16_t rootLen, const void* data, uint64_t size, uint32_t checksum, uint8_t flags)
+{
+	src_resource_header header;
+	src_record_header_init(&header, path, rootLen, size, flags);
+	header.checksum = checksum;
+
+	uint64_t offset = (uint64_t)src_ftell64(out);
+	WRITE_STRUCT(header, out);
+	WRITE_DATA(path, header.nameLen, out);
+	WRITE_DATA(RecordPadding, src_record_data_offset(&header) - sizeof(header) - header.nameLen, out);
+	WRITE_DATA(data, (size_t)size, out);
+	WRITE_DATA(RecordPadding, src_record_size(&header) - src_record_data_offset(&header) - header.resourceSize, out);
+	return offset;
+}
 
-	// write tmp tables
-	WRITE_TEXTF(ctx->tmpStringTableFile, "\t\"%s\",\n", file->path);
-	WRITE_TEXTF(ctx->tmpOffsetTableFile, "\t%lld,\n", ctx->lastResourceOffset);
+unsigned char* src_read_file(const char* path, uint64_t size)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file) return NULL;
+	// one extra byte, malloc(0) may return NULL
+	unsigned char* data = (unsigned char*)malloc((size_t)size + 1);
+	if (fread(data, 1, (size_t)size, file) != size) {
+		free(data);
+		data = NULL;
+	}
+	fclose(file);
+	return data;
+}
 
-	char* resourceName = SanitizeName(ToUppercase(GetFilename(file->path, TRUE)));
-	WRITE_TEXTF(ctx->tmpIdTableFile,
-		"\tSRC_%s_%s = %d,\n",
-		ctx->uppercaseFilename,
-		resourceName,
-		ctx->packedFileCount);
+void src_align_record_data(FILE* out, const char* path, uint32_t alignment)
+{
+	static const char padding[256] = { 0 };
+	src_resource_header header = { 0 };
+	header.nameLen = (uint16_t)(strlen(path) + 1);
+	uint64_t dataOffset = (uint64_t)src_ftell64(out) + src_record_data_offset(&header);
+	for (uint64_t pad = (alignment - dataOffset % alignment) % alignment; pad > 0;) {
+		size_t len = pad < sizeof(padding) ? (size_t)pad : sizeof(padding);
+		WRITE_DATA(padding, len, out);
+		pad -= len;
+	}
+}
 
-	free(resourceName);
-	ctx->packedFileCount += 1;
+void src_mark_record_alignment(FILE* out, uint64_t offset, uint32_t alignment)
+{
+	uint8_t log2 = 0;
+	while ((1u << log2) < alignment) log2 += 1;
+	src_fseek64(out, (int64_t)(offset + offsetof(src_resource_header, alignment)), SEEK_SET);
+	WRITE_DATA(&log2, 1, out);
+	src_fseek64(out, 0, SEEK_END);
+}
+
+uint32_t src_record_alignment(const src_resource_header* header)
+{
+	return header->alignment ? 1u << header->alignment : SRC_RECORD_ALIGNMENT;
+}
+
+int src_pack_file(src_context* ctx, const src_file_entry* file)
+{
+	if (ctx->inlineThreshold && file->size <= ctx->inlineThreshold) {
+		LOGF_MSG("Inlining: \"%s\"", file->path);
+		unsigned char* data = src_read_file(file->source, file->size);
+		if (!data) return 0;
+		src_add_entry(ctx, file->path, 0, 0, file->size, SRC_PACKED_FLAG_INLINE)->inlineData = data;
+		ctx->inlineCount += 1;
+		ctx->packedFileCount += 1;
+		return 1;
+	}
+
+	LOGF_MSG("Hashing: \"%s\"", file->path);
+	LOGF_MSG("Id: %u", djb2_hash((unsigned char*)file->path));
+	// records don't have to be adjacent, the gap is skipped through the TOC
+	if (file->alignment > SRC_RECORD_ALIGNMENT) {
+		src_align_record_data(ctx->outputFile, file->path, file->alignment);
+	}
+	int succ;
+	if (ctx->chunkThreshold && file->size >= ctx->chunkThreshold) {
+		succ = src_pack_chunked(ctx, file);
+	}
+	else if (src_compressible(ctx, file)) {
+		succ = src_pack_compressed(ctx, file);
+	}
+	else {
+		FILE* fileHandle = fopen(file->source, "rb");
+		if (!fileHandle) return 0;
+
+		uint64_t offset = src_write_record(ctx->outputFile, file->path, src_root_length(ctx, file->path), fileHandle, file->size, 0);
+		fclose(fileHandle);
+
+		uint64_t recordSize = (uint64_t)src_ftell64(ctx->outputFile) - offset;
+		src_add_entry(ctx, file->path, offset, recordSize, file->size, 0);
+		ctx->packedFileCount += 1;
+		succ = 1;
+	}
+
+	// merge and watch keep the data aligned when they move the record
+	if (succ && file->alignment > SRC_RECORD_ALIGNMENT) {
+		src_packed_entry* entry = &ctx->entries[ctx->entryCount - 1];
+		src_resource_header header = { 0 };
+		header.nameLen = (uint16_t)(strlen(file->path) + 1);
+		if ((entry->offset + src_record_data_offset(&header)) % file->alignment == 0) {
+			entry->alignment = file->alignment;
+			src_mark_record_alignment(ctx->outputFile, entry->offset, file->alignment);
+		}
+	}
+	return succ;
+}
+
+int src_pack_tombstone(src_context* ctx, const char* path)
+{
+	LOGF_MSG("Tombstone: \"%s\"", path);
+	uint64_t offset = src_write_record(ctx->outputFile, path, src_root_length(ctx, path), NULL, 0, SRC_RESOURCE_FLAG_TOMBSTONE);
+	uint64_t recordSize = (uint64_t)src_ftell64(ctx->outputFile) - offset;
+	src_add_entry(ctx, path, offset, recordSize, 0, SRC_RESOURCE_FLAG_TOMBSTONE);
 	return 1;
 }
 
-static void src_write_header_end(src_context* ctx)
+uint64_t src_write_toc(src_context* ctx)
 {
-	WRITE_TEXT("};\n\n", ctx->tmpStringTableFile);
-	WRITE_TEXT("};\n\n", ctx->tmpOffsetTableFile);
-	
-	WRITE_TEXTF(ctx->tmpIdTableFile,
-		"\tSRC_%s_COUNT = %d,\n",
-		ctx->uppercaseFilename,
-		ctx->packedFileCount);
-	WRITE_TEXT("};\n\n", ctx->tmpIdTableFile);
+	src_fseek64(ctx->outputFile, 0, SEEK_END);
+	uint64_t tocOffset = (uint64_t)src_ftell64(ctx->outputFile);
 
+	src_toc_header header = { 0 };
+	strcpy(header.header, SRC_TOC_HEADER_VALUE);
+	header.entryCount = ctx->entryCount - ctx->inlineCount;
+	WRITE_STRUCT(header, ctx->outputFile);
+
+	for (size_t i = 0; i < ctx->entryCount; i += 1) {
+		if (ctx->entries[i].flags & SRC_PACKED_FLAG_INLINE) continue;
+		src_toc_entry entry = { 0 };
+		entry.id = djb2_hash((unsigned char*)ctx->entries[i].path);
+		entry.flags = ctx->entries[i].flags;
+		entry.offset = ctx->entries[i].offset;
+		header.checksum = src_crc32c(&entry, sizeof(entry), header.checksum);
+		WRITE_STRUCT(entry, ctx->outputFile);
+	}
+
+	// update TOC header with the checksum
+	src_fseek64(ctx->outputFile, tocOffset, SEEK_SET);
+	WRITE_STRUCT(header, ctx->outputFile);
+	src_fseek64(ctx->outputFile, 0, SEEK_END);
+	return tocOffset;
+}
+
+static void src_write_header_end(src_context* ctx)
+{
 	//////////////////////////////////////
 	src_write_helper_definitions(ctx);
 
-	fseek(ctx->tmpIdTableFile, 0, SEEK_END);
-	size_t tmpFileSize = ftell(ctx->tmpIdTableFile);
-	rewind(ctx->tmpIdTableFile);
-	CopyFileToFile(ctx->outputHeaderFile, ctx->tmpIdTableFile, tmpFileSize);
+	// resources come first, in the order of their ids
+	int resourceCount = 0;
+	WRITE_TEXTF(ctx->outputHeaderFile, "\nenum SRC_RESOURCE_%s_ID : int32_t {\n", ctx->uppercaseFilename);
+	for (size_t i = 0; i < ctx->entryCount; i += 1) {
+		if (ctx->entries[i].flags & SRC_RESOURCE_FLAG_TOMBSTONE) continue;
+		char* resourceName = SanitizeName(ToUppercase(GetFilename(ctx->entries[i].path, TRUE)));
+		WRITE_TEXTF(ctx->outputHeaderFile,
+			"\tSRC_%s_%s = %d,\n",
+			ctx->uppercaseFilename,
+			resourceName,
+			resourceCount);
+		free(resourceName);
+		resourceCount += 1;
+	}
+	WRITE_TEXTF(ctx->outputHeaderFile,
+		"\tSRC_%s_COUNT = %d,\n",
+		ctx->uppercaseFilename,
+		resourceCount);
+	WRITE_TEXT("};\n\n", ctx->outputHeaderFile);
 
 	WRITE_TEXTF(ctx->outputHeaderFile, "#ifdef SRC_RESOURCE_%s_IMPLEMENTATION\n", ctx->uppercaseFilename);
 
-	fseek(ctx->tmpStringTableFile, 0, SEEK_END);
-	tmpFileSize = ftell(ctx->tmpStringTableFile);
-	rewind(ctx->tmpStringTableFile);
-	CopyFileToFile(ctx->outputHeaderFile, ctx->tmpStringTableFile, tmpFileSize);
+	WRITE_TEXTF(ctx->outputHeaderFile, "\nstatic char* %s_RESOURCE_NAMES[] = {\n", ctx->uppercaseFilename);
+	for (size_t i = 0; i < ctx->entryCount; i += 1) {
+		if (ctx->entries[i].flags & SRC_RESOURCE_FLAG_TOMBSTONE) continue;
+		WRITE_TEXTF(ctx->outputHeaderFile, "\t\"%s\",\n", ctx->entries[i].path);
+	}
+	WRITE_TEXT("};\n\n", ctx->outputHeaderFile);
+
+	// archives updated by --watch move resources, the TOC has the current offsets,
+	// inlined resources have no record in the archive
+	WRITE_TEXTF(ctx->outputHeaderFile, "\nstatic uint64_t %s_RESOURCE_OFFSETS[] = {\n", ctx->uppercaseFilename);
+	for (size_t i = 0; i < ctx->entryCount; i += 1) {
+		if (ctx->entries[i].flags & SRC_RESOURCE_FLAG_TOMBSTONE) continue;
+		if (ctx->entries[i].flags & SRC_PACKED_FLAG_INLINE) {
+			WRITE_TEXT("\tUINT64_MAX,\n", ctx->outputHeaderFile);
+		}
+		else {
+			WRITE_TEXTF(ctx->outputHeaderFile, "\t%" PRIu64 "ULL,\n", ctx->entries[i].offset);
+		}
+	}
+	WRITE_TEXT("};\n\n", ctx->outputHeaderFile);
 
-	fseek(ctx->tmpOffsetTableFile, 0, SEEK_END);
-	tmpFileSize = ftell(ctx->tmpOffsetTableFile);
-	rewind(ctx->tmpOffsetTableFile);
-	CopyFileToFile(ctx->outputHeaderFile, ctx->tmpOffsetTableFile, tmpFileSize);
+	src_write_inline_tables(ctx);
+
+	if (ctx->shardMode != SRC_SHARD_NONE) {
+		// offsets are relative to the shard
+		WRITE_TEXTF(ctx->outputHeaderFile, "\nstatic const uint32_t %s_RESOURCE_SHARDS[] = {\n", ctx->uppercaseFilename);
+		for (size_t i = 0; i < ctx->entryCount; i += 1) {
+			if (ctx->entries[i].flags & SRC_RESOURCE_FLAG_TOMBSTONE) continue;
+			WRITE_TEXTF(ctx->outputHeaderFile, "\t%u,\n", ctx->entries[i].shard);
+		}
+		WRITE_TEXT("};\n\n", ctx->outputHeaderFile);
+	}
 
 	src_write_helper_implementations(ctx);
 	WRITE_TEXTF(ctx->outputHeaderFile, "\n#endif // SRC_RESOURCE_%s_IMPLEMENTATION\n", ctx->uppercaseFilename);
@@ -323,12 +417,84 @@ static void src_write_header_end(src_context* ctx)
 	WRITE_TEXTF(ctx->outputHeaderFile, "#endif // SRC_RESOURCE_%s_HEADER\n", ctx->uppercaseFilename);
 }
 
+// dumps the content of an inlined resource as a byte array
+static void src_write_inline_data(src_context* ctx, int id, const src_packed_entry* entry)
+{
+	WRITE_TEXTF(ctx->outputHeaderFile, "static const unsigned char %s_RESOURCE_DATA_%d[] = {", ctx->uppercaseFilename, id);
+	for (uint64_t i = 0; i < entry->size; i += 1) {
+		char byte[8];
+		snprintf(byte, sizeof(byte), i % 16 == 0 ? "\n\t0x%02x," : "0x%02x,", entry->inlineData[i]);
+		WRITE_TEXT(byte, ctx->outputHeaderFile);
+	}
+	// arrays can't be empty, the size table has the real size
+	WRITE_TEXT(entry->size ? "\n};\n" : " 0 };\n", ctx->outputHeaderFile);
+}
+
+static void src_write_inline_tables(src_context* ctx)
+{
+	int id = 0;
+	for (size_t i = 0; i < ctx->entryCount; i += 1) {
+		if (ctx->entries[i].flags & SRC_RESOURCE_FLAG_TOMBSTONE) continue;
+		if (ctx->entries[i].flags & SRC_PACKED_FLAG_INLINE) {
+			src_write_inline_data(ctx, id, &ctx->entries[i]);
+		}
+		id += 1;
+	}
+
+	// inlined resources have data here, the others are read from the bound archive
+	WRITE_TEXTF(ctx->outputHeaderFile, "\nstatic const unsigned char* %s_RESOURCE_INLINE_DATA[] = {\n", ctx->uppercaseFilename);
+	id = 0;
+	for (size_t i = 0; i < ctx->entryCount; i += 1) {
+		if (ctx->entries[i].flags & SRC_RESOURCE_FLAG_TOMBSTONE) continue;
+		if (ctx->entries[i].flags & SRC_PACKED_FLAG_INLINE) {
+			WRITE_TEXTF(ctx->outputHeaderFile, "\t%s_RESOURCE_DATA_%d,\n", ctx->uppercaseFilename, id);
+		}
+		else {
+			WRITE_TEXT("\tNULL,\n", ctx->outputHeaderFile);
+		}
+		id += 1;
+	}
+	WRITE_TEXT("};\n\n", ctx->outputHeaderFile);
+
+	WRITE_TEXTF(ctx->outputHeaderFile, "\nstatic const uint64_t %s_RESOURCE_SIZES[] = {\n", ctx->uppercaseFilename);
+	for (size_t i = 0; i < ctx->entryCount; i += 1) {
+		if (ctx->entries[i].flags & SRC_RESOURCE_FLAG_TOMBSTONE) continue;
+		WRITE_TEXTF(ctx->outputHeaderFile, "\t%" PRIu64 "ULL,\n", ctx->entries[i].size);
+	}
+	WRITE_TEXT("};\n\n", ctx->outputHeaderFile);
+
+	// position in the TOC, of its shard for sharded archives, -1 for inlined resources
+	WRITE_TEXTF(ctx->outputHeaderFile, "\nstatic const int32_t %s_RESOURCE_ARCHIVE_INDEX[] = {\n", ctx->uppercaseFilename);
+	int archiveIndex = 0;
+	for (size_t i = 0; i < ctx->entryCount; i += 1) {
+		if (ctx->entries[i].flags & SRC_RESOURCE_FLAG_TOMBSTONE) continue;
+		if (ctx->entries[i].flags & SRC_PACKED_FLAG_INLINE) {
+			WRITE_TEXT("\t-1,\n", ctx->outputHeaderFile);
+		}
+		else if (ctx->shardMode != SRC_SHARD_NONE) {
+			WRITE_TEXTF(ctx->outputHeaderFile, "\t%u,\n", ctx->entries[i].shardIndex);
+		}
+		else {
+			WRITE_TEXTF(ctx->outputHeaderFile, "\t%d,\n", archiveIndex);
+			archiveIndex += 1;
+		}
+	}
+	WRITE_TEXT("};\n\n", ctx->outputHeaderFile);
+}
+
 static void src_write_helper_definitions(src_context* ctx)
 {
 	WRITE_TEXTF(ctx->outputHeaderFile, src_helper_definitions,
 	 	ctx->outputFileName,
 	  	ctx->outputFileName
 	);
+	WRITE_TEXTF(ctx->outputHeaderFile, ctx->shardMode != SRC_SHARD_NONE ? src_helper_shard_view_definitions : src_helper_view_definitions,
+		ctx->outputFileName,
+		ctx->outputFileName
+	);
+	if (ctx->shardMode != SRC_SHARD_NONE) {
+		WRITE_TEXTF(ctx->outputHeaderFile, src_helper_shard_definitions, ctx->outputFileName);
+	}
 }
 
 static void src_write_helper_implementations(src_context* ctx)
@@ -339,64 +505,115 @@ static void src_write_helper_implementations(src_context* ctx)
 		ctx->outputFileName,
 		ctx->uppercaseFilename
 	);
+	if (ctx->shardMode != SRC_SHARD_NONE) {
+		WRITE_TEXTF(ctx->outputHeaderFile, src_helper_shard_impl,
+			ctx->outputFileName,
+			ctx->uppercaseFilename
+		);
+	}
+	// sharded archives bind an array of their shards, the index of a resource is within its shard
+	WRITE_TEXTF(ctx->outputHeaderFile, ctx->shardMode != SRC_SHARD_NONE ? src_helper_shard_view_impl : src_helper_view_impl,
+		ctx->uppercaseFilename,
+		ctx->outputFileName,
+		ctx->uppercaseFilename,
+		ctx->outputFileName,
+		ctx->uppercaseFilename,
+		ctx->uppercaseFilename,
+		ctx->uppercaseFilename,
+		ctx->uppercaseFilename,
+		ctx->uppercaseFilename,
+		ctx->uppercaseFilename,
+		ctx->uppercaseFilename,
+		ctx->uppercaseFilename
+	);
 }
 
-static int StartPacking(src_context* ctx)
+int src_write_generated_header(src_context* ctx)
 {
-	if (ctx->outputFile = fopen(ctx->outputFilePath, "wb+")) {
-		ctx->outputHeaderFile = fopen(ctx->outputHeaderPath, "w+");
-		ctx->tmpStringTableFile = fopen(SRC_STRING_TABLE_FILE, "w+");
-		ctx->tmpIdTableFile = fopen(SRC_ID_TABLE_FILE, "w+");
-		ctx->tmpOffsetTableFile = fopen(SRC_OFFSET_TABLE_FILE, "w+");
-
-		if (!ctx->outputHeaderFile 
-		|| !ctx->tmpStringTableFile
-		|| !ctx->tmpIdTableFile
-		|| !ctx->tmpOffsetTableFile) {
-			if(ctx->outputFile) {
-				fclose(ctx->outputFile);
-			} 
-			if(ctx->tmpStringTableFile) {
-				fclose(ctx->tmpStringTableFile);
-			} 
-			if(ctx->tmpIdTableFile) {
-				fclose(ctx->tmpIdTableFile);
-			} 
-			if(ctx->tmpOffsetTableFile) {
-				fclose(ctx->tmpIdTableFile);
-			}
-			//assert(0);
-			LOGF_MSG("Failed to open header file.");
-			return -1;
-		}
+	ctx->outputHeaderFile = fopen(ctx->outputHeaderPath, "w+");
+	if (!ctx->outputHeaderFile) {
+		LOGR_MSG("Failed to open header file.");
+		return 0;
+	}
+	src_write_header_start(ctx);
+	src_write_header_end(ctx);
+	fclose(ctx->outputHeaderFile); ctx->outputHeaderFile = NULL;
+	return 1;
+}
 
-		// write header start
-		src_write_header_start(ctx);
+void src_context_set_output(src_context* ctx, const char* outputPath, const char* headerDir)
+{
+	ctx->outputFilePath = outputPath;
+	ctx->outputFileName = GetFilename(outputPath, FALSE);
+	ctx->uppercaseFilename = ToUppercase(strdup(ctx->outputFileName));
+	if (headerDir) {
+		size_t bufLen = strlen(headerDir) + strlen(outputPath) + 16;
+		char* headerPath = (char*)malloc(bufLen);
+		snprintf(headerPath, bufLen, "%s%c%s.h", headerDir, PrefPathDelimiter, outputPath);
+		ctx->outputHeaderPath = headerPath;
+	}
+}
+
+void src_context_free(src_context* ctx)
+{
+	for (size_t i = 0; i < ctx->entryCount; i += 1) {
+		free(ctx->entries[i].path);
+		free(ctx->entries[i].inlineData);
+	}
+	free(ctx->entries);
+	free((char*)ctx->outputFileName);
+	free((char*)ctx->uppercaseFilename);
+	free((char*)ctx->outputHeaderPath);
+	free(ctx->tombstones);
+	src_chunk_store_free(ctx->chunkStore);
+	src_group_table_free(&ctx->groups);
+	src_rules_free(&ctx->rules);
+	for (size_t i = 0; i < ctx->transformCount; i += 1) {
+		free((char*)ctx->transforms[i].extension);
+	}
+	free(ctx->transforms);
+	free(ctx->dictionary);
+	memset(ctx, 0, sizeof(src_context));
+}
 
+int StartPacking(src_context* ctx)
+{
+	if (ctx->outputFile = fopen(ctx->outputFilePath, "wb+")) {
 		// write blank header
-		src_write_header(ctx, 0);
+		src_write_header(ctx, 0, 0);
 
 		// write sub resources
-		int succ = RecurseDirectory(ctx, ctx->targetDir);
-		
-		// update header
-		fseek(ctx->outputFile, 0, SEEK_SET);
-		src_write_header(ctx, ctx->packedFileCount);
+		int succ = PackDirectory(ctx);
 
-		// write header end
-		src_write_header_end(ctx);
+		// write tombstones
+		for (int i = 0; i < ctx->tombstoneCount; i += 1) {
+			src_pack_tombstone(ctx, ctx->tombstones[i]);
+		}
 
-		fclose(ctx->outputHeaderFile); ctx->outputHeaderFile = NULL;
+		// write table of contents
+		uint64_t tocOffset = src_write_toc(ctx);
+		if (ctx->groups.count) {
+			src_write_groups(ctx);
+		}
+		if (ctx->dictionarySize) {
+			src_write_dictionary(ctx);
+		}
+		
+		// update header
+		src_write_header(ctx, ctx->entryCount - ctx->inlineCount, tocOffset);
+		src_fseek64(ctx->outputFile, 0, SEEK_END);
+		uint64_t archiveSize = (uint64_t)src_ftell64(ctx->outputFile);
 		fclose(ctx->outputFile); ctx->outputFile = NULL;
-		fclose(ctx->tmpStringTableFile); ctx->tmpStringTableFile = NULL;
-		fclose(ctx->tmpIdTableFile); ctx->tmpIdTableFile = NULL;
-		fclose(ctx->tmpOffsetTableFile); ctx->tmpOffsetTableFile = NULL;
 
-		remove(SRC_STRING_TABLE_FILE);
-		remove(SRC_ID_TABLE_FILE);
-		remove(SRC_OFFSET_TABLE_FILE);
+		// write generated header
+		if (!src_write_generated_header(ctx)) {
+			return -1;
+		}
 		
 		LOGF_MSG("Packaged %d files", ctx->packedFileCount);
+		if (ctx->stats) {
+			src_print_stats(ctx, archiveSize);
+		}
 		return succ;
 	}
 	else {
@@ -406,35 +623,69 @@ static int StartPacking(src_context* ctx)
 	return 0;
 }
 
-static int RecurseDirectory(src_context* ctx, const char* path)
+static int CompareEntryPath(const void* a, const void* b)
 {
-	cf_dir_t dir;
-	if (!cf_dir_open(&dir, path)) {
-		LOGF_MSG("Failed to open \"%s\"", path);
+	return strcmp(((const src_packed_entry*)a)->path, ((const src_packed_entry*)b)->path);
+}
+
+static int PackDirectory(src_context* ctx)
+{
+	src_file_list list;
+	if (!src_collect_files(ctx->targetDir, ctx->threadCount, &ctx->rules, &list)) {
 		return -1;
 	}
+	LOGF_MSG("Found %zu files", list.count);
+
+	int succ = src_run_transforms(ctx, &list, NULL, 0) ? 0 : -1;
+	uint32_t* fileGroups = NULL;
+	if (succ == 0 && (ctx->groupFilePath || ctx->groupByDir || ctx->rules.groups)) {
+		fileGroups = (uint32_t*)malloc((list.count + 1) * sizeof(uint32_t));
+		if (!src_assign_groups(ctx, &list, fileGroups)) {
+			succ = -1;
+		}
+	}
+	if (succ == 0 && ctx->compress && !src_train_dictionary(ctx, &list)) {
+		succ = -1;
+	}
 
-	while (dir.has_next) {
-		cf_file_t file;
-		cf_read_file(&dir, &file);
-		if (file.is_dir && file.name[0] != '.') {
-			// recurse
-			LOGF_MSG("Found directory: \"%s\"", file.name);
-			RecurseDirectory(ctx, file.path);
+	// every group in one piece, then the files of no group
+	for (uint32_t g = 0; g <= ctx->groups.count && succ == 0; g += 1) {
+		uint32_t group = g < ctx->groups.count ? g : SRC_GROUP_NONE;
+		if (group != SRC_GROUP_NONE) {
+			LOGF_MSG("Group: \"%s\"", ctx->groups.names[g]);
+			ctx->groups.offsets[g] = (uint64_t)src_ftell64(ctx->outputFile);
 		}
-		else if (!file.is_dir && file.is_reg) {
+		for (size_t i = 0; i < list.count; i += 1) {
+			if ((fileGroups ? fileGroups[i] : SRC_GROUP_NONE) != group) continue;
 			// pack resource
-			LOGF_MSG("Packing: \"%s\"", file.name);
-			if (!src_pack_file(ctx, &file)) {
-				LOGF_MSG("Failed to pack file: \"%s\"", file.path);
-				return -1;
+			LOGF_MSG("Packing: \"%s\"", list.files[i].path);
+			if (!src_pack_file(ctx, &list.files[i])) {
+				LOGF_MSG("Failed to pack file: \"%s\"", list.files[i].path);
+				succ = -1;
+				break;
 			}
 		}
-
-		cf_dir_next(&dir);
+		if (group != SRC_GROUP_NONE) {
+			ctx->groups.ends[g] = (uint64_t)src_ftell64(ctx->outputFile);
+		}
 	}
-	cf_dir_close(&dir);
-	return 0;
+	// the TOC and the generated ids stay in path order
+	if (fileGroups) {
+		qsort(ctx->entries, ctx->entryCount, sizeof(src_packed_entry), CompareEntryPath);
+	}
+	free(fileGroups);
+
+	// the generated header is the first output of the build step
+	const char* extraDeps[2];
+	size_t extraDepCount = 0;
+	if (ctx->groupFilePath) extraDeps[extraDepCount++] = ctx->groupFilePath;
+	if (ctx->rules.path) extraDeps[extraDepCount++] = ctx->rules.path;
+	if (succ == 0 && ctx->depfilePath
+		&& !src_write_list_depfile(ctx->depfilePath, ctx->outputHeaderPath, &list, extraDeps, extraDepCount)) {
+		succ = -1;
+	}
+	src_file_list_free(&list);
+	return succ;
 }
 
 static char* GetFilename(const char* path, int withExtension)
@@ -475,16 +726,33 @@ static char* ToUppercase(char* text)
 	return text;
 }
 
-static void CopyFileToFile(FILE* dst, FILE* src, size_t bytesToCopy)
+void CopyFileToFile(FILE* dst, FILE* src, size_t bytesToCopy)
 {
 	char buffer[1024];
 	while (bytesToCopy != 0) {
-		size_t read = fread(buffer, 1, sizeof(buffer), src);
+		size_t chunk = bytesToCopy < sizeof(buffer) ? bytesToCopy : sizeof(buffer);
+		size_t read = fread(buffer, 1, chunk, src);
+		assert(ferror(src) == 0);
+		if (read == 0) break;
+		WRITE_DATA(buffer, read, dst);
+		bytesToCopy -= read;
+	}
+}
+
+uint32_t CopyFileToFileCrc(FILE* dst, FILE* src, size_t bytesToCopy)
+{
+	char buffer[64 * 1024];
+	uint32_t crc = 0;
+	while (bytesToCopy != 0) {
+		size_t chunk = bytesToCopy < sizeof(buffer) ? bytesToCopy : sizeof(buffer);
+		size_t read = fread(buffer, 1, chunk, src);
 		assert(ferror(src) == 0);
 		if (read == 0) break;
+		crc = src_crc32c(buffer, read, crc);
 		WRITE_DATA(buffer, read, dst);
 		bytesToCopy -= read;
 	}
+	return crc;
 }
 
 static char* SanitizeName(char* name)
@@ -4,48 +4,601 @@
 extern "C" {
 #endif
 #include <stdint.h>
+#include <stddef.h>
+
+// The archive is little endian and every field is naturally aligned, so the
+// mapped bytes are read in place. Sizes and offsets are 64 bit on every platform.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#error "simple_resource_compiler: archives are little endian, big endian targets are not supported"
+#endif
+
+#define SRC_STATIC_ASSERT(cond, name) typedef char src_static_assert_##name[(cond) ? 1 : -1]
 
 #define SRC_RESOURCE_HEADER_VALUE "SRCDATA"
-#define SRC_RESOURCE_VERSION 1
+#define SRC_RESOURCE_VERSION 4
+// archives holding chunked or compressed resources, readers which can't decode them reject the archive
+#define SRC_RESOURCE_VERSION_ENCODED 5
+
+// records, the TOC and the data of every resource start at a multiple of this
+#define SRC_RECORD_ALIGNMENT 8
 
 typedef struct {
 	char header[8]; // == SRC_RESOURCE_HEADER_VALUE
-	int32_t version; // == SRC_RESOURCE_VERSION
-	size_t subResourceCount;
+	uint32_t version; // == SRC_RESOURCE_VERSION or SRC_RESOURCE_VERSION_ENCODED
+	uint32_t inlineCount; // resources only in the generated header, not in the archive
+	uint64_t subResourceCount;
+	uint64_t tocOffset; // offset of the src_toc_header
 	// after the header follows
 	/* first subresouce */
 } src_main_header;
 
+SRC_STATIC_ASSERT(sizeof(src_main_header) == 32, main_header_size);
+
 int src_validate_header(src_main_header* h);
 
+#define SRC_TOC_HEADER_VALUE "SRCTOC"
+
+// The table of contents lists the live resources, in the order of the ids of
+// the generated header. Archives updated in place append changed resources and
+// a new TOC, then swap tocOffset in the main header. Resources not referenced
+// by the TOC are dead, so only freshly packed archives can be read sequentially.
+typedef struct {
+	char header[8]; // == SRC_TOC_HEADER_VALUE
+	uint64_t entryCount;
+	uint32_t checksum; // src_crc32c of the entries
+	uint32_t reserved;
+	// after the header follows
+	/* src_toc_entry[entryCount] */
+} src_toc_header;
+
+typedef struct {
+	uint32_t id;
+	uint32_t flags;
+	uint64_t offset; // offset of the src_resource_header
+} src_toc_entry;
+
+SRC_STATIC_ASSERT(sizeof(src_toc_header) == 24, toc_header_size);
+SRC_STATIC_ASSERT(sizeof(src_toc_entry) == 16, toc_entry_size);
+
+int src_validate_toc_header(src_toc_header* h);
+
 #define SRC_SUB_RESOURCE_HEADER_VALUE "SUBDATA"
 
 typedef struct {
 	char header[8]; // == SRC_SUB_RESOURCE_HEADER_VALUE
 	uint32_t id;
-	size_t resourceSize;
+	uint32_t checksum; // src_crc32c of the resource data
+	uint64_t resourceSize;
 	uint16_t nameLen;
-	uint8_t flags;
+	uint8_t flags; // SRC_RESOURCE_FLAG_*
+	uint8_t alignment; // log2 of the data alignment the rules asked for, 0 for SRC_RECORD_ALIGNMENT
+	uint16_t rootLen; // the name starts with this many bytes of the directory it was packed from
+	uint8_t reserved2[2];
 	// after the header follows
-	/* name */
-	/* resourceData */
+	/* name, zero padded to SRC_RECORD_ALIGNMENT */
+	/* resourceData, zero padded to SRC_RECORD_ALIGNMENT */
 } src_resource_header;
 
+SRC_STATIC_ASSERT(sizeof(src_resource_header) == 32, resource_header_size);
+
+// the resource was deleted, it hides the resource of the same name
+// in lower priority archives mounted into a src_vfs
+#define SRC_RESOURCE_FLAG_TOMBSTONE 0x01
+// the data is a src_chunk_list, the resource is reassembled from chunks which
+// may be shared with other records. Read it through a src_stream.
+#define SRC_RESOURCE_FLAG_CHUNKED 0x02
+// the data is a src_compressed_header and the compressed resource, read it with
+// src_archive_read or, parts of it, src_archive_read_range
+#define SRC_RESOURCE_FLAG_COMPRESSED 0x04
+
 int src_validate_sub_header(src_resource_header* h);
 
+// Data of a chunked resource. The checksum of the record covers the list and the
+// chunks stored after it, every chunk is stored in the record which used it first.
+typedef struct {
+	uint64_t size; // size of the reassembled resource
+	uint64_t chunkCount;
+	// after the list follows
+	/* src_chunk_ref[chunkCount], in the order of the resource */
+	/* the chunks first used by this resource */
+} src_chunk_list;
+
+typedef struct {
+	uint64_t offset; // offset of the chunk in the archive
+	uint32_t size;
+	uint32_t checksum; // src_crc32c of the chunk
+} src_chunk_ref;
+
+SRC_STATIC_ASSERT(sizeof(src_chunk_list) == 16, chunk_list_size);
+SRC_STATIC_ASSERT(sizeof(src_chunk_ref) == 16, chunk_ref_size);
+
+#define SRC_CODEC_LZ 1 // src_lz_decompress
+#define SRC_CODEC_LZ_DICT 2 // src_lz_decompress with the dictionary of the archive
+
+typedef struct {
+	uint64_t size; // size of the decompressed resource
+	uint32_t codec; // SRC_CODEC_*
+	uint32_t frameSize; // 0 for one stream, else the resource is split into frames of this size
+	// after the header follows
+	/* the compressed resource */
+	// or, with frames, every frame compressed on its own
+	/* the frames, zero padded to SRC_RECORD_ALIGNMENT */
+	/* src_frame_ref[frameCount], frameCount = ceil(size / frameSize) */
+} src_compressed_header;
+
+// A frame of a framed resource. Frames only depend on the dictionary, a range of
+// the resource is read by decompressing the frames overlapping it.
+typedef struct {
+	uint64_t offset; // from the src_compressed_header
+	uint32_t size; // stored as it is when that's the decompressed size
+	uint32_t checksum; // src_crc32c of the stored frame
+} src_frame_ref;
+
+SRC_STATIC_ASSERT(sizeof(src_compressed_header) == 16, compressed_header_size);
+SRC_STATIC_ASSERT(sizeof(src_frame_ref) == 16, frame_ref_size);
+
+#define SRC_INDEX_HEADER_VALUE "SRCIDX"
+
+// Index of a sharded archive. Every shard is a regular archive, the index maps
+// the generated ids to the shard and record holding the resource.
+typedef struct {
+	char header[8]; // == SRC_INDEX_HEADER_VALUE
+	uint32_t version; // == SRC_RESOURCE_VERSION
+	uint32_t shardCount;
+	uint64_t entryCount;
+	uint32_t checksum; // src_crc32c of the entries and the shard names
+	uint32_t reserved;
+	// after the header follows
+	/* src_index_entry[entryCount], in the order of the generated ids */
+	/* shardCount zero terminated file names of the shards, relative to the index */
+} src_index_header;
+
+typedef struct {
+	uint32_t id;
+	uint32_t shard;
+	uint64_t offset; // offset of the src_resource_header in the shard
+} src_index_entry;
+
+SRC_STATIC_ASSERT(sizeof(src_index_header) == 32, index_header_size);
+SRC_STATIC_ASSERT(sizeof(src_index_entry) == 16, index_entry_size);
+
+#define SRC_GROUP_HEADER_VALUE "SRCGRP"
+
+// Resource groups, e.g. everything a level loads. The records of a group are
+// placed contiguously, so a group is one byte range of the archive. The group
+// table directly follows the TOC entries, archives without groups end there.
+typedef struct {
+	char header[8]; // == SRC_GROUP_HEADER_VALUE
+	uint64_t groupCount;
+	uint32_t checksum; // src_crc32c of the entries and the names
+	uint32_t namesSize;
+	// after the header follows
+	/* src_group_entry[groupCount] */
+	/* groupCount zero terminated names, namesSize bytes */
+} src_group_header;
+
+typedef struct {
+	uint64_t offset; // offset of the first record of the group
+	uint64_t size; // up to the end of its last record
+} src_group_entry;
+
+SRC_STATIC_ASSERT(sizeof(src_group_header) == 24, group_header_size);
+SRC_STATIC_ASSERT(sizeof(src_group_entry) == 16, group_entry_size);
+
+#define SRC_DICT_HEADER_VALUE "SRCDICT"
+
+// Dictionary of the resources compressed with SRC_CODEC_LZ_DICT, it follows the
+// group table or, without groups, the TOC entries. Sections after the TOC are
+// zero padded to SRC_RECORD_ALIGNMENT.
+typedef struct {
+	char header[8]; // == SRC_DICT_HEADER_VALUE
+	uint64_t size;
+	uint32_t checksum; // src_crc32c of the dictionary
+	uint32_t reserved;
+	// after the header follows
+	/* the dictionary, size bytes */
+} src_dict_header;
+
+SRC_STATIC_ASSERT(sizeof(src_dict_header) == 24, dict_header_size);
+
+// offset of the resource data from the start of its record
+uint64_t src_record_data_offset(const src_resource_header* h);
+// size of the whole record including padding, the next record starts there
+uint64_t src_record_size(const src_resource_header* h);
+
 // djb2 http://www.cse.yorku.ca/~oz/hash.html
 // this algorithm(k = 33) was first reported by dan bernstein many years ago in comp.lang.c.
 // another version of this algorithm(now favored by bernstein) usesxor : hash(i) = hash(i - 1) * 33 ^ str[i];
 // the magic of number 33 (why it works better than many other constants, prime or not) has never been adequately explained.
 uint32_t djb2_hash(unsigned char* str);
 
+// FNV-1a 64 bit http://www.isthe.com/chongo/tech/comp/fnv/
+// used to compare resource contents. Pass SRC_FNV1A64_INIT as the initial hash,
+// the result of a previous call continues the hash over the next block.
+#define SRC_FNV1A64_INIT 0xcbf29ce484222325ULL
+uint64_t src_fnv1a64(const void* data, size_t len, uint64_t hash);
+
+// LZ77 with byte aligned sequences in the style of LZ4 blocks. A sequence is a
+// token, literals and a match: the high nibble of the token is the literal count,
+// the low one the match length minus SRC_LZ_MIN_MATCH, 15 continues the value in
+// the following bytes, which are added up until one isn't 255. The literals
+// follow, then the 16 bit little endian offset of the match and the bytes
+// extending its length. The last sequence ends after its literals. Offsets reach
+// back into dict, the history in front of the output. Returns 1 if the input
+// decodes to exactly dstSize bytes, malformed input is rejected.
+#define SRC_LZ_MIN_MATCH 4
+#define SRC_LZ_MAX_OFFSET 65535
+int src_lz_decompress(const void* src, size_t srcSize, void* dst, size_t dstSize, const void* dict, size_t dictSize);
+
+// CRC-32C (Castagnoli), uses the SSE4.2 / ARMv8 crc instructions when available.
+// Pass 0 as the initial crc, the result of a previous call continues over the next block.
+uint32_t src_crc32c(const void* data, size_t len, uint32_t crc);
+// the crc of two blocks one after the other from the crcs of both and the length
+// of the second, blocks checked on different threads are joined with it
+uint32_t src_crc32c_combine(uint32_t crcA, uint32_t crcB, uint64_t lenB);
+
+// =================================================================================
+// Runtime reader
+// =================================================================================
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SRC_ATOMIC_INC(p) _InterlockedIncrement((volatile long*)(p))
+#define SRC_ATOMIC_DEC(p) _InterlockedDecrement((volatile long*)(p))
+#define SRC_ATOMIC_LOAD(p) _InterlockedCompareExchange((volatile long*)(p), 0, 0)
+#define SRC_ATOMIC_CAS(p, expected, desired) (_InterlockedCompareExchange((volatile long*)(p), desired, expected) == (expected))
+#define SRC_ATOMIC_LOAD_PTR(p) _InterlockedCompareExchangePointer((void* volatile*)(p), NULL, NULL)
+#define SRC_ATOMIC_XCHG_PTR(p, v) _InterlockedExchangePointer((void* volatile*)(p), v)
+#define SRC_ATOMIC_ADD64(p, v) _InterlockedExchangeAdd64((volatile long long*)(p), (long long)(v))
+#define SRC_ATOMIC_LOAD64(p) ((uint64_t)_InterlockedCompareExchange64((volatile long long*)(p), 0, 0))
+#define SRC_ATOMIC_STORE64(p, v) _InterlockedExchange64((volatile long long*)(p), (long long)(v))
+#define SRC_ATOMIC_CAS64(p, expected, desired) (_InterlockedCompareExchange64((volatile long long*)(p), (long long)(desired), (long long)(expected)) == (long long)(expected))
+#else
+#define SRC_ATOMIC_INC(p) __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST)
+#define SRC_ATOMIC_DEC(p) __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST)
+#define SRC_ATOMIC_LOAD(p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define SRC_ATOMIC_CAS(p, expected, desired) __sync_bool_compare_and_swap(p, expected, desired)
+#define SRC_ATOMIC_LOAD_PTR(p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define SRC_ATOMIC_XCHG_PTR(p, v) __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST)
+#define SRC_ATOMIC_ADD64(p, v) __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST)
+#define SRC_ATOMIC_LOAD64(p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define SRC_ATOMIC_STORE64(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+#define SRC_ATOMIC_CAS64(p, expected, desired) __sync_bool_compare_and_swap(p, expected, desired)
+#endif
+
+typedef struct {
+	const void* data;
+	size_t size;
+} src_view;
+
+enum {
+	SRC_VERIFY_UNKNOWN = 0,
+	SRC_VERIFY_OK = 1,
+	SRC_VERIFY_FAILED = 2,
+};
+
+typedef struct {
+	const src_resource_header* header;
+	const char* name;
+	const unsigned char* data;
+	volatile long verifyState; // SRC_VERIFY_*, cached by src_entry_verify
+} src_archive_entry;
+
+// checks the data of every resource against its checksum on first access through src_archive_get
+#define SRC_OPEN_VERIFY_ON_ACCESS 0x01
+// Mapping modes trading memory for the latency of first accesses, see src_archive_get_stats
+// for their effect. Locking is limited by RLIMIT_MEMLOCK or the working set size and
+// best effort, the stats tell what was locked.
+// faults the whole archive in at open, MAP_POPULATE on Linux
+#define SRC_OPEN_POPULATE 0x02
+// locks the main header, the record headers and names, the TOC and the sections after it
+#define SRC_OPEN_LOCK_INDEX 0x04
+// locks the whole archive, which is faulted in first
+#define SRC_OPEN_LOCK_ALL 0x08
+// asks for transparent huge pages on the file mapping, where the kernel has them for files
+#define SRC_OPEN_HUGE_PAGES 0x10
+// copies the archive into anonymous memory, on explicit huge pages (MAP_HUGETLB,
+// MEM_LARGE_PAGES) when some are free and transparent ones otherwise. Costs the
+// size of the archive in memory, which isn't shared with other processes.
+#define SRC_OPEN_HUGE_PAGES_COPY 0x20
+// counts the accesses to resources and their bytes
+#define SRC_OPEN_COUNTERS 0x40
+
+// A memory mapped archive. Entries point directly into the mapping.
+typedef struct {
+	const unsigned char* base;
+	size_t size;
+	size_t entryCount;
+	src_archive_entry* entries;
+	uint32_t openFlags; // SRC_OPEN_*
+	size_t groupCount;
+	const src_group_entry* groups;
+	const char* groupNames; // groupCount zero terminated names
+	src_view dictionary; // of resources compressed with SRC_CODEC_LZ_DICT, checked at open
+	size_t copySize; // of the SRC_OPEN_HUGE_PAGES_COPY copy, 0 if the file is mapped
+	size_t pageSize; // of the pages backing the archive
+	size_t lockedBytes;
+	uint64_t faultsAtOpen[2]; // minor and major faults of the process
+	uint64_t accessCount; // SRC_OPEN_COUNTERS
+	uint64_t accessBytes;
+#ifdef _WIN32
+	void* fileHandle;
+	void* mappingHandle;
+#else
+	int fd;
+#endif
+} src_archive;
+
+// returns 1 on success, 0 if the file can't be mapped or doesn't validate
+int src_archive_open(src_archive* archive, const char* path);
+int src_archive_open_ex(src_archive* archive, const char* path, uint32_t openFlags);
+void src_archive_close(src_archive* archive);
+src_view src_archive_entry_view(const src_archive_entry* entry);
+// returns 0 if SRC_OPEN_VERIFY_ON_ACCESS is set and the data doesn't match its checksum,
+// or if the resource is chunked and has no contiguous data
+int src_archive_get(const src_archive* archive, const src_archive_entry* entry, src_view* view);
+// checks the data against its checksum once, later calls return the cached result
+int src_entry_verify(const src_archive_entry* entry);
+// index of the group or -1 if the archive has none of that name
+int src_archive_find_group(const src_archive* archive, const char* name);
+// Starts reading the pages of a group in the background, e.g. while the loading
+// screen of a level is up. Returns 0 if there is no such group.
+int src_archive_prefetch_group(const src_archive* archive, const char* name);
+// Drops the pages of a group from the mapping once it was unloaded, they stay in
+// the page cache and are read again on the next access. Locked archives and copies
+// keep their pages. Returns 0 if there is no such group.
+int src_archive_release_group(const src_archive* archive, const char* name);
+typedef struct {
+	uint64_t mappedBytes; // of the mapping or the copy
+	uint64_t residentBytes; // of it in memory now, Linux only
+	uint64_t lockedBytes;
+	uint64_t pageSize; // of the pages backing the archive, the huge page size of a copy on explicit ones
+	uint64_t minorFaults; // of the whole process since the archive was opened, not on Windows
+	uint64_t majorFaults; // the ones which had to read from disk
+	uint64_t accessCount; // resources handed out or read, with SRC_OPEN_COUNTERS
+	uint64_t accessBytes; // their bytes
+} src_archive_stats;
+
+void src_archive_get_stats(const src_archive* archive, src_archive_stats* stats);
+// size of the resource, of the reassembled or decompressed data
+uint64_t src_entry_size(const src_archive_entry* entry);
+// the name without the directory it was packed from, e.g. "font/arial.ttf"
+const char* src_entry_relative_name(const src_archive_entry* entry);
+// Copies the whole resource to dst of src_entry_size bytes, chunked resources are
+// reassembled and compressed ones decompressed. Returns 0 if the data is damaged
+// or, with SRC_OPEN_VERIFY_ON_ACCESS, doesn't match its checksum.
+int src_archive_read(const src_archive* archive, const src_archive_entry* entry, void* dst, size_t dstSize);
+// Copies size bytes from offset of the resource to dst. Of framed resources only
+// the frames overlapping the range are decompressed, a compressed stream is
+// decompressed up to its end. Returns 0 if the range exceeds src_entry_size or
+// the data is damaged, with SRC_OPEN_VERIFY_ON_ACCESS frames are checked as they are read.
+int src_archive_read_range(const src_archive* archive, const src_archive_entry* entry, uint64_t offset, void* dst, size_t size);
+// frame size of a framed resource, 0 for others. Frames are independent, reads of
+// a large range split at multiples of it can run on several threads.
+uint32_t src_entry_frame_size(const src_archive_entry* entry);
+
+// Sequential reads of a resource, chunked or not. Chunks are copied out of the
+// mapping as they are reached, nothing is allocated.
+typedef struct {
+	const src_archive* archive;
+	const src_chunk_ref* refs; // NULL if the resource isn't chunked
+	uint64_t chunkCount;
+	const unsigned char* data; // resources which aren't chunked
+	uint64_t size;
+	uint64_t position;
+	uint64_t chunk;
+	uint64_t chunkOffset; // position in the current chunk
+	int failed; // a chunk was out of bounds or didn't match its checksum
+} src_stream;
+
+// returns 0 if the chunk list doesn't fit its record or, with SRC_OPEN_VERIFY_ON_ACCESS,
+// the record doesn't match its checksum. Chunks are then verified as they are read.
+// Compressed resources can't be streamed, they are read with src_archive_read(_range).
+int src_stream_open(src_stream* stream, const src_archive* archive, const src_archive_entry* entry);
+// returns the number of bytes copied, less than size at the end of the resource or on failure
+size_t src_stream_read(src_stream* stream, void* dst, size_t size);
+// moves to position of the resource, returns 0 past its end
+int src_stream_seek(src_stream* stream, uint64_t position);
+
+typedef struct {
+	const src_archive* archive;
+	int priority;
+	uint32_t order;
+} src_vfs_layer;
+
+typedef struct {
+	uint32_t id;
+	const src_archive_entry* entry;
+} src_vfs_slot;
+
+// Layered view over several archives, e.g. a base archive and overlay patches.
+// A path resolves to the highest priority archive containing it, on equal
+// priority the archive mounted last wins. The merged index is rebuilt on
+// mount/unmount so a lookup is a single hash probe regardless of the layer count.
+typedef struct {
+	src_vfs_layer* layers;
+	size_t layerCount;
+	size_t layerCapacity;
+	uint32_t mountCounter;
+
+	src_vfs_slot* slots;
+	size_t slotMask;
+} src_vfs;
+
+void src_vfs_init(src_vfs* vfs);
+void src_vfs_free(src_vfs* vfs);
+// the archive has to stay open while it is mounted
+int src_vfs_mount(src_vfs* vfs, const src_archive* archive, int priority);
+int src_vfs_unmount(src_vfs* vfs, const src_archive* archive);
+// Paths are relative to the directory an archive was packed from, see
+// src_entry_relative_name, so overlays packed from another directory shadow the base.
+// Returns NULL if no layer has the resource or it was deleted by a tombstone.
+const src_archive_entry* src_vfs_find(const src_vfs* vfs, const char* path);
+// looks up by djb2_hash of the relative path, on hash collisions the first match wins
+const src_archive_entry* src_vfs_find_id(const src_vfs* vfs, uint32_t id);
+
+// The shards of a sharded archive opened through its index. Entries are in the
+// order of the generated ids and point into the mappings of the shards.
+typedef struct {
+	src_archive index;
+	src_archive* shards;
+	uint32_t shardCount;
+	size_t entryCount;
+	src_archive_entry* entries;
+	uint32_t* entryShards; // shard of every entry
+} src_sharded_archive;
+
+// opens the index and every shard it lists, returns 0 if one of them doesn't validate
+int src_sharded_open(src_sharded_archive* sharded, const char* indexPath);
+void src_sharded_close(src_sharded_archive* sharded);
+
+// =================================================================================
+// Shared cache
+// =================================================================================
+
+// A cache of decoded resources in a named shared memory segment. Processes which
+// open the same name attach to the same bytes, a resource is decoded once by the
+// first process asking for it and every other one waits for and shares its result.
+//
+// The index is an open addressed table of slots claimed with compare and swap,
+// there are no locks. A slot being filled records the pid of its filler and a
+// generation. When that process died the next reader claims the next generation
+// and fills the slot itself, a filler which is alive is waited for however long
+// its decode takes. A filler whose pid was reused meanwhile can't publish into
+// the slot of a later generation anymore.
+// A segment whose creator died before it was initialized is initialized by the
+// next process attaching to it. The data area is a bump allocator capped at the capacity given
+// by the creator; once it is used up, or the table is full, get fails and the
+// caller decodes into its own memory. Nothing is ever evicted, the segment lives
+// until it is unlinked and the last process detached.
+//
+// On Linux with glibc older than 2.34 this needs librt.
+
+#define SRC_SHARED_CACHE_MAGIC 0x48435253u // "SRCH"
+#define SRC_SHARED_CACHE_ALIGNMENT 64
+
+typedef struct {
+	volatile uint32_t magic; // written last by the creator
+	uint32_t slotCount; // power of two
+	uint64_t capacity; // size of the data area
+	volatile uint64_t used; // bump allocator, may run past the capacity
+	volatile uint64_t creator; // pid of the process initializing the header
+} src_shared_cache_header;
+SRC_STATIC_ASSERT(sizeof(src_shared_cache_header) == 32, shared_cache_header_size);
+
+#define SRC_CACHE_SLOT_EMPTY 0
+#define SRC_CACHE_SLOT_FILLING 1
+#define SRC_CACHE_SLOT_READY 2
+#define SRC_CACHE_SLOT_FAILED 3 // decode failed, the next reader retries
+#define SRC_CACHE_SLOT_FULL 4 // no room was left, not retried
+#define SRC_CACHE_SLOT_PUBLISHING 5 // filled, the offset and size are written
+
+typedef struct {
+	volatile uint64_t key; // 0 for an unused slot
+	volatile uint64_t state; // generation << 40 | SRC_CACHE_SLOT_* << 32 | pid of the filling process
+	uint64_t offset; // into the data area, valid once ready
+	uint64_t size;
+} src_shared_cache_slot;
+SRC_STATIC_ASSERT(sizeof(src_shared_cache_slot) == 32, shared_cache_slot_size);
+
+typedef struct {
+	unsigned char* base;
+	size_t size;
+	src_shared_cache_header* header;
+	src_shared_cache_slot* slots;
+	unsigned char* data;
+#ifdef _WIN32
+	void* mappingHandle;
+#endif
+} src_shared_cache;
+
+// writes size decoded bytes to dst, returns 0 on failure
+typedef int (*src_decode_func)(void* user, void* dst, size_t size);
+
+// attaches to the cache of the given name or creates it with a data area of capacity
+// bytes and room for slotCount resources, an existing cache keeps its own sizes.
+// Names follow shm_open, a leading slash and no other one.
+int src_shared_cache_open(src_shared_cache* cache, const char* name, uint64_t capacity, uint32_t slotCount);
+// detaches, the cached bytes stay for the other processes
+void src_shared_cache_close(src_shared_cache* cache);
+// removes the name, attached processes keep their mapping (no-op on Windows,
+// the segment goes away with the last handle)
+void src_shared_cache_unlink(const char* name);
+// returns the cached bytes of key, decoding size bytes with decode on a miss. Returns 0
+// if the cache has no room or decoding failed, the caller falls back to its own memory.
+int src_shared_cache_get(src_shared_cache* cache, uint64_t key, size_t size, src_decode_func decode, void* user, src_view* view);
+// content key of an archive entry, entries with equal path and data share it
+uint64_t src_shared_cache_key(const src_archive_entry* entry);
+
+// =================================================================================
+// Live reloading
+// =================================================================================
+
+// An opened version of the archive, views into it stay valid until it is released.
+typedef struct {
+	src_archive archive;
+	// references released minus the ones taken while it was published,
+	// the reloader adds the taken ones when it unpublishes the snapshot
+	volatile int64_t refCount;
+	volatile long state;
+	// identity of the mapped file
+	uint64_t fileId;
+	uint64_t fileTime;
+	uint64_t fileSize;
+} src_archive_snapshot;
+
+// snapshots old versions may hold on to, reloading fails while all are held
+#define SRC_RELOADER_SNAPSHOTS 16
+
+// Publishes the current version of an archive which is replaced on disk while
+// the program runs. Acquiring and releasing never wait: the published word holds
+// the slot of the current snapshot and the number of references taken from it,
+// acquiring increments it in one CAS. A reload publishes the new slot and moves
+// the count of the old word to the old snapshot, whoever brings its count to
+// zero, the reload or the last reader, unmaps it. Readers should keep a
+// snapshot across a batch of lookups, acquiring touches the published word.
+typedef struct {
+	char* path;
+	// slot << 48 | references taken
+	volatile uint64_t current;
+	volatile long reloading;
+	src_archive_snapshot* snapshots[SRC_RELOADER_SNAPSHOTS];
+} src_archive_reloader;
+
+int src_reloader_init(src_archive_reloader* reloader, const char* path);
+// drops the reloader's reference, acquired snapshots stay valid until released
+void src_reloader_free(src_archive_reloader* reloader);
+src_archive_snapshot* src_reloader_acquire(src_archive_reloader* reloader);
+void src_snapshot_release(src_archive_snapshot* snapshot);
+// maps and publishes the file at the path, returns 1 if a new snapshot was published,
+// 0 if it couldn't be opened, another reload runs or old versions hold every slot
+int src_reloader_reload(src_archive_reloader* reloader);
+// reloads if the file was replaced or modified (file id, mtime or size changed)
+int src_reloader_poll(src_archive_reloader* reloader);
+
 #ifdef SIMPLE_RESOURCE_COMPILER_IMPLEMENTATION
 
 #include <string.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 int src_validate_header(src_main_header* h)
 {
-	return h->version == SRC_RESOURCE_VERSION 
+	return (h->version == SRC_RESOURCE_VERSION || h->version == SRC_RESOURCE_VERSION_ENCODED)
 		&& strcmp(h->header, SRC_RESOURCE_HEADER_VALUE) == 0;
 }
 
@@ -54,6 +607,26 @@ inline int src_validate_sub_header(src_resource_header* h)
 	return strcmp(h->header, SRC_SUB_RESOURCE_HEADER_VALUE) == 0;
 }
 
+int src_validate_toc_header(src_toc_header* h)
+{
+	return strcmp(h->header, SRC_TOC_HEADER_VALUE) == 0;
+}
+
+static uint64_t src_align_up(uint64_t value)
+{
+	return (value + SRC_RECORD_ALIGNMENT - 1) & ~(uint64_t)(SRC_RECORD_ALIGNMENT - 1);
+}
+
+uint64_t src_record_data_offset(const src_resource_header* h)
+{
+	return sizeof(src_resource_header) + src_align_up(h->nameLen);
+}
+
+uint64_t src_record_size(const src_resource_header* h)
+{
+	return src_record_data_offset(h) + src_align_up(h->resourceSize);
+}
+
 
 uint32_t djb2_hash(unsigned char* str)
 {
@@ -66,6 +639,1529 @@ uint32_t djb2_hash(unsigned char* str)
 	return hash;
 }
 
+uint64_t src_fnv1a64(const void* data, size_t len, uint64_t hash)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < len; i += 1) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static uint32_t src_crc32c_table[256];
+static volatile long src_crc32c_table_ready;
+
+static uint32_t src_crc32c_sw(uint32_t crc, const unsigned char* bytes, size_t len)
+{
+	if (!SRC_ATOMIC_LOAD(&src_crc32c_table_ready)) {
+		// racing threads write the same values
+		for (uint32_t i = 0; i < 256; i += 1) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k += 1) {
+				c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1)));
+			}
+			src_crc32c_table[i] = c;
+		}
+		SRC_ATOMIC_CAS(&src_crc32c_table_ready, 0, 1);
+	}
+	while (len--) {
+		crc = src_crc32c_table[(crc ^ *bytes++) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SRC_CRC32C_HW
+__attribute__((target("sse4.2")))
+static uint32_t src_crc32c_hw(uint32_t crc, const unsigned char* bytes, size_t len)
+{
+#if defined(__x86_64__)
+	uint64_t c = crc;
+	while (len >= 8) {
+		uint64_t v;
+		memcpy(&v, bytes, 8);
+		c = __builtin_ia32_crc32di(c, v);
+		bytes += 8;
+		len -= 8;
+	}
+	crc = (uint32_t)c;
+#endif
+	while (len--) {
+		crc = __builtin_ia32_crc32qi(crc, *bytes++);
+	}
+	return crc;
+}
+
+static int src_crc32c_hw_supported(void)
+{
+	return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define SRC_CRC32C_HW
+#include <nmmintrin.h>
+static uint32_t src_crc32c_hw(uint32_t crc, const unsigned char* bytes, size_t len)
+{
+#if defined(_M_X64)
+	uint64_t c = crc;
+	while (len >= 8) {
+		uint64_t v;
+		memcpy(&v, bytes, 8);
+		c = _mm_crc32_u64(c, v);
+		bytes += 8;
+		len -= 8;
+	}
+	crc = (uint32_t)c;
+#endif
+	while (len--) {
+		crc = _mm_crc32_u8(crc, *bytes++);
+	}
+	return crc;
+}
+
+static int src_crc32c_hw_supported(void)
+{
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] >> 20) & 1;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define SRC_CRC32C_HW
+#include <arm_acle.h>
+static uint32_t src_crc32c_hw(uint32_t crc, const unsigned char* bytes, size_t len)
+{
+	while (len >= 8) {
+		uint64_t v;
+		memcpy(&v, bytes, 8);
+		crc = __crc32cd(crc, v);
+		bytes += 8;
+		len -= 8;
+	}
+	while (len--) {
+		crc = __crc32cb(crc, *bytes++);
+	}
+	return crc;
+}
+
+static int src_crc32c_hw_supported(void)
+{
+	return 1;
+}
+#endif
+
+uint32_t src_crc32c(const void* data, size_t len, uint32_t crc)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	crc = ~crc;
+#ifdef SRC_CRC32C_HW
+	static volatile long hwSupported = -1;
+	if (hwSupported < 0) hwSupported = src_crc32c_hw_supported();
+	if (hwSupported) return ~src_crc32c_hw(crc, bytes, len);
+#endif
+	return ~src_crc32c_sw(crc, bytes, len);
+}
+
+// a * b modulo the polynomial, bit 31 is x^0
+static uint32_t src_crc32c_multiply(uint32_t a, uint32_t b)
+{
+	uint32_t product = 0;
+	for (uint32_t m = 1u << 31; m && a; m >>= 1) {
+		if (a & m) {
+			product ^= b;
+			a ^= m;
+		}
+		b = (b & 1) ? (b >> 1) ^ 0x82F63B78u : b >> 1;
+	}
+	return product;
+}
+
+uint32_t src_crc32c_combine(uint32_t crcA, uint32_t crcB, uint64_t lenB)
+{
+	// shifts crcA over lenB zero bytes, x^(8 * lenB) by squaring x^8
+	uint32_t shift = 1u << 31;
+	uint32_t square = 1u << 23;
+	for (; lenB; lenB >>= 1) {
+		if (lenB & 1) shift = src_crc32c_multiply(square, shift);
+		square = src_crc32c_multiply(square, square);
+	}
+	return src_crc32c_multiply(shift, crcA) ^ crcB;
+}
+
+// length bytes continued from the input, 15 in the nibble and the bytes up to one below 255
+static int src_lz_length(const unsigned char** ip, const unsigned char* iend, size_t* length)
+{
+	unsigned char b;
+	do {
+		if (*ip == iend) return 0;
+		b = *(*ip)++;
+		*length += b;
+	} while (b == 255);
+	return 1;
+}
+
+int src_lz_decompress(const void* src, size_t srcSize, void* dst, size_t dstSize, const void* dict, size_t dictSize)
+{
+	const unsigned char* ip = (const unsigned char*)src;
+	const unsigned char* iend = ip + srcSize;
+	unsigned char* out = (unsigned char*)dst;
+	unsigned char* op = out;
+	unsigned char* oend = out + dstSize;
+
+	while (ip < iend) {
+		unsigned token = *ip++;
+		size_t literals = token >> 4;
+		if (literals == 15 && !src_lz_length(&ip, iend, &literals)) return 0;
+		if ((size_t)(iend - ip) < literals || (size_t)(oend - op) < literals) return 0;
+		memcpy(op, ip, literals);
+		op += literals;
+		ip += literals;
+		if (ip == iend) break;
+
+		if (iend - ip < 2) return 0;
+		size_t offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+		ip += 2;
+		size_t length = token & 15;
+		if (length == 15 && !src_lz_length(&ip, iend, &length)) return 0;
+		length += SRC_LZ_MIN_MATCH;
+
+		size_t produced = (size_t)(op - out);
+		if (offset == 0 || offset > produced + dictSize || (size_t)(oend - op) < length) return 0;
+		const unsigned char* match = op - (offset < produced ? offset : produced);
+		if (offset > produced) {
+			// starts in the dictionary and may run on into the output
+			size_t fromDict = offset - produced;
+			size_t n = fromDict < length ? fromDict : length;
+			memcpy(op, (const unsigned char*)dict + dictSize - fromDict, n);
+			op += n;
+			length -= n;
+		}
+		if ((size_t)(op - match) >= length) {
+			memcpy(op, match, length);
+			op += length;
+		}
+		else {
+			// overlaps the bytes it writes, repeats them
+			while (length--) *op++ = *match++;
+		}
+	}
+	return op == oend;
+}
+
+static size_t src_system_page_size(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (size_t)info.dwPageSize;
+#else
+	return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static void src_process_faults(uint64_t faults[2])
+{
+	faults[0] = 0;
+	faults[1] = 0;
+#ifndef _WIN32
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+		faults[0] = (uint64_t)usage.ru_minflt;
+		faults[1] = (uint64_t)usage.ru_majflt;
+	}
+#endif
+}
+
+static int src_archive_map(src_archive* archive, const char* path)
+{
+	archive->pageSize = src_system_page_size();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return 0;
+	LARGE_INTEGER size;
+	HANDLE mapping = NULL;
+	if (GetFileSizeEx(file, &size) && (uint64_t)size.QuadPart <= (uint64_t)SIZE_MAX) {
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	}
+	if (!mapping) {
+		CloseHandle(file);
+		return 0;
+	}
+	archive->base = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!archive->base) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return 0;
+	}
+	archive->size = (size_t)size.QuadPart;
+	archive->fileHandle = file;
+	archive->mappingHandle = mapping;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return 0;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0 || (uint64_t)st.st_size > (uint64_t)SIZE_MAX) {
+		close(fd);
+		return 0;
+	}
+	int mapFlags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+	// a copy reads the file once anyway
+	if ((archive->openFlags & SRC_OPEN_POPULATE) && !(archive->openFlags & SRC_OPEN_HUGE_PAGES_COPY)) mapFlags |= MAP_POPULATE;
+#endif
+	void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, mapFlags, fd, 0);
+	if (base == MAP_FAILED) {
+		close(fd);
+		return 0;
+	}
+	archive->base = (const unsigned char*)base;
+	archive->size = (size_t)st.st_size;
+	archive->fd = fd;
+#endif
+	return 1;
+}
+
+// replaces the mapping of the file by a copy on huge pages, the file stays open
+static int src_archive_copy(src_archive* archive)
+{
+#ifdef _WIN32
+	size_t largePage = GetLargePageMinimum();
+	size_t copySize = 0;
+	void* copy = NULL;
+	if (largePage) {
+		// needs SeLockMemoryPrivilege, large pages are never paged out
+		copySize = (archive->size + largePage - 1) & ~(largePage - 1);
+		copy = VirtualAlloc(NULL, copySize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (copy) archive->pageSize = largePage;
+	}
+	if (!copy) {
+		copySize = archive->size;
+		copy = VirtualAlloc(NULL, copySize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	}
+	if (!copy) return 0;
+	memcpy(copy, archive->base, archive->size);
+	UnmapViewOfFile(archive->base);
+	CloseHandle(archive->mappingHandle);
+	archive->mappingHandle = NULL;
+#else
+	const size_t hugePage = 2 * 1024 * 1024;
+	size_t copySize = (archive->size + hugePage - 1) & ~(hugePage - 1);
+	void* copy = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	// only succeeds when the pool of the default huge page size has enough free pages
+	copy = mmap(NULL, copySize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (copy != MAP_FAILED) archive->pageSize = hugePage;
+#endif
+	if (copy == MAP_FAILED) {
+		// transparent huge pages need an aligned start, the slack around it is unmapped
+		unsigned char* area = (unsigned char*)mmap(NULL, copySize + hugePage, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (area == (unsigned char*)MAP_FAILED) return 0;
+		unsigned char* aligned = (unsigned char*)(((uintptr_t)area + hugePage - 1) & ~(uintptr_t)(hugePage - 1));
+		if (aligned > area) munmap(area, (size_t)(aligned - area));
+		munmap(aligned + copySize, (size_t)(area + hugePage - aligned));
+		copy = aligned;
+#ifdef MADV_HUGEPAGE
+		madvise(copy, copySize, MADV_HUGEPAGE);
+#endif
+	}
+	memcpy(copy, archive->base, archive->size);
+	mprotect(copy, copySize, PROT_READ);
+	munmap((void*)archive->base, archive->size);
+#endif
+	archive->base = (const unsigned char*)copy;
+	archive->copySize = copySize;
+	return 1;
+}
+
+// locks the pages of [begin, end) of the archive, best effort
+static void src_archive_lock(src_archive* archive, size_t begin, size_t end)
+{
+	begin &= ~(src_system_page_size() - 1);
+	if (end > archive->size) end = archive->size;
+	if (begin >= end) return;
+#ifdef _WIN32
+	if (VirtualLock((void*)(archive->base + begin), end - begin)) archive->lockedBytes += end - begin;
+#else
+	if (mlock(archive->base + begin, end - begin) == 0) archive->lockedBytes += end - begin;
+#endif
+}
+
+// everything a lookup reads besides the data
+static void src_archive_lock_index(src_archive* archive, uint64_t tocOffset)
+{
+	size_t pageSize = src_system_page_size();
+	// runs of adjacent pages are locked at once
+	size_t runBegin = 0;
+	size_t runEnd = (sizeof(src_main_header) + pageSize - 1) & ~(pageSize - 1);
+	for (size_t i = 0; i < archive->entryCount; i += 1) {
+		const src_archive_entry* entry = &archive->entries[i];
+		size_t begin = (size_t)((const unsigned char*)entry->header - archive->base) & ~(pageSize - 1);
+		size_t end = (size_t)((const unsigned char*)entry->name - archive->base) + entry->header->nameLen;
+		end = (end + pageSize - 1) & ~(pageSize - 1);
+		if (begin >= runBegin && begin <= runEnd) {
+			if (end > runEnd) runEnd = end;
+			continue;
+		}
+		src_archive_lock(archive, runBegin, runEnd);
+		runBegin = begin;
+		runEnd = end;
+	}
+	src_archive_lock(archive, runBegin, runEnd < (size_t)tocOffset ? runEnd : (size_t)tocOffset);
+	src_archive_lock(archive, (size_t)tocOffset, archive->size);
+}
+
+static void src_archive_unmap(src_archive* archive)
+{
+	if (!archive->base) return;
+#ifdef _WIN32
+	if (archive->copySize) {
+		VirtualFree((void*)archive->base, 0, MEM_RELEASE);
+	}
+	else {
+		UnmapViewOfFile(archive->base);
+		CloseHandle(archive->mappingHandle);
+	}
+	CloseHandle(archive->fileHandle);
+#else
+	// unmapping drops the locks as well
+	munmap((void*)archive->base, archive->copySize ? archive->copySize : archive->size);
+	close(archive->fd);
+#endif
+	archive->base = NULL;
+}
+
+// validates the record at offset and points entry into it
+static int src_archive_resolve(const src_archive* archive, uint64_t offset, src_archive_entry* entry)
+{
+	if (offset > archive->size
+		|| archive->size - offset < sizeof(src_resource_header)
+		|| offset % SRC_RECORD_ALIGNMENT != 0) {
+		return 0;
+	}
+	const src_resource_header* sub = (const src_resource_header*)(archive->base + offset);
+	if (!src_validate_sub_header((src_resource_header*)sub)
+		|| sub->nameLen == 0
+		|| archive->size - offset - sizeof(src_resource_header) < sub->nameLen) {
+		return 0;
+	}
+	const char* name = (const char*)(sub + 1);
+	uint64_t dataOffset = offset + src_record_data_offset(sub);
+	if (name[sub->nameLen - 1] != '\0' || dataOffset > archive->size || archive->size - dataOffset < sub->resourceSize) {
+		return 0;
+	}
+
+	entry->header = sub;
+	entry->name = name;
+	entry->data = archive->base + dataOffset;
+	entry->verifyState = SRC_VERIFY_UNKNOWN;
+	return 1;
+}
+
+static int src_archive_has_section(const src_archive* archive, uint64_t offset, const char* value)
+{
+	// every section header is 24 bytes
+	return offset <= archive->size
+		&& archive->size - offset >= sizeof(src_group_header)
+		&& memcmp(archive->base + offset, value, strlen(value) + 1) == 0;
+}
+
+// next is set to the offset of the following section
+static int src_archive_load_groups(src_archive* archive, const src_group_header* header, uint64_t* next)
+{
+	uint64_t left = archive->size - ((const unsigned char*)(header + 1) - archive->base);
+	if (header->groupCount > left / sizeof(src_group_entry)
+		|| left - header->groupCount * sizeof(src_group_entry) < header->namesSize) {
+		return 0;
+	}
+	size_t count = (size_t)header->groupCount;
+	const src_group_entry* groups = (const src_group_entry*)(header + 1);
+	const char* names = (const char*)(groups + count);
+	if (src_crc32c(groups, count * sizeof(src_group_entry) + header->namesSize, 0) != header->checksum) {
+		return 0;
+	}
+	size_t terminators = 0;
+	for (uint32_t i = 0; i < header->namesSize; i += 1) {
+		terminators += names[i] == '\0';
+	}
+	if (terminators != count || (header->namesSize > 0 && names[header->namesSize - 1] != '\0')) {
+		return 0;
+	}
+	for (size_t i = 0; i < count; i += 1) {
+		if (groups[i].offset > archive->size || archive->size - groups[i].offset < groups[i].size) return 0;
+	}
+	archive->groupCount = count;
+	archive->groups = groups;
+	archive->groupNames = names;
+	*next = src_align_up((uint64_t)((const unsigned char*)names - archive->base) + header->namesSize);
+	return 1;
+}
+
+static int src_archive_load_dictionary(src_archive* archive, const src_dict_header* header)
+{
+	const unsigned char* dictionary = (const unsigned char*)(header + 1);
+	if (header->size > archive->size - (uint64_t)(dictionary - archive->base)
+		|| src_crc32c(dictionary, (size_t)header->size, 0) != header->checksum) {
+		return 0;
+	}
+	archive->dictionary.data = dictionary;
+	archive->dictionary.size = (size_t)header->size;
+	return 1;
+}
+
+int src_archive_open(src_archive* archive, const char* path)
+{
+	return src_archive_open_ex(archive, path, 0);
+}
+
+int src_archive_open_ex(src_archive* archive, const char* path, uint32_t openFlags)
+{
+	memset(archive, 0, sizeof(src_archive));
+	archive->openFlags = openFlags;
+	if (!src_archive_map(archive, path)) return 0;
+	// without the memory for a copy the file mapping is used
+	if (!(openFlags & SRC_OPEN_HUGE_PAGES_COPY) || !src_archive_copy(archive)) {
+#if defined(MADV_HUGEPAGE)
+		if (openFlags & SRC_OPEN_HUGE_PAGES) madvise((void*)archive->base, archive->size, MADV_HUGEPAGE);
+#endif
+		int prefault = (openFlags & SRC_OPEN_POPULATE) != 0;
+#if defined(MAP_POPULATE)
+		// the mapping left MAP_POPULATE out for the copy, which failed
+		prefault = prefault && (openFlags & SRC_OPEN_HUGE_PAGES_COPY);
+#endif
+#if defined(MADV_POPULATE_READ)
+		// kernels before 5.14 refuse it and touch every page below
+		if (prefault && madvise((void*)archive->base, archive->size, MADV_POPULATE_READ) == 0) prefault = 0;
+#endif
+		if (prefault) {
+			const volatile unsigned char* bytes = archive->base;
+			unsigned char sink = 0;
+			for (size_t offset = 0; offset < archive->size; offset += archive->pageSize) {
+				sink ^= bytes[offset];
+			}
+			(void)sink;
+		}
+	}
+
+	src_main_header* header = (src_main_header*)archive->base;
+	if (archive->size < sizeof(src_main_header) || !src_validate_header(header)) {
+		src_archive_close(archive);
+		return 0;
+	}
+
+	uint64_t tocOffset = header->tocOffset;
+	if (tocOffset < sizeof(src_main_header)
+		|| tocOffset > archive->size - sizeof(src_toc_header)
+		|| tocOffset % SRC_RECORD_ALIGNMENT != 0) {
+		src_archive_close(archive);
+		return 0;
+	}
+	src_toc_header* toc = (src_toc_header*)(archive->base + tocOffset);
+	if (!src_validate_toc_header(toc)
+		|| toc->entryCount > (archive->size - tocOffset - sizeof(src_toc_header)) / sizeof(src_toc_entry)) {
+		src_archive_close(archive);
+		return 0;
+	}
+	size_t count = (size_t)toc->entryCount;
+	const src_toc_entry* tocEntries = (const src_toc_entry*)(toc + 1);
+	if (src_crc32c(tocEntries, count * sizeof(src_toc_entry), 0) != toc->checksum) {
+		src_archive_close(archive);
+		return 0;
+	}
+	archive->entries = (src_archive_entry*)malloc((count + 1) * sizeof(src_archive_entry));
+
+	for (size_t i = 0; i < count; i += 1) {
+		if (!src_archive_resolve(archive, tocEntries[i].offset, &archive->entries[i])) {
+			src_archive_close(archive);
+			return 0;
+		}
+	}
+	archive->entryCount = count;
+
+	// optional sections, in this order
+	uint64_t sectionOffset = tocOffset + sizeof(src_toc_header) + count * sizeof(src_toc_entry);
+	if (src_archive_has_section(archive, sectionOffset, SRC_GROUP_HEADER_VALUE)
+		&& !src_archive_load_groups(archive, (const src_group_header*)(archive->base + sectionOffset), &sectionOffset)) {
+		src_archive_close(archive);
+		return 0;
+	}
+	if (src_archive_has_section(archive, sectionOffset, SRC_DICT_HEADER_VALUE)
+		&& !src_archive_load_dictionary(archive, (const src_dict_header*)(archive->base + sectionOffset))) {
+		src_archive_close(archive);
+		return 0;
+	}
+
+	// locking faults the pages in
+	if (openFlags & SRC_OPEN_LOCK_ALL) {
+		src_archive_lock(archive, 0, archive->size);
+	}
+	else if (openFlags & SRC_OPEN_LOCK_INDEX) {
+		src_archive_lock_index(archive, tocOffset);
+	}
+	src_process_faults(archive->faultsAtOpen);
+	return 1;
+}
+
+void src_archive_get_stats(const src_archive* archive, src_archive_stats* stats)
+{
+	memset(stats, 0, sizeof(src_archive_stats));
+	stats->mappedBytes = archive->copySize ? archive->copySize : archive->size;
+	stats->lockedBytes = archive->lockedBytes;
+	stats->pageSize = archive->pageSize;
+	stats->accessCount = SRC_ATOMIC_LOAD64(&archive->accessCount);
+	stats->accessBytes = SRC_ATOMIC_LOAD64(&archive->accessBytes);
+#if defined(__linux__)
+	size_t pageSize = src_system_page_size();
+	size_t pages = (archive->size + pageSize - 1) / pageSize;
+	unsigned char* resident = (unsigned char*)malloc(pages + 1);
+	if (resident && mincore((void*)archive->base, archive->size, resident) == 0) {
+		for (size_t i = 0; i < pages; i += 1) {
+			if (resident[i] & 1) stats->residentBytes += pageSize;
+		}
+	}
+	free(resident);
+#endif
+#ifndef _WIN32
+	uint64_t faults[2];
+	src_process_faults(faults);
+	stats->minorFaults = faults[0] - archive->faultsAtOpen[0];
+	stats->majorFaults = faults[1] - archive->faultsAtOpen[1];
+#endif
+}
+
+static void src_archive_count(const src_archive* archive, uint64_t bytes)
+{
+	if (!(archive->openFlags & SRC_OPEN_COUNTERS)) return;
+	SRC_ATOMIC_ADD64(&((src_archive*)archive)->accessCount, 1);
+	SRC_ATOMIC_ADD64(&((src_archive*)archive)->accessBytes, bytes);
+}
+
+void src_archive_close(src_archive* archive)
+{
+	src_archive_unmap(archive);
+	free(archive->entries);
+	archive->entries = NULL;
+	archive->entryCount = 0;
+	archive->groupCount = 0;
+	archive->groups = NULL;
+	archive->groupNames = NULL;
+	archive->dictionary.data = NULL;
+	archive->dictionary.size = 0;
+	archive->copySize = 0;
+	archive->lockedBytes = 0;
+}
+
+src_view src_archive_entry_view(const src_archive_entry* entry)
+{
+	src_view view;
+	view.data = entry->data;
+	view.size = (size_t)entry->header->resourceSize;
+	return view;
+}
+
+int src_entry_verify(const src_archive_entry* entry)
+{
+	long state = SRC_ATOMIC_LOAD(&entry->verifyState);
+	if (state == SRC_VERIFY_UNKNOWN) {
+		uint32_t crc = src_crc32c(entry->data, (size_t)entry->header->resourceSize, 0);
+		state = crc == entry->header->checksum ? SRC_VERIFY_OK : SRC_VERIFY_FAILED;
+		// concurrent first accesses compute the same result
+		SRC_ATOMIC_CAS(&((src_archive_entry*)entry)->verifyState, SRC_VERIFY_UNKNOWN, state);
+	}
+	return state == SRC_VERIFY_OK;
+}
+
+int src_archive_get(const src_archive* archive, const src_archive_entry* entry, src_view* view)
+{
+	if ((entry->header->flags & (SRC_RESOURCE_FLAG_CHUNKED | SRC_RESOURCE_FLAG_COMPRESSED))
+		|| ((archive->openFlags & SRC_OPEN_VERIFY_ON_ACCESS) && !src_entry_verify(entry))) {
+		view->data = NULL;
+		view->size = 0;
+		return 0;
+	}
+	*view = src_archive_entry_view(entry);
+	src_archive_count(archive, view->size);
+	return 1;
+}
+
+int src_archive_find_group(const src_archive* archive, const char* name)
+{
+	const char* groupName = archive->groupNames;
+	for (size_t i = 0; i < archive->groupCount; i += 1) {
+		if (strcmp(groupName, name) == 0) return (int)i;
+		groupName += strlen(groupName) + 1;
+	}
+	return -1;
+}
+
+// the pages covering a group, hints apply to whole pages
+static int src_archive_group_pages(const src_archive* archive, const char* name, void** begin, size_t* length)
+{
+	int group = src_archive_find_group(archive, name);
+	if (group < 0) return 0;
+	uintptr_t pageSize = (uintptr_t)src_system_page_size();
+	uintptr_t start = (uintptr_t)(archive->base + archive->groups[group].offset);
+	uintptr_t end = start + (uintptr_t)archive->groups[group].size;
+	start &= ~(pageSize - 1);
+	*begin = (void*)start;
+	*length = (size_t)(end - start);
+	return 1;
+}
+
+int src_archive_prefetch_group(const src_archive* archive, const char* name)
+{
+	void* begin;
+	size_t length;
+	if (!src_archive_group_pages(archive, name, &begin, &length)) return 0;
+	if (length == 0) return 1;
+#ifdef _WIN32
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0602
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = begin;
+	range.NumberOfBytes = length;
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+#else
+	// schedules readahead of the file pages and returns
+	madvise(begin, length, MADV_WILLNEED);
+#endif
+	return 1;
+}
+
+int src_archive_release_group(const src_archive* archive, const char* name)
+{
+	void* begin;
+	size_t length;
+	if (!src_archive_group_pages(archive, name, &begin, &length)) return 0;
+	// dropped pages of a copy would read back as zeros
+	if (length == 0 || archive->lockedBytes || archive->copySize) return 1;
+#ifdef _WIN32
+	// unlocking pages which aren't locked removes them from the working set
+	VirtualUnlock(begin, length);
+#else
+	// the mapping is read only, its pages are dropped without writing anything back
+	madvise(begin, length, MADV_DONTNEED);
+#endif
+	return 1;
+}
+
+const char* src_entry_relative_name(const src_archive_entry* entry)
+{
+	// archives of older packers and of libsrc have names without a root
+	if (entry->header->rootLen >= entry->header->nameLen - 1) return entry->name;
+	return entry->name + entry->header->rootLen;
+}
+
+uint64_t src_entry_size(const src_archive_entry* entry)
+{
+	if (entry->header->flags & SRC_RESOURCE_FLAG_COMPRESSED) {
+		if (entry->header->resourceSize < sizeof(src_compressed_header)) return 0;
+		return ((const src_compressed_header*)entry->data)->size;
+	}
+	if (!(entry->header->flags & SRC_RESOURCE_FLAG_CHUNKED)) return entry->header->resourceSize;
+	if (entry->header->resourceSize < sizeof(src_chunk_list)) return 0;
+	return ((const src_chunk_list*)entry->data)->size;
+}
+
+uint32_t src_entry_frame_size(const src_archive_entry* entry)
+{
+	if (!(entry->header->flags & SRC_RESOURCE_FLAG_COMPRESSED) || entry->header->resourceSize < sizeof(src_compressed_header)) return 0;
+	return ((const src_compressed_header*)entry->data)->frameSize;
+}
+
+// the history a compressed resource refers to, returns 0 for an unknown codec
+static int src_compressed_dict(const src_archive* archive, const src_compressed_header* header, const void** dict, size_t* dictSize)
+{
+	*dict = NULL;
+	*dictSize = 0;
+	if (header->codec == SRC_CODEC_LZ_DICT) {
+		*dict = archive->dictionary.data;
+		*dictSize = archive->dictionary.size;
+		return archive->dictionary.data != NULL;
+	}
+	return header->codec == SRC_CODEC_LZ;
+}
+
+// the frame index at the end of the data, NULL if it doesn't fit the record
+static const src_frame_ref* src_entry_frames(const src_archive_entry* entry, uint64_t* frameCount)
+{
+	const src_compressed_header* header = (const src_compressed_header*)entry->data;
+	uint64_t count = header->size / header->frameSize + (header->size % header->frameSize != 0);
+	uint64_t dataSize = entry->header->resourceSize - sizeof(src_compressed_header);
+	if (entry->header->resourceSize % SRC_RECORD_ALIGNMENT != 0 || count > dataSize / sizeof(src_frame_ref)) return NULL;
+	*frameCount = count;
+	return (const src_frame_ref*)(entry->data + entry->header->resourceSize - count * sizeof(src_frame_ref));
+}
+
+static int src_decode_frame(const src_archive* archive, const src_archive_entry* entry, const src_frame_ref* ref,
+	void* dst, size_t dstSize, const void* dict, size_t dictSize)
+{
+	if (ref->offset > entry->header->resourceSize || entry->header->resourceSize - ref->offset < ref->size) return 0;
+	const unsigned char* frame = entry->data + ref->offset;
+	if ((archive->openFlags & SRC_OPEN_VERIFY_ON_ACCESS) && src_crc32c(frame, ref->size, 0) != ref->checksum) return 0;
+	if (ref->size == dstSize) {
+		memcpy(dst, frame, dstSize);
+		return 1;
+	}
+	return src_lz_decompress(frame, ref->size, dst, dstSize, dict, dictSize);
+}
+
+// decompresses the frames overlapping the range, the caller checked its bounds
+static int src_read_frames(const src_archive* archive, const src_archive_entry* entry, uint64_t offset, void* dst, size_t size)
+{
+	const src_compressed_header* header = (const src_compressed_header*)entry->data;
+	const void* dict;
+	size_t dictSize;
+	uint64_t frameCount;
+	const src_frame_ref* refs = src_entry_frames(entry, &frameCount);
+	if (!refs || !src_compressed_dict(archive, header, &dict, &dictSize)) return 0;
+
+	unsigned char* out = (unsigned char*)dst;
+	unsigned char* partial = NULL; // frames only partly in the range go through it
+	int succ = 1;
+	for (uint64_t frame = offset / header->frameSize; succ && size > 0; frame += 1) {
+		uint64_t frameStart = frame * header->frameSize;
+		uint64_t left = header->size - frameStart;
+		size_t frameLen = (size_t)(left < header->frameSize ? left : header->frameSize);
+		size_t skip = (size_t)(offset - frameStart);
+		size_t n = frameLen - skip < size ? frameLen - skip : size;
+		if (n == frameLen) {
+			succ = src_decode_frame(archive, entry, &refs[frame], out, frameLen, dict, dictSize);
+		}
+		else {
+			if (!partial) partial = (unsigned char*)malloc(header->frameSize);
+			succ = partial && src_decode_frame(archive, entry, &refs[frame], partial, frameLen, dict, dictSize);
+			if (succ) memcpy(out, partial + skip, n);
+		}
+		out += n;
+		offset += n;
+		size -= n;
+	}
+	free(partial);
+	return succ;
+}
+
+static size_t src_stream_copy(src_stream* stream, void* dst, size_t size);
+
+// the public reads count each access once
+static int src_archive_read_all(const src_archive* archive, const src_archive_entry* entry, void* dst, size_t dstSize)
+{
+	if (src_entry_size(entry) != dstSize) return 0;
+	if (!(entry->header->flags & SRC_RESOURCE_FLAG_COMPRESSED)) {
+		src_stream stream;
+		return src_stream_open(&stream, archive, entry) && src_stream_copy(&stream, dst, dstSize) == dstSize;
+	}
+	const src_compressed_header* header = (const src_compressed_header*)entry->data;
+	// frames carry their own checksums
+	if (header->frameSize) return src_read_frames(archive, entry, 0, dst, dstSize);
+
+	if ((archive->openFlags & SRC_OPEN_VERIFY_ON_ACCESS) && !src_entry_verify(entry)) return 0;
+	const void* dict;
+	size_t dictSize;
+	if (!src_compressed_dict(archive, header, &dict, &dictSize)) return 0;
+	return src_lz_decompress(header + 1, (size_t)entry->header->resourceSize - sizeof(src_compressed_header), dst, dstSize, dict, dictSize);
+}
+
+int src_archive_read(const src_archive* archive, const src_archive_entry* entry, void* dst, size_t dstSize)
+{
+	if (!src_archive_read_all(archive, entry, dst, dstSize)) return 0;
+	src_archive_count(archive, dstSize);
+	return 1;
+}
+
+static int src_archive_read_part(const src_archive* archive, const src_archive_entry* entry, uint64_t offset, void* dst, size_t size)
+{
+	uint64_t entrySize = src_entry_size(entry);
+	if (offset > entrySize || entrySize - offset < size) return 0;
+	if (!(entry->header->flags & SRC_RESOURCE_FLAG_COMPRESSED)) {
+		src_stream stream;
+		return src_stream_open(&stream, archive, entry) && src_stream_seek(&stream, offset)
+			&& src_stream_copy(&stream, dst, size) == size;
+	}
+	const src_compressed_header* header = (const src_compressed_header*)entry->data;
+	if (header->frameSize) return src_read_frames(archive, entry, offset, dst, size);
+
+	// a stream only decodes from its start
+	unsigned char* whole = (unsigned char*)malloc((size_t)entrySize + 1);
+	int succ = whole && src_archive_read_all(archive, entry, whole, (size_t)entrySize);
+	if (succ) memcpy(dst, whole + offset, size);
+	free(whole);
+	return succ;
+}
+
+int src_archive_read_range(const src_archive* archive, const src_archive_entry* entry, uint64_t offset, void* dst, size_t size)
+{
+	if (!src_archive_read_part(archive, entry, offset, dst, size)) return 0;
+	src_archive_count(archive, size);
+	return 1;
+}
+
+int src_stream_open(src_stream* stream, const src_archive* archive, const src_archive_entry* entry)
+{
+	memset(stream, 0, sizeof(src_stream));
+	stream->archive = archive;
+	if (entry->header->flags & SRC_RESOURCE_FLAG_COMPRESSED) {
+		return 0;
+	}
+	if ((archive->openFlags & SRC_OPEN_VERIFY_ON_ACCESS) && !src_entry_verify(entry)) {
+		return 0;
+	}
+	if (!(entry->header->flags & SRC_RESOURCE_FLAG_CHUNKED)) {
+		stream->data = entry->data;
+		stream->size = entry->header->resourceSize;
+		return 1;
+	}
+
+	const src_chunk_list* list = (const src_chunk_list*)entry->data;
+	if (entry->header->resourceSize < sizeof(src_chunk_list)
+		|| list->chunkCount > (entry->header->resourceSize - sizeof(src_chunk_list)) / sizeof(src_chunk_ref)) {
+		return 0;
+	}
+	stream->refs = (const src_chunk_ref*)(list + 1);
+	stream->chunkCount = list->chunkCount;
+	stream->size = list->size;
+	return 1;
+}
+
+static size_t src_stream_copy(src_stream* stream, void* dst, size_t size)
+{
+	uint64_t left = stream->size - stream->position;
+	if (size > left) size = (size_t)left;
+	if (!stream->refs) {
+		memcpy(dst, stream->data + stream->position, size);
+		stream->position += size;
+		return size;
+	}
+
+	const src_archive* archive = stream->archive;
+	size_t copied = 0;
+	while (copied < size) {
+		if (stream->chunk >= stream->chunkCount) {
+			stream->failed = 1;
+			break;
+		}
+		const src_chunk_ref* ref = &stream->refs[stream->chunk];
+		if (ref->offset > archive->size || archive->size - ref->offset < ref->size) {
+			stream->failed = 1;
+			break;
+		}
+		const unsigned char* chunk = archive->base + ref->offset;
+		if (stream->chunkOffset == 0
+			&& (archive->openFlags & SRC_OPEN_VERIFY_ON_ACCESS)
+			&& src_crc32c(chunk, ref->size, 0) != ref->checksum) {
+			stream->failed = 1;
+			break;
+		}
+		size_t n = (size_t)(ref->size - stream->chunkOffset);
+		if (n > size - copied) n = size - copied;
+		memcpy((unsigned char*)dst + copied, chunk + stream->chunkOffset, n);
+		copied += n;
+		stream->chunkOffset += n;
+		if (stream->chunkOffset == ref->size) {
+			stream->chunk += 1;
+			stream->chunkOffset = 0;
+		}
+	}
+	stream->position += copied;
+	return copied;
+}
+
+size_t src_stream_read(src_stream* stream, void* dst, size_t size)
+{
+	size_t copied = src_stream_copy(stream, dst, size);
+	if (copied) src_archive_count(stream->archive, copied);
+	return copied;
+}
+
+int src_stream_seek(src_stream* stream, uint64_t position)
+{
+	if (position > stream->size) return 0;
+	stream->position = position;
+	if (!stream->refs) return 1;
+	// chunks only know their size, walk the list from the start
+	uint64_t start = 0;
+	uint64_t chunk = 0;
+	while (chunk < stream->chunkCount && start + stream->refs[chunk].size <= position) {
+		start += stream->refs[chunk].size;
+		chunk += 1;
+	}
+	stream->chunk = chunk;
+	stream->chunkOffset = position - start;
+	return 1;
+}
+
+void src_vfs_init(src_vfs* vfs)
+{
+	memset(vfs, 0, sizeof(src_vfs));
+}
+
+void src_vfs_free(src_vfs* vfs)
+{
+	free(vfs->layers);
+	free(vfs->slots);
+	memset(vfs, 0, sizeof(src_vfs));
+}
+
+static int src_vfs_compare_layers(const void* a, const void* b)
+{
+	const src_vfs_layer* la = (const src_vfs_layer*)a;
+	const src_vfs_layer* lb = (const src_vfs_layer*)b;
+	if (la->priority != lb->priority) return la->priority > lb->priority ? -1 : 1;
+	return la->order > lb->order ? -1 : 1;
+}
+
+static void src_vfs_build_index(src_vfs* vfs)
+{
+	// highest priority first, so the first entry inserted for a path wins
+	qsort(vfs->layers, vfs->layerCount, sizeof(src_vfs_layer), src_vfs_compare_layers);
+
+	size_t total = 0;
+	for (size_t i = 0; i < vfs->layerCount; i += 1) {
+		total += vfs->layers[i].archive->entryCount;
+	}
+	size_t slotCount = 16;
+	while (slotCount < total * 2) slotCount *= 2;
+
+	free(vfs->slots);
+	vfs->slots = (src_vfs_slot*)calloc(slotCount, sizeof(src_vfs_slot));
+	vfs->slotMask = slotCount - 1;
+
+	for (size_t l = 0; l < vfs->layerCount; l += 1) {
+		const src_archive* archive = vfs->layers[l].archive;
+		for (size_t e = 0; e < archive->entryCount; e += 1) {
+			const src_archive_entry* entry = &archive->entries[e];
+			const char* name = src_entry_relative_name(entry);
+			uint32_t id = entry->header->rootLen ? djb2_hash((unsigned char*)name) : entry->header->id;
+			size_t slot = id & vfs->slotMask;
+			while (vfs->slots[slot].entry) {
+				if (vfs->slots[slot].id == id
+					&& strcmp(src_entry_relative_name(vfs->slots[slot].entry), name) == 0) break;
+				slot = (slot + 1) & vfs->slotMask;
+			}
+			if (!vfs->slots[slot].entry) {
+				vfs->slots[slot].id = id;
+				vfs->slots[slot].entry = entry;
+			}
+		}
+	}
+}
+
+int src_vfs_mount(src_vfs* vfs, const src_archive* archive, int priority)
+{
+	if (vfs->layerCount == vfs->layerCapacity) {
+		size_t capacity = vfs->layerCapacity ? vfs->layerCapacity * 2 : 4;
+		src_vfs_layer* layers = (src_vfs_layer*)realloc(vfs->layers, capacity * sizeof(src_vfs_layer));
+		if (!layers) return 0;
+		vfs->layers = layers;
+		vfs->layerCapacity = capacity;
+	}
+	src_vfs_layer* layer = &vfs->layers[vfs->layerCount++];
+	layer->archive = archive;
+	layer->priority = priority;
+	layer->order = vfs->mountCounter++;
+	src_vfs_build_index(vfs);
+	return 1;
+}
+
+int src_vfs_unmount(src_vfs* vfs, const src_archive* archive)
+{
+	for (size_t i = 0; i < vfs->layerCount; i += 1) {
+		if (vfs->layers[i].archive == archive) {
+			vfs->layers[i] = vfs->layers[--vfs->layerCount];
+			src_vfs_build_index(vfs);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static const src_archive_entry* src_vfs_resolve(const src_archive_entry* entry)
+{
+	if (!entry || (entry->header->flags & SRC_RESOURCE_FLAG_TOMBSTONE)) return NULL;
+	return entry;
+}
+
+const src_archive_entry* src_vfs_find(const src_vfs* vfs, const char* path)
+{
+	if (!vfs->slots) return NULL;
+	uint32_t id = djb2_hash((unsigned char*)path);
+	size_t slot = id & vfs->slotMask;
+	while (vfs->slots[slot].entry) {
+		if (vfs->slots[slot].id == id && strcmp(src_entry_relative_name(vfs->slots[slot].entry), path) == 0) {
+			return src_vfs_resolve(vfs->slots[slot].entry);
+		}
+		slot = (slot + 1) & vfs->slotMask;
+	}
+	return NULL;
+}
+
+const src_archive_entry* src_vfs_find_id(const src_vfs* vfs, uint32_t id)
+{
+	if (!vfs->slots) return NULL;
+	size_t slot = id & vfs->slotMask;
+	while (vfs->slots[slot].entry) {
+		if (vfs->slots[slot].id == id) {
+			return src_vfs_resolve(vfs->slots[slot].entry);
+		}
+		slot = (slot + 1) & vfs->slotMask;
+	}
+	return NULL;
+}
+
+int src_sharded_open(src_sharded_archive* sharded, const char* indexPath)
+{
+	memset(sharded, 0, sizeof(src_sharded_archive));
+	src_archive* index = &sharded->index;
+	if (!src_archive_map(index, indexPath)) return 0;
+
+	const src_index_header* header = (const src_index_header*)index->base;
+	if (index->size < sizeof(src_index_header)
+		|| strcmp(header->header, SRC_INDEX_HEADER_VALUE) != 0
+		|| header->version != SRC_RESOURCE_VERSION
+		|| header->entryCount > (index->size - sizeof(src_index_header)) / sizeof(src_index_entry)
+		|| src_crc32c(header + 1, index->size - sizeof(src_index_header), 0) != header->checksum) {
+		src_archive_unmap(index);
+		return 0;
+	}
+
+	// shard names follow the entries, relative to the directory of the index
+	size_t dirLen = strlen(indexPath);
+	while (dirLen > 0 && indexPath[dirLen - 1] != '/' && indexPath[dirLen - 1] != '\\') dirLen -= 1;
+	const char* names = (const char*)((const src_index_entry*)(header + 1) + header->entryCount);
+	const char* end = (const char*)index->base + index->size;
+	sharded->shards = (src_archive*)calloc(header->shardCount + 1, sizeof(src_archive));
+	for (uint32_t i = 0; i < header->shardCount; i += 1) {
+		size_t nameLen = strnlen(names, end - names);
+		if (names + nameLen == end) {
+			src_sharded_close(sharded);
+			return 0;
+		}
+		char* path = (char*)malloc(dirLen + nameLen + 1);
+		memcpy(path, indexPath, dirLen);
+		memcpy(path + dirLen, names, nameLen + 1);
+		int opened = src_archive_open(&sharded->shards[i], path);
+		free(path);
+		if (!opened) {
+			src_sharded_close(sharded);
+			return 0;
+		}
+		sharded->shardCount += 1;
+		names += nameLen + 1;
+	}
+
+	size_t count = (size_t)header->entryCount;
+	const src_index_entry* indexEntries = (const src_index_entry*)(header + 1);
+	sharded->entries = (src_archive_entry*)malloc((count + 1) * sizeof(src_archive_entry));
+	sharded->entryShards = (uint32_t*)malloc((count + 1) * sizeof(uint32_t));
+	for (size_t i = 0; i < count; i += 1) {
+		if (indexEntries[i].shard >= sharded->shardCount
+			|| !src_archive_resolve(&sharded->shards[indexEntries[i].shard], indexEntries[i].offset, &sharded->entries[i])) {
+			src_sharded_close(sharded);
+			return 0;
+		}
+		sharded->entryShards[i] = indexEntries[i].shard;
+	}
+	sharded->entryCount = count;
+	return 1;
+}
+
+void src_sharded_close(src_sharded_archive* sharded)
+{
+	for (uint32_t i = 0; i < sharded->shardCount; i += 1) {
+		src_archive_close(&sharded->shards[i]);
+	}
+	free(sharded->shards);
+	free(sharded->entries);
+	free(sharded->entryShards);
+	src_archive_unmap(&sharded->index);
+	memset(sharded, 0, sizeof(src_sharded_archive));
+}
+
+static uint32_t src_process_id(void)
+{
+#ifdef _WIN32
+	return (uint32_t)GetCurrentProcessId();
+#else
+	return (uint32_t)getpid();
+#endif
+}
+
+static int src_process_alive(uint32_t pid)
+{
+#ifdef _WIN32
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, pid);
+	if (!process) return GetLastError() == ERROR_ACCESS_DENIED;
+	int alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+	CloseHandle(process);
+	return alive;
+#else
+	return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+#endif
+}
+
+static void src_shared_cache_wait(uint32_t spin)
+{
+#ifdef _WIN32
+	if (spin < 64) SwitchToThread();
+	else Sleep(1);
+#else
+	if (spin < 64) sched_yield();
+	else usleep(100);
+#endif
+}
+
+int src_shared_cache_open(src_shared_cache* cache, const char* name, uint64_t capacity, uint32_t slotCount)
+{
+	memset(cache, 0, sizeof(src_shared_cache));
+	uint32_t slots = 16;
+	while (slots < slotCount && slots < 0x80000000u) slots *= 2;
+	capacity = (capacity + SRC_SHARED_CACHE_ALIGNMENT - 1) & ~(uint64_t)(SRC_SHARED_CACHE_ALIGNMENT - 1);
+	uint64_t size = sizeof(src_shared_cache_header) + (uint64_t)slots * sizeof(src_shared_cache_slot) + capacity;
+	if (size > (uint64_t)SIZE_MAX) return 0;
+
+#ifdef _WIN32
+	HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+		(DWORD)(size >> 32), (DWORD)size, name);
+	if (!mapping) return 0;
+	int created = GetLastError() != ERROR_ALREADY_EXISTS;
+	// an existing section is mapped whole, its size comes from its header
+	void* base = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (!base) {
+		CloseHandle(mapping);
+		return 0;
+	}
+	cache->mappingHandle = mapping;
+	MEMORY_BASIC_INFORMATION info;
+	size_t mappedSize = VirtualQuery(base, &info, sizeof(info)) ? info.RegionSize : 0;
+#else
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	int created = fd >= 0;
+	if (!created) {
+		if (errno != EEXIST) return 0;
+		fd = shm_open(name, O_RDWR, 0);
+		if (fd < 0) return 0;
+	}
+	else if (ftruncate(fd, (off_t)size) != 0) {
+		close(fd);
+		shm_unlink(name);
+		return 0;
+	}
+	// the creator may not have sized the segment yet
+	struct stat st;
+	for (uint32_t spin = 0; fstat(fd, &st) == 0 && st.st_size == 0 && spin < 1000; spin += 1) {
+		src_shared_cache_wait(spin);
+	}
+	if (st.st_size < (off_t)sizeof(src_shared_cache_header) || (uint64_t)st.st_size > (uint64_t)SIZE_MAX) {
+		// the creator died before sizing it, the next open creates the segment anew
+		if (st.st_size == 0) shm_unlink(name);
+		close(fd);
+		return 0;
+	}
+	size_t mappedSize = (size_t)st.st_size;
+	void* base = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) return 0;
+#endif
+	cache->base = (unsigned char*)base;
+	cache->size = mappedSize;
+	cache->header = (src_shared_cache_header*)base;
+
+	src_shared_cache_header* header = cache->header;
+	uint64_t pid = src_process_id();
+	// one process initializes the header, an attacher which won the race for it waits instead
+	int initialize = created && SRC_ATOMIC_CAS64(&header->creator, 0, pid);
+	if (!initialize) {
+		for (uint32_t spin = 0; SRC_ATOMIC_LOAD(&header->magic) != SRC_SHARED_CACHE_MAGIC && spin < 1000; spin += 1) {
+			src_shared_cache_wait(spin);
+		}
+		// the creator died before it was done, the segment keeps its size and is set up from it
+		uint64_t creator = SRC_ATOMIC_LOAD64(&header->creator);
+		if (SRC_ATOMIC_LOAD(&header->magic) != SRC_SHARED_CACHE_MAGIC
+			&& (creator == 0 || !src_process_alive((uint32_t)creator))
+			&& SRC_ATOMIC_CAS64(&header->creator, creator, pid)) {
+			initialize = 1;
+			while (slots > 16 && sizeof(src_shared_cache_header) + (uint64_t)slots * sizeof(src_shared_cache_slot) > mappedSize) {
+				slots /= 2;
+			}
+			uint64_t tableEnd = sizeof(src_shared_cache_header) + (uint64_t)slots * sizeof(src_shared_cache_slot);
+			capacity = mappedSize > tableEnd ? (mappedSize - tableEnd) & ~(uint64_t)(SRC_SHARED_CACHE_ALIGNMENT - 1) : 0;
+		}
+	}
+	if (initialize) {
+		// the segment starts zeroed and no slot is claimed before the magic is set
+		header->slotCount = slots;
+		header->capacity = capacity;
+		SRC_ATOMIC_CAS(&header->magic, 0, SRC_SHARED_CACHE_MAGIC);
+	}
+
+	slots = header->slotCount;
+	if (SRC_ATOMIC_LOAD(&header->magic) != SRC_SHARED_CACHE_MAGIC
+		|| slots == 0 || (slots & (slots - 1)) != 0
+		|| (cache->size - sizeof(src_shared_cache_header)) / sizeof(src_shared_cache_slot) < slots
+		|| cache->size - sizeof(src_shared_cache_header) - (uint64_t)slots * sizeof(src_shared_cache_slot) < header->capacity) {
+		src_shared_cache_close(cache);
+		return 0;
+	}
+	cache->slots = (src_shared_cache_slot*)(header + 1);
+	cache->data = (unsigned char*)(cache->slots + slots);
+	return 1;
+}
+
+void src_shared_cache_close(src_shared_cache* cache)
+{
+	if (!cache->base) return;
+#ifdef _WIN32
+	UnmapViewOfFile(cache->base);
+	CloseHandle(cache->mappingHandle);
+#else
+	munmap(cache->base, cache->size);
+#endif
+	memset(cache, 0, sizeof(src_shared_cache));
+}
+
+void src_shared_cache_unlink(const char* name)
+{
+#ifndef _WIN32
+	shm_unlink(name);
+#else
+	(void)name;
+#endif
+}
+
+#define SRC_CACHE_GENERATION_SHIFT 40
+#define SRC_CACHE_GENERATION_MASK (~0ull << SRC_CACHE_GENERATION_SHIFT)
+#define SRC_CACHE_SLOT_KIND(state) ((uint32_t)((state) >> 32) & 0xff)
+
+// called with the slot claimed by this process
+static int src_shared_cache_fill(src_shared_cache* cache, src_shared_cache_slot* slot, uint64_t claim, size_t size,
+	src_decode_func decode, void* user, src_view* view)
+{
+	// space of a filler which was taken over is not reused, the takeover decodes into fresh space
+	uint64_t generation = claim & SRC_CACHE_GENERATION_MASK;
+	uint64_t capacity = cache->header->capacity;
+	uint64_t alignedSize = (size + SRC_SHARED_CACHE_ALIGNMENT - 1) & ~(uint64_t)(SRC_SHARED_CACHE_ALIGNMENT - 1);
+	uint64_t offset = SRC_ATOMIC_ADD64(&cache->header->used, alignedSize);
+	if (offset > capacity || capacity - offset < size) {
+		SRC_ATOMIC_CAS64(&slot->state, claim, generation | (uint64_t)SRC_CACHE_SLOT_FULL << 32);
+		return 0;
+	}
+	if (!decode(user, cache->data + offset, size)) {
+		SRC_ATOMIC_CAS64(&slot->state, claim, generation | (uint64_t)SRC_CACHE_SLOT_FAILED << 32);
+		return 0;
+	}
+	view->data = cache->data + offset;
+	view->size = size;
+
+	// taken over while decoding, the bytes are still this caller's
+	uint64_t publishing = (claim & ~(0xffull << 32)) | (uint64_t)SRC_CACHE_SLOT_PUBLISHING << 32;
+	if (!SRC_ATOMIC_CAS64(&slot->state, claim, publishing)) return 1;
+	slot->offset = offset;
+	slot->size = size;
+	SRC_ATOMIC_STORE64(&slot->state, generation | (uint64_t)SRC_CACHE_SLOT_READY << 32);
+	return 1;
+}
+
+int src_shared_cache_get(src_shared_cache* cache, uint64_t key, size_t size, src_decode_func decode, void* user, src_view* view)
+{
+	view->data = NULL;
+	view->size = 0;
+	if (key == 0) key = 1;
+
+	uint32_t mask = cache->header->slotCount - 1;
+	uint32_t i = (uint32_t)(key ^ (key >> 32)) & mask;
+	src_shared_cache_slot* slot = NULL;
+	for (uint32_t probe = 0; probe <= mask; probe += 1, i = (i + 1) & mask) {
+		uint64_t current = SRC_ATOMIC_LOAD64(&cache->slots[i].key);
+		if (current == 0) {
+			SRC_ATOMIC_CAS64(&cache->slots[i].key, 0, key);
+			current = SRC_ATOMIC_LOAD64(&cache->slots[i].key);
+		}
+		if (current == key) {
+			slot = &cache->slots[i];
+			break;
+		}
+	}
+	if (!slot) return 0;
+
+	uint64_t pid = src_process_id();
+	for (uint32_t spin = 0;; spin += 1) {
+		uint64_t state = SRC_ATOMIC_LOAD64(&slot->state);
+		uint32_t kind = SRC_CACHE_SLOT_KIND(state);
+		if (kind == SRC_CACHE_SLOT_READY) {
+			if (slot->size != size) return 0;
+			view->data = cache->data + slot->offset;
+			view->size = size;
+			return 1;
+		}
+		if (kind == SRC_CACHE_SLOT_FULL) return 0;
+
+		// the liveness check is a syscall, filling processes are only checked now and then
+		int claimable = kind == SRC_CACHE_SLOT_EMPTY || kind == SRC_CACHE_SLOT_FAILED
+			|| ((kind == SRC_CACHE_SLOT_FILLING || kind == SRC_CACHE_SLOT_PUBLISHING) && spin % 64 == 63
+				&& !src_process_alive((uint32_t)state));
+		uint64_t claim = ((state & SRC_CACHE_GENERATION_MASK) + (1ull << SRC_CACHE_GENERATION_SHIFT))
+			| (uint64_t)SRC_CACHE_SLOT_FILLING << 32 | pid;
+		if (claimable && SRC_ATOMIC_CAS64(&slot->state, state, claim)) {
+			return src_shared_cache_fill(cache, slot, claim, size, decode, user, view);
+		}
+		src_shared_cache_wait(spin);
+	}
+}
+
+uint64_t src_shared_cache_key(const src_archive_entry* entry)
+{
+	return ((uint64_t)entry->header->id << 32) | entry->header->checksum;
+}
+
+static int src_file_identity(const char* path, uint64_t* fileId, uint64_t* fileTime, uint64_t* fileSize)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return 0;
+	BY_HANDLE_FILE_INFORMATION info;
+	int succ = GetFileInformationByHandle(file, &info);
+	CloseHandle(file);
+	if (!succ) return 0;
+	*fileId = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+	*fileTime = ((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+	*fileSize = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0) return 0;
+	*fileId = (uint64_t)st.st_ino ^ ((uint64_t)st.st_dev << 48);
+	*fileTime = (uint64_t)st.st_mtime * 1000000000ull;
+#if defined(__linux__)
+	*fileTime += (uint64_t)st.st_mtim.tv_nsec;
+#endif
+	*fileSize = (uint64_t)st.st_size;
+#endif
+	return 1;
+}
+
+enum {
+	SRC_SNAPSHOT_LIVE = 0,
+	// unmapped, the reloader frees it when it reuses the slot
+	SRC_SNAPSHOT_CLOSED = 1,
+	// the reloader was freed, the last reader frees it
+	SRC_SNAPSHOT_ORPHAN = 2,
+};
+
+#define SRC_RELOADER_SLOT_SHIFT 48
+#define SRC_RELOADER_COUNT_MASK ((1ull << SRC_RELOADER_SLOT_SHIFT) - 1)
+
+static src_archive_snapshot* src_snapshot_open(const char* path)
+{
+	src_archive_snapshot* snapshot = (src_archive_snapshot*)calloc(1, sizeof(src_archive_snapshot));
+	// the identity is taken first, a replacement while mapping is picked up by the next poll
+	if (!snapshot
+		|| !src_file_identity(path, &snapshot->fileId, &snapshot->fileTime, &snapshot->fileSize)
+		|| !src_archive_open(&snapshot->archive, path)) {
+		free(snapshot);
+		return NULL;
+	}
+	return snapshot;
+}
+
+static void src_snapshot_destroy(src_archive_snapshot* snapshot)
+{
+	src_archive_close(&snapshot->archive);
+	if (!SRC_ATOMIC_CAS(&snapshot->state, SRC_SNAPSHOT_LIVE, SRC_SNAPSHOT_CLOSED)) free(snapshot);
+}
+
+void src_snapshot_release(src_archive_snapshot* snapshot)
+{
+	// below zero while published, the last release after unpublishing takes it from one to zero
+	if (SRC_ATOMIC_ADD64(&snapshot->refCount, -1) == 1) src_snapshot_destroy(snapshot);
+}
+
+// adds the references taken while the snapshot was published
+static void src_snapshot_unpublish(src_archive_snapshot* snapshot, uint64_t word)
+{
+	int64_t taken = (int64_t)(word & SRC_RELOADER_COUNT_MASK);
+	if (SRC_ATOMIC_ADD64(&snapshot->refCount, taken) + taken == 0) src_snapshot_destroy(snapshot);
+}
+
+int src_reloader_init(src_archive_reloader* reloader, const char* path)
+{
+	memset(reloader, 0, sizeof(src_archive_reloader));
+	reloader->snapshots[0] = src_snapshot_open(path);
+	if (!reloader->snapshots[0]) return 0;
+	size_t len = strlen(path) + 1;
+	reloader->path = (char*)malloc(len);
+	memcpy(reloader->path, path, len);
+	return 1;
+}
+
+void src_reloader_free(src_archive_reloader* reloader)
+{
+	uint64_t word = SRC_ATOMIC_LOAD64(&reloader->current);
+	src_archive_snapshot* current = reloader->snapshots[word >> SRC_RELOADER_SLOT_SHIFT];
+	if (current) src_snapshot_unpublish(current, word);
+	// snapshots still held are freed by their last reader
+	for (int i = 0; i < SRC_RELOADER_SNAPSHOTS; i += 1) {
+		src_archive_snapshot* snapshot = reloader->snapshots[i];
+		if (snapshot && !SRC_ATOMIC_CAS(&snapshot->state, SRC_SNAPSHOT_LIVE, SRC_SNAPSHOT_ORPHAN)) free(snapshot);
+	}
+	free(reloader->path);
+	memset(reloader, 0, sizeof(src_archive_reloader));
+}
+
+src_archive_snapshot* src_reloader_acquire(src_archive_reloader* reloader)
+{
+	for (;;) {
+		uint64_t word = SRC_ATOMIC_LOAD64(&reloader->current);
+		// the taken reference keeps the snapshot mapped and its slot from being reused
+		if (SRC_ATOMIC_CAS64(&reloader->current, word, word + 1)) {
+			return reloader->snapshots[word >> SRC_RELOADER_SLOT_SHIFT];
+		}
+	}
+}
+
+int src_reloader_reload(src_archive_reloader* reloader)
+{
+	// one reload at a time, the others give up
+	if (!SRC_ATOMIC_CAS(&reloader->reloading, 0, 1)) return 0;
+
+	uint64_t word = SRC_ATOMIC_LOAD64(&reloader->current);
+	int slot = (int)(word >> SRC_RELOADER_SLOT_SHIFT);
+	// an empty slot or one whose snapshot was unmapped, no reader can reach it anymore
+	int next = -1;
+	for (int i = 0; i < SRC_RELOADER_SNAPSHOTS && next < 0; i += 1) {
+		src_archive_snapshot* old = reloader->snapshots[i];
+		if (i == slot) continue;
+		if (old && SRC_ATOMIC_LOAD(&old->state) == SRC_SNAPSHOT_CLOSED) {
+			free(old);
+			reloader->snapshots[i] = NULL;
+		}
+		if (!reloader->snapshots[i]) next = i;
+	}
+
+	src_archive_snapshot* snapshot = next >= 0 ? src_snapshot_open(reloader->path) : NULL;
+	if (snapshot) {
+		reloader->snapshots[next] = snapshot;
+		uint64_t published = (uint64_t)next << SRC_RELOADER_SLOT_SHIFT;
+		while (!SRC_ATOMIC_CAS64(&reloader->current, word, published)) word = SRC_ATOMIC_LOAD64(&reloader->current);
+		src_snapshot_unpublish(reloader->snapshots[slot], word);
+	}
+
+	SRC_ATOMIC_DEC(&reloader->reloading);
+	return snapshot != NULL;
+}
+
+int src_reloader_poll(src_archive_reloader* reloader)
+{
+	uint64_t fileId, fileTime, fileSize;
+	if (!src_file_identity(reloader->path, &fileId, &fileTime, &fileSize)) return 0;
+
+	src_archive_snapshot* current = src_reloader_acquire(reloader);
+	int changed = current->fileId != fileId
+		|| current->fileTime != fileTime
+		|| current->fileSize != fileSize;
+	src_snapshot_release(current);
+
+	return changed && src_reloader_reload(reloader);
+}
+
 #endif //SIMPLE_RESOURCE_COMPILER_IMPLEMENTATION
 
 #ifdef __cplusplus
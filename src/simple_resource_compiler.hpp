@@ -0,0 +1,195 @@
+#ifndef SIMPLE_RESOURCE_COMPILER_HPP
+#define SIMPLE_RESOURCE_COMPILER_HPP
+// C++17 layer over the runtime reader of simple_resource_compiler.h. Every type
+// here is a thin handle into the C structures, nothing allocates per resource.
+// The C implementation is still compiled in one translation unit with
+// SIMPLE_RESOURCE_COMPILER_IMPLEMENTATION defined.
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <string_view>
+#if __has_include(<span>)
+#include <span>
+#endif
+
+#include "simple_resource_compiler.h"
+
+namespace src {
+
+#if defined(__cpp_lib_span) && __cpp_lib_span >= 202002L
+using byte_view = std::span<const std::byte>;
+#else
+// the part of std::span<const std::byte> C++17 code needs
+class byte_view {
+public:
+	constexpr byte_view() noexcept = default;
+	constexpr byte_view(const std::byte* data, std::size_t size) noexcept : data_(data), size_(size) {}
+	constexpr const std::byte* data() const noexcept { return data_; }
+	constexpr std::size_t size() const noexcept { return size_; }
+	constexpr bool empty() const noexcept { return size_ == 0; }
+	constexpr const std::byte* begin() const noexcept { return data_; }
+	constexpr const std::byte* end() const noexcept { return data_ + size_; }
+	constexpr const std::byte& operator[](std::size_t i) const noexcept { return data_[i]; }
+
+private:
+	const std::byte* data_ = nullptr;
+	std::size_t size_ = 0;
+};
+#endif
+
+inline byte_view to_bytes(src_view view) noexcept
+{
+	return byte_view(static_cast<const std::byte*>(view.data), view.size);
+}
+
+// a resource of an open archive, valid as long as the archive is open
+class entry {
+public:
+	constexpr entry() noexcept = default;
+	constexpr explicit entry(const src_archive_entry* e) noexcept : e_(e) {}
+
+	std::string_view name() const noexcept { return std::string_view(e_->name, e_->header->nameLen - 1); }
+	std::uint32_t id() const noexcept { return e_->header->id; }
+	std::uint32_t checksum() const noexcept { return e_->header->checksum; }
+	bool tombstone() const noexcept { return (e_->header->flags & SRC_RESOURCE_FLAG_TOMBSTONE) != 0; }
+	// read through a src_stream, data() is the chunk list
+	bool chunked() const noexcept { return (e_->header->flags & SRC_RESOURCE_FLAG_CHUNKED) != 0; }
+	bool compressed() const noexcept { return (e_->header->flags & SRC_RESOURCE_FLAG_COMPRESSED) != 0; }
+	std::size_t size() const noexcept { return static_cast<std::size_t>(e_->header->resourceSize); }
+	// the mapped bytes, not verified
+	byte_view data() const noexcept { return byte_view(reinterpret_cast<const std::byte*>(e_->data), size()); }
+	// checks the CRC32C once, later calls return the cached result
+	bool verify() const noexcept { return src_entry_verify(e_) != 0; }
+
+	const src_archive_entry* get() const noexcept { return e_; }
+	explicit operator bool() const noexcept { return e_ != nullptr; }
+
+private:
+	const src_archive_entry* e_ = nullptr;
+};
+
+// Random access over the entries of an archive. Dereferencing yields an entry by
+// value, like std::vector<bool> it is a proxy, which the standard and parallel
+// algorithms accept.
+class entry_iterator {
+public:
+	using iterator_category = std::random_access_iterator_tag;
+	using value_type = entry;
+	using difference_type = std::ptrdiff_t;
+	using reference = entry;
+	using pointer = void;
+
+	constexpr entry_iterator() noexcept = default;
+	constexpr explicit entry_iterator(const src_archive_entry* p) noexcept : p_(p) {}
+
+	constexpr entry operator*() const noexcept { return entry(p_); }
+	constexpr entry operator[](difference_type n) const noexcept { return entry(p_ + n); }
+
+	constexpr entry_iterator& operator++() noexcept { ++p_; return *this; }
+	constexpr entry_iterator operator++(int) noexcept { entry_iterator t = *this; ++p_; return t; }
+	constexpr entry_iterator& operator--() noexcept { --p_; return *this; }
+	constexpr entry_iterator operator--(int) noexcept { entry_iterator t = *this; --p_; return t; }
+	constexpr entry_iterator& operator+=(difference_type n) noexcept { p_ += n; return *this; }
+	constexpr entry_iterator& operator-=(difference_type n) noexcept { p_ -= n; return *this; }
+	friend constexpr entry_iterator operator+(entry_iterator i, difference_type n) noexcept { return i += n; }
+	friend constexpr entry_iterator operator+(difference_type n, entry_iterator i) noexcept { return i += n; }
+	friend constexpr entry_iterator operator-(entry_iterator i, difference_type n) noexcept { return i -= n; }
+	friend constexpr difference_type operator-(entry_iterator a, entry_iterator b) noexcept { return a.p_ - b.p_; }
+
+	friend constexpr bool operator==(entry_iterator a, entry_iterator b) noexcept { return a.p_ == b.p_; }
+	friend constexpr bool operator!=(entry_iterator a, entry_iterator b) noexcept { return a.p_ != b.p_; }
+	friend constexpr bool operator<(entry_iterator a, entry_iterator b) noexcept { return a.p_ < b.p_; }
+	friend constexpr bool operator>(entry_iterator a, entry_iterator b) noexcept { return a.p_ > b.p_; }
+	friend constexpr bool operator<=(entry_iterator a, entry_iterator b) noexcept { return a.p_ <= b.p_; }
+	friend constexpr bool operator>=(entry_iterator a, entry_iterator b) noexcept { return a.p_ >= b.p_; }
+
+private:
+	const src_archive_entry* p_ = nullptr;
+};
+
+// Owns an open src_archive. Failing to open leaves it empty, test with operator bool.
+class archive {
+public:
+	archive() noexcept = default;
+	explicit archive(const char* path, std::uint32_t openFlags = 0) noexcept { open(path, openFlags); }
+	~archive() { close(); }
+
+	archive(const archive&) = delete;
+	archive& operator=(const archive&) = delete;
+	archive(archive&& other) noexcept : a_(other.a_), open_(other.open_) { other.release(); }
+	archive& operator=(archive&& other) noexcept
+	{
+		if (this != &other) {
+			close();
+			a_ = other.a_;
+			open_ = other.open_;
+			other.release();
+		}
+		return *this;
+	}
+
+	// closes the current archive first, flags are SRC_OPEN_*
+	bool open(const char* path, std::uint32_t openFlags = 0) noexcept
+	{
+		close();
+		open_ = src_archive_open_ex(&a_, path, openFlags) != 0;
+		return open_;
+	}
+	void close() noexcept
+	{
+		if (open_) src_archive_close(&a_);
+		release();
+	}
+	explicit operator bool() const noexcept { return open_; }
+
+	std::size_t size() const noexcept { return a_.entryCount; }
+	bool empty() const noexcept { return a_.entryCount == 0; }
+	entry operator[](std::size_t i) const noexcept { return entry(&a_.entries[i]); }
+	entry_iterator begin() const noexcept { return entry_iterator(a_.entries); }
+	entry_iterator end() const noexcept { return entry_iterator(a_.entries + a_.entryCount); }
+
+	// the data, verified first with SRC_OPEN_VERIFY_ON_ACCESS
+	std::optional<byte_view> get(entry e) const noexcept
+	{
+		src_view view;
+		if (!src_archive_get(&a_, e.get(), &view)) return std::nullopt;
+		return to_bytes(view);
+	}
+
+	// linear scan, mount the archive in a src_vfs for repeated lookups
+	entry find(std::string_view path) const noexcept
+	{
+		std::uint32_t id = 5381;
+		for (char c : path) id = ((id << 5) + id) + static_cast<unsigned char>(c);
+		for (std::size_t i = 0; i < a_.entryCount; i += 1) {
+			const src_archive_entry* e = &a_.entries[i];
+			if (e->header->id == id && path == std::string_view(e->name, e->header->nameLen - 1)) return entry(e);
+		}
+		return entry();
+	}
+
+	// residency, locks and faults, the access counters need SRC_OPEN_COUNTERS
+	src_archive_stats stats() const noexcept
+	{
+		src_archive_stats s;
+		src_archive_get_stats(&a_, &s);
+		return s;
+	}
+
+	const src_archive* get() const noexcept { return &a_; }
+
+private:
+	void release() noexcept
+	{
+		a_ = src_archive();
+		open_ = false;
+	}
+
+	src_archive a_ = src_archive();
+	bool open_ = false;
+};
+
+} // namespace src
+
+#endif //SIMPLE_RESOURCE_COMPILER_HPP
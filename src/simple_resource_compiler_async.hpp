@@ -0,0 +1,208 @@
+#ifndef SIMPLE_RESOURCE_COMPILER_ASYNC_HPP
+#define SIMPLE_RESOURCE_COMPILER_ASYNC_HPP
+// C++20 coroutine loads on top of simple_resource_compiler.hpp.
+//
+// Reading a mapped resource blocks on page faults. co_await loader.load_async(i)
+// hands the resource to an io_pool instead, whose threads fault its pages in
+// (and verify it with SRC_OPEN_VERIFY_ON_ACCESS). The coroutine is then resumed
+// through an executor, usually the job system of the caller.
+//
+// Loads are queued in the awaiter itself, nothing is allocated per load. A pool
+// thread takes everything queued at once and handles it as one batch in file
+// order, so loads issued together cost one wakeup and one readahead pass.
+// Cancellation goes through std::stop_token and is observed until the batch
+// touches the pages, a cancelled load resumes with an empty result.
+#include <algorithm>
+#include <condition_variable>
+#include <coroutine>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+#include "simple_resource_compiler.hpp"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace src {
+
+// resumes on the thread which completed the load
+struct inline_executor {
+	void post(std::coroutine_handle<> handle) { handle.resume(); }
+};
+
+class io_pool;
+
+namespace detail {
+
+struct load_request {
+	load_request* next = nullptr;
+	const src_archive* archive = nullptr;
+	const src_archive_entry* entry = nullptr;
+	std::stop_token stop;
+	std::optional<byte_view> result;
+	std::coroutine_handle<> handle;
+	void* executor = nullptr;
+	void (*post)(void* executor, std::coroutine_handle<> handle) = nullptr;
+};
+
+} // namespace detail
+
+// The async I/O backend, a small pool of threads faulting in mapped pages.
+// It has to outlive every load submitted to it.
+class io_pool {
+public:
+	explicit io_pool(unsigned threadCount = 1)
+	{
+		if (threadCount == 0) threadCount = 1;
+		for (unsigned i = 0; i < threadCount; i += 1) {
+			threads_.emplace_back([this] { run(); });
+		}
+	}
+	~io_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		wake_.notify_all();
+		for (std::thread& thread : threads_) thread.join();
+	}
+	io_pool(const io_pool&) = delete;
+	io_pool& operator=(const io_pool&) = delete;
+
+	void submit(detail::load_request* request)
+	{
+		bool wasEmpty;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			wasEmpty = pending_ == nullptr;
+			request->next = pending_;
+			pending_ = request;
+		}
+		// a thread is already about to take the queue when it wasn't empty
+		if (wasEmpty) wake_.notify_one();
+	}
+
+private:
+	void run()
+	{
+		std::vector<detail::load_request*> batch;
+		for (;;) {
+			detail::load_request* list;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				wake_.wait(lock, [this] { return pending_ || stopping_; });
+				if (!pending_) return;
+				list = pending_;
+				pending_ = nullptr;
+			}
+			batch.clear();
+			for (; list; list = list->next) batch.push_back(list);
+			process(batch);
+		}
+	}
+
+	static void process(std::vector<detail::load_request*>& batch)
+	{
+		// file order, neighbouring resources share pages and readahead
+		std::sort(batch.begin(), batch.end(), [](const detail::load_request* a, const detail::load_request* b) {
+			return a->entry->data < b->entry->data;
+		});
+#ifndef _WIN32
+		static const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+		// announce the whole batch first, the kernel reads while earlier pages are touched
+		for (detail::load_request* request : batch) {
+			if (request->stop.stop_requested()) continue;
+			uintptr_t begin = (uintptr_t)request->entry->data & ~(uintptr_t)(pageSize - 1);
+			uintptr_t end = (uintptr_t)request->entry->data + (size_t)request->entry->header->resourceSize;
+			madvise((void*)begin, end - begin, MADV_WILLNEED);
+		}
+#else
+		const size_t pageSize = 4096;
+#endif
+		for (detail::load_request* request : batch) {
+			if (!request->stop.stop_requested()) {
+				const unsigned char* data = request->entry->data;
+				size_t size = (size_t)request->entry->header->resourceSize;
+				unsigned char sink = 0;
+				for (size_t offset = 0; offset < size; offset += pageSize) {
+					sink ^= ((const volatile unsigned char*)data)[offset];
+				}
+				(void)sink;
+				src_view view;
+				if (src_archive_get(request->archive, request->entry, &view)) {
+					request->result = to_bytes(view);
+				}
+			}
+			// the request lives in the suspended coroutine, it is gone after posting
+			request->post(request->executor, request->handle);
+		}
+	}
+
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	detail::load_request* pending_ = nullptr;
+	bool stopping_ = false;
+	std::vector<std::thread> threads_;
+};
+
+// co_await yields std::optional<byte_view>, empty if the load was cancelled or
+// the data failed verification
+template <class Executor>
+class load_awaiter {
+public:
+	load_awaiter(io_pool& pool, Executor& executor, const src_archive* archive, const src_archive_entry* entry, std::stop_token stop) noexcept
+		: pool_(pool)
+	{
+		request_.archive = archive;
+		request_.entry = entry;
+		request_.stop = std::move(stop);
+		request_.executor = &executor;
+		request_.post = [](void* e, std::coroutine_handle<> handle) { static_cast<Executor*>(e)->post(handle); };
+	}
+
+	bool await_ready() const noexcept { return request_.stop.stop_requested(); }
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		request_.handle = handle;
+		pool_.submit(&request_);
+	}
+	std::optional<byte_view> await_resume() noexcept { return request_.result; }
+
+private:
+	io_pool& pool_;
+	detail::load_request request_;
+};
+
+// Binds an open archive to a backend and an executor, which have to outlive it.
+// Executor is anything with post(std::coroutine_handle<>).
+template <class Executor = inline_executor>
+class async_loader {
+public:
+	async_loader(const archive& archive, io_pool& pool, Executor& executor) noexcept
+		: archive_(archive), pool_(pool), executor_(executor) {}
+
+	// index into the archive, the generated id unless resources were inlined
+	load_awaiter<Executor> load_async(std::size_t index, std::stop_token stop = {}) const noexcept
+	{
+		return load_async(archive_[index], std::move(stop));
+	}
+	load_awaiter<Executor> load_async(entry e, std::stop_token stop = {}) const noexcept
+	{
+		return load_awaiter<Executor>(pool_, executor_, archive_.get(), e.get(), std::move(stop));
+	}
+
+private:
+	const archive& archive_;
+	io_pool& pool_;
+	Executor& executor_;
+};
+
+} // namespace src
+
+#endif //SIMPLE_RESOURCE_COMPILER_ASYNC_HPP
@@ -0,0 +1,752 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "simple_resource_compiler.h"
+#include "src_tool.h"
+#include "src_thread.h"
+
+///
+/// Analyzing archives.
+///
+/// Usage: src.exe analyze "data.src" [-j threads] [--top 20] [--json "report.json"]
+///            [--trace "trace.txt"] [--page-size 4096]
+///
+/// Reports where the bytes of an archive go: totals by directory, every level
+/// counted, and by extension, the largest resources and the resources stored
+/// more than once. Paths are shown below the directory all resources share,
+/// the resources directly in it are totaled as "(root)", so it and the top level
+/// directories add up to all records. Records are counted with their header and
+/// name, next to the size of the resources themselves. Duplicates are records of
+/// equal stored data, the records of equal size and checksum are compared on -j
+/// threads.
+///
+/// The compression estimate compresses a sample of every resource with src_lz,
+/// without a dictionary: resources up to the sample size whole, larger ones in
+/// blocks spread over them. The samples of all resources add up to about
+/// SRC_ANALYZE_SAMPLE_TOTAL bytes and are compressed on -j threads.
+///
+/// --trace replays reads against the layout of the archive. Every line is a
+/// resource path, as in the archive or below the shared directory, optionally
+/// followed by the offset and length of the read, the whole resource otherwise.
+/// Blank lines and lines starting with '#' are skipped.
+///
+///     levels/level3/map.bin
+///     audio/bank.bin 1048576 65536
+///
+/// Every page of the mapping faults the first time a read touches it. Reads of
+/// a compressed stream touch all of it, of framed and chunked resources the
+/// index and the frames or chunks the read overlaps. Pages touched when the
+/// archive is opened, the headers and the TOC, aren't counted. The replay reports
+/// the page faults, the read amplification, bytes faulted in over bytes read,
+/// and the faults not next to the previous one, each a seek on a disk.
+///
+/// --json writes the report as JSON as well, with every directory and extension.
+///
+
+#define SRC_ANALYZE_SAMPLE_TOTAL (256 * 1024 * 1024)
+#define SRC_ANALYZE_SAMPLE_MIN (4 * 1024) // per resource
+#define SRC_ANALYZE_SAMPLE_MAX (64 * 1024)
+#define SRC_ANALYZE_SAMPLE_BLOCKS 4
+#define SRC_ANALYZE_NONE SIZE_MAX
+#define SRC_ANALYZE_ROOT "(root)" // the directory row of the resources below no directory
+
+typedef struct {
+	const src_archive_entry* entry;
+	const char* path; // below the shared directory
+	uint64_t size; // of the resource
+	uint64_t recordSize;
+	uint64_t sampled;
+	uint64_t sampledCompressed;
+	int failed; // the sample couldn't be read
+	size_t duplicateOf; // the first copy or SRC_ANALYZE_NONE
+} src_analyze_entry;
+
+typedef struct {
+	const char* key; // a directory or an extension
+	size_t keyLen;
+	size_t count;
+	uint64_t size;
+	uint64_t recordSize;
+	uint64_t sampled;
+	uint64_t sampledCompressed;
+} src_analyze_total;
+
+typedef struct {
+	const src_archive* archive;
+	src_analyze_entry* entries;
+	size_t sampleSize;
+} src_analyze_job;
+
+typedef struct {
+	uint64_t pageSize;
+	unsigned char* touched; // a bit per page
+	uint64_t pageCount;
+	uint64_t faults;
+	uint64_t seeks; // faults not next to the previous one
+	uint64_t lastPage;
+	uint64_t reads;
+	uint64_t unknown;
+	uint64_t requested;
+} src_page_model;
+
+static double NowSeconds(void)
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int IsSeparator(char c)
+{
+	return c == '/' || c == '\\';
+}
+
+static const char* FormatSize(char* buffer, size_t size, uint64_t bytes)
+{
+	static const char* units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+	double value = (double)bytes;
+	int unit = 0;
+	while (value >= 1024.0 && unit < 4) {
+		value /= 1024.0;
+		unit += 1;
+	}
+	snprintf(buffer, size, unit ? "%.1f %s" : "%.0f %s", value, units[unit]);
+	return buffer;
+}
+
+static double Percent(uint64_t part, uint64_t whole)
+{
+	return whole ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+// the size of a total compressed at the ratio of its samples
+static uint64_t Estimate(uint64_t size, uint64_t sampled, uint64_t sampledCompressed)
+{
+	return sampled ? (uint64_t)((double)size * (double)sampledCompressed / (double)sampled) : size;
+}
+
+static void SampleEntry(void* arg, int index)
+{
+	src_analyze_job* job = (src_analyze_job*)arg;
+	src_analyze_entry* e = &job->entries[index];
+	if (e->size == 0 || (e->entry->header->flags & SRC_RESOURCE_FLAG_TOMBSTONE)) return;
+
+	size_t sample = e->size < job->sampleSize ? (size_t)e->size : job->sampleSize;
+	unsigned char* data = (unsigned char*)malloc(2 * sample);
+	// blocks spread over larger resources, they are compressed as one
+	size_t blocks = sample < e->size ? SRC_ANALYZE_SAMPLE_BLOCKS : 1;
+	size_t filled = 0;
+	int succ = 1;
+	for (size_t b = 0; succ && b < blocks; b += 1) {
+		size_t len = b + 1 < blocks ? sample / blocks : sample - filled;
+		uint64_t offset = blocks > 1 ? (e->size - len) / (blocks - 1) * b : 0;
+		succ = src_archive_read_range(job->archive, e->entry, offset, data + filled, len);
+		filled += len;
+	}
+	if (succ) {
+		size_t compressed = src_lz_compress(data, sample, data + sample, sample, NULL, 0);
+		e->sampled = sample;
+		e->sampledCompressed = compressed ? compressed : sample;
+	}
+	e->failed = !succ;
+	free(data);
+}
+
+// records which may hold the same data
+static int CompareStored(const src_analyze_entry* ea, const src_analyze_entry* eb)
+{
+	const src_resource_header* ha = ea->entry->header;
+	const src_resource_header* hb = eb->entry->header;
+	if (ha->resourceSize != hb->resourceSize) return ha->resourceSize < hb->resourceSize ? -1 : 1;
+	if (ha->checksum != hb->checksum) return ha->checksum < hb->checksum ? -1 : 1;
+	return ha->flags < hb->flags ? -1 : ha->flags > hb->flags;
+}
+
+static int CompareByData(const void* a, const void* b)
+{
+	const src_analyze_entry* ea = *(const src_analyze_entry* const*)a;
+	const src_analyze_entry* eb = *(const src_analyze_entry* const*)b;
+	int cmp = CompareStored(ea, eb);
+	// the first copy in the archive stays the original
+	return cmp != 0 ? cmp : ea < eb ? -1 : ea > eb;
+}
+
+typedef struct {
+	src_analyze_entry* entries;
+	src_analyze_entry** sorted;
+	size_t* runs; // the start and end of every run of equal candidates
+} src_duplicate_job;
+
+// equal checksums only make a candidate, the data is compared
+static void CompareRun(void* arg, int index)
+{
+	src_duplicate_job* job = (src_duplicate_job*)arg;
+	src_analyze_entry** sorted = job->sorted;
+	size_t start = job->runs[2 * index];
+	size_t end = job->runs[2 * index + 1];
+	for (size_t k = start + 1; k < end; k += 1) {
+		for (size_t j = start; j < k; j += 1) {
+			if (sorted[j]->duplicateOf != SRC_ANALYZE_NONE) continue;
+			if (memcmp(sorted[j]->entry->data, sorted[k]->entry->data, (size_t)sorted[k]->entry->header->resourceSize) == 0) {
+				sorted[k]->duplicateOf = (size_t)(sorted[j] - job->entries);
+				break;
+			}
+		}
+	}
+}
+
+// marks every record whose stored data equals an earlier one, returns the wasted bytes
+static uint64_t FindDuplicates(src_analyze_entry* entries, size_t count, int threadCount)
+{
+	src_analyze_entry** sorted = (src_analyze_entry**)malloc((count + 1) * sizeof(src_analyze_entry*));
+	size_t n = 0;
+	for (size_t i = 0; i < count; i += 1) {
+		if (!(entries[i].entry->header->flags & SRC_RESOURCE_FLAG_TOMBSTONE) && entries[i].entry->header->resourceSize) {
+			sorted[n++] = &entries[i];
+		}
+	}
+	qsort(sorted, n, sizeof(src_analyze_entry*), CompareByData);
+
+	// runs of a single record hold no duplicate, the others are compared on threads
+	src_duplicate_job job;
+	job.entries = entries;
+	job.sorted = sorted;
+	job.runs = (size_t*)malloc((n + 1) * sizeof(size_t));
+	size_t runCount = 0;
+	for (size_t start = 0; start < n;) {
+		size_t end = start + 1;
+		while (end < n && CompareStored(sorted[start], sorted[end]) == 0) end += 1;
+		if (end - start > 1) {
+			job.runs[2 * runCount] = start;
+			job.runs[2 * runCount + 1] = end;
+			runCount += 1;
+		}
+		start = end;
+	}
+	src_parallel_for(threadCount, (int)runCount, CompareRun, &job);
+
+	uint64_t wasted = 0;
+	for (size_t i = 0; i < count; i += 1) {
+		if (entries[i].duplicateOf != SRC_ANALYZE_NONE) wasted += entries[i].recordSize;
+	}
+	free(job.runs);
+	free(sorted);
+	return wasted;
+}
+
+static int CompareTotalKey(const void* a, const void* b)
+{
+	const src_analyze_total* ta = (const src_analyze_total*)a;
+	const src_analyze_total* tb = (const src_analyze_total*)b;
+	size_t len = ta->keyLen < tb->keyLen ? ta->keyLen : tb->keyLen;
+	int cmp = memcmp(ta->key, tb->key, len);
+	if (cmp != 0) return cmp;
+	return ta->keyLen < tb->keyLen ? -1 : ta->keyLen > tb->keyLen;
+}
+
+static int CompareTotalSize(const void* a, const void* b)
+{
+	const src_analyze_total* ta = (const src_analyze_total*)a;
+	const src_analyze_total* tb = (const src_analyze_total*)b;
+	if (ta->recordSize != tb->recordSize) return ta->recordSize > tb->recordSize ? -1 : 1;
+	return CompareTotalKey(a, b);
+}
+
+static void AddItem(src_analyze_total** items, size_t* count, size_t* capacity, const src_analyze_entry* e, const char* key, size_t keyLen)
+{
+	if (*count == *capacity) {
+		*capacity = *capacity ? *capacity * 2 : 64;
+		*items = (src_analyze_total*)realloc(*items, *capacity * sizeof(src_analyze_total));
+	}
+	src_analyze_total* item = &(*items)[(*count)++];
+	item->key = key;
+	item->keyLen = keyLen;
+	item->count = 1;
+	item->size = e->size;
+	item->recordSize = e->recordSize;
+	item->sampled = e->sampled;
+	item->sampledCompressed = e->sampledCompressed;
+}
+
+// sums the items of equal keys, largest first
+static size_t MergeTotals(src_analyze_total* items, size_t count)
+{
+	qsort(items, count, sizeof(src_analyze_total), CompareTotalKey);
+	size_t n = 0;
+	for (size_t i = 0; i < count; i += 1) {
+		if (n > 0 && CompareTotalKey(&items[n - 1], &items[i]) == 0) {
+			items[n - 1].count += 1;
+			items[n - 1].size += items[i].size;
+			items[n - 1].recordSize += items[i].recordSize;
+			items[n - 1].sampled += items[i].sampled;
+			items[n - 1].sampledCompressed += items[i].sampledCompressed;
+		}
+		else {
+			items[n++] = items[i];
+		}
+	}
+	qsort(items, n, sizeof(src_analyze_total), CompareTotalSize);
+	return n;
+}
+
+// every directory level of a path, SRC_ANALYZE_ROOT for the paths without one
+static size_t TotalByDirectory(const src_analyze_entry* entries, size_t count, src_analyze_total** totals)
+{
+	size_t n = 0;
+	size_t capacity = 0;
+	*totals = NULL;
+	for (size_t i = 0; i < count; i += 1) {
+		if (entries[i].entry->header->flags & SRC_RESOURCE_FLAG_TOMBSTONE) continue;
+		const char* path = entries[i].path;
+		int nested = 0;
+		for (const char* c = path; *c; c += 1) {
+			if (IsSeparator(*c)) {
+				AddItem(totals, &n, &capacity, &entries[i], path, (size_t)(c - path));
+				nested = 1;
+			}
+		}
+		// resources directly in the shared directory, the top levels add up to all records with them
+		if (!nested) AddItem(totals, &n, &capacity, &entries[i], SRC_ANALYZE_ROOT, sizeof(SRC_ANALYZE_ROOT) - 1);
+	}
+	return MergeTotals(*totals, n);
+}
+
+static size_t TotalByExtension(const src_analyze_entry* entries, size_t count, src_analyze_total** totals)
+{
+	size_t n = 0;
+	size_t capacity = 0;
+	*totals = NULL;
+	for (size_t i = 0; i < count; i += 1) {
+		if (entries[i].entry->header->flags & SRC_RESOURCE_FLAG_TOMBSTONE) continue;
+		const char* name = entries[i].path;
+		for (const char* c = name; *c; c += 1) {
+			if (IsSeparator(*c)) name = c + 1;
+		}
+		const char* extension = strrchr(name, '.');
+		// a leading dot names a hidden file
+		if (!extension || extension == name) extension = name + strlen(name);
+		AddItem(totals, &n, &capacity, &entries[i], extension, strlen(extension));
+	}
+	return MergeTotals(*totals, n);
+}
+
+static int CompareRecordSize(const void* a, const void* b)
+{
+	const src_analyze_entry* ea = *(const src_analyze_entry* const*)a;
+	const src_analyze_entry* eb = *(const src_analyze_entry* const*)b;
+	if (ea->recordSize != eb->recordSize) return ea->recordSize > eb->recordSize ? -1 : 1;
+	return strcmp(ea->path, eb->path);
+}
+
+static void TouchRange(src_page_model* model, uint64_t begin, uint64_t length)
+{
+	if (length == 0) return;
+	uint64_t last = (begin + length - 1) / model->pageSize;
+	for (uint64_t page = begin / model->pageSize; page <= last && page < model->pageCount; page += 1) {
+		unsigned char bit = (unsigned char)(1 << (page & 7));
+		if (model->touched[page >> 3] & bit) continue;
+		model->touched[page >> 3] |= bit;
+		if (model->faults == 0 || page != model->lastPage + 1) model->seeks += 1;
+		model->faults += 1;
+		model->lastPage = page;
+	}
+}
+
+// touches the pages a read of length bytes at offset of the resource goes through
+static void TouchRead(src_page_model* model, const src_archive* archive, const src_archive_entry* entry, uint64_t offset, uint64_t length)
+{
+	const src_resource_header* header = entry->header;
+	uint64_t dataOffset = (uint64_t)(entry->data - archive->base);
+	if ((header->flags & SRC_RESOURCE_FLAG_COMPRESSED) && src_entry_frame_size(entry)) {
+		const src_compressed_header* compressed = (const src_compressed_header*)entry->data;
+		uint64_t frameSize = compressed->frameSize;
+		uint64_t frameCount = compressed->size / frameSize + (compressed->size % frameSize != 0);
+		if (frameCount > (header->resourceSize - sizeof(src_compressed_header)) / sizeof(src_frame_ref)) return;
+		uint64_t indexOffset = header->resourceSize - frameCount * sizeof(src_frame_ref);
+		const src_frame_ref* refs = (const src_frame_ref*)(entry->data + indexOffset);
+		TouchRange(model, dataOffset, sizeof(src_compressed_header));
+		for (uint64_t frame = offset / frameSize; length > 0 && frame * frameSize < offset + length && frame < frameCount; frame += 1) {
+			TouchRange(model, dataOffset + indexOffset + frame * sizeof(src_frame_ref), sizeof(src_frame_ref));
+			if (refs[frame].offset <= header->resourceSize && header->resourceSize - refs[frame].offset >= refs[frame].size) {
+				TouchRange(model, dataOffset + refs[frame].offset, refs[frame].size);
+			}
+		}
+	}
+	else if (header->flags & SRC_RESOURCE_FLAG_COMPRESSED) {
+		// a stream decodes from its start
+		TouchRange(model, dataOffset, header->resourceSize);
+	}
+	else if (header->flags & SRC_RESOURCE_FLAG_CHUNKED) {
+		const src_chunk_list* list = (const src_chunk_list*)entry->data;
+		if (header->resourceSize < sizeof(src_chunk_list)
+			|| list->chunkCount > (header->resourceSize - sizeof(src_chunk_list)) / sizeof(src_chunk_ref)) return;
+		const src_chunk_ref* refs = (const src_chunk_ref*)(list + 1);
+		TouchRange(model, dataOffset, sizeof(src_chunk_list));
+		// a seek walks the list from its start
+		uint64_t start = 0;
+		for (uint64_t i = 0; i < list->chunkCount && start < offset + length; i += 1) {
+			TouchRange(model, dataOffset + sizeof(src_chunk_list) + i * sizeof(src_chunk_ref), sizeof(src_chunk_ref));
+			uint64_t end = start + refs[i].size;
+			if (end > offset && refs[i].offset <= archive->size && archive->size - refs[i].offset >= refs[i].size) {
+				TouchRange(model, refs[i].offset, refs[i].size);
+			}
+			start = end;
+		}
+	}
+	else {
+		TouchRange(model, dataOffset + offset, length);
+	}
+}
+
+static int CompareEntryName(const void* a, const void* b)
+{
+	const src_analyze_entry* ea = *(const src_analyze_entry* const*)a;
+	const src_analyze_entry* eb = *(const src_analyze_entry* const*)b;
+	return strcmp(ea->entry->name, eb->entry->name);
+}
+
+static const src_analyze_entry* FindEntry(src_analyze_entry** byName, size_t count, const char* name)
+{
+	src_archive_entry key = { 0 };
+	key.name = name;
+	src_analyze_entry keyEntry = { 0 };
+	keyEntry.entry = &key;
+	const src_analyze_entry* keyPtr = &keyEntry;
+	src_analyze_entry** found = (src_analyze_entry**)bsearch(&keyPtr, byName, count, sizeof(src_analyze_entry*), CompareEntryName);
+	return found ? *found : NULL;
+}
+
+static int ParseNumber(const char* text, uint64_t* value)
+{
+	if (*text < '0' || *text > '9') return 0;
+	char* end;
+	*value = strtoull(text, &end, 10);
+	return *end == '\0';
+}
+
+static int ReplayTrace(const char* path, const src_archive* archive, src_analyze_entry* entries, size_t count,
+	const char* root, size_t rootLen, src_page_model* model)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		LOGF_MSG("Failed to open trace \"%s\"", path);
+		return 0;
+	}
+	src_analyze_entry** byName = (src_analyze_entry**)malloc((count + 1) * sizeof(src_analyze_entry*));
+	for (size_t i = 0; i < count; i += 1) {
+		byName[i] = &entries[i];
+	}
+	qsort(byName, count, sizeof(src_analyze_entry*), CompareEntryName);
+	model->pageCount = ((uint64_t)archive->size + model->pageSize - 1) / model->pageSize;
+	model->touched = (unsigned char*)calloc((size_t)(model->pageCount / 8 + 1), 1);
+
+	char line[4096];
+	char* fullName = (char*)malloc(rootLen + sizeof(line));
+	while (fgets(line, sizeof(line), file)) {
+		size_t len = strlen(line);
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' ' || line[len - 1] == '\t')) {
+			line[--len] = '\0';
+		}
+		if (len == 0 || line[0] == '#') continue;
+
+		// "path offset length", paths may hold spaces
+		uint64_t offset = 0;
+		uint64_t length = UINT64_MAX;
+		char* lengthText = strrchr(line, ' ');
+		if (lengthText && ParseNumber(lengthText + 1, &length)) {
+			*lengthText = '\0';
+			char* offsetText = strrchr(line, ' ');
+			if (offsetText && ParseNumber(offsetText + 1, &offset)) {
+				*offsetText = '\0';
+			}
+			else {
+				*lengthText = ' ';
+				length = UINT64_MAX;
+			}
+		}
+
+		const src_analyze_entry* e = FindEntry(byName, count, line);
+		if (!e) {
+			memcpy(fullName, root, rootLen);
+			strcpy(fullName + rootLen, line);
+			e = FindEntry(byName, count, fullName);
+		}
+		if (!e || (e->entry->header->flags & SRC_RESOURCE_FLAG_TOMBSTONE) || offset > e->size) {
+			model->unknown += 1;
+			continue;
+		}
+		if (length > e->size - offset) length = e->size - offset;
+		model->reads += 1;
+		model->requested += length;
+		TouchRead(model, archive, e->entry, offset, length);
+	}
+	fclose(file);
+	free(fullName);
+	free(byName);
+	return 1;
+}
+
+static void WriteJsonString(FILE* out, const char* text, size_t len)
+{
+	fputc('"', out);
+	for (size_t i = 0; i < len; i += 1) {
+		unsigned char c = (unsigned char)text[i];
+		if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+		else if (c < 0x20) fprintf(out, "\\u%04x", c);
+		else fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+static void WriteJsonTotals(FILE* out, const char* name, const char* keyName, const src_analyze_total* totals, size_t count)
+{
+	fprintf(out, "  \"%s\": [", name);
+	for (size_t i = 0; i < count; i += 1) {
+		const src_analyze_total* t = &totals[i];
+		fprintf(out, "%s\n    { \"%s\": ", i ? "," : "", keyName);
+		WriteJsonString(out, t->key, t->keyLen);
+		fprintf(out, ", \"count\": %zu, \"recordBytes\": %llu, \"resourceBytes\": %llu, \"estimatedCompressedBytes\": %llu }",
+			t->count, (unsigned long long)t->recordSize, (unsigned long long)t->size,
+			(unsigned long long)Estimate(t->size, t->sampled, t->sampledCompressed));
+	}
+	fprintf(out, "%s],\n", count ? "\n  " : "");
+}
+
+static void PrintTotals(const char* title, const src_analyze_total* totals, size_t count, size_t top, uint64_t recordBytes)
+{
+	char a[32], b[32], c[32];
+	printf("\n%-40s %8s %12s %12s %7s %22s\n", title, "Count", "Records", "Resources", "Share", "Est. compressed");
+	for (size_t i = 0; i < count && i < top; i += 1) {
+		const src_analyze_total* t = &totals[i];
+		uint64_t estimate = Estimate(t->size, t->sampled, t->sampledCompressed);
+		printf("%-40.*s %8zu %12s %12s %6.1f%% %14s (%3.0f%%)\n", (int)(t->keyLen ? t->keyLen : 6), t->keyLen ? t->key : "(none)",
+			t->count, FormatSize(a, sizeof(a), t->recordSize), FormatSize(b, sizeof(b), t->size),
+			Percent(t->recordSize, recordBytes), FormatSize(c, sizeof(c), estimate), Percent(estimate, t->size));
+	}
+	if (count > top) printf("... %zu more\n", count - top);
+}
+
+static const char* EntryKind(const src_analyze_entry* e)
+{
+	uint8_t flags = e->entry->header->flags;
+	if (flags & SRC_RESOURCE_FLAG_TOMBSTONE) return "tombstone";
+	if (flags & SRC_RESOURCE_FLAG_CHUNKED) return "chunked";
+	if (flags & SRC_RESOURCE_FLAG_COMPRESSED) return src_entry_frame_size(e->entry) ? "framed" : "compressed";
+	return "stored";
+}
+
+int src_analyze_main(int argc, char** argv)
+{
+	const char* path = NULL;
+	const char* jsonPath = NULL;
+	const char* tracePath = NULL;
+	size_t top = 20;
+	int threadCount = src_cpu_count();
+	src_page_model model = { 0 };
+	model.pageSize = 4096;
+	for (int i = 1; i < argc; i += 1) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			threadCount = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+			top = (size_t)strtoull(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+			jsonPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+			tracePath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--page-size") == 0 && i + 1 < argc) {
+			model.pageSize = strtoull(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "-v") == 0) {
+			verbose = 0;
+		}
+		else if (argv[i][0] == '-' || path) {
+			LOGF_MSG("Failed to handle \"%s\"", argv[i]);
+			path = NULL;
+			break;
+		}
+		else {
+			path = argv[i];
+		}
+	}
+	if (!path || model.pageSize == 0) {
+		LOGR_MSG("Usage:\tsrc.exe analyze \"data.src\" [-j threads] [--top 20] [--json \"report.json\"] [--trace \"trace.txt\"] [--page-size 4096]");
+		return -1;
+	}
+
+	double start = NowSeconds();
+	src_archive archive;
+	if (!src_archive_open(&archive, path)) {
+		printf("\"%s\": header or table of contents didn't validate.\n", path);
+		return -1;
+	}
+
+	// paths are shown below the directory all resources share
+	size_t count = archive.entryCount;
+	const char* root = count ? archive.entries[0].name : "";
+	size_t rootLen = strlen(root);
+	for (size_t i = 1; i < count; i += 1) {
+		const char* name = archive.entries[i].name;
+		size_t len = 0;
+		while (len < rootLen && name[len] == root[len]) len += 1;
+		rootLen = len;
+	}
+	while (rootLen > 0 && !IsSeparator(root[rootLen - 1])) rootLen -= 1;
+
+	src_analyze_entry* entries = (src_analyze_entry*)calloc(count + 1, sizeof(src_analyze_entry));
+	uint64_t recordBytes = 0;
+	uint64_t resourceBytes = 0;
+	size_t tombstoneCount = 0;
+	for (size_t i = 0; i < count; i += 1) {
+		src_analyze_entry* e = &entries[i];
+		e->entry = &archive.entries[i];
+		e->path = e->entry->name + rootLen;
+		while (IsSeparator(*e->path)) e->path += 1;
+		e->size = src_entry_size(e->entry);
+		e->recordSize = src_record_size(e->entry->header);
+		e->duplicateOf = SRC_ANALYZE_NONE;
+		recordBytes += e->recordSize;
+		if (e->entry->header->flags & SRC_RESOURCE_FLAG_TOMBSTONE) {
+			tombstoneCount += 1;
+			continue;
+		}
+		resourceBytes += e->size;
+	}
+
+	src_analyze_job job;
+	job.archive = &archive;
+	job.entries = entries;
+	job.sampleSize = count ? SRC_ANALYZE_SAMPLE_TOTAL / count : SRC_ANALYZE_SAMPLE_MAX;
+	if (job.sampleSize < SRC_ANALYZE_SAMPLE_MIN) job.sampleSize = SRC_ANALYZE_SAMPLE_MIN;
+	if (job.sampleSize > SRC_ANALYZE_SAMPLE_MAX) job.sampleSize = SRC_ANALYZE_SAMPLE_MAX;
+	src_parallel_for(threadCount > 0 ? threadCount : 1, (int)count, SampleEntry, &job);
+
+	uint64_t sampled = 0;
+	uint64_t sampledCompressed = 0;
+	size_t failed = 0;
+	for (size_t i = 0; i < count; i += 1) {
+		sampled += entries[i].sampled;
+		sampledCompressed += entries[i].sampledCompressed;
+		if (entries[i].failed) {
+			printf("Failed to read \"%s\"\n", entries[i].entry->name);
+			failed += 1;
+		}
+	}
+	uint64_t wasted = FindDuplicates(entries, count, threadCount > 0 ? threadCount : 1);
+	src_analyze_total* directories;
+	src_analyze_total* extensions;
+	size_t directoryCount = TotalByDirectory(entries, count, &directories);
+	size_t extensionCount = TotalByExtension(entries, count, &extensions);
+	src_analyze_entry** largest = (src_analyze_entry**)malloc((count + 1) * sizeof(src_analyze_entry*));
+	for (size_t i = 0; i < count; i += 1) {
+		largest[i] = &entries[i];
+	}
+	qsort(largest, count, sizeof(src_analyze_entry*), CompareRecordSize);
+
+	int succ = failed == 0;
+	if (tracePath) {
+		succ = ReplayTrace(tracePath, &archive, entries, count, root, rootLen, &model) && succ;
+	}
+
+	char a[32], b[32], c[32];
+	uint64_t estimate = Estimate(resourceBytes, sampled, sampledCompressed);
+	printf("\"%s\": %zu resources, %zu tombstones, %s of records in a %s file, below \"%.*s\"\n", path,
+		count - tombstoneCount, tombstoneCount, FormatSize(a, sizeof(a), recordBytes), FormatSize(b, sizeof(b), archive.size),
+		(int)rootLen, root);
+	printf("Resources: %s, estimated compressed %s (%.1f%%) from %s sampled\n", FormatSize(a, sizeof(a), resourceBytes),
+		FormatSize(b, sizeof(b), estimate), Percent(estimate, resourceBytes), FormatSize(c, sizeof(c), sampled));
+	PrintTotals("Directory", directories, directoryCount, top, recordBytes);
+	PrintTotals("Extension", extensions, extensionCount, top, recordBytes);
+
+	printf("\nLargest resources\n");
+	for (size_t i = 0; i < count && i < top; i += 1) {
+		printf("%12s  %-10s %s\n", FormatSize(a, sizeof(a), largest[i]->recordSize), EntryKind(largest[i]), largest[i]->path);
+	}
+
+	size_t duplicateCount = 0;
+	for (size_t i = 0; i < count; i += 1) {
+		duplicateCount += entries[i].duplicateOf != SRC_ANALYZE_NONE;
+	}
+	printf("\nDuplicates: %zu records, %s wasted\n", duplicateCount, FormatSize(a, sizeof(a), wasted));
+	for (size_t i = 0, shown = 0; i < count && shown < top; i += 1) {
+		const src_analyze_entry* e = largest[i];
+		if (e->duplicateOf == SRC_ANALYZE_NONE) continue;
+		printf("%12s  %s = %s\n", FormatSize(a, sizeof(a), e->recordSize), e->path, entries[e->duplicateOf].path);
+		shown += 1;
+	}
+
+	if (tracePath) {
+		uint64_t faulted = model.faults * model.pageSize;
+		printf("\nTrace \"%s\": %llu reads of %s, %llu unknown\n", tracePath, (unsigned long long)model.reads,
+			FormatSize(a, sizeof(a), model.requested), (unsigned long long)model.unknown);
+		printf("%llu page faults of %llu bytes, %s faulted in, read amplification %.2fx, %llu seeks\n",
+			(unsigned long long)model.faults, (unsigned long long)model.pageSize, FormatSize(b, sizeof(b), faulted),
+			model.requested ? (double)faulted / (double)model.requested : 0.0, (unsigned long long)model.seeks);
+	}
+
+	if (jsonPath) {
+		FILE* out = fopen(jsonPath, "wb");
+		if (!out) {
+			LOGF_MSG("Failed to open \"%s\"", jsonPath);
+			succ = 0;
+		}
+		else {
+			fprintf(out, "{\n  \"archive\": ");
+			WriteJsonString(out, path, strlen(path));
+			fprintf(out, ",\n  \"root\": ");
+			WriteJsonString(out, root, rootLen);
+			fprintf(out, ",\n  \"fileBytes\": %llu,\n  \"resourceCount\": %zu,\n  \"tombstoneCount\": %zu,\n", (unsigned long long)archive.size,
+				count - tombstoneCount, tombstoneCount);
+			fprintf(out, "  \"recordBytes\": %llu,\n  \"resourceBytes\": %llu,\n  \"sampledBytes\": %llu,\n  \"sampledCompressedBytes\": %llu,\n",
+				(unsigned long long)recordBytes, (unsigned long long)resourceBytes, (unsigned long long)sampled,
+				(unsigned long long)sampledCompressed);
+			fprintf(out, "  \"estimatedCompressedBytes\": %llu,\n", (unsigned long long)estimate);
+			WriteJsonTotals(out, "directories", "path", directories, directoryCount);
+			WriteJsonTotals(out, "extensions", "extension", extensions, extensionCount);
+
+			fprintf(out, "  \"largest\": [");
+			for (size_t i = 0; i < count && i < top; i += 1) {
+				fprintf(out, "%s\n    { \"path\": ", i ? "," : "");
+				WriteJsonString(out, largest[i]->path, strlen(largest[i]->path));
+				fprintf(out, ", \"kind\": \"%s\", \"recordBytes\": %llu, \"resourceBytes\": %llu }", EntryKind(largest[i]),
+					(unsigned long long)largest[i]->recordSize, (unsigned long long)largest[i]->size);
+			}
+			fprintf(out, "%s],\n  \"duplicates\": [", count && top ? "\n  " : "");
+			for (size_t i = 0, shown = 0; i < count; i += 1) {
+				const src_analyze_entry* e = largest[i];
+				if (e->duplicateOf == SRC_ANALYZE_NONE) continue;
+				fprintf(out, "%s\n    { \"path\": ", shown++ ? "," : "");
+				WriteJsonString(out, e->path, strlen(e->path));
+				fprintf(out, ", \"copyOf\": ");
+				WriteJsonString(out, entries[e->duplicateOf].path, strlen(entries[e->duplicateOf].path));
+				fprintf(out, ", \"recordBytes\": %llu }", (unsigned long long)e->recordSize);
+			}
+			fprintf(out, "%s],\n  \"wastedBytes\": %llu", duplicateCount ? "\n  " : "", (unsigned long long)wasted);
+			if (tracePath) {
+				uint64_t faulted = model.faults * model.pageSize;
+				fprintf(out, ",\n  \"trace\": { \"reads\": %llu, \"unknown\": %llu, \"requestedBytes\": %llu, \"pageSize\": %llu, "
+					"\"pageFaults\": %llu, \"faultedBytes\": %llu, \"readAmplification\": %.4f, \"seeks\": %llu }",
+					(unsigned long long)model.reads, (unsigned long long)model.unknown, (unsigned long long)model.requested,
+					(unsigned long long)model.pageSize, (unsigned long long)model.faults, (unsigned long long)faulted,
+					model.requested ? (double)faulted / (double)model.requested : 0.0, (unsigned long long)model.seeks);
+			}
+			fprintf(out, "\n}\n");
+			succ = fclose(out) == 0 && succ;
+		}
+	}
+
+	printf("\nAnalyzed in %.3f s\n", NowSeconds() - start);
+	free(model.touched);
+	free(largest);
+	free(directories);
+	free(extensions);
+	free(entries);
+	src_archive_close(&archive);
+	return succ ? 0 : -1;
+}
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simple_resource_compiler.h"
+#include "src_builder.h"
+#include "src_tool.h"
+#include "src_thread.h"
+
+struct src_builder {
+	src_context ctx;
+	char* outputPath;
+	// guards ctx, records are appended in the order they are added
+	src_mutex lock;
+	int failed;
+	// the global verbose belongs to the program, the builder only logs its own resources
+	int verbose;
+};
+
+src_builder* src_builder_create(const src_builder_desc* desc)
+{
+	src_builder* builder = (src_builder*)calloc(1, sizeof(src_builder));
+	builder->verbose = desc->verbose;
+	builder->outputPath = strdup(desc->outputPath);
+	src_context_set_output(&builder->ctx, builder->outputPath, desc->headerDir);
+	// inlined resources only exist in the generated header
+	builder->ctx.inlineThreshold = desc->headerDir ? desc->inlineThreshold : 0;
+
+	builder->ctx.outputFile = fopen(builder->outputPath, "wb+");
+	if (!builder->ctx.outputFile) {
+		LOGF_MSG("Failed to open output file \"%s\"", builder->outputPath);
+		src_context_free(&builder->ctx);
+		free(builder->outputPath);
+		free(builder);
+		return NULL;
+	}
+	// write blank header
+	src_write_header(&builder->ctx, 0, 0);
+	src_mutex_init(&builder->lock);
+	return builder;
+}
+
+static void AddInline(src_builder* builder, const char* path, unsigned char* data, uint64_t size)
+{
+	src_mutex_lock(&builder->lock);
+	if (builder->verbose) LOGF_MSG("Inlining: \"%s\"", path);
+	src_add_entry(&builder->ctx, path, 0, 0, size, SRC_PACKED_FLAG_INLINE)->inlineData = data;
+	builder->ctx.inlineCount += 1;
+	builder->ctx.packedFileCount += 1;
+	src_mutex_unlock(&builder->lock);
+}
+
+int src_builder_add_memory(src_builder* builder, const char* path, const void* data, size_t size)
+{
+	if (builder->ctx.inlineThreshold && size <= builder->ctx.inlineThreshold) {
+		unsigned char* copy = (unsigned char*)malloc(size + 1);
+		memcpy(copy, data, size);
+		AddInline(builder, path, copy, size);
+		return 1;
+	}
+
+	// the checksum is computed outside of the lock, only the write is serialized
+	uint32_t checksum = src_crc32c(data, size, 0);
+	src_context* ctx = &builder->ctx;
+	src_mutex_lock(&builder->lock);
+	if (builder->verbose) LOGF_MSG("Packing: \"%s\"", path);
+	uint64_t offset = src_write_record_memory(ctx->outputFile, path, 0, data, size, checksum, 0);
+	uint64_t recordSize = (uint64_t)src_ftell64(ctx->outputFile) - offset;
+	src_add_entry(ctx, path, offset, recordSize, size, 0);
+	ctx->packedFileCount += 1;
+	int succ = !ferror(ctx->outputFile);
+	builder->failed |= !succ;
+	src_mutex_unlock(&builder->lock);
+	return succ;
+}
+
+int src_builder_add_file(src_builder* builder, const char* path, const char* filePath)
+{
+	FILE* file = fopen(filePath, "rb");
+	if (!file) {
+		LOGF_MSG("Failed to open \"%s\"", filePath);
+		return 0;
+	}
+	src_fseek64(file, 0, SEEK_END);
+	uint64_t size = (uint64_t)src_ftell64(file);
+	src_fseek64(file, 0, SEEK_SET);
+
+	if (builder->ctx.inlineThreshold && size <= builder->ctx.inlineThreshold) {
+		fclose(file);
+		unsigned char* data = src_read_file(filePath, size);
+		if (!data) return 0;
+		AddInline(builder, path, data, size);
+		return 1;
+	}
+
+	src_context* ctx = &builder->ctx;
+	src_mutex_lock(&builder->lock);
+	if (builder->verbose) LOGF_MSG("Packing: \"%s\"", path);
+	uint64_t offset = src_write_record(ctx->outputFile, path, 0, file, size, 0);
+	uint64_t recordSize = (uint64_t)src_ftell64(ctx->outputFile) - offset;
+	src_add_entry(ctx, path, offset, recordSize, size, 0);
+	ctx->packedFileCount += 1;
+	int succ = !ferror(ctx->outputFile) && !ferror(file);
+	builder->failed |= !succ;
+	src_mutex_unlock(&builder->lock);
+	fclose(file);
+	return succ;
+}
+
+static int CompareEntryPath(const void* a, const void* b)
+{
+	return strcmp(((const src_packed_entry*)a)->path, ((const src_packed_entry*)b)->path);
+}
+
+int src_builder_finish(src_builder* builder)
+{
+	src_context* ctx = &builder->ctx;
+	int succ = !builder->failed;
+
+	// same id order as a packed directory
+	qsort(ctx->entries, ctx->entryCount, sizeof(src_packed_entry), CompareEntryPath);
+	for (size_t i = 1; succ && i < ctx->entryCount; i += 1) {
+		if (strcmp(ctx->entries[i - 1].path, ctx->entries[i].path) == 0) {
+			LOGF_MSG("Resource \"%s\" was added twice", ctx->entries[i].path);
+			succ = 0;
+		}
+	}
+
+	if (succ) {
+		uint64_t tocOffset = src_write_toc(ctx);
+		src_write_header(ctx, ctx->entryCount - ctx->inlineCount, tocOffset);
+		succ = !ferror(ctx->outputFile);
+	}
+	fclose(ctx->outputFile); ctx->outputFile = NULL;
+
+	if (succ && ctx->outputHeaderPath) {
+		succ = src_write_generated_header(ctx);
+	}
+	if (succ && builder->verbose) {
+		LOGF_MSG("Packaged %d files", ctx->packedFileCount);
+	}
+	if (!succ) {
+		remove(builder->outputPath);
+	}
+
+	src_context_free(ctx);
+	src_mutex_destroy(&builder->lock);
+	free(builder->outputPath);
+	free(builder);
+	return succ;
+}
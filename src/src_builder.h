@@ -0,0 +1,42 @@
+#ifndef SRC_BUILDER_H
+#define SRC_BUILDER_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <stddef.h>
+
+///
+/// libsrc, packs archives from inside a program without a round trip through
+/// a directory on disk.
+///
+/// Resources are written to the archive as they are added, from any number of
+/// threads. src_builder_finish orders them by path like the src executable does,
+/// writes the table of contents and the generated header, and frees the builder.
+///
+/// libsrc contains the implementation of simple_resource_compiler.h, programs
+/// linking it must not define SIMPLE_RESOURCE_COMPILER_IMPLEMENTATION.
+///
+
+typedef struct src_builder src_builder;
+
+typedef struct {
+	const char* outputPath; // the archive to write
+	const char* headerDir; // directory of the generated header, NULL writes no header
+	uint64_t inlineThreshold; // see --inline-threshold, only used with a header
+	int verbose; // log every resource, failures are logged either way
+} src_builder_desc;
+
+// returns NULL if the archive can't be created
+src_builder* src_builder_create(const src_builder_desc* desc);
+// path is the name of the resource, its id is hashed from it. Returns 0 on failure.
+int src_builder_add_memory(src_builder* builder, const char* path, const void* data, size_t size);
+// packs the file at filePath as the resource path. Returns 0 on failure.
+int src_builder_add_file(src_builder* builder, const char* path, const char* filePath);
+// returns 1 if the archive and the header were written, the builder is freed either way
+int src_builder_finish(src_builder* builder);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif // SRC_BUILDER_H
@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simple_resource_compiler.h"
+#include "src_tool.h"
+
+///
+/// Chunked storage.
+///
+/// Usage: src.exe -t "resources/" -o "data.src" -s "include/" --chunk-threshold 1048576 [--stats]
+///
+/// Files of at least --chunk-threshold bytes are cut into content defined chunks
+/// (FastCDC, Xia et al. 2016) and every distinct chunk is stored once. The record
+/// of such a file holds a src_chunk_list followed by the chunks no earlier record
+/// stored, the others are referenced by their offset in the archive. Cut points
+/// only depend on the bytes in front of them, so an insertion or removal changes
+/// the chunks around it and near identical files share the rest.
+///
+/// A chunk is identified by its FNV-1a 64, CRC-32C and size. Files are read twice,
+/// once to find the chunks and once to copy the new ones, they are never held in
+/// memory as a whole.
+///
+
+#define SRC_CHUNK_MIN (2 * 1024)
+#define SRC_CHUNK_AVG (8 * 1024)
+#define SRC_CHUNK_MAX (64 * 1024)
+// normalized chunking, more bits below the average size and fewer above it pull
+// the chunk sizes towards SRC_CHUNK_AVG
+#define SRC_CHUNK_MASK_SMALL 0x0003590703530000ULL // 15 bits
+#define SRC_CHUNK_MASK_LARGE 0x0000d90003530000ULL // 11 bits
+
+// the read window, the chunker always sees SRC_CHUNK_MAX bytes unless the file ends
+#define SRC_CHUNK_BUFFER (4 * SRC_CHUNK_MAX)
+
+typedef struct {
+	uint64_t hash; // src_fnv1a64
+	uint32_t checksum;
+	uint32_t size; // 0 marks an empty slot
+	uint64_t offset; // in the archive
+} src_chunk;
+
+struct src_chunk_store {
+	uint64_t gear[256];
+	src_chunk* slots;
+	size_t slotMask;
+	size_t count;
+
+	// for --stats
+	uint64_t chunkCount; // referenced, shared ones counted each time
+	uint64_t logicalBytes;
+	uint64_t storedBytes; // chunk lists and new chunks
+};
+
+static struct src_chunk_store* CreateStore(void)
+{
+	struct src_chunk_store* store = (struct src_chunk_store*)calloc(1, sizeof(struct src_chunk_store));
+	// splitmix64 from a fixed seed, the cut points and so the archives stay reproducible
+	uint64_t seed = 0x5352434348554e4bULL;
+	for (int i = 0; i < 256; i += 1) {
+		uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		store->gear[i] = z ^ (z >> 31);
+	}
+	store->slotMask = 1023;
+	store->slots = (src_chunk*)calloc(store->slotMask + 1, sizeof(src_chunk));
+	return store;
+}
+
+void src_chunk_store_free(struct src_chunk_store* store)
+{
+	if (!store) return;
+	free(store->slots);
+	free(store);
+}
+
+static src_chunk* FindSlot(src_chunk* slots, size_t slotMask, const src_chunk* chunk)
+{
+	size_t i = (size_t)chunk->hash & slotMask;
+	while (slots[i].size != 0
+		&& (slots[i].hash != chunk->hash || slots[i].checksum != chunk->checksum || slots[i].size != chunk->size)) {
+		i = (i + 1) & slotMask;
+	}
+	return &slots[i];
+}
+
+// returns the stored chunk or adds chunk at offset, kept at most half full
+static const src_chunk* FindOrAdd(struct src_chunk_store* store, const src_chunk* chunk, uint64_t offset, int* added)
+{
+	src_chunk* slot = FindSlot(store->slots, store->slotMask, chunk);
+	*added = slot->size == 0;
+	if (!*added) return slot;
+
+	if ((store->count + 1) * 2 > store->slotMask + 1) {
+		size_t slotMask = store->slotMask * 2 + 1;
+		src_chunk* slots = (src_chunk*)calloc(slotMask + 1, sizeof(src_chunk));
+		for (size_t i = 0; i <= store->slotMask; i += 1) {
+			if (store->slots[i].size != 0) *FindSlot(slots, slotMask, &store->slots[i]) = store->slots[i];
+		}
+		free(store->slots);
+		store->slots = slots;
+		store->slotMask = slotMask;
+		slot = FindSlot(store->slots, store->slotMask, chunk);
+	}
+	*slot = *chunk;
+	slot->offset = offset;
+	store->count += 1;
+	return slot;
+}
+
+// FastCDC, returns the size of the chunk starting at data
+static size_t CutPoint(const uint64_t* gear, const unsigned char* data, size_t len)
+{
+	if (len <= SRC_CHUNK_MIN) return len;
+	if (len > SRC_CHUNK_MAX) len = SRC_CHUNK_MAX;
+	size_t normal = len < SRC_CHUNK_AVG ? len : SRC_CHUNK_AVG;
+
+	uint64_t fp = 0;
+	size_t i = SRC_CHUNK_MIN;
+	for (; i < normal; i += 1) {
+		fp = (fp << 1) + gear[data[i]];
+		if (!(fp & SRC_CHUNK_MASK_SMALL)) return i + 1;
+	}
+	for (; i < len; i += 1) {
+		fp = (fp << 1) + gear[data[i]];
+		if (!(fp & SRC_CHUNK_MASK_LARGE)) return i + 1;
+	}
+	return len;
+}
+
+// fills the window from the file, returns the bytes available at pos
+static size_t Refill(FILE* file, unsigned char* buffer, size_t* pos, size_t* len, int* eof)
+{
+	if (!*eof && *len - *pos < SRC_CHUNK_MAX) {
+		memmove(buffer, buffer + *pos, *len - *pos);
+		*len -= *pos;
+		*pos = 0;
+		size_t want = SRC_CHUNK_BUFFER - *len;
+		size_t read = fread(buffer + *len, 1, want, file);
+		*len += read;
+		*eof = read < want;
+	}
+	return *len - *pos;
+}
+
+// first pass, the chunks of the file in order
+static src_chunk* FindChunks(const struct src_chunk_store* store, FILE* file, unsigned char* buffer, uint64_t fileSize, size_t* chunkCount)
+{
+	size_t capacity = (size_t)(fileSize / SRC_CHUNK_AVG) + 16;
+	src_chunk* chunks = (src_chunk*)malloc(capacity * sizeof(src_chunk));
+	size_t count = 0;
+	uint64_t total = 0;
+	size_t pos = 0;
+	size_t len = 0;
+	int eof = 0;
+	for (;;) {
+		size_t available = Refill(file, buffer, &pos, &len, &eof);
+		if (available == 0) break;
+		size_t cut = CutPoint(store->gear, buffer + pos, available);
+		if (count == capacity) {
+			capacity *= 2;
+			chunks = (src_chunk*)realloc(chunks, capacity * sizeof(src_chunk));
+		}
+		src_chunk* chunk = &chunks[count++];
+		chunk->hash = src_fnv1a64(buffer + pos, cut, SRC_FNV1A64_INIT);
+		chunk->checksum = src_crc32c(buffer + pos, cut, 0);
+		chunk->size = (uint32_t)cut;
+		chunk->offset = 0;
+		pos += cut;
+		total += cut;
+	}
+	if (ferror(file) || total != fileSize) {
+		free(chunks);
+		return NULL;
+	}
+	*chunkCount = count;
+	return chunks;
+}
+
+int src_pack_chunked(src_context* ctx, const src_file_entry* file)
+{
+	if (!ctx->chunkStore) ctx->chunkStore = CreateStore();
+	struct src_chunk_store* store = ctx->chunkStore;
+
+	FILE* fileHandle = fopen(file->source, "rb");
+	if (!fileHandle) return 0;
+	unsigned char* buffer = (unsigned char*)malloc(SRC_CHUNK_BUFFER);
+	size_t chunkCount = 0;
+	src_chunk* chunks = FindChunks(store, fileHandle, buffer, file->size, &chunkCount);
+	if (!chunks) {
+		LOGF_MSG("Failed to read \"%s\"", file->path);
+		free(buffer);
+		fclose(fileHandle);
+		return 0;
+	}
+
+	// place the new chunks behind the list, repeats within the file are found as well
+	uint64_t listSize = sizeof(src_chunk_list) + (uint64_t)chunkCount * sizeof(src_chunk_ref);
+	uint64_t offset = (uint64_t)src_ftell64(ctx->outputFile);
+	src_resource_header header = { 0 };
+	header.nameLen = (uint16_t)(strlen(file->path) + 1);
+	uint64_t dataOffset = offset + src_record_data_offset(&header);
+	uint64_t storedSize = listSize;
+	unsigned char* isNew = (unsigned char*)malloc(chunkCount + 1);
+	for (size_t i = 0; i < chunkCount; i += 1) {
+		int added;
+		chunks[i].offset = FindOrAdd(store, &chunks[i], dataOffset + storedSize, &added)->offset;
+		isNew[i] = (unsigned char)added;
+		if (added) storedSize += chunks[i].size;
+	}
+
+	src_write_record_start(ctx->outputFile, &header, file->path, src_root_length(ctx, file->path), storedSize, SRC_RESOURCE_FLAG_CHUNKED);
+
+	src_chunk_list list = { 0 };
+	list.size = file->size;
+	list.chunkCount = chunkCount;
+	header.checksum = src_crc32c(&list, sizeof(list), 0);
+	WRITE_STRUCT(list, ctx->outputFile);
+	for (size_t i = 0; i < chunkCount; i += 1) {
+		src_chunk_ref ref = { 0 };
+		ref.offset = chunks[i].offset;
+		ref.size = chunks[i].size;
+		ref.checksum = chunks[i].checksum;
+		header.checksum = src_crc32c(&ref, sizeof(ref), header.checksum);
+		WRITE_STRUCT(ref, ctx->outputFile);
+	}
+
+	// second pass, the file has to be unchanged since the first one
+	int succ = fseek(fileHandle, 0, SEEK_SET) == 0;
+	for (size_t i = 0; succ && i < chunkCount; i += 1) {
+		succ = fread(buffer, 1, chunks[i].size, fileHandle) == chunks[i].size
+			&& src_crc32c(buffer, chunks[i].size, 0) == chunks[i].checksum;
+		if (succ && isNew[i]) {
+			header.checksum = src_crc32c(buffer, chunks[i].size, header.checksum);
+			WRITE_DATA(buffer, chunks[i].size, ctx->outputFile);
+		}
+	}
+	fclose(fileHandle);
+	free(buffer);
+	free(isNew);
+	free(chunks);
+	if (!succ) {
+		LOGF_MSG("\"%s\" changed while it was packed", file->path);
+		return 0;
+	}
+	src_write_record_finish(ctx->outputFile, offset, &header);
+
+	uint64_t recordSize = (uint64_t)src_ftell64(ctx->outputFile) - offset;
+	src_add_entry(ctx, file->path, offset, recordSize, file->size, SRC_RESOURCE_FLAG_CHUNKED);
+	LOGF_MSG("Chunked: \"%s\", %zu chunks, %llu of %llu bytes stored", file->path, chunkCount,
+		(unsigned long long)storedSize, (unsigned long long)file->size);
+	store->chunkCount += chunkCount;
+	store->logicalBytes += file->size;
+	store->storedBytes += storedSize;
+	ctx->chunkedCount += 1;
+	ctx->packedFileCount += 1;
+	return 1;
+}
+
+static double ToMiB(uint64_t bytes)
+{
+	return (double)bytes / (1024.0 * 1024.0);
+}
+
+void src_print_stats(const src_context* ctx, uint64_t archiveSize)
+{
+	uint64_t dataBytes = 0;
+	for (size_t i = 0; i < ctx->entryCount; i += 1) {
+		dataBytes += ctx->entries[i].size;
+	}
+	// printed with -v as well, they were asked for
+	printf("Resources: %zu, %.2f MiB of data, archive %.2f MiB\n",
+		ctx->entryCount, ToMiB(dataBytes), ToMiB(archiveSize));
+	if (ctx->inlineCount) {
+		printf("Inlined: %zu resources\n", ctx->inlineCount);
+	}
+
+	if (ctx->compress) {
+		printf("Compressed: %zu resources, %.2f MiB stored as %.2f MiB, dictionary %zu bytes\n",
+			ctx->compressedCount, ToMiB(ctx->compressedInput), ToMiB(ctx->compressedOutput), ctx->dictionarySize);
+	}
+
+	const struct src_chunk_store* store = ctx->chunkStore;
+	if (!store) {
+		printf("Chunked: 0 resources\n");
+		return;
+	}
+	printf("Chunked: %zu resources, %llu chunks, %zu unique\n",
+		ctx->chunkedCount, (unsigned long long)store->chunkCount, store->count);
+	printf("Dedup: %.2f MiB stored as %.2f MiB, ratio %.2f\n",
+		ToMiB(store->logicalBytes), ToMiB(store->storedBytes),
+		store->storedBytes ? (double)store->logicalBytes / (double)store->storedBytes : 0.0);
+}
@@ -0,0 +1,430 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simple_resource_compiler.h"
+#include "src_tool.h"
+#include "src_thread.h"
+
+///
+/// Dictionary compression.
+///
+/// Usage: src.exe -t "resources/" -o "data.src" -s "include/" --compress [--dict-size 32768]
+///
+/// Small files compress poorly on their own, every one starts with an empty
+/// history. With --compress the packer samples the files first and trains a
+/// dictionary of the segments most of them share (FastCover, as in zstd). The
+/// dictionary is stored once after the TOC and every resource is compressed on
+/// its own against it with src_lz, so it is still loaded by id without touching
+/// the others. Resources which don't get smaller are stored as they are.
+///
+/// Files larger than --frame-size, 256 KiB by default, are split into frames which
+/// are compressed on their own, on -j threads, and listed in a src_frame_ref index
+/// after them. A reader then decompresses only the frames overlapping the range it
+/// reads with src_archive_read_range. Frames which don't get smaller are stored as
+/// they are. Framed files are read a batch of frames at a time.
+///
+/// --frame-size 0 compresses every file as one stream in memory, larger ones than
+/// SRC_COMPRESS_MAX_FILE are then stored as they are. --dict-size 0 compresses
+/// without a dictionary. Rules with compress=off leave files out, without
+/// --compress only the files of rules with compress=on are compressed, see src_rules.c.
+///
+
+#define SRC_COMPRESS_MAX_FILE (64 * 1024 * 1024)
+
+// the encoder keeps a hash chain over the dictionary and the input
+#define SRC_LZ_HASH_BITS 16
+#define SRC_LZ_CHAIN_DEPTH 32
+
+// training
+#define SRC_DICT_SAMPLE_FILE (64 * 1024) // bytes sampled from the start of a file
+#define SRC_DICT_SAMPLE_TOTAL (8 * 1024 * 1024)
+#define SRC_DICT_DMER 8 // the unit of similarity
+#define SRC_DICT_SEGMENT 256 // the unit the dictionary is built of
+#define SRC_DICT_HASH_BITS 20
+
+static uint32_t Read32(const unsigned char* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t LzHash(const unsigned char* p)
+{
+	return (Read32(p) * 2654435761u) >> (32 - SRC_LZ_HASH_BITS);
+}
+
+static int WriteLength(unsigned char** op, const unsigned char* oend, size_t length)
+{
+	for (; length >= 255; length -= 255) {
+		if (*op == oend) return 0;
+		*(*op)++ = 255;
+	}
+	if (*op == oend) return 0;
+	*(*op)++ = (unsigned char)length;
+	return 1;
+}
+
+// one sequence, matchLength 0 for the last one
+static int WriteSequence(unsigned char** op, const unsigned char* oend, const unsigned char* literals, size_t literalCount,
+	size_t offset, size_t matchLength)
+{
+	if (*op == oend) return 0;
+	size_t matchCode = matchLength ? matchLength - SRC_LZ_MIN_MATCH : 0;
+	*(*op)++ = (unsigned char)((literalCount < 15 ? literalCount : 15) << 4 | (matchCode < 15 ? matchCode : 15));
+	if (literalCount >= 15 && !WriteLength(op, oend, literalCount - 15)) return 0;
+	if ((size_t)(oend - *op) < literalCount) return 0;
+	memcpy(*op, literals, literalCount);
+	*op += literalCount;
+	if (!matchLength) return 1;
+
+	if (oend - *op < 2) return 0;
+	*(*op)++ = (unsigned char)(offset & 0xFF);
+	*(*op)++ = (unsigned char)(offset >> 8);
+	return matchCode < 15 || WriteLength(op, oend, matchCode - 15);
+}
+
+size_t src_lz_compress(const unsigned char* src, size_t size, unsigned char* dst, size_t capacity,
+	const unsigned char* dict, size_t dictSize)
+{
+	// the dictionary is the history in front of the input
+	size_t windowSize = dictSize + size;
+	unsigned char* window = (unsigned char*)malloc(windowSize + 1);
+	memcpy(window, dict, dictSize);
+	memcpy(window + dictSize, src, size);
+	int32_t* head = (int32_t*)malloc(sizeof(int32_t) << SRC_LZ_HASH_BITS);
+	memset(head, 0xFF, sizeof(int32_t) << SRC_LZ_HASH_BITS);
+	int32_t* prev = (int32_t*)malloc((windowSize + 1) * sizeof(int32_t));
+
+	size_t pos = 0;
+	size_t end = windowSize;
+	size_t hashEnd = windowSize >= SRC_LZ_MIN_MATCH ? windowSize - SRC_LZ_MIN_MATCH + 1 : 0;
+	for (; pos < dictSize && pos < hashEnd; pos += 1) {
+		uint32_t h = LzHash(window + pos);
+		prev[pos] = head[h];
+		head[h] = (int32_t)pos;
+	}
+
+	unsigned char* op = dst;
+	const unsigned char* oend = dst + capacity;
+	size_t anchor = pos = dictSize;
+	int succ = 1;
+	while (succ && pos < hashEnd) {
+		uint32_t h = LzHash(window + pos);
+		size_t bestLength = 0;
+		size_t bestOffset = 0;
+		int32_t candidate = head[h];
+		for (int depth = 0; candidate >= 0 && depth < SRC_LZ_CHAIN_DEPTH; depth += 1) {
+			size_t offset = pos - (size_t)candidate;
+			if (offset > SRC_LZ_MAX_OFFSET) break;
+			size_t length = 0;
+			while (pos + length < end && window[candidate + length] == window[pos + length]) length += 1;
+			if (length > bestLength) {
+				bestLength = length;
+				bestOffset = offset;
+			}
+			candidate = prev[candidate];
+		}
+		prev[pos] = head[h];
+		head[h] = (int32_t)pos;
+
+		if (bestLength < SRC_LZ_MIN_MATCH) {
+			pos += 1;
+			continue;
+		}
+		succ = WriteSequence(&op, oend, window + anchor, pos - anchor, bestOffset, bestLength);
+		for (size_t i = pos + 1; i < pos + bestLength && i < hashEnd; i += 1) {
+			uint32_t hi = LzHash(window + i);
+			prev[i] = head[hi];
+			head[hi] = (int32_t)i;
+		}
+		pos += bestLength;
+		anchor = pos;
+	}
+	if (succ && (anchor < end || op == dst)) {
+		succ = WriteSequence(&op, oend, window + anchor, end - anchor, 0, 0);
+	}
+
+	free(prev);
+	free(head);
+	free(window);
+	return succ ? (size_t)(op - dst) : 0;
+}
+
+static uint32_t DmerHash(const unsigned char* p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return (uint32_t)((v * 0x9E3779B97F4A7C15ULL) >> (64 - SRC_DICT_HASH_BITS));
+}
+
+// FastCover: the samples are split into one epoch per segment of the dictionary,
+// from each the segment whose d-mers appear in the most samples is taken. Taken
+// d-mers score nothing afterwards, so the segments don't repeat each other.
+static size_t TrainDictionary(const unsigned char* samples, const size_t* sampleSizes, size_t sampleCount,
+	unsigned char* dict, size_t capacity)
+{
+	uint32_t* freq = (uint32_t*)calloc((size_t)1 << SRC_DICT_HASH_BITS, sizeof(uint32_t));
+	uint32_t* seen = (uint32_t*)calloc((size_t)1 << SRC_DICT_HASH_BITS, sizeof(uint32_t));
+	size_t total = 0;
+	for (size_t s = 0; s < sampleCount; s += 1) {
+		const unsigned char* sample = samples + total;
+		for (size_t i = 0; i + SRC_DICT_DMER <= sampleSizes[s]; i += 1) {
+			uint32_t h = DmerHash(sample + i);
+			// counted once per sample
+			if (seen[h] == (uint32_t)s + 1) continue;
+			seen[h] = (uint32_t)s + 1;
+			freq[h] += 1;
+		}
+		total += sampleSizes[s];
+	}
+	free(seen);
+
+	size_t filled = 0;
+	size_t epochs = capacity / SRC_DICT_SEGMENT;
+	size_t epochSize = epochs ? total / epochs : 0;
+	if (epochSize < SRC_DICT_SEGMENT) {
+		epochSize = SRC_DICT_SEGMENT;
+		epochs = total / SRC_DICT_SEGMENT;
+	}
+	const size_t dmers = SRC_DICT_SEGMENT - SRC_DICT_DMER + 1;
+	for (size_t e = 0; e < epochs && filled + SRC_DICT_SEGMENT <= capacity; e += 1) {
+		size_t begin = e * epochSize;
+		size_t end = begin + epochSize < total ? begin + epochSize : total;
+		if (end - begin < SRC_DICT_SEGMENT) continue;
+
+		// sliding sum over the d-mers of a segment, only the ones shared by samples count
+		uint64_t score = 0;
+		uint64_t bestScore = 0;
+		size_t best = begin;
+		for (size_t i = begin; i + SRC_DICT_DMER <= end; i += 1) {
+			uint32_t f = freq[DmerHash(samples + i)];
+			score += f > 1 ? f - 1 : 0;
+			if (i >= begin + dmers) {
+				uint32_t out = freq[DmerHash(samples + i - dmers)];
+				score -= out > 1 ? out - 1 : 0;
+			}
+			if (i + 1 >= begin + dmers && score > bestScore) {
+				bestScore = score;
+				best = i + 1 - dmers;
+			}
+		}
+		if (bestScore == 0) continue;
+
+		memcpy(dict + filled, samples + best, SRC_DICT_SEGMENT);
+		filled += SRC_DICT_SEGMENT;
+		for (size_t i = best; i < best + dmers; i += 1) {
+			freq[DmerHash(samples + i)] = 0;
+		}
+	}
+	free(freq);
+	return filled;
+}
+
+int src_compressible(const src_context* ctx, const src_file_entry* file)
+{
+	int compress = ctx->compress == SRC_COMPRESS_ALL ? file->compress != 0
+		: ctx->compress == SRC_COMPRESS_RULES && file->compress == 1;
+	uint64_t size = file->size;
+	return compress && size > ctx->inlineThreshold
+		&& !(ctx->chunkThreshold && size >= ctx->chunkThreshold)
+		&& (size <= SRC_COMPRESS_MAX_FILE || (ctx->frameSize && size > ctx->frameSize));
+}
+
+int src_train_dictionary(src_context* ctx, const src_file_list* list)
+{
+	if (ctx->dictionaryCapacity == 0) return 1;
+
+	// a spread of the files when they exceed the sample budget
+	uint64_t eligible = 0;
+	for (size_t i = 0; i < list->count; i += 1) {
+		if (!src_compressible(ctx, &list->files[i])) continue;
+		eligible += list->files[i].size < SRC_DICT_SAMPLE_FILE ? list->files[i].size : SRC_DICT_SAMPLE_FILE;
+	}
+	size_t stride = (size_t)(eligible / SRC_DICT_SAMPLE_TOTAL) + 1;
+
+	unsigned char* samples = (unsigned char*)malloc(SRC_DICT_SAMPLE_TOTAL + SRC_DICT_SAMPLE_FILE);
+	size_t* sampleSizes = (size_t*)malloc((list->count + 1) * sizeof(size_t));
+	size_t sampleCount = 0;
+	size_t total = 0;
+	size_t seen = 0;
+	for (size_t i = 0; i < list->count && total < SRC_DICT_SAMPLE_TOTAL; i += 1) {
+		if (!src_compressible(ctx, &list->files[i]) || seen++ % stride != 0) continue;
+		FILE* file = fopen(list->files[i].source, "rb");
+		if (!file) {
+			LOGF_MSG("Failed to open \"%s\"", list->files[i].path);
+			free(samples);
+			free(sampleSizes);
+			return 0;
+		}
+		size_t read = fread(samples + total, 1, SRC_DICT_SAMPLE_FILE, file);
+		fclose(file);
+		sampleSizes[sampleCount++] = read;
+		total += read;
+	}
+
+	ctx->dictionary = (unsigned char*)malloc(ctx->dictionaryCapacity + 1);
+	ctx->dictionarySize = TrainDictionary(samples, sampleSizes, sampleCount, ctx->dictionary, ctx->dictionaryCapacity);
+	LOGF_MSG("Trained a dictionary of %zu bytes on %zu files", ctx->dictionarySize, sampleCount);
+	free(samples);
+	free(sampleSizes);
+	return 1;
+}
+
+typedef struct {
+	const src_context* ctx;
+	const unsigned char* input; // a batch of frames, the last one may be shorter
+	size_t inputSize;
+	unsigned char* output; // frameSize bytes per frame
+	size_t* sizes; // compressed, 0 if the frame is stored as it is
+} src_frame_job;
+
+static void CompressFrame(void* arg, int index)
+{
+	src_frame_job* job = (src_frame_job*)arg;
+	size_t frameSize = job->ctx->frameSize;
+	size_t start = (size_t)index * frameSize;
+	size_t len = job->inputSize - start < frameSize ? job->inputSize - start : frameSize;
+	// a frame of its decompressed size is stored as it is, a compressed one has to be smaller
+	job->sizes[index] = src_lz_compress(job->input + start, len, job->output + start, len - 1,
+		job->ctx->dictionary, job->ctx->dictionarySize);
+}
+
+static int PackFramed(src_context* ctx, const src_file_entry* file)
+{
+	FILE* fileHandle = fopen(file->source, "rb");
+	if (!fileHandle) return 0;
+	size_t frameSize = ctx->frameSize;
+	uint64_t frameCount = (file->size + frameSize - 1) / frameSize;
+	int batch = ctx->threadCount > 1 ? ctx->threadCount : 1;
+	unsigned char* input = (unsigned char*)malloc((size_t)batch * frameSize);
+	src_frame_job job = { 0 };
+	job.ctx = ctx;
+	job.input = input;
+	job.output = (unsigned char*)malloc((size_t)batch * frameSize);
+	job.sizes = (size_t*)malloc(batch * sizeof(size_t));
+	src_frame_ref* refs = (src_frame_ref*)malloc((size_t)(frameCount + 1) * sizeof(src_frame_ref));
+
+	// the size of the record is known once the frames are written
+	src_resource_header header;
+	uint64_t offset = src_write_record_start(ctx->outputFile, &header, file->path, src_root_length(ctx, file->path), 0, SRC_RESOURCE_FLAG_COMPRESSED);
+	src_compressed_header compressed = { 0 };
+	compressed.size = file->size;
+	compressed.codec = ctx->dictionarySize ? SRC_CODEC_LZ_DICT : SRC_CODEC_LZ;
+	compressed.frameSize = ctx->frameSize;
+	header.checksum = src_crc32c(&compressed, sizeof(compressed), 0);
+	WRITE_STRUCT(compressed, ctx->outputFile);
+	uint64_t storedSize = sizeof(compressed);
+
+	int succ = 1;
+	for (uint64_t frame = 0; succ && frame < frameCount; frame += (uint64_t)batch) {
+		int count = frameCount - frame < (uint64_t)batch ? (int)(frameCount - frame) : batch;
+		uint64_t left = file->size - frame * frameSize;
+		size_t len = left < (uint64_t)count * frameSize ? (size_t)left : (size_t)count * frameSize;
+		succ = fread(input, 1, len, fileHandle) == len;
+		if (!succ) break;
+		job.inputSize = len;
+		src_parallel_for(ctx->threadCount, count, CompressFrame, &job);
+
+		for (int i = 0; i < count; i += 1) {
+			size_t start = (size_t)i * frameSize;
+			size_t frameLen = len - start < frameSize ? len - start : frameSize;
+			const unsigned char* stored = job.sizes[i] ? job.output + start : input + start;
+			size_t storedLen = job.sizes[i] ? job.sizes[i] : frameLen;
+			src_frame_ref* ref = &refs[frame + i];
+			ref->offset = storedSize;
+			ref->size = (uint32_t)storedLen;
+			ref->checksum = src_crc32c(stored, storedLen, 0);
+			header.checksum = src_crc32c(stored, storedLen, header.checksum);
+			WRITE_DATA(stored, storedLen, ctx->outputFile);
+			storedSize += storedLen;
+		}
+	}
+	fclose(fileHandle);
+	free(input);
+	free(job.output);
+	free(job.sizes);
+	if (!succ) {
+		LOGF_MSG("Failed to read \"%s\"", file->path);
+		free(refs);
+		return 0;
+	}
+
+	// the index stays aligned
+	static const char padding[SRC_RECORD_ALIGNMENT] = { 0 };
+	size_t pad = (size_t)((SRC_RECORD_ALIGNMENT - storedSize % SRC_RECORD_ALIGNMENT) % SRC_RECORD_ALIGNMENT);
+	header.checksum = src_crc32c(padding, pad, header.checksum);
+	WRITE_DATA(padding, pad, ctx->outputFile);
+	header.checksum = src_crc32c(refs, (size_t)frameCount * sizeof(src_frame_ref), header.checksum);
+	WRITE_DATA(refs, (size_t)frameCount * sizeof(src_frame_ref), ctx->outputFile);
+	storedSize += pad + frameCount * sizeof(src_frame_ref);
+	free(refs);
+	header.resourceSize = storedSize;
+	src_write_record_finish(ctx->outputFile, offset, &header);
+
+	uint64_t recordSize = (uint64_t)src_ftell64(ctx->outputFile) - offset;
+	src_add_entry(ctx, file->path, offset, recordSize, file->size, SRC_RESOURCE_FLAG_COMPRESSED);
+	LOGF_MSG("Framed: \"%s\", %llu frames, %llu of %llu bytes stored", file->path, (unsigned long long)frameCount,
+		(unsigned long long)storedSize, (unsigned long long)file->size);
+	ctx->compressedCount += 1;
+	ctx->compressedInput += file->size;
+	ctx->compressedOutput += storedSize;
+	ctx->packedFileCount += 1;
+	return 1;
+}
+
+int src_pack_compressed(src_context* ctx, const src_file_entry* file)
+{
+	if (ctx->frameSize && file->size > ctx->frameSize) {
+		return PackFramed(ctx, file);
+	}
+	unsigned char* data = src_read_file(file->source, file->size);
+	if (!data) return 0;
+	size_t size = (size_t)file->size;
+	// only kept when it is smaller than the file
+	size_t capacity = size > sizeof(src_compressed_header) ? size - sizeof(src_compressed_header) : 0;
+	unsigned char* compressed = (unsigned char*)malloc(sizeof(src_compressed_header) + capacity + 1);
+	size_t compressedSize = capacity ? src_lz_compress(data, size, compressed + sizeof(src_compressed_header), capacity,
+		ctx->dictionary, ctx->dictionarySize) : 0;
+
+	uint64_t offset;
+	uint64_t storedSize;
+	uint8_t flags = 0;
+	if (compressedSize) {
+		src_compressed_header header = { 0 };
+		header.size = file->size;
+		header.codec = ctx->dictionarySize ? SRC_CODEC_LZ_DICT : SRC_CODEC_LZ;
+		memcpy(compressed, &header, sizeof(header));
+		storedSize = sizeof(header) + compressedSize;
+		flags = SRC_RESOURCE_FLAG_COMPRESSED;
+		offset = src_write_record_memory(ctx->outputFile, file->path, src_root_length(ctx, file->path), compressed, storedSize,
+			src_crc32c(compressed, (size_t)storedSize, 0), flags);
+		ctx->compressedCount += 1;
+		ctx->compressedInput += file->size;
+		ctx->compressedOutput += storedSize;
+	}
+	else {
+		storedSize = file->size;
+		offset = src_write_record_memory(ctx->outputFile, file->path, src_root_length(ctx, file->path), data, storedSize, src_crc32c(data, size, 0), 0);
+	}
+	free(compressed);
+	free(data);
+
+	uint64_t recordSize = (uint64_t)src_ftell64(ctx->outputFile) - offset;
+	src_add_entry(ctx, file->path, offset, recordSize, file->size, flags);
+	ctx->packedFileCount += 1;
+	return 1;
+}
+
+void src_write_dictionary(src_context* ctx)
+{
+	src_fseek64(ctx->outputFile, 0, SEEK_END);
+	src_dict_header header = { 0 };
+	strcpy(header.header, SRC_DICT_HEADER_VALUE);
+	header.size = ctx->dictionarySize;
+	header.checksum = src_crc32c(ctx->dictionary, ctx->dictionarySize, 0);
+	WRITE_STRUCT(header, ctx->outputFile);
+	WRITE_DATA(ctx->dictionary, ctx->dictionarySize, ctx->outputFile);
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <direct.h>
+#define getcwd _getcwd
+#else
+#include <unistd.h>
+#endif
+
+#include "src_tool.h"
+
+///
+/// Depfiles.
+///
+/// A depfile names every file and directory a run scanned, so a build system
+/// repacks when a file changes and when one is added or removed (the mtime of
+/// its directory changes) without globbing at configure time. Paths are written
+/// absolute, the working directory of the tool isn't the one of the build.
+///
+
+static int IsAbsolute(const char* path)
+{
+#ifdef _WIN32
+	return path[0] == '/' || path[0] == '\\' || (path[0] != '\0' && path[1] == ':');
+#else
+	return path[0] == '/';
+#endif
+}
+
+char* src_absolute_path(const char* path)
+{
+	size_t len = strlen(path);
+	if (IsAbsolute(path)) {
+		char* copy = (char*)malloc(len + 1);
+		memcpy(copy, path, len + 1);
+		return copy;
+	}
+	char cwd[4096];
+	if (!getcwd(cwd, sizeof(cwd))) return NULL;
+	size_t cwdLen = strlen(cwd);
+	char* absolute = (char*)malloc(cwdLen + len + 2);
+	memcpy(absolute, cwd, cwdLen);
+	absolute[cwdLen] = '/';
+	memcpy(absolute + cwdLen + 1, path, len + 1);
+	return absolute;
+}
+
+static int IsSeparator(char c)
+{
+	return c == '/' || c == '\\';
+}
+
+// escapes like gcc -M, which make and ninja both parse. Repeated and trailing
+// separators are dropped, build systems match the targets by their spelling.
+static void WritePath(FILE* out, const char* path)
+{
+	char* absolute = src_absolute_path(path);
+	const char* c = absolute ? absolute : path;
+	for (const char* start = c; *c; c += 1) {
+		if (IsSeparator(*c) && c != start && (IsSeparator(c[1]) || c[1] == '\0')) continue;
+		if (*c == ' ' || *c == '#') fputc('\\', out);
+		else if (*c == '$') fputc('$', out);
+		fputc(*c, out);
+	}
+	free(absolute);
+}
+
+int src_write_depfile(const char* depfilePath, const char* target, const char* const* deps, size_t depCount)
+{
+	FILE* out = fopen(depfilePath, "wb");
+	if (!out) {
+		LOGF_MSG("Failed to open depfile \"%s\"", depfilePath);
+		return 0;
+	}
+
+	WritePath(out, target);
+	fputc(':', out);
+	for (size_t i = 0; i < depCount; i += 1) {
+		fputs(" \\\n ", out);
+		WritePath(out, deps[i]);
+	}
+	fputc('\n', out);
+	for (size_t i = 0; i < depCount; i += 1) {
+		fputc('\n', out);
+		WritePath(out, deps[i]);
+		fputs(":\n", out);
+	}
+
+	int succ = !ferror(out);
+	succ = fclose(out) == 0 && succ;
+	if (!succ) {
+		LOGF_MSG("Failed to write depfile \"%s\"", depfilePath);
+	}
+	return succ;
+}
+
+int src_write_list_depfile(const char* depfilePath, const char* target, const src_file_list* list,
+	const char* const* extraDeps, size_t extraDepCount)
+{
+	const char** deps = (const char**)malloc((list->count + list->dirCount + extraDepCount + 1) * sizeof(const char*));
+	for (size_t i = 0; i < list->count; i += 1) {
+		deps[i] = list->files[i].path;
+	}
+	memcpy(deps + list->count, list->dirs, list->dirCount * sizeof(const char*));
+	size_t depCount = list->count + list->dirCount;
+	for (size_t i = 0; i < extraDepCount; i += 1) {
+		deps[depCount++] = extraDeps[i];
+	}
+	int succ = src_write_depfile(depfilePath, target, deps, depCount);
+	free(deps);
+	return succ;
+}
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simple_resource_compiler.h"
+#include "src_tool.h"
+
+///
+/// Resource groups.
+///
+/// Usage: src.exe -t "resources/" -o "data.src" -s "include/" [--groups "groups.txt"] [--group-by-dir]
+///
+/// The group file has one rule per line, a group name and a path relative to the
+/// target directory. A path names a file or a directory and everything below it,
+/// a file goes into the group of the first rule matching it. Blank lines and
+/// lines starting with '#' are skipped.
+///
+///     # group  path
+///     level3   levels/level3
+///     level3   music/level3.ogg
+///     ui       ui
+///
+/// Files can also be put into a group by the group= setting of a rule, see
+/// src_rules.c, which goes ahead of the group file.
+///
+/// With --group-by-dir every top level directory not matched by a rule is a group
+/// of its own. The records of a group are packed contiguously, groups in the order
+/// they first appear, then the files of no group. The TOC and the generated ids
+/// stay in path order. Chunks a chunked resource shares with an earlier record
+/// stay in that record and aren't part of the byte range of its group.
+///
+
+typedef struct {
+	uint32_t group;
+	char* path;
+} src_group_rule;
+
+static int IsSeparator(char c)
+{
+	return c == '/' || c == '\\';
+}
+
+// rule names path itself or a directory above it
+static int RuleMatches(const char* rule, const char* path)
+{
+	for (; *rule; rule += 1, path += 1) {
+		if (*rule != *path && !(IsSeparator(*rule) && IsSeparator(*path))) return 0;
+	}
+	return *path == '\0' || IsSeparator(*path);
+}
+
+static uint32_t FindOrAddGroup(src_group_table* groups, const char* name, size_t len)
+{
+	for (uint32_t i = 0; i < groups->count; i += 1) {
+		if (strlen(groups->names[i]) == len && memcmp(groups->names[i], name, len) == 0) return i;
+	}
+	groups->names = (char**)realloc(groups->names, (groups->count + 1) * sizeof(char*));
+	char* copy = (char*)malloc(len + 1);
+	memcpy(copy, name, len);
+	copy[len] = '\0';
+	groups->names[groups->count] = copy;
+	return groups->count++;
+}
+
+static int ReadGroupFile(const char* path, src_group_table* groups, src_group_rule** rules, size_t* ruleCount)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		LOGF_MSG("Failed to open group file \"%s\"", path);
+		return 0;
+	}
+	char line[4096];
+	int lineNumber = 0;
+	int succ = 1;
+	while (succ && fgets(line, sizeof(line), file)) {
+		lineNumber += 1;
+		size_t len = strlen(line);
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' ' || line[len - 1] == '\t'
+			|| IsSeparator(line[len - 1]))) {
+			line[--len] = '\0';
+		}
+		const char* c = line;
+		while (*c == ' ' || *c == '\t') c += 1;
+		if (*c == '\0' || *c == '#') continue;
+
+		const char* name = c;
+		while (*c && *c != ' ' && *c != '\t') c += 1;
+		size_t nameLen = (size_t)(c - name);
+		while (*c == ' ' || *c == '\t') c += 1;
+		if (*c == '\0') {
+			LOGF_MSG("%s:%d: expected a group and a path", path, lineNumber);
+			succ = 0;
+			break;
+		}
+
+		*rules = (src_group_rule*)realloc(*rules, (*ruleCount + 1) * sizeof(src_group_rule));
+		src_group_rule* rule = &(*rules)[(*ruleCount)++];
+		rule->group = FindOrAddGroup(groups, name, nameLen);
+		rule->path = strdup(c);
+	}
+	fclose(file);
+	return succ;
+}
+
+int src_assign_groups(src_context* ctx, const src_file_list* list, uint32_t* fileGroups)
+{
+	src_group_rule* rules = NULL;
+	size_t ruleCount = 0;
+	int succ = !ctx->groupFilePath || ReadGroupFile(ctx->groupFilePath, &ctx->groups, &rules, &ruleCount);
+
+	size_t rootLen = strlen(ctx->targetDir);
+	for (size_t i = 0; succ && i < list->count; i += 1) {
+		const char* rel = list->files[i].path + rootLen + 1;
+		while (IsSeparator(*rel)) rel += 1;
+
+		// the group set by a rule goes first
+		fileGroups[i] = list->files[i].group ? FindOrAddGroup(&ctx->groups, list->files[i].group, strlen(list->files[i].group))
+			: SRC_GROUP_NONE;
+		for (size_t r = 0; r < ruleCount && fileGroups[i] == SRC_GROUP_NONE; r += 1) {
+			if (RuleMatches(rules[r].path, rel)) {
+				fileGroups[i] = rules[r].group;
+				break;
+			}
+		}
+		const char* slash = strpbrk(rel, "/\\");
+		if (fileGroups[i] == SRC_GROUP_NONE && ctx->groupByDir && slash) {
+			fileGroups[i] = FindOrAddGroup(&ctx->groups, rel, (size_t)(slash - rel));
+		}
+	}
+
+	for (size_t r = 0; r < ruleCount; r += 1) {
+		free(rules[r].path);
+	}
+	free(rules);
+	ctx->groups.offsets = (uint64_t*)calloc(ctx->groups.count + 1, sizeof(uint64_t));
+	ctx->groups.ends = (uint64_t*)calloc(ctx->groups.count + 1, sizeof(uint64_t));
+	return succ;
+}
+
+void src_write_groups(src_context* ctx)
+{
+	src_fseek64(ctx->outputFile, 0, SEEK_END);
+	uint64_t offset = (uint64_t)src_ftell64(ctx->outputFile);
+
+	src_group_header header = { 0 };
+	strcpy(header.header, SRC_GROUP_HEADER_VALUE);
+	header.groupCount = ctx->groups.count;
+	WRITE_STRUCT(header, ctx->outputFile);
+
+	for (uint32_t i = 0; i < ctx->groups.count; i += 1) {
+		src_group_entry entry = { 0 };
+		entry.offset = ctx->groups.offsets[i];
+		entry.size = ctx->groups.ends[i] - ctx->groups.offsets[i];
+		header.checksum = src_crc32c(&entry, sizeof(entry), header.checksum);
+		WRITE_STRUCT(entry, ctx->outputFile);
+	}
+	for (uint32_t i = 0; i < ctx->groups.count; i += 1) {
+		size_t len = strlen(ctx->groups.names[i]) + 1;
+		header.checksum = src_crc32c(ctx->groups.names[i], len, header.checksum);
+		header.namesSize += (uint32_t)len;
+		WRITE_DATA(ctx->groups.names[i], len, ctx->outputFile);
+	}
+	// the next section stays aligned
+	static const char padding[SRC_RECORD_ALIGNMENT] = { 0 };
+	WRITE_DATA(padding, (SRC_RECORD_ALIGNMENT - header.namesSize % SRC_RECORD_ALIGNMENT) % SRC_RECORD_ALIGNMENT, ctx->outputFile);
+
+	// update group header with the checksum
+	src_fseek64(ctx->outputFile, offset, SEEK_SET);
+	WRITE_STRUCT(header, ctx->outputFile);
+	src_fseek64(ctx->outputFile, 0, SEEK_END);
+}
+
+void src_group_table_free(src_group_table* groups)
+{
+	for (uint32_t i = 0; i < groups->count; i += 1) {
+		free(groups->names[i]);
+	}
+	free(groups->names);
+	free(groups->offsets);
+	free(groups->ends);
+	memset(groups, 0, sizeof(src_group_table));
+}
@@ -2,7 +2,27 @@
 //       move this to another function instead
 static const char* src_helper_definitions = 
     "const char* src_get_%s_resource_name(int32_t id);\n"
-    "size_t src_get_%s_resource_offset(int32_t id);\n"
+    "// offset of the record in the archive, UINT64_MAX for resources inlined into this header\n"
+    "uint64_t src_get_%s_resource_offset(int32_t id);\n"
+    "";
+
+static const char* src_helper_view_definitions = 
+    "// resources not inlined into this header are read from the bound archive\n"
+    "void src_bind_%s_archive(const src_archive* archive);\n"
+    "// Goes through src_archive_get, so SRC_OPEN_VERIFY_ON_ACCESS and SRC_OPEN_COUNTERS apply.\n"
+    "// The data is NULL when no archive is bound, the data failed verification or the resource\n"
+    "// is chunked or compressed, read those with src_archive_read. Empty resources have data.\n"
+    "src_view src_get_%s_resource(int32_t id);\n"
+    "";
+
+static const char* src_helper_shard_view_definitions = 
+    "// binds the shards in the order of their numbers, e.g. src_sharded_archive.shards,\n"
+    "// a resource is read from the shard src_get_<name>_resource_shard names\n"
+    "void src_bind_%s_archive(const src_archive* shards);\n"
+    "// Goes through src_archive_get, so SRC_OPEN_VERIFY_ON_ACCESS and SRC_OPEN_COUNTERS apply.\n"
+    "// The data is NULL when no shards are bound, the data failed verification or the resource\n"
+    "// is chunked or compressed, read those with src_archive_read. Empty resources have data.\n"
+    "src_view src_get_%s_resource(int32_t id);\n"
     "";
 
 static const char* src_helper_impl = 
@@ -11,7 +31,55 @@ static const char* src_helper_impl =
     "\t" "return name;\n"
     "}\n\n"
 
-    "size_t src_get_%s_resource_offset(int32_t id) {\n"
-    "\t" "size_t offset = %s_RESOURCE_OFFSETS[id];\n"
+    "uint64_t src_get_%s_resource_offset(int32_t id) {\n"
+    "\t" "uint64_t offset = %s_RESOURCE_OFFSETS[id];\n"
     "\t" "return offset;\n"
-    "}\n\n";
\ No newline at end of file
+    "}\n\n";
+
+static const char* src_helper_shard_definitions = 
+    "uint32_t src_get_%s_resource_shard(int32_t id);\n"
+    "";
+
+static const char* src_helper_shard_impl = 
+    "uint32_t src_get_%s_resource_shard(int32_t id) {\n"
+    "\t" "return %s_RESOURCE_SHARDS[id];\n"
+    "}\n\n";
+
+static const char* src_helper_view_impl = 
+    "static const src_archive* %s_ARCHIVE = NULL;\n\n"
+
+    "void src_bind_%s_archive(const src_archive* archive) {\n"
+    "\t" "%s_ARCHIVE = archive;\n"
+    "}\n\n"
+
+    "src_view src_get_%s_resource(int32_t id) {\n"
+    "\t" "src_view view = { NULL, 0 };\n"
+    "\t" "if (%s_RESOURCE_INLINE_DATA[id]) {\n"
+    "\t\t" "view.data = %s_RESOURCE_INLINE_DATA[id];\n"
+    "\t\t" "view.size = (size_t)%s_RESOURCE_SIZES[id];\n"
+    "\t" "}\n"
+    "\t" "else if (%s_ARCHIVE) {\n"
+    "\t\t" "src_archive_get(%s_ARCHIVE, &%s_ARCHIVE->entries[%s_RESOURCE_ARCHIVE_INDEX[id]], &view);\n"
+    "\t" "}\n"
+    "\t" "return view;\n"
+    "}\n\n";
+
+static const char* src_helper_shard_view_impl = 
+    "static const src_archive* %s_ARCHIVE = NULL;\n\n"
+
+    "void src_bind_%s_archive(const src_archive* shards) {\n"
+    "\t" "%s_ARCHIVE = shards;\n"
+    "}\n\n"
+
+    "src_view src_get_%s_resource(int32_t id) {\n"
+    "\t" "src_view view = { NULL, 0 };\n"
+    "\t" "if (%s_RESOURCE_INLINE_DATA[id]) {\n"
+    "\t\t" "view.data = %s_RESOURCE_INLINE_DATA[id];\n"
+    "\t\t" "view.size = (size_t)%s_RESOURCE_SIZES[id];\n"
+    "\t" "}\n"
+    "\t" "else if (%s_ARCHIVE) {\n"
+    "\t\t" "const src_archive* shard = &%s_ARCHIVE[%s_RESOURCE_SHARDS[id]];\n"
+    "\t\t" "src_archive_get(shard, &shard->entries[%s_RESOURCE_ARCHIVE_INDEX[id]], &view);\n"
+    "\t" "}\n"
+    "\t" "return view;\n"
+    "}\n\n";
@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simple_resource_compiler.h"
+#include "src_tool.h"
+#include "src_thread.h"
+
+/// 
+/// Usage: src.exe -t "resources/" -o "data.src"
+///        src.exe diff "old.src" "new.src" -o "patch.srcp"
+///        src.exe patch "old.src" "patch.srcp" -o "new.src"
+///        src.exe verify "data.src"
+///        src.exe merge "a.src" "b.src" -o "out.src"
+/// 
+
+static void PrintUsage() {
+	LOGR_MSG("Usage:\tsrc.exe -t \"resources/\" -o \"data.src\"");
+	LOGR_MSG("\t-t : Target directory");
+	LOGR_MSG("\t-o : Output file");
+	LOGR_MSG("\t-s : Source output directory");
+	LOGR_MSG("\t-v : Verbose switch");
+	LOGR_MSG("\t-j : Number of threads scanning the target directory");
+	LOGR_MSG("\t-d : Resource path relative to the target directory to mark as deleted, hides it in lower priority archives");
+	LOGR_MSG("\t--depfile : Write a make style depfile listing every file and directory scanned");
+	LOGR_MSG("\t--rules : File of include and exclude rules with per glob settings");
+	LOGR_MSG("\t--include : Glob of files to pack");
+	LOGR_MSG("\t--exclude : Glob of files and directories to skip");
+	LOGR_MSG("\t--watch : Keep running and update the archive in place when files change");
+	LOGR_MSG("\t--transform : Extension and built-in transform run on those files before packing, e.g. .json=json-minify");
+	LOGR_MSG("\t--transform-cmd : Extension and command converting those files from stdin to stdout");
+	LOGR_MSG("\t--cache : Directory of the transformed files, \"<output>.cache\" by default");
+	LOGR_MSG("\t--inline-threshold : Resources up to this many bytes are embedded in the generated header");
+	LOGR_MSG("\t--chunk-threshold : Files of at least this many bytes are split into chunks, identical chunks are stored once");
+	LOGR_MSG("\t--compress : Compress the resources against a dictionary trained on them");
+	LOGR_MSG("\t--dict-size : Size of the dictionary in bytes, 32768 by default, 0 for none");
+	LOGR_MSG("\t--frame-size : Larger files are compressed in frames of this many bytes for range reads, 262144 by default, 0 for none");
+	LOGR_MSG("\t--stats : Print the sizes and the dedup ratio of the archive");
+	LOGR_MSG("\t--groups : File of \"group path\" lines, the resources of a group are placed contiguously");
+	LOGR_MSG("\t--group-by-dir : Every top level directory not named in the group file is a group");
+	LOGR_MSG("\t--shards : Split the output into this many shards by path hash, the output becomes their index");
+	LOGR_MSG("\t--shard-size : Split the output into shards of about this many bytes");
+	LOGR_MSG("\t--shard-by-dir : Split the output into one shard per top level directory");
+	LOGR_MSG("\t--shard : Only write this shard");
+	LOGR_MSG("\t--shard-index : Only write the index and header of shards written before");
+	LOGR_MSG("\tsrc.exe diff \"old.src\" \"new.src\" -o \"patch.srcp\"");
+	LOGR_MSG("\tsrc.exe patch \"old.src\" \"patch.srcp\" -o \"new.src\"");
+	LOGR_MSG("\tsrc.exe verify \"data.src\" [-j threads]");
+	LOGR_MSG("\tsrc.exe merge \"a.src\" \"b.src\" ... -o \"out.src\" [-s headerDir] [--conflict error|first|last] [--no-copy-range]");
+	LOGR_MSG("\tsrc.exe analyze \"data.src\" [-j threads] [--top 20] [--json \"report.json\"] [--trace \"trace.txt\"] [--page-size 4096]");
+}
+
+int main(int argc, char** argv) {
+	if (argc <= 1) {
+		PrintUsage();
+		return -1;
+	}
+
+	if (strcmp(argv[1], "diff") == 0) {
+		return src_diff_main(argc - 1, argv + 1);
+	}
+	if (strcmp(argv[1], "patch") == 0) {
+		return src_patch_main(argc - 1, argv + 1);
+	}
+	if (strcmp(argv[1], "verify") == 0) {
+		return src_verify_main(argc - 1, argv + 1);
+	}
+	if (strcmp(argv[1], "merge") == 0) {
+		return src_merge_main(argc - 1, argv + 1);
+	}
+	if (strcmp(argv[1], "analyze") == 0) {
+		return src_analyze_main(argc - 1, argv + 1);
+	}
+
+	src_context ctx = {0};
+	const char* outputPath = "compiled.src";
+	const char* headerDir = NULL;
+	ctx.threadCount = src_cpu_count();
+	ctx.shardSelect = SRC_SHARD_ALL;
+	ctx.dictionaryCapacity = SRC_DICT_DEFAULT_SIZE;
+	ctx.frameSize = SRC_FRAME_DEFAULT_SIZE;
+	int handledArgs = 1;
+
+	while (handledArgs < argc) {
+		const char* arg = argv[handledArgs];
+		if (arg[0] != '-' 
+			|| (handledArgs + 1 == argc && strcmp(arg, "-v") != 0 && strcmp(arg, "--watch") != 0 && strcmp(arg, "--stats") != 0 && strcmp(arg, "--compress") != 0 && strcmp(arg, "--group-by-dir") != 0
+				&& strcmp(arg, "--shard-by-dir") != 0 && strcmp(arg, "--shard-index") != 0)) {
+			PrintUsage();
+			LOGF_MSG("Failed to handle \"%s\"", arg);
+			return -1;
+		}
+
+		if (strcmp(arg, "--watch") == 0) {
+			ctx.watch = 1;
+			handledArgs += 1;
+		}
+		else if (strcmp(arg, "-o") == 0) {
+			outputPath = argv[handledArgs + 1];
+			handledArgs += 2;
+		}
+		else if (strcmp(arg, "-t") == 0) {
+			ctx.targetDir = argv[handledArgs + 1];
+			handledArgs += 2;
+		}
+		else if(strcmp(arg, "-s") == 0) {
+			headerDir = argv[handledArgs + 1];
+			handledArgs += 2;
+		}
+		else if(strcmp(arg, "-j") == 0) {
+			ctx.threadCount = atoi(argv[handledArgs + 1]);
+			handledArgs += 2;
+		}
+		else if(strcmp(arg, "--depfile") == 0) {
+			ctx.depfilePath = argv[handledArgs + 1];
+			handledArgs += 2;
+		}
+		else if(strcmp(arg, "--rules") == 0) {
+			if (!src_rules_read(&ctx.rules, argv[handledArgs + 1])) {
+				return -1;
+			}
+			handledArgs += 2;
+		}
+		else if(strcmp(arg, "--include") == 0 || strcmp(arg, "--exclude") == 0) {
+			src_rules_add(&ctx.rules, strcmp(arg, "--include") == 0, argv[handledArgs + 1]);
+			handledArgs += 2;
+		}
+		else if(strcmp(arg, "--transform") == 0 || strcmp(arg, "--transform-cmd") == 0) {
+			if (!src_add_transform(&ctx, argv[handledArgs + 1], strcmp(arg, "--transform-cmd") == 0)) {
+				return -1;
+			}
+			handledArgs += 2;
+		}
+		else if(strcmp(arg, "--cache") == 0) {
+			ctx.cacheDir = argv[handledArgs + 1];
+			handledArgs += 2;
+		}
+		else if(strcmp(arg, "--inline-threshold") == 0) {
+			ctx.inlineThreshold = strtoull(argv[handledArgs + 1], NULL, 10);
+			handledArgs += 2;
+		}
+		else if(strcmp(arg, "--chunk-threshold") == 0) {
+			ctx.chunkThreshold = strtoull(argv[handledArgs + 1], NULL, 10);
+			handledArgs += 2;
+		}
+		else if(strcmp(arg, "--compress") == 0) {
+			ctx.compress = SRC_COMPRESS_ALL;
+			handledArgs += 1;
+		}
+		else if(strcmp(arg, "--dict-size") == 0) {
+			ctx.dictionaryCapacity = (size_t)strtoull(argv[handledArgs + 1], NULL, 10);
+			// matches can't reach further back
+			if (ctx.dictionaryCapacity > SRC_LZ_MAX_OFFSET) ctx.dictionaryCapacity = SRC_LZ_MAX_OFFSET;
+			handledArgs += 2;
+		}
+		else if(strcmp(arg, "--frame-size") == 0) {
+			uint64_t frameSize = strtoull(argv[handledArgs + 1], NULL, 10);
+			// every thread holds a frame and its compressed copy
+			ctx.frameSize = (uint32_t)(frameSize < SRC_FRAME_MAX_SIZE ? frameSize : SRC_FRAME_MAX_SIZE);
+			handledArgs += 2;
+		}
+		else if(strcmp(arg, "--stats") == 0) {
+			ctx.stats = 1;
+			handledArgs += 1;
+		}
+		else if(strcmp(arg, "--groups") == 0) {
+			ctx.groupFilePath = argv[handledArgs + 1];
+			handledArgs += 2;
+		}
+		else if(strcmp(arg, "--group-by-dir") == 0) {
+			ctx.groupByDir = 1;
+			handledArgs += 1;
+		}
+		else if(strcmp(arg, "--shards") == 0) {
+			ctx.shardMode = SRC_SHARD_HASH;
+			ctx.shardCount = (uint32_t)strtoul(argv[handledArgs + 1], NULL, 10);
+			handledArgs += 2;
+		}
+		else if(strcmp(arg, "--shard-size") == 0) {
+			ctx.shardMode = SRC_SHARD_SIZE;
+			ctx.shardSize = strtoull(argv[handledArgs + 1], NULL, 10);
+			handledArgs += 2;
+		}
+		else if(strcmp(arg, "--shard-by-dir") == 0) {
+			ctx.shardMode = SRC_SHARD_DIR;
+			handledArgs += 1;
+		}
+		else if(strcmp(arg, "--shard") == 0) {
+			ctx.shardSelect = (uint32_t)strtoul(argv[handledArgs + 1], NULL, 10);
+			handledArgs += 2;
+		}
+		else if(strcmp(arg, "--shard-index") == 0) {
+			ctx.shardIndexOnly = 1;
+			handledArgs += 1;
+		}
+		else if(strcmp(arg, "-d") == 0) {
+			ctx.tombstones = (const char**)realloc(ctx.tombstones, (ctx.tombstoneCount + 1) * sizeof(const char*));
+			ctx.tombstones[ctx.tombstoneCount++] = argv[handledArgs + 1];
+			handledArgs += 2;
+		}
+		else if(strcmp(arg, "-v") == 0) {
+			verbose = 0;
+			handledArgs += 1;
+		}
+		else {
+			LOGF_MSG("Failed to handle \"%s\"", arg);
+			return -1;
+		}
+	}
+	
+	if(!ctx.targetDir) {
+		return -1;
+	}
+	if(!headerDir) {
+		return -1;
+	}
+	ctx.rules.root = ctx.targetDir;
+	if (!ctx.compress && ctx.rules.compress) {
+		ctx.compress = SRC_COMPRESS_RULES;
+	}
+	if (ctx.watch && ctx.inlineThreshold) {
+		// changed files are appended to the archive, the header isn't inlined into again
+		LOGR_MSG("--inline-threshold is ignored with --watch");
+		ctx.inlineThreshold = 0;
+	}
+	if (ctx.watch && ctx.chunkThreshold) {
+		// updated records would leave the chunks other records share behind
+		LOGR_MSG("--chunk-threshold is ignored with --watch");
+		ctx.chunkThreshold = 0;
+	}
+	if (ctx.watch && (ctx.groupFilePath || ctx.groupByDir || ctx.rules.groups)) {
+		// updated records are appended, they would leave their group
+		LOGR_MSG("--groups, --group-by-dir and group rules are ignored with --watch");
+		ctx.groupFilePath = NULL;
+		ctx.groupByDir = 0;
+		ctx.rules.groups = 0;
+	}
+	if (ctx.watch && ctx.transformCount) {
+		// changed files are packed as they are
+		LOGR_MSG("--transform and --transform-cmd are ignored with --watch");
+		for (size_t i = 0; i < ctx.transformCount; i += 1) {
+			free((char*)ctx.transforms[i].extension);
+		}
+		ctx.transformCount = 0;
+	}
+	if (ctx.watch && ctx.compress) {
+		// updated records would have to be compressed against a dictionary trained without them
+		LOGR_MSG("--compress and compress rules are ignored with --watch");
+		ctx.compress = 0;
+	}
+	if (ctx.shardMode != SRC_SHARD_NONE && (ctx.watch || ctx.inlineThreshold || ctx.chunkThreshold || ctx.groupFilePath || ctx.groupByDir
+		|| ctx.rules.groups || ctx.compress)) {
+		LOGR_MSG("--watch, --inline-threshold, --chunk-threshold, groups and --compress are ignored for sharded output");
+		ctx.watch = 0;
+		ctx.inlineThreshold = 0;
+		ctx.chunkThreshold = 0;
+		ctx.groupFilePath = NULL;
+		ctx.groupByDir = 0;
+		ctx.rules.groups = 0;
+		ctx.compress = 0;
+	}
+	src_context_set_output(&ctx, outputPath, headerDir);
+
+	printf("Running with Output: \"%s\"\n", ctx.outputFilePath);
+	printf("Running with Input: \"%s\"\n", ctx.targetDir);
+	printf("Running with Header: \"%s\"\n", ctx.outputHeaderPath);
+
+	if (ctx.shardMode != SRC_SHARD_NONE) {
+		return src_pack_sharded(&ctx);
+	}
+
+	int succ = StartPacking(&ctx);
+	if (succ == 0 && ctx.watch) {
+		succ = src_watch(&ctx);
+	}
+	return succ;
+}
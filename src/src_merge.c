@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simple_resource_compiler.h"
+#include "src_tool.h"
+
+///
+/// Merging archives.
+///
+/// Usage: src.exe merge "a.src" "b.src" ... -o "out.src" [-s "headerDir"] [--conflict error|first|last] [--no-copy-range]
+///
+/// Only the TOCs and record headers of the inputs are read. Records don't depend
+/// on their position, so every resource is copied as its whole record, runs of
+/// records which stay adjacent as one range. Records whose data the rules
+/// aligned are padded to the same alignment in the output. On Linux the ranges are copied with
+/// copy_file_range, which clones them on file systems with reflinks and keeps
+/// them in the kernel otherwise, --no-copy-range writes them from the mapping.
+/// The output gets a fresh TOC and the generated header numbers the merged
+/// resources by path, tombstones last.
+///
+/// A path in more than one input is a conflict unless the records carry the same
+/// data (size and checksum). --conflict picks the record of the first or last
+/// input listing it, by default conflicts fail the merge. Sharded indexes,
+/// chunked resources, whose chunks are referenced by their offset in the input,
+/// and archives with groups or compressed against a dictionary, tables the
+/// output wouldn't have, can't be merged. Resources inlined into the generated header of an input
+/// aren't in its archive, they are reported and left out.
+///
+
+#if defined(__linux__)
+#include <errno.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+enum {
+	SRC_MERGE_CONFLICT_ERROR,
+	SRC_MERGE_CONFLICT_FIRST,
+	SRC_MERGE_CONFLICT_LAST,
+};
+
+typedef struct {
+	const src_archive_entry* entry;
+	int input;
+	uint64_t recordOffset; // in the input
+} src_merge_entry;
+
+static int CompareMergeEntry(const void* a, const void* b)
+{
+	const src_merge_entry* ea = (const src_merge_entry*)a;
+	const src_merge_entry* eb = (const src_merge_entry*)b;
+	int cmp = strcmp(ea->entry->name, eb->entry->name);
+	return cmp != 0 ? cmp : ea->input - eb->input;
+}
+
+// generated id order, tombstones last
+static void MoveTombstonesLast(src_merge_entry* entries, size_t count)
+{
+	src_merge_entry* sorted = (src_merge_entry*)malloc((count + 1) * sizeof(src_merge_entry));
+	size_t n = 0;
+	for (int tombstones = 0; tombstones < 2; tombstones += 1) {
+		for (size_t i = 0; i < count; i += 1) {
+			int tombstone = (entries[i].entry->header->flags & SRC_RESOURCE_FLAG_TOMBSTONE) != 0;
+			if (tombstone == tombstones) sorted[n++] = entries[i];
+		}
+	}
+	memcpy(entries, sorted, count * sizeof(src_merge_entry));
+	free(sorted);
+}
+
+// copies length bytes at offset of the input to the end of out
+static int CopyRange(FILE* out, const src_archive* input, uint64_t offset, uint64_t length, int copyRange)
+{
+#if defined(__linux__) && defined(SYS_copy_file_range)
+	if (copyRange) {
+		if (fflush(out) != 0) return 0;
+		int64_t inPos = (int64_t)offset;
+		int64_t outPos = (int64_t)src_ftell64(out);
+		while (length > 0) {
+			long copied = syscall(SYS_copy_file_range, input->fd, &inPos, fileno(out), &outPos, (size_t)length, 0);
+			if (copied < 0 && errno == EINTR) continue;
+			// not supported between these files, the rest is written from the mapping
+			if (copied <= 0) break;
+			length -= (uint64_t)copied;
+		}
+		offset = (uint64_t)inPos;
+		src_fseek64(out, outPos, SEEK_SET);
+	}
+#else
+	(void)copyRange;
+#endif
+	return length == 0 || fwrite(input->base + offset, 1, (size_t)length, out) == length;
+}
+
+static int ParseMergeArgs(int argc, char** argv, const char*** inputs, int* inputCount,
+	const char** output, const char** headerDir, int* conflict, int* copyRange)
+{
+	*inputs = (const char**)malloc(argc * sizeof(const char*));
+	*inputCount = 0;
+	*output = NULL;
+	*headerDir = NULL;
+	*conflict = SRC_MERGE_CONFLICT_ERROR;
+	*copyRange = 1;
+	for (int i = 1; i < argc; i += 1) {
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			*output = argv[++i];
+		}
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			*headerDir = argv[++i];
+		}
+		else if (strcmp(argv[i], "--conflict") == 0 && i + 1 < argc) {
+			const char* policy = argv[++i];
+			if (strcmp(policy, "error") == 0) *conflict = SRC_MERGE_CONFLICT_ERROR;
+			else if (strcmp(policy, "first") == 0) *conflict = SRC_MERGE_CONFLICT_FIRST;
+			else if (strcmp(policy, "last") == 0) *conflict = SRC_MERGE_CONFLICT_LAST;
+			else {
+				LOGF_MSG("Unknown conflict policy \"%s\"", policy);
+				return 0;
+			}
+		}
+		else if (strcmp(argv[i], "--no-copy-range") == 0) {
+			*copyRange = 0;
+		}
+		else if (strcmp(argv[i], "-v") == 0) {
+			verbose = 0;
+		}
+		else if (argv[i][0] == '-') {
+			LOGF_MSG("Failed to handle \"%s\"", argv[i]);
+			return 0;
+		}
+		else {
+			(*inputs)[(*inputCount)++] = argv[i];
+		}
+	}
+	return *inputCount > 0 && *output;
+}
+
+// picks one record per path, returns the number of conflicts which weren't resolved
+static size_t ResolveConflicts(src_merge_entry* entries, size_t* count, int conflict, const char* const* inputs)
+{
+	size_t failed = 0;
+	size_t kept = 0;
+	for (size_t i = 0; i < *count;) {
+		size_t end = i + 1;
+		while (end < *count && strcmp(entries[end].entry->name, entries[i].entry->name) == 0) end += 1;
+
+		size_t winner = conflict == SRC_MERGE_CONFLICT_LAST ? end - 1 : i;
+		for (size_t k = i + 1; k < end; k += 1) {
+			const src_resource_header* a = entries[i].entry->header;
+			const src_resource_header* b = entries[k].entry->header;
+			if (a->resourceSize == b->resourceSize && a->checksum == b->checksum && a->flags == b->flags) continue;
+			if (conflict == SRC_MERGE_CONFLICT_ERROR) {
+				LOGF_MSG("Conflict: \"%s\" differs in \"%s\" and \"%s\"", entries[i].entry->name,
+					inputs[entries[i].input], inputs[entries[k].input]);
+				failed += 1;
+				break;
+			}
+			LOGF_MSG("Conflict: \"%s\", taking it from \"%s\"", entries[i].entry->name, inputs[entries[winner].input]);
+			break;
+		}
+		entries[kept++] = entries[winner];
+		i = end;
+	}
+	*count = kept;
+	return failed;
+}
+
+static int WriteMerged(src_context* ctx, const src_archive* archives, const src_merge_entry* entries, size_t count, int copyRange)
+{
+	ctx->outputFile = fopen(ctx->outputFilePath, "wb+");
+	if (!ctx->outputFile) {
+		LOGF_MSG("Failed to open output file \"%s\"", ctx->outputFilePath);
+		return 0;
+	}
+	src_write_header(ctx, 0, 0);
+
+	// a run of records adjacent in the same input is one copy
+	int succ = 1;
+	size_t rangeCount = 0;
+	uint64_t copiedBytes = 0;
+	uint64_t runStart = 0;
+	uint64_t runLength = 0;
+	int runInput = -1;
+	uint64_t offset = (uint64_t)src_ftell64(ctx->outputFile);
+	for (size_t i = 0; i <= count && succ; i += 1) {
+		const src_merge_entry* e = i < count ? &entries[i] : NULL;
+		// data the rules aligned is padded to the same alignment, the padding ends the run
+		uint32_t alignment = e ? src_record_alignment(e->entry->header) : SRC_RECORD_ALIGNMENT;
+		int pad = alignment > SRC_RECORD_ALIGNMENT && (offset + src_record_data_offset(e->entry->header)) % alignment != 0;
+		if (runLength > 0 && (!e || pad || e->input != runInput || e->recordOffset != runStart + runLength)) {
+			succ = CopyRange(ctx->outputFile, &archives[runInput], runStart, runLength, copyRange);
+			copiedBytes += runLength;
+			rangeCount += 1;
+			runLength = 0;
+		}
+		if (!e) break;
+		if (pad) {
+			src_align_record_data(ctx->outputFile, e->entry->name, alignment);
+			offset = (uint64_t)src_ftell64(ctx->outputFile);
+		}
+
+		uint64_t recordSize = src_record_size(e->entry->header);
+		if (runLength == 0) {
+			runInput = e->input;
+			runStart = e->recordOffset;
+		}
+		runLength += recordSize;
+		src_add_entry(ctx, e->entry->name, offset, recordSize, e->entry->header->resourceSize, e->entry->header->flags)->alignment
+			= alignment > SRC_RECORD_ALIGNMENT ? alignment : 0;
+		offset += recordSize;
+	}
+
+	uint64_t tocOffset = src_write_toc(ctx);
+	src_write_header(ctx, ctx->entryCount, tocOffset);
+	succ = !ferror(ctx->outputFile) && succ;
+	succ = fclose(ctx->outputFile) == 0 && succ;
+	ctx->outputFile = NULL;
+
+	if (succ) {
+		LOGF_MSG("Copied %llu bytes in %zu ranges", (unsigned long long)copiedBytes, rangeCount);
+	}
+	return succ;
+}
+
+int src_merge_main(int argc, char** argv)
+{
+	const char** inputs;
+	int inputCount;
+	const char* output;
+	const char* headerDir;
+	int conflict;
+	int copyRange;
+	if (!ParseMergeArgs(argc, argv, &inputs, &inputCount, &output, &headerDir, &conflict, &copyRange)) {
+		LOGR_MSG("Usage:\tsrc.exe merge \"a.src\" \"b.src\" ... -o \"out.src\" [-s headerDir] [--conflict error|first|last] [--no-copy-range]");
+		free(inputs);
+		return -1;
+	}
+
+	int succ = 1;
+	size_t total = 0;
+	size_t inlined = 0;
+	int opened = 0;
+	src_archive* archives = (src_archive*)calloc(inputCount, sizeof(src_archive));
+	for (; opened < inputCount; opened += 1) {
+		if (!src_archive_open(&archives[opened], inputs[opened])) {
+			LOGF_MSG("\"%s\": header or table of contents didn't validate.", inputs[opened]);
+			succ = 0;
+			break;
+		}
+		if (archives[opened].groupCount) {
+			LOGF_MSG("\"%s\": archives with groups can't be merged.", inputs[opened]);
+			succ = 0;
+		}
+		if (archives[opened].dictionary.size) {
+			LOGF_MSG("\"%s\": resources compressed against a dictionary can't be merged.", inputs[opened]);
+			succ = 0;
+		}
+		for (size_t i = 0; i < archives[opened].entryCount && succ; i += 1) {
+			if (archives[opened].entries[i].header->flags & SRC_RESOURCE_FLAG_CHUNKED) {
+				LOGF_MSG("\"%s\": chunked resources can't be merged.", inputs[opened]);
+				succ = 0;
+			}
+		}
+		uint32_t inlineCount = ((const src_main_header*)archives[opened].base)->inlineCount;
+		if (inlineCount) {
+			LOGF_MSG("\"%s\": %u resources are inlined into its generated header, they aren't merged.", inputs[opened], inlineCount);
+			inlined += inlineCount;
+		}
+		total += archives[opened].entryCount;
+	}
+
+	src_merge_entry* entries = (src_merge_entry*)malloc((total + 1) * sizeof(src_merge_entry));
+	size_t count = 0;
+	for (int i = 0; i < opened && succ; i += 1) {
+		for (size_t k = 0; k < archives[i].entryCount; k += 1) {
+			src_merge_entry* e = &entries[count++];
+			e->entry = &archives[i].entries[k];
+			e->input = i;
+			e->recordOffset = (uint64_t)((const unsigned char*)e->entry->header - archives[i].base);
+		}
+	}
+	qsort(entries, count, sizeof(src_merge_entry), CompareMergeEntry);
+
+	if (succ && ResolveConflicts(entries, &count, conflict, inputs) != 0) {
+		LOGR_MSG("Merge failed, pick a --conflict policy");
+		succ = 0;
+	}
+	MoveTombstonesLast(entries, count);
+
+	src_context ctx = { 0 };
+	if (succ) {
+		src_context_set_output(&ctx, output, headerDir);
+		succ = WriteMerged(&ctx, archives, entries, count, copyRange);
+		if (succ && headerDir) {
+			succ = src_write_generated_header(&ctx);
+		}
+		if (!succ) {
+			remove(output);
+		}
+		else {
+			LOGF_MSG("Merged %zu resources from %d archives, left out %zu inlined ones", count, inputCount, inlined);
+		}
+		src_context_free(&ctx);
+	}
+
+	for (int i = 0; i < opened; i += 1) {
+		src_archive_close(&archives[i]);
+	}
+	free(archives);
+	free(entries);
+	free(inputs);
+	return succ ? 0 : -1;
+}
@@ -0,0 +1,590 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simple_resource_compiler.h"
+#include "src_tool.h"
+
+///
+/// Binary patches between two archive versions.
+///
+/// Usage: src.exe diff "old.src" "new.src" -o "patch.srcp"
+///        src.exe patch "old.src" "patch.srcp" -o "new.src"
+///
+/// A patch is a list of ops which rebuild the new archive front to back.
+/// COPY takes bytes from the old archive, INSERT carries its bytes in the patch.
+/// Unchanged resources (same path or same content) are copied by reference,
+/// changed ones only ship the bytes between their common prefix and suffix.
+/// Nothing else is matched: an edit at the start and one at the end of a
+/// resource ship all of it, and moved blocks are shipped again.
+///
+
+#define SRC_PATCH_HEADER_VALUE "SRCPTCH"
+#define SRC_PATCH_VERSION 1
+
+typedef struct {
+	char header[8]; // == SRC_PATCH_HEADER_VALUE
+	int32_t version; // == SRC_PATCH_VERSION
+	uint64_t oldSize; // size of the archive the patch applies to
+	uint64_t newSize; // size of the archive the patch produces
+	uint64_t newHash; // src_fnv1a64 of the archive the patch produces
+	uint64_t opCount;
+	// after the header follows
+	/* op, for SRC_PATCH_OP_INSERT followed by its data */
+} src_patch_header;
+
+enum {
+	SRC_PATCH_OP_COPY = 1,
+	SRC_PATCH_OP_INSERT = 2,
+};
+
+typedef struct {
+	uint32_t type;
+	uint32_t reserved;
+	uint64_t offset; // offset into the old archive (SRC_PATCH_OP_COPY)
+	uint64_t length;
+} src_patch_op;
+
+// changed resources below this amount of shared bytes are shipped whole
+#define SRC_PATCH_MIN_DELTA 64
+#define SRC_PATCH_BUFFER_SIZE (64 * 1024)
+
+typedef struct {
+	src_resource_header header;
+	char* name;
+	uint64_t recordOffset;
+	uint64_t dataOffset;
+	uint64_t hash;
+} src_patch_entry;
+
+typedef struct {
+	FILE* oldFile;
+	FILE* newFile;
+	FILE* patchFile;
+
+	// resources of the old archive sorted by name and by content
+	src_patch_entry* entries;
+	size_t entryCount;
+	src_patch_entry** byContent;
+
+	// the last op is kept open to merge adjacent ranges
+	src_patch_op lastOp;
+	uint64_t lastOpPos;
+	int hasLastOp;
+
+	uint64_t opCount;
+	uint64_t copiedBytes;
+	uint64_t insertedBytes;
+} src_diff_context;
+
+static int ParsePatchArgs(int argc, char** argv, const char** first, const char** second, const char** output)
+{
+	*first = NULL;
+	*second = NULL;
+	*output = NULL;
+	for (int i = 1; i < argc; i += 1) {
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			*output = argv[i + 1];
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-v") == 0) {
+			verbose = 0;
+		}
+		else if (!*first) {
+			*first = argv[i];
+		}
+		else if (!*second) {
+			*second = argv[i];
+		}
+		else {
+			LOGF_MSG("Failed to handle \"%s\"", argv[i]);
+			return 0;
+		}
+	}
+	return *first && *second && *output;
+}
+
+static uint64_t GetFileSize64(FILE* file)
+{
+	src_fseek64(file, 0, SEEK_END);
+	uint64_t size = (uint64_t)src_ftell64(file);
+	src_fseek64(file, 0, SEEK_SET);
+	return size;
+}
+
+// hashes len bytes from the current position, optionally copying them to dst
+static int HashRange(FILE* src, uint64_t len, uint64_t* hash, FILE* dst)
+{
+	static char buffer[SRC_PATCH_BUFFER_SIZE];
+	while (len != 0) {
+		size_t chunk = len < sizeof(buffer) ? (size_t)len : sizeof(buffer);
+		if (fread(buffer, 1, chunk, src) != chunk) return 0;
+		*hash = src_fnv1a64(buffer, chunk, *hash);
+		if (dst && fwrite(buffer, 1, chunk, dst) != chunk) return 0;
+		len -= chunk;
+	}
+	return 1;
+}
+
+static int ReadRecord(FILE* file, src_resource_header* header, char** name)
+{
+	if (fread(header, sizeof(src_resource_header), 1, file) != 1) return 0;
+	if (!src_validate_sub_header(header) || header->nameLen == 0) return 0;
+	*name = (char*)malloc(header->nameLen);
+	if (fread(*name, 1, header->nameLen, file) != header->nameLen
+		|| (*name)[header->nameLen - 1] != '\0') {
+		free(*name);
+		*name = NULL;
+		return 0;
+	}
+	return 1;
+}
+
+static int CompareEntryName(const void* a, const void* b)
+{
+	return strcmp(((const src_patch_entry*)a)->name, ((const src_patch_entry*)b)->name);
+}
+
+static int CompareEntryContent(const void* a, const void* b)
+{
+	const src_patch_entry* ea = *(const src_patch_entry* const*)a;
+	const src_patch_entry* eb = *(const src_patch_entry* const*)b;
+	if (ea->hash != eb->hash) return ea->hash < eb->hash ? -1 : 1;
+	if (ea->header.resourceSize != eb->header.resourceSize)
+		return ea->header.resourceSize < eb->header.resourceSize ? -1 : 1;
+	return 0;
+}
+
+static int CompareOffset(const void* a, const void* b)
+{
+	uint64_t oa = *(const uint64_t*)a;
+	uint64_t ob = *(const uint64_t*)b;
+	return oa < ob ? -1 : oa > ob ? 1 : 0;
+}
+
+// reads the record offsets listed in the TOC, sorted by offset
+static uint64_t* ReadToc(FILE* file, size_t* count)
+{
+	src_main_header mainHeader;
+	src_toc_header tocHeader;
+	uint64_t fileSize = GetFileSize64(file);
+	if (fread(&mainHeader, sizeof(mainHeader), 1, file) != 1
+		|| !src_validate_header(&mainHeader)
+		|| mainHeader.tocOffset > fileSize - sizeof(src_toc_header)
+		|| src_fseek64(file, mainHeader.tocOffset, SEEK_SET) != 0
+		|| fread(&tocHeader, sizeof(tocHeader), 1, file) != 1
+		|| !src_validate_toc_header(&tocHeader)) {
+		return NULL;
+	}
+	// the count is untrusted, the entries have to fit into the file
+	if (tocHeader.entryCount > (fileSize - mainHeader.tocOffset - sizeof(src_toc_header)) / sizeof(src_toc_entry)) {
+		return NULL;
+	}
+
+	uint64_t* offsets = (uint64_t*)malloc((tocHeader.entryCount + 1) * sizeof(uint64_t));
+	for (size_t i = 0; i < tocHeader.entryCount; i += 1) {
+		src_toc_entry entry;
+		if (fread(&entry, sizeof(entry), 1, file) != 1) {
+			free(offsets);
+			return NULL;
+		}
+		offsets[i] = entry.offset;
+	}
+	qsort(offsets, tocHeader.entryCount, sizeof(uint64_t), CompareOffset);
+	*count = tocHeader.entryCount;
+	return offsets;
+}
+
+static int IndexOldArchive(src_diff_context* ctx)
+{
+	uint64_t* offsets = ReadToc(ctx->oldFile, &ctx->entryCount);
+	if (!offsets) {
+		LOGR_MSG("Old archive header didn't validate.");
+		return 0;
+	}
+
+	ctx->entries = (src_patch_entry*)calloc(ctx->entryCount + 1, sizeof(src_patch_entry));
+	ctx->byContent = (src_patch_entry**)calloc(ctx->entryCount + 1, sizeof(src_patch_entry*));
+	for (size_t i = 0; i < ctx->entryCount; i += 1) {
+		src_patch_entry* entry = &ctx->entries[i];
+		entry->recordOffset = offsets[i];
+		src_fseek64(ctx->oldFile, entry->recordOffset, SEEK_SET);
+		if (!ReadRecord(ctx->oldFile, &entry->header, &entry->name)) {
+			LOGF_MSG("Old archive resource %zu didn't validate.", i);
+			free(offsets);
+			return 0;
+		}
+		entry->dataOffset = entry->recordOffset + src_record_data_offset(&entry->header);
+		src_fseek64(ctx->oldFile, entry->dataOffset, SEEK_SET);
+		entry->hash = SRC_FNV1A64_INIT;
+		if (!HashRange(ctx->oldFile, entry->header.resourceSize, &entry->hash, NULL)) {
+			LOGF_MSG("Old archive resource \"%s\" is truncated.", entry->name);
+			free(offsets);
+			return 0;
+		}
+	}
+	free(offsets);
+
+	qsort(ctx->entries, ctx->entryCount, sizeof(src_patch_entry), CompareEntryName);
+	for (size_t i = 0; i < ctx->entryCount; i += 1) {
+		ctx->byContent[i] = &ctx->entries[i];
+	}
+	qsort(ctx->byContent, ctx->entryCount, sizeof(src_patch_entry*), CompareEntryContent);
+	return 1;
+}
+
+static src_patch_entry* FindByName(src_diff_context* ctx, const char* name)
+{
+	src_patch_entry key = { 0 };
+	key.name = (char*)name;
+	return (src_patch_entry*)bsearch(&key, ctx->entries, ctx->entryCount,
+		sizeof(src_patch_entry), CompareEntryName);
+}
+
+static src_patch_entry* FindByContent(src_diff_context* ctx, uint64_t hash, uint64_t size)
+{
+	src_patch_entry key = { 0 };
+	src_patch_entry* keyPtr = &key;
+	key.hash = hash;
+	key.header.resourceSize = size;
+	src_patch_entry** found = (src_patch_entry**)bsearch(&keyPtr, ctx->byContent, ctx->entryCount,
+		sizeof(src_patch_entry*), CompareEntryContent);
+	return found ? *found : NULL;
+}
+
+static void WriteOp(src_diff_context* ctx, uint32_t type, uint64_t offset, uint64_t length)
+{
+	ctx->lastOp.type = type;
+	ctx->lastOp.reserved = 0;
+	ctx->lastOp.offset = offset;
+	ctx->lastOp.length = length;
+	ctx->lastOpPos = (uint64_t)src_ftell64(ctx->patchFile);
+	ctx->hasLastOp = 1;
+	ctx->opCount += 1;
+	WRITE_STRUCT(ctx->lastOp, ctx->patchFile);
+}
+
+static void UpdateLastOp(src_diff_context* ctx)
+{
+	uint64_t end = (uint64_t)src_ftell64(ctx->patchFile);
+	src_fseek64(ctx->patchFile, ctx->lastOpPos, SEEK_SET);
+	WRITE_STRUCT(ctx->lastOp, ctx->patchFile);
+	src_fseek64(ctx->patchFile, end, SEEK_SET);
+}
+
+static void EmitCopy(src_diff_context* ctx, uint64_t offset, uint64_t length)
+{
+	if (length == 0) return;
+	ctx->copiedBytes += length;
+	if (ctx->hasLastOp
+		&& ctx->lastOp.type == SRC_PATCH_OP_COPY
+		&& ctx->lastOp.offset + ctx->lastOp.length == offset) {
+		ctx->lastOp.length += length;
+		UpdateLastOp(ctx);
+		return;
+	}
+	WriteOp(ctx, SRC_PATCH_OP_COPY, offset, length);
+}
+
+// inserts length bytes from the current position of src
+static int EmitInsert(src_diff_context* ctx, FILE* src, uint64_t length)
+{
+	if (length == 0) return 1;
+	ctx->insertedBytes += length;
+	if (ctx->hasLastOp && ctx->lastOp.type == SRC_PATCH_OP_INSERT) {
+		// the data of the last insert ends at the end of the patch
+		ctx->lastOp.length += length;
+		UpdateLastOp(ctx);
+	}
+	else {
+		WriteOp(ctx, SRC_PATCH_OP_INSERT, 0, length);
+	}
+	uint64_t unused = SRC_FNV1A64_INIT;
+	return HashRange(src, length, &unused, ctx->patchFile);
+}
+
+static int EmitInsertAt(src_diff_context* ctx, FILE* src, uint64_t offset, uint64_t length)
+{
+	src_fseek64(src, offset, SEEK_SET);
+	return EmitInsert(ctx, src, length);
+}
+
+static uint64_t CommonPrefix(FILE* a, uint64_t aOffset, FILE* b, uint64_t bOffset, uint64_t maxLen)
+{
+	static unsigned char bufA[SRC_PATCH_BUFFER_SIZE];
+	static unsigned char bufB[SRC_PATCH_BUFFER_SIZE];
+	uint64_t len = 0;
+	src_fseek64(a, aOffset, SEEK_SET);
+	src_fseek64(b, bOffset, SEEK_SET);
+	while (len < maxLen) {
+		size_t chunk = maxLen - len < sizeof(bufA) ? (size_t)(maxLen - len) : sizeof(bufA);
+		if (fread(bufA, 1, chunk, a) != chunk || fread(bufB, 1, chunk, b) != chunk) break;
+		size_t i = 0;
+		while (i < chunk && bufA[i] == bufB[i]) i += 1;
+		len += i;
+		if (i != chunk) break;
+	}
+	return len;
+}
+
+static uint64_t CommonSuffix(FILE* a, uint64_t aEnd, FILE* b, uint64_t bEnd, uint64_t maxLen)
+{
+	static unsigned char bufA[SRC_PATCH_BUFFER_SIZE];
+	static unsigned char bufB[SRC_PATCH_BUFFER_SIZE];
+	uint64_t len = 0;
+	while (len < maxLen) {
+		size_t chunk = maxLen - len < sizeof(bufA) ? (size_t)(maxLen - len) : sizeof(bufA);
+		src_fseek64(a, aEnd - len - chunk, SEEK_SET);
+		src_fseek64(b, bEnd - len - chunk, SEEK_SET);
+		if (fread(bufA, 1, chunk, a) != chunk || fread(bufB, 1, chunk, b) != chunk) break;
+		size_t i = 0;
+		while (i < chunk && bufA[chunk - 1 - i] == bufB[chunk - 1 - i]) i += 1;
+		len += i;
+		if (i != chunk) break;
+	}
+	return len;
+}
+
+static int EmitDelta(src_diff_context* ctx, src_patch_entry* old, uint64_t dataOffset, uint64_t size)
+{
+	uint64_t oldSize = old->header.resourceSize;
+	uint64_t maxLen = oldSize < size ? oldSize : size;
+	uint64_t prefix = CommonPrefix(ctx->oldFile, old->dataOffset, ctx->newFile, dataOffset, maxLen);
+	uint64_t suffix = CommonSuffix(ctx->oldFile, old->dataOffset + oldSize,
+		ctx->newFile, dataOffset + size, maxLen - prefix);
+
+	if (prefix + suffix < SRC_PATCH_MIN_DELTA) {
+		return EmitInsertAt(ctx, ctx->newFile, dataOffset, size);
+	}
+	EmitCopy(ctx, old->dataOffset, prefix);
+	if (!EmitInsertAt(ctx, ctx->newFile, dataOffset + prefix, size - prefix - suffix)) return 0;
+	EmitCopy(ctx, old->dataOffset + oldSize - suffix, suffix);
+	return 1;
+}
+
+static int DiffNewArchive(src_diff_context* ctx)
+{
+	size_t count = 0;
+	uint64_t* offsets = ReadToc(ctx->newFile, &count);
+	if (!offsets) {
+		LOGR_MSG("New archive header didn't validate.");
+		return 0;
+	}
+
+	// walk the records front to back, headers, TOC and dead space is inserted as is
+	uint64_t pos = 0;
+	for (size_t i = 0; i < count; i += 1) {
+		uint64_t recordOffset = offsets[i];
+		if (recordOffset < pos || !EmitInsertAt(ctx, ctx->newFile, pos, recordOffset - pos)) {
+			free(offsets);
+			return 0;
+		}
+
+		src_resource_header header;
+		char* name = NULL;
+		src_fseek64(ctx->newFile, recordOffset, SEEK_SET);
+		if (!ReadRecord(ctx->newFile, &header, &name)) {
+			LOGF_MSG("New archive resource %zu didn't validate.", i);
+			free(offsets);
+			return 0;
+		}
+		uint64_t dataOffset = recordOffset + src_record_data_offset(&header);
+		uint64_t size = header.resourceSize;
+		src_fseek64(ctx->newFile, dataOffset, SEEK_SET);
+		uint64_t hash = SRC_FNV1A64_INIT;
+		if (!HashRange(ctx->newFile, size, &hash, NULL)) {
+			LOGF_MSG("New archive resource \"%s\" is truncated.", name);
+			free(name);
+			free(offsets);
+			return 0;
+		}
+
+		int succ = 1;
+		src_patch_entry* old = FindByName(ctx, name);
+		if (old && old->hash == hash && old->header.resourceSize == size
+			&& memcmp(&old->header, &header, sizeof(header)) == 0) {
+			LOGF_MSG("Unchanged: \"%s\"", name);
+			EmitCopy(ctx, old->recordOffset, dataOffset - recordOffset + size);
+		}
+		else {
+			src_patch_entry* same = FindByContent(ctx, hash, size);
+			succ = EmitInsertAt(ctx, ctx->newFile, recordOffset, dataOffset - recordOffset);
+			if (same) {
+				LOGF_MSG("Moved: \"%s\"", name);
+				EmitCopy(ctx, same->dataOffset, size);
+			}
+			else if (old) {
+				LOGF_MSG("Changed: \"%s\"", name);
+				succ = succ && EmitDelta(ctx, old, dataOffset, size);
+			}
+			else {
+				LOGF_MSG("Added: \"%s\"", name);
+				succ = succ && EmitInsertAt(ctx, ctx->newFile, dataOffset, size);
+			}
+		}
+		free(name);
+		if (!succ) {
+			free(offsets);
+			return 0;
+		}
+		pos = dataOffset + size;
+	}
+	free(offsets);
+
+	uint64_t size = GetFileSize64(ctx->newFile);
+	return pos <= size && EmitInsertAt(ctx, ctx->newFile, pos, size - pos);
+}
+
+int src_diff_main(int argc, char** argv)
+{
+	const char* oldPath;
+	const char* newPath;
+	const char* patchPath;
+	if (!ParsePatchArgs(argc, argv, &oldPath, &newPath, &patchPath)) {
+		LOGR_MSG("Usage:\tsrc.exe diff \"old.src\" \"new.src\" -o \"patch.srcp\"");
+		return -1;
+	}
+
+	src_diff_context ctx = { 0 };
+	ctx.oldFile = fopen(oldPath, "rb");
+	ctx.newFile = fopen(newPath, "rb");
+	if (!ctx.oldFile || !ctx.newFile) {
+		LOGF_MSG("Failed to open \"%s\"", ctx.oldFile ? newPath : oldPath);
+		if (ctx.oldFile) fclose(ctx.oldFile);
+		if (ctx.newFile) fclose(ctx.newFile);
+		return -1;
+	}
+
+	int succ = 0;
+	src_patch_header header = { 0 };
+	strcpy(header.header, SRC_PATCH_HEADER_VALUE);
+	header.version = SRC_PATCH_VERSION;
+	header.oldSize = GetFileSize64(ctx.oldFile);
+	header.newSize = GetFileSize64(ctx.newFile);
+	header.newHash = SRC_FNV1A64_INIT;
+	if (!HashRange(ctx.newFile, header.newSize, &header.newHash, NULL)) {
+		LOGF_MSG("Failed to read \"%s\"", newPath);
+	}
+	else if (!(ctx.patchFile = fopen(patchPath, "wb+"))) {
+		LOGF_MSG("Failed to open output file \"%s\"", patchPath);
+	}
+	else {
+		// write blank header
+		WRITE_STRUCT(header, ctx.patchFile);
+
+		succ = IndexOldArchive(&ctx) && DiffNewArchive(&ctx);
+
+		// update header
+		header.opCount = ctx.opCount;
+		src_fseek64(ctx.patchFile, 0, SEEK_SET);
+		WRITE_STRUCT(header, ctx.patchFile);
+		fclose(ctx.patchFile);
+		if (!succ) remove(patchPath);
+	}
+
+	for (size_t i = 0; i < ctx.entryCount; i += 1) {
+		free(ctx.entries[i].name);
+	}
+	free(ctx.entries);
+	free(ctx.byContent);
+	fclose(ctx.oldFile);
+	fclose(ctx.newFile);
+
+	if (!succ) {
+		LOGR_MSG("Failed to create patch.");
+		return -1;
+	}
+	LOGF_MSG("Patch with %llu ops, %llu bytes copied, %llu bytes inserted",
+		(unsigned long long)ctx.opCount,
+		(unsigned long long)ctx.copiedBytes,
+		(unsigned long long)ctx.insertedBytes);
+	return 0;
+}
+
+static int ApplyPatch(FILE* oldFile, FILE* patchFile, FILE* outFile, const src_patch_header* header)
+{
+	uint64_t hash = SRC_FNV1A64_INIT;
+	uint64_t written = 0;
+	for (uint64_t i = 0; i < header->opCount; i += 1) {
+		src_patch_op op;
+		if (fread(&op, sizeof(op), 1, patchFile) != 1) {
+			LOGR_MSG("Patch is truncated.");
+			return 0;
+		}
+		if (op.type == SRC_PATCH_OP_COPY) {
+			if (op.offset + op.length > header->oldSize) {
+				LOGR_MSG("Patch copies outside of the old archive.");
+				return 0;
+			}
+			src_fseek64(oldFile, op.offset, SEEK_SET);
+			if (!HashRange(oldFile, op.length, &hash, outFile)) {
+				LOGR_MSG("Failed to read the old archive.");
+				return 0;
+			}
+		}
+		else if (op.type == SRC_PATCH_OP_INSERT) {
+			if (!HashRange(patchFile, op.length, &hash, outFile)) {
+				LOGR_MSG("Patch is truncated.");
+				return 0;
+			}
+		}
+		else {
+			LOGF_MSG("Unknown patch op %u.", op.type);
+			return 0;
+		}
+		written += op.length;
+	}
+
+	if (written != header->newSize || hash != header->newHash) {
+		LOGR_MSG("Patched archive doesn't match the expected content.");
+		return 0;
+	}
+	return 1;
+}
+
+int src_patch_main(int argc, char** argv)
+{
+	const char* oldPath;
+	const char* patchPath;
+	const char* outPath;
+	if (!ParsePatchArgs(argc, argv, &oldPath, &patchPath, &outPath)) {
+		LOGR_MSG("Usage:\tsrc.exe patch \"old.src\" \"patch.srcp\" -o \"new.src\"");
+		return -1;
+	}
+
+	FILE* oldFile = fopen(oldPath, "rb");
+	FILE* patchFile = fopen(patchPath, "rb");
+	if (!oldFile || !patchFile) {
+		LOGF_MSG("Failed to open \"%s\"", oldFile ? patchPath : oldPath);
+		if (oldFile) fclose(oldFile);
+		if (patchFile) fclose(patchFile);
+		return -1;
+	}
+
+	int succ = 0;
+	src_patch_header header;
+	FILE* outFile = NULL;
+	if (fread(&header, sizeof(header), 1, patchFile) != 1
+		|| strcmp(header.header, SRC_PATCH_HEADER_VALUE) != 0
+		|| header.version != SRC_PATCH_VERSION) {
+		LOGR_MSG("Patch header didn't validate.");
+	}
+	else if (GetFileSize64(oldFile) != header.oldSize) {
+		LOGF_MSG("\"%s\" is not the archive the patch was made for.", oldPath);
+	}
+	else if (!(outFile = fopen(outPath, "wb"))) {
+		LOGF_MSG("Failed to open output file \"%s\"", outPath);
+	}
+	else {
+		succ = ApplyPatch(oldFile, patchFile, outFile, &header);
+		fclose(outFile);
+		if (!succ) remove(outPath);
+	}
+
+	fclose(oldFile);
+	fclose(patchFile);
+	if (!succ) return -1;
+	LOGF_MSG("Patched \"%s\"", outPath);
+	return 0;
+}
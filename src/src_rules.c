@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simple_resource_compiler.h"
+#include "src_tool.h"
+
+///
+/// Include and exclude rules.
+///
+/// Usage: src.exe -t "resources/" -o "data.src" -s "include/" [--rules "rules.txt"] [--include glob] [--exclude glob]
+///
+/// The rule file has one rule per line, an action, a glob and settings. Blank
+/// lines and lines starting with '#' are skipped, a glob containing spaces is
+/// quoted.
+///
+///     # action  glob          settings
+///     exclude   **/*.psd
+///     exclude   editor/
+///     exclude   *~
+///     set       **/*.ktx      align=4096 compress=off
+///     set       levels/       group=levels
+///
+/// Globs are matched against the path relative to the target directory. '*' and
+/// '?' don't match '/', "**" matches any number of directories. A glob without a
+/// '/' in front of its last character matches the name at any depth, one ending
+/// in '/' a directory and everything below it.
+///
+/// Of the include and exclude rules the last one matching a path decides. Files
+/// none of them matches are packed, unless the first of them is an include.
+/// Directories are matched while the tree is traversed, an excluded directory
+/// is never opened and nothing below it can be included again. set only gives
+/// settings, which include can as well. The settings of every rule matching a
+/// file apply, later ones override earlier ones:
+///
+///     compress=on|off   compress the file with or without --compress
+///     align=N           the data starts at a multiple of N bytes in the archive
+///     group=name        the group of the file, ahead of the group file
+///
+/// --include and --exclude add rules without settings, all rules are applied in
+/// the order they are given on the command line.
+///
+
+// rules are compiled to the cheapest test which matches the same paths
+#define SRC_GLOB_LITERAL 0 // no wildcards, the whole path
+#define SRC_GLOB_NAME 1 // "**/name", the last component
+#define SRC_GLOB_SUFFIX 2 // "**/*.ext", the end of the path
+#define SRC_GLOB_WILDCARD 3
+
+#define SRC_RULE_EXCLUDE 0
+#define SRC_RULE_INCLUDE 1
+#define SRC_RULE_SET 2
+
+#define SRC_RULE_MAX_ALIGNMENT (1024 * 1024)
+
+struct src_rule {
+	int action; // SRC_RULE_*
+	int kind;
+	char* pattern; // normalized, relative to the root
+	size_t prefixLen; // literal directories in front of the first wildcard
+	const char* tail; // SRC_GLOB_NAME and SRC_GLOB_SUFFIX, the part after the wildcards
+	size_t tailLen;
+
+	// settings, SRC_RULE_UNSET or 0 where the rule has none
+	int compress;
+	uint32_t alignment;
+	char* group;
+};
+
+static int IsWildcard(char c)
+{
+	return c == '*' || c == '?';
+}
+
+// '*' and '?' within a component, "**/" any number of components, "/**" at the
+// end matches the directory in front of it as well
+static int MatchGlob(const char* p, const char* s)
+{
+	while (*p) {
+		if (p[0] == '*' && p[1] == '*' && (p[2] == '/' || p[2] == '\0')) {
+			if (p[2] == '\0') return 1;
+			for (p += 3;;) {
+				if (MatchGlob(p, s)) return 1;
+				s = strchr(s, '/');
+				if (!s) return 0;
+				s += 1;
+			}
+		}
+		if (*p == '*') {
+			for (p += 1;; s += 1) {
+				if (MatchGlob(p, s)) return 1;
+				if (*s == '\0' || *s == '/') return 0;
+			}
+		}
+		if (*s == '\0') return strcmp(p, "/**") == 0;
+		if (*p == '?' ? *s == '/' : *p != *s) return 0;
+		p += 1;
+		s += 1;
+	}
+	return *s == '\0';
+}
+
+static int RuleMatches(const src_rule* rule, const char* path, size_t len)
+{
+	switch (rule->kind) {
+	case SRC_GLOB_LITERAL:
+		return strcmp(rule->pattern, path) == 0;
+	case SRC_GLOB_NAME:
+		return len >= rule->tailLen && memcmp(path + len - rule->tailLen, rule->tail, rule->tailLen) == 0
+			&& (len == rule->tailLen || path[len - rule->tailLen - 1] == '/');
+	case SRC_GLOB_SUFFIX:
+		return len >= rule->tailLen && memcmp(path + len - rule->tailLen, rule->tail, rule->tailLen) == 0;
+	default:
+		return strncmp(rule->pattern, path, rule->prefixLen) == 0
+			&& MatchGlob(rule->pattern + rule->prefixLen, path + rule->prefixLen);
+	}
+}
+
+static void CompileRule(src_rule* rule, const char* glob)
+{
+	while (glob[0] == '.' && (glob[1] == '/' || glob[1] == '\\')) glob += 2;
+	int anchored = glob[0] == '/' || glob[0] == '\\';
+	while (*glob == '/' || *glob == '\\') glob += 1;
+
+	size_t len = strlen(glob);
+	int directory = len > 0 && (glob[len - 1] == '/' || glob[len - 1] == '\\');
+	int hasSeparator = 0;
+	for (size_t i = 0; i + 1 < len; i += 1) {
+		hasSeparator |= glob[i] == '/' || glob[i] == '\\';
+	}
+
+	char* pattern = (char*)malloc(len + 6);
+	char* p = pattern;
+	if (!anchored && !hasSeparator) {
+		memcpy(p, "**/", 3);
+		p += 3;
+	}
+	for (size_t i = 0; i < len; i += 1) {
+		*p++ = glob[i] == '\\' ? '/' : glob[i];
+	}
+	if (directory) {
+		memcpy(p, "**", 2);
+		p += 2;
+	}
+	*p = '\0';
+	rule->pattern = pattern;
+
+	const char* wildcard = pattern;
+	while (*wildcard && !IsWildcard(*wildcard)) wildcard += 1;
+	const char* name = pattern + 3;
+	if (*wildcard == '\0') {
+		rule->kind = SRC_GLOB_LITERAL;
+	}
+	else if (strncmp(pattern, "**/", 3) == 0 && !strpbrk(name, "*?/")) {
+		rule->kind = SRC_GLOB_NAME;
+		rule->tail = name;
+	}
+	else if (strncmp(pattern, "**/*", 4) == 0 && !strpbrk(name + 1, "*?/")) {
+		rule->kind = SRC_GLOB_SUFFIX;
+		rule->tail = name + 1;
+	}
+	else {
+		rule->kind = SRC_GLOB_WILDCARD;
+		// up to the separator in front of the component with the wildcard
+		const char* prefixEnd = wildcard;
+		while (prefixEnd > pattern && prefixEnd[-1] != '/') prefixEnd -= 1;
+		rule->prefixLen = prefixEnd > pattern ? (size_t)(prefixEnd - pattern - 1) : 0;
+	}
+	rule->tailLen = rule->tail ? strlen(rule->tail) : 0;
+}
+
+static src_rule* AddRule(src_rules* rules, int action, const char* glob)
+{
+	rules->rules = (src_rule*)realloc(rules->rules, (rules->count + 1) * sizeof(src_rule));
+	src_rule* rule = &rules->rules[rules->count++];
+	memset(rule, 0, sizeof(src_rule));
+	rule->action = action;
+	rule->compress = SRC_RULE_UNSET;
+	CompileRule(rule, glob);
+	if (action != SRC_RULE_SET && !rules->filters) {
+		rules->whitelist = action == SRC_RULE_INCLUDE;
+	}
+	rules->filters |= action != SRC_RULE_SET;
+	return rule;
+}
+
+void src_rules_add(src_rules* rules, int include, const char* glob)
+{
+	AddRule(rules, include ? SRC_RULE_INCLUDE : SRC_RULE_EXCLUDE, glob);
+}
+
+// the next token of line, a quoted one without the quotes, NULL at the end
+static char* NextToken(char** line)
+{
+	char* c = *line;
+	while (*c == ' ' || *c == '\t') c += 1;
+	if (*c == '\0') return NULL;
+	char* token = c;
+	if (*c == '"') {
+		token = ++c;
+		while (*c && *c != '"') c += 1;
+	}
+	else {
+		while (*c && *c != ' ' && *c != '\t') c += 1;
+	}
+	if (*c) *c++ = '\0';
+	*line = c;
+	return token;
+}
+
+static int ParseSetting(src_rule* rule, const char* setting)
+{
+	const char* value = strchr(setting, '=');
+	if (!value) return 0;
+	size_t keyLen = (size_t)(value - setting);
+	value += 1;
+	if (keyLen == 8 && strncmp(setting, "compress", keyLen) == 0) {
+		if (strcmp(value, "on") == 0) rule->compress = 1;
+		else if (strcmp(value, "off") == 0) rule->compress = 0;
+		else return 0;
+	}
+	else if (keyLen == 5 && strncmp(setting, "align", keyLen) == 0) {
+		unsigned long alignment = strtoul(value, NULL, 10);
+		// a power of two the records are already aligned to at least
+		if (alignment < SRC_RECORD_ALIGNMENT || alignment > SRC_RULE_MAX_ALIGNMENT || (alignment & (alignment - 1))) return 0;
+		rule->alignment = (uint32_t)alignment;
+	}
+	else if (keyLen == 5 && strncmp(setting, "group", keyLen) == 0 && *value) {
+		free(rule->group);
+		rule->group = strdup(value);
+	}
+	else {
+		return 0;
+	}
+	return 1;
+}
+
+int src_rules_read(src_rules* rules, const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		LOGF_MSG("Failed to open rule file \"%s\"", path);
+		return 0;
+	}
+	rules->path = path;
+	char buffer[4096];
+	int lineNumber = 0;
+	int succ = 1;
+	while (succ && fgets(buffer, sizeof(buffer), file)) {
+		lineNumber += 1;
+		size_t len = strlen(buffer);
+		while (len > 0 && (buffer[len - 1] == '\n' || buffer[len - 1] == '\r')) {
+			buffer[--len] = '\0';
+		}
+		char* line = buffer;
+		char* action = NextToken(&line);
+		if (!action || action[0] == '#') continue;
+
+		int kind = strcmp(action, "include") == 0 ? SRC_RULE_INCLUDE
+			: strcmp(action, "exclude") == 0 ? SRC_RULE_EXCLUDE
+			: strcmp(action, "set") == 0 ? SRC_RULE_SET : -1;
+		char* glob = NextToken(&line);
+		if (kind < 0 || !glob || !*glob) {
+			LOGF_MSG("%s:%d: expected include, exclude or set and a glob", path, lineNumber);
+			succ = 0;
+			break;
+		}
+		src_rule* rule = AddRule(rules, kind, glob);
+		char* setting;
+		while (succ && (setting = NextToken(&line))) {
+			if (kind == SRC_RULE_EXCLUDE || !ParseSetting(rule, setting)) {
+				LOGF_MSG("%s:%d: invalid setting \"%s\"", path, lineNumber, setting);
+				succ = 0;
+			}
+		}
+		rules->compress |= rule->compress == 1;
+		rules->groups |= rule->group != NULL;
+	}
+	fclose(file);
+	return succ;
+}
+
+static const char* RelativePath(const src_rules* rules, const char* path)
+{
+	size_t rootLen = rules->root ? strlen(rules->root) : 0;
+	if (rootLen && strncmp(path, rules->root, rootLen) == 0) path += rootLen;
+	while (*path == '/' || *path == '\\') path += 1;
+	return path;
+}
+
+int src_rules_match_dir(const src_rules* rules, const char* path)
+{
+	if (!rules || !rules->filters) return 1;
+	const char* rel = RelativePath(rules, path);
+	size_t len = strlen(rel);
+	int scanned = 1;
+	for (size_t i = 0; i < rules->count; i += 1) {
+		const src_rule* rule = &rules->rules[i];
+		if (rule->action != SRC_RULE_SET && RuleMatches(rule, rel, len)) scanned = rule->action == SRC_RULE_INCLUDE;
+	}
+	return scanned;
+}
+
+int src_rules_match_file(const src_rules* rules, src_file_entry* file)
+{
+	if (!rules || rules->count == 0) return 1;
+	const char* rel = RelativePath(rules, file->path);
+	size_t len = strlen(rel);
+	int included = !rules->whitelist;
+	for (size_t i = 0; i < rules->count; i += 1) {
+		const src_rule* rule = &rules->rules[i];
+		if (!RuleMatches(rule, rel, len)) continue;
+		if (rule->action != SRC_RULE_SET) included = rule->action == SRC_RULE_INCLUDE;
+		if (rule->compress != SRC_RULE_UNSET) file->compress = (int8_t)rule->compress;
+		if (rule->alignment) file->alignment = rule->alignment;
+		if (rule->group) file->group = rule->group;
+	}
+	return included;
+}
+
+void src_rules_free(src_rules* rules)
+{
+	for (size_t i = 0; i < rules->count; i += 1) {
+		free(rules->rules[i].pattern);
+		free(rules->rules[i].group);
+	}
+	free(rules->rules);
+	memset(rules, 0, sizeof(src_rules));
+}
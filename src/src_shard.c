@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simple_resource_compiler.h"
+#include "src_tool.h"
+#include "src_thread.h"
+
+///
+/// Sharded output.
+///
+/// The files of one traversal are split into shards, every shard is a regular
+/// archive written by its own thread. The output file becomes an index which
+/// maps the generated ids to (shard, offset), the generated header gets an
+/// additional shard table. --shard k writes a single shard and --shard-index
+/// builds the index from shards written before, so a build system can run one
+/// step per shard and only repack the shards whose files changed. Such a step
+/// only transforms the files of its shard, so shards are cut by the sizes of
+/// the files before their transforms, and the index step transforms none.
+///
+
+typedef struct {
+	src_context* ctx;
+	const src_file_list* list;
+	const uint32_t* fileShards;
+	volatile int64_t failed;
+} src_shard_job;
+
+char* src_shard_path(const char* outputPath, uint32_t shard)
+{
+	size_t len = strlen(outputPath);
+	size_t ext = len;
+	for (size_t i = len; i > 0; i -= 1) {
+		char c = outputPath[i - 1];
+		if (c == '/' || c == '\\') break;
+		if (c == '.') {
+			ext = i - 1;
+			break;
+		}
+	}
+	char* path = (char*)malloc(len + 16);
+	snprintf(path, len + 16, "%.*s.%u%s", (int)ext, outputPath, shard, outputPath + ext);
+	return path;
+}
+
+static int CompareString(const void* a, const void* b)
+{
+	return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+// length of the top level directory of a file below root, 0 for files in root
+static size_t TopDirLength(const src_context* ctx, const char* path)
+{
+	const char* rel = path + strlen(ctx->targetDir) + 1;
+	const char* slash = strchr(rel, '/');
+	return slash ? (size_t)(slash - rel) : 0;
+}
+
+// returns the shard of every file and the number of shards
+static uint32_t* AssignShards(src_context* ctx, const src_file_list* list, uint32_t* shardCount)
+{
+	uint32_t* shards = (uint32_t*)calloc(list->count + 1, sizeof(uint32_t));
+	if (ctx->shardMode == SRC_SHARD_HASH) {
+		*shardCount = ctx->shardCount ? ctx->shardCount : 1;
+		for (size_t i = 0; i < list->count; i += 1) {
+			shards[i] = djb2_hash((unsigned char*)list->files[i].path) % *shardCount;
+		}
+	}
+	else if (ctx->shardMode == SRC_SHARD_SIZE) {
+		// files are sorted by path, neighbours stay together
+		uint32_t shard = 0;
+		uint64_t used = 0;
+		for (size_t i = 0; i < list->count; i += 1) {
+			if (used > 0 && used + list->files[i].size > ctx->shardSize) {
+				shard += 1;
+				used = 0;
+			}
+			shards[i] = shard;
+			used += list->files[i].size;
+		}
+		*shardCount = shard + 1;
+	}
+	else {
+		// sorted names of the top level directories, shard 0 is the root
+		char** dirs = (char**)malloc((list->count + 1) * sizeof(char*));
+		size_t dirCount = 0;
+		for (size_t i = 0; i < list->count; i += 1) {
+			size_t len = TopDirLength(ctx, list->files[i].path);
+			if (len == 0) continue;
+			const char* rel = list->files[i].path + strlen(ctx->targetDir) + 1;
+			if (dirCount > 0 && strncmp(dirs[dirCount - 1], rel, len) == 0 && dirs[dirCount - 1][len] == '\0') continue;
+			dirs[dirCount] = (char*)malloc(len + 1);
+			memcpy(dirs[dirCount], rel, len);
+			dirs[dirCount][len] = '\0';
+			dirCount += 1;
+		}
+		qsort(dirs, dirCount, sizeof(char*), CompareString);
+		size_t unique = 0;
+		for (size_t i = 0; i < dirCount; i += 1) {
+			if (unique > 0 && strcmp(dirs[unique - 1], dirs[i]) == 0) {
+				free(dirs[i]);
+				continue;
+			}
+			dirs[unique++] = dirs[i];
+		}
+		dirCount = unique;
+
+		for (size_t i = 0; i < list->count; i += 1) {
+			size_t len = TopDirLength(ctx, list->files[i].path);
+			if (len == 0) continue;
+			char* key = (char*)malloc(len + 1);
+			memcpy(key, list->files[i].path + strlen(ctx->targetDir) + 1, len);
+			key[len] = '\0';
+			char** found = (char**)bsearch(&key, dirs, dirCount, sizeof(char*), CompareString);
+			shards[i] = (uint32_t)(found - dirs) + 1;
+			free(key);
+		}
+		for (size_t i = 0; i < dirCount; i += 1) {
+			free(dirs[i]);
+		}
+		free(dirs);
+		*shardCount = (uint32_t)dirCount + 1;
+	}
+	return shards;
+}
+
+static void PackShard(void* arg, int index)
+{
+	src_shard_job* job = (src_shard_job*)arg;
+	uint32_t shard = (uint32_t)index;
+	if (job->ctx->shardSelect != SRC_SHARD_ALL) {
+		shard = job->ctx->shardSelect;
+	}
+
+	src_context shardCtx = { 0 };
+	char* path = src_shard_path(job->ctx->outputFilePath, shard);
+	shardCtx.outputFilePath = path;
+	shardCtx.outputFile = fopen(path, "wb+");
+	if (!shardCtx.outputFile) {
+		LOGF_MSG("Failed to open output file \"%s\"", path);
+		src_atomic_add(&job->failed, 1);
+		free(path);
+		return;
+	}
+	src_write_header(&shardCtx, 0, 0);
+
+	int succ = 1;
+	for (size_t i = 0; succ && i < job->list->count; i += 1) {
+		if (job->fileShards[i] != shard) continue;
+		LOGF_MSG("Packing: \"%s\" into shard %u", job->list->files[i].path, shard);
+		succ = src_pack_file(&shardCtx, &job->list->files[i]);
+		if (!succ) {
+			LOGF_MSG("Failed to pack file: \"%s\"", job->list->files[i].path);
+		}
+	}
+	// tombstones hide resources in lower priority archives, any shard will do
+	for (int i = 0; succ && shard == 0 && i < job->ctx->tombstoneCount; i += 1) {
+		src_pack_tombstone(&shardCtx, job->ctx->tombstones[i]);
+	}
+
+	uint64_t tocOffset = src_write_toc(&shardCtx);
+	src_write_header(&shardCtx, shardCtx.entryCount, tocOffset);
+	succ = succ && !ferror(shardCtx.outputFile);
+	fclose(shardCtx.outputFile);
+	if (!succ) {
+		src_atomic_add(&job->failed, 1);
+	}
+	src_context_free(&shardCtx);
+	free(path);
+}
+
+static int CompareEntryPath(const void* a, const void* b)
+{
+	return strcmp(((const src_packed_entry*)a)->path, ((const src_packed_entry*)b)->path);
+}
+
+// collects the resources of the written shards and writes the index and the header
+static int WriteIndex(src_context* ctx, uint32_t shardCount)
+{
+	char** shardPaths = (char**)malloc((shardCount + 1) * sizeof(char*));
+	int succ = 1;
+	for (uint32_t shard = 0; shard < shardCount; shard += 1) {
+		shardPaths[shard] = src_shard_path(ctx->outputFilePath, shard);
+		src_archive archive;
+		if (!succ) continue;
+		if (!src_archive_open(&archive, shardPaths[shard])) {
+			LOGF_MSG("Shard \"%s\" is missing or didn't validate.", shardPaths[shard]);
+			succ = 0;
+			continue;
+		}
+		for (size_t i = 0; i < archive.entryCount; i += 1) {
+			const src_archive_entry* entry = &archive.entries[i];
+			if (entry->header->flags & SRC_RESOURCE_FLAG_TOMBSTONE) continue;
+			uint64_t offset = (uint64_t)((const unsigned char*)entry->header - archive.base);
+			src_packed_entry* packed = src_add_entry(ctx, entry->name, offset, src_record_size(entry->header), entry->header->resourceSize, 0);
+			packed->shard = shard;
+			packed->shardIndex = (uint32_t)i;
+		}
+		src_archive_close(&archive);
+	}
+
+	FILE* out = succ ? fopen(ctx->outputFilePath, "wb") : NULL;
+	if (succ && !out) {
+		LOGF_MSG("Failed to open output file \"%s\"", ctx->outputFilePath);
+		succ = 0;
+	}
+	if (succ) {
+		// same id order as an archive packed in one piece
+		qsort(ctx->entries, ctx->entryCount, sizeof(src_packed_entry), CompareEntryPath);
+
+		src_index_header header = { 0 };
+		strcpy(header.header, SRC_INDEX_HEADER_VALUE);
+		header.version = SRC_RESOURCE_VERSION;
+		header.shardCount = shardCount;
+		header.entryCount = ctx->entryCount;
+		WRITE_STRUCT(header, out);
+		for (size_t i = 0; i < ctx->entryCount; i += 1) {
+			src_index_entry entry = { 0 };
+			entry.id = djb2_hash((unsigned char*)ctx->entries[i].path);
+			entry.shard = ctx->entries[i].shard;
+			entry.offset = ctx->entries[i].offset;
+			header.checksum = src_crc32c(&entry, sizeof(entry), header.checksum);
+			WRITE_STRUCT(entry, out);
+		}
+		for (uint32_t shard = 0; shard < shardCount; shard += 1) {
+			// shards live next to the index
+			const char* name = shardPaths[shard] + strlen(shardPaths[shard]);
+			while (name > shardPaths[shard] && name[-1] != '/' && name[-1] != '\\') name -= 1;
+			header.checksum = src_crc32c(name, strlen(name) + 1, header.checksum);
+			WRITE_DATA(name, strlen(name) + 1, out);
+		}
+		fseek(out, 0, SEEK_SET);
+		WRITE_STRUCT(header, out);
+		succ = !ferror(out);
+		fclose(out);
+	}
+	for (uint32_t shard = 0; shard < shardCount; shard += 1) {
+		free(shardPaths[shard]);
+	}
+	free(shardPaths);
+
+	if (succ) {
+		succ = src_write_generated_header(ctx);
+	}
+	return succ;
+}
+
+// a single shard is the output of its own build step. A directory shard only
+// depends on its directory tree, the root shard also on the root, which changes
+// when top level directories come and go
+static int WriteDepfile(src_context* ctx, const src_file_list* list, const uint32_t* fileShards)
+{
+	size_t rulesDepCount = ctx->rules.path ? 1 : 0;
+	if (ctx->shardSelect == SRC_SHARD_ALL) {
+		return src_write_list_depfile(ctx->depfilePath, ctx->outputHeaderPath, list, &ctx->rules.path, rulesDepCount);
+	}
+
+	char* target = src_shard_path(ctx->outputFilePath, ctx->shardSelect);
+	if (ctx->shardMode != SRC_SHARD_DIR) {
+		// files move between hash and size shards, every shard depends on all of them
+		int succ = src_write_list_depfile(ctx->depfilePath, target, list, &ctx->rules.path, rulesDepCount);
+		free(target);
+		return succ;
+	}
+
+	const char** deps = (const char**)malloc((list->count + list->dirCount + 2) * sizeof(const char*));
+	size_t depCount = 0;
+	if (ctx->rules.path) deps[depCount++] = ctx->rules.path;
+	const char* topDir = NULL;
+	size_t topDirLen = 0;
+	for (size_t i = 0; i < list->count; i += 1) {
+		if (fileShards[i] != ctx->shardSelect) continue;
+		deps[depCount++] = list->files[i].path;
+		if (!topDir && ctx->shardSelect != 0) {
+			topDir = list->files[i].path + strlen(ctx->targetDir) + 1;
+			topDirLen = TopDirLength(ctx, list->files[i].path);
+		}
+	}
+	size_t rootLen = strlen(ctx->targetDir);
+	for (size_t i = 0; i < list->dirCount; i += 1) {
+		const char* dir = list->dirs[i];
+		if (strlen(dir) <= rootLen) {
+			if (ctx->shardSelect == 0) deps[depCount++] = dir;
+		}
+		else if (topDir && strncmp(dir + rootLen + 1, topDir, topDirLen) == 0
+			&& (dir[rootLen + 1 + topDirLen] == '/' || dir[rootLen + 1 + topDirLen] == '\0')) {
+			deps[depCount++] = dir;
+		}
+	}
+
+	int succ = src_write_depfile(ctx->depfilePath, target, deps, depCount);
+	free(target);
+	free(deps);
+	return succ;
+}
+
+int src_pack_sharded(src_context* ctx)
+{
+	src_file_list list;
+	if (!src_collect_files(ctx->targetDir, ctx->threadCount, &ctx->rules, &list)) {
+		return -1;
+	}
+	LOGF_MSG("Found %zu files", list.count);
+
+	uint32_t shardCount = 0;
+	src_shard_job job = { 0 };
+	job.ctx = ctx;
+	job.list = &list;
+	job.fileShards = AssignShards(ctx, &list, &shardCount);
+	LOGF_MSG("Splitting into %u shards", shardCount);
+	int selected = ctx->shardSelect != SRC_SHARD_ALL;
+	// the index step reads the shards written before and transforms nothing
+	if (!ctx->shardIndexOnly && !src_run_transforms(ctx, &list, selected ? job.fileShards : NULL, ctx->shardSelect)) {
+		free((void*)job.fileShards);
+		src_file_list_free(&list);
+		return -1;
+	}
+
+	int succ = 1;
+	if (ctx->shardSelect != SRC_SHARD_ALL) {
+		if (ctx->shardSelect >= shardCount) {
+			LOGF_MSG("Shard %u doesn't exist, there are %u shards", ctx->shardSelect, shardCount);
+			succ = 0;
+		}
+		else {
+			PackShard(&job, 0);
+			succ = job.failed == 0;
+		}
+	}
+	else {
+		if (!ctx->shardIndexOnly) {
+			src_parallel_for(ctx->threadCount, (int)shardCount, PackShard, &job);
+			succ = job.failed == 0;
+		}
+		succ = succ && WriteIndex(ctx, shardCount);
+	}
+	// the index only depends on its shards
+	if (succ && ctx->depfilePath && !ctx->shardIndexOnly) {
+		succ = WriteDepfile(ctx, &list, job.fileShards);
+	}
+
+	if (succ) {
+		LOGF_MSG("Packaged %zu files", list.count);
+	}
+	free((void*)job.fileShards);
+	src_file_list_free(&list);
+	return succ ? 0 : -1;
+}
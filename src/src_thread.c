@@ -0,0 +1,163 @@
+#include <stdlib.h>
+
+#include "src_thread.h"
+
+#ifndef _WIN32
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+typedef struct {
+	src_thread_func func;
+	void* arg;
+} src_thread_start;
+
+#ifdef _WIN32
+static DWORD WINAPI src_thread_entry(LPVOID param)
+#else
+static void* src_thread_entry(void* param)
+#endif
+{
+	src_thread_start start = *(src_thread_start*)param;
+	free(param);
+	start.func(start.arg);
+	return 0;
+}
+
+int src_thread_create(src_thread* thread, src_thread_func func, void* arg)
+{
+	src_thread_start* start = (src_thread_start*)malloc(sizeof(src_thread_start));
+	start->func = func;
+	start->arg = arg;
+#ifdef _WIN32
+	*thread = CreateThread(NULL, 0, src_thread_entry, start, 0, NULL);
+	if (*thread) return 1;
+#else
+	if (pthread_create(thread, NULL, src_thread_entry, start) == 0) return 1;
+#endif
+	free(start);
+	return 0;
+}
+
+void src_thread_join(src_thread thread)
+{
+#ifdef _WIN32
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#else
+	pthread_join(thread, NULL);
+#endif
+}
+
+void src_thread_yield(void)
+{
+#ifdef _WIN32
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+int src_cpu_count(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+#endif
+}
+
+void src_mutex_init(src_mutex* mutex)
+{
+#ifdef _WIN32
+	InitializeCriticalSection(mutex);
+#else
+	pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+void src_mutex_destroy(src_mutex* mutex)
+{
+#ifdef _WIN32
+	DeleteCriticalSection(mutex);
+#else
+	pthread_mutex_destroy(mutex);
+#endif
+}
+
+void src_mutex_lock(src_mutex* mutex)
+{
+#ifdef _WIN32
+	EnterCriticalSection(mutex);
+#else
+	pthread_mutex_lock(mutex);
+#endif
+}
+
+void src_mutex_unlock(src_mutex* mutex)
+{
+#ifdef _WIN32
+	LeaveCriticalSection(mutex);
+#else
+	pthread_mutex_unlock(mutex);
+#endif
+}
+
+int64_t src_atomic_add(volatile int64_t* value, int64_t amount)
+{
+#ifdef _MSC_VER
+	return InterlockedExchangeAdd64((volatile LONG64*)value, amount) + amount;
+#else
+	return __atomic_add_fetch(value, amount, __ATOMIC_SEQ_CST);
+#endif
+}
+
+int64_t src_atomic_load(volatile int64_t* value)
+{
+#ifdef _MSC_VER
+	return InterlockedCompareExchange64((volatile LONG64*)value, 0, 0);
+#else
+	return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+typedef struct {
+	src_parallel_func func;
+	void* arg;
+	int count;
+	volatile int64_t next;
+} src_parallel_job;
+
+static void src_parallel_worker(void* arg)
+{
+	src_parallel_job* job = (src_parallel_job*)arg;
+	int64_t index;
+	while ((index = src_atomic_add(&job->next, 1) - 1) < job->count) {
+		job->func(job->arg, (int)index);
+	}
+}
+
+void src_parallel_for(int threadCount, int count, src_parallel_func func, void* arg)
+{
+	src_parallel_job job;
+	job.func = func;
+	job.arg = arg;
+	job.count = count;
+	job.next = 0;
+
+	if (threadCount > count) threadCount = count;
+	src_thread* threads = (src_thread*)malloc(sizeof(src_thread) * (threadCount > 0 ? threadCount : 1));
+	int started = 0;
+	for (int i = 1; i < threadCount; i += 1) {
+		if (src_thread_create(&threads[started], src_parallel_worker, &job)) started += 1;
+	}
+	// the calling thread takes part
+	src_parallel_worker(&job);
+	for (int i = 0; i < started; i += 1) {
+		src_thread_join(threads[i]);
+	}
+	free(threads);
+}
@@ -0,0 +1,39 @@
+#ifndef SRC_THREAD_H
+#define SRC_THREAD_H
+// Minimal threading layer of the src executable.
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+typedef HANDLE src_thread;
+typedef CRITICAL_SECTION src_mutex;
+#else
+#include <pthread.h>
+typedef pthread_t src_thread;
+typedef pthread_mutex_t src_mutex;
+#endif
+
+typedef void (*src_thread_func)(void* arg);
+
+int src_thread_create(src_thread* thread, src_thread_func func, void* arg);
+void src_thread_join(src_thread thread);
+void src_thread_yield(void);
+int src_cpu_count(void);
+
+void src_mutex_init(src_mutex* mutex);
+void src_mutex_destroy(src_mutex* mutex);
+void src_mutex_lock(src_mutex* mutex);
+void src_mutex_unlock(src_mutex* mutex);
+
+// sequentially consistent, returns the new value
+int64_t src_atomic_add(volatile int64_t* value, int64_t amount);
+int64_t src_atomic_load(volatile int64_t* value);
+
+// runs func(arg, index) for index in [0, count) on threadCount threads
+typedef void (*src_parallel_func)(void* arg, int index);
+void src_parallel_for(int threadCount, int count, src_parallel_func func, void* arg);
+
+#endif // SRC_THREAD_H
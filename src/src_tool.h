@@ -0,0 +1,307 @@
+#ifndef SRC_TOOL_H
+#define SRC_TOOL_H
+// Declarations shared between the translation units of the src executable and libsrc.
+#include <stdio.h>
+#include <stdint.h>
+
+#include "simple_resource_compiler.h"
+
+#define LOGR_MSG(msg) PrintHelper(msg)
+#define LOGF_MSG(fmt, ...) PrintHelper(fmt, __VA_ARGS__)
+
+#define WRITE_STRUCT(buf, file) fwrite(&buf, sizeof(buf), 1, file)
+#define WRITE_DATA(buf, len, file) fwrite(buf, 1, len, file)
+
+// 64 bit file positions, archives may exceed 2 GiB
+#ifdef _WIN32
+#define src_fseek64 _fseeki64
+#define src_ftell64 _ftelli64
+#else
+#define src_fseek64 fseeko
+#define src_ftell64 ftello
+#endif
+
+extern int verbose;
+
+void PrintHelper(const char* fmt, ...);
+void CopyFileToFile(FILE* dst, FILE* src, size_t bytesToCopy);
+// returns the src_crc32c of the copied bytes
+uint32_t CopyFileToFileCrc(FILE* dst, FILE* src, size_t bytesToCopy);
+
+// src_traverse.c
+typedef struct {
+	const char* path;
+	uint64_t size;
+	const char* source; // the file read for the data, path unless it was transformed
+
+	// set by the rules matching the path, see src_rules.c
+	int8_t compress; // SRC_RULE_UNSET, 0 or 1
+	uint32_t alignment; // of the data in the archive, 0 for SRC_RECORD_ALIGNMENT
+	const char* group; // owned by the rules, NULL for none
+} src_file_entry;
+
+typedef struct {
+	src_file_entry* files; // sorted by path
+	size_t count;
+	// every directory scanned including root, sorted
+	const char** dirs;
+	size_t dirCount;
+	// storage of the paths
+	char** blocks;
+	size_t blockCount;
+} src_file_list;
+
+struct src_rules;
+
+// collects every regular file below root the rules include, directories starting
+// with '.' and excluded ones are skipped. rules may be NULL.
+int src_collect_files(const char* root, int threadCount, const struct src_rules* rules, src_file_list* list);
+void src_file_list_free(src_file_list* list);
+
+// src_rules.c
+#define SRC_RULE_UNSET -1
+
+typedef struct src_rule src_rule;
+
+typedef struct src_rules {
+	const char* root; // paths are matched relative to it
+	const char* path; // the rule file, may be NULL
+	src_rule* rules; // in the order they were given
+	size_t count;
+	int filters; // there are include or exclude rules
+	int whitelist; // the first of them is an include, files none of them matches are left out
+	int compress; // a rule sets compress=on
+	int groups; // a rule sets a group
+} src_rules;
+
+// appends the rules of a rule file, returns 0 if it doesn't parse
+int src_rules_read(src_rules* rules, const char* path);
+// appends an include or exclude rule without settings
+void src_rules_add(src_rules* rules, int include, const char* glob);
+// 0 if the directory at path is excluded, it isn't scanned then
+int src_rules_match_dir(const src_rules* rules, const char* path);
+// 0 if the file is excluded, otherwise sets the settings of the rules matching it
+int src_rules_match_file(const src_rules* rules, src_file_entry* file);
+void src_rules_free(src_rules* rules);
+
+// src_depfile.c
+// writes a make style depfile in which target depends on every path of deps, the
+// paths also get empty rules so make doesn't fail once one of them was removed
+int src_write_depfile(const char* depfilePath, const char* target, const char* const* deps, size_t depCount);
+// target, every file and directory of the list and the extra deps, which may be NULL
+int src_write_list_depfile(const char* depfilePath, const char* target, const src_file_list* list,
+	const char* const* extraDeps, size_t extraDepCount);
+// NULL if the current directory can't be determined
+char* src_absolute_path(const char* path);
+
+// simple_recource_compiler.c
+typedef struct {
+	char* path;
+	uint64_t offset; // offset of the src_resource_header
+	uint64_t recordSize; // header, name and data
+	uint64_t size; // size of the resource data
+	uint8_t flags;
+	uint32_t alignment; // of the data, 0 for SRC_RECORD_ALIGNMENT
+	unsigned char* inlineData; // owned copy of the data of an inlined resource
+	uint32_t shard; // shard holding the record of a sharded archive
+	uint32_t shardIndex; // position of the record in the TOC of its shard
+} src_packed_entry;
+
+// tool only, the resource is embedded in the generated header and not in the archive
+#define SRC_PACKED_FLAG_INLINE 0x40
+
+struct src_chunk_store;
+
+// returns the converted data allocated with malloc, NULL on failure
+typedef unsigned char* (*src_transform_func)(const unsigned char* data, size_t size, size_t* outSize);
+
+typedef struct {
+	const char* extension; // with the '.'
+	const char* id; // the name of a built-in transform or the command
+	src_transform_func func; // NULL for a command
+	uint32_t version; // of a built-in transform
+} src_transform;
+
+#define SRC_GROUP_NONE 0xFFFFFFFFu
+
+// groups of the archive being packed, see src_group.c
+typedef struct {
+	char** names; // in the order the groups are placed
+	uint32_t count;
+	uint64_t* offsets; // first record of every group
+	uint64_t* ends; // end of the last record
+} src_group_table;
+
+// how files are split into shards, see src_shard.c
+#define SRC_SHARD_NONE 0
+#define SRC_SHARD_HASH 1 // by djb2_hash of the path
+#define SRC_SHARD_SIZE 2 // contiguous runs of files up to a size budget
+#define SRC_SHARD_DIR 3 // one shard per top level directory, files of the root go into shard 0
+#define SRC_SHARD_ALL 0xFFFFFFFFu
+
+typedef struct
+{
+	// the input directory
+	const char* targetDir;
+	
+	// the file generated
+	const char* outputFilePath;
+	const char* outputFileName;
+	const char* uppercaseFilename;
+	FILE* outputFile;
+
+	// the header file generated
+	const char* outputHeaderPath;
+	FILE* outputHeaderFile;
+
+	int threadCount;
+	int watch;
+
+	// make style depfile listing the scanned files and directories, may be NULL
+	const char* depfilePath;
+
+	// resources up to this size go into the generated header, 0 disables inlining
+	uint64_t inlineThreshold;
+	size_t inlineCount;
+
+	// files of at least this size are stored as content defined chunks, 0 disables chunking
+	uint64_t chunkThreshold;
+	struct src_chunk_store* chunkStore; // the chunks in the archive so far
+	size_t chunkedCount;
+
+	// records of a group are placed contiguously, the archive gets a table of the groups
+	const char* groupFilePath; // lines of "group path", may be NULL
+	int groupByDir; // top level directories matched by no rule are groups
+	src_group_table groups;
+
+	// which files are packed and how, see src_rules.c
+	src_rules rules;
+
+	// converters run on the files before they are packed, see src_transform.c
+	src_transform* transforms; // by extension
+	size_t transformCount;
+	const char* cacheDir; // NULL for "<output>.cache"
+
+	// files are compressed against a dictionary trained on them, see src_compress.c
+	int compress; // SRC_COMPRESS_*
+	size_t dictionaryCapacity; // 0 compresses without a dictionary
+	uint32_t frameSize; // larger files are compressed in frames of this size, 0 as one stream
+	unsigned char* dictionary;
+	size_t dictionarySize;
+	size_t compressedCount;
+	uint64_t compressedInput;
+	uint64_t compressedOutput; // compressed headers and streams
+
+	// print sizes and the dedup ratio after packing
+	int stats;
+
+	// sharded output, the output file becomes the index of the shards
+	int shardMode; // SRC_SHARD_*
+	uint32_t shardCount; // SRC_SHARD_HASH
+	uint64_t shardSize; // SRC_SHARD_SIZE
+	uint32_t shardSelect; // the only shard written or SRC_SHARD_ALL
+	int shardIndexOnly; // only write the index and header of existing shards
+
+	// resource paths written as tombstones
+	const char** tombstones;
+	int tombstoneCount;
+
+	// resources in the order of the generated ids, tombstones last
+	src_packed_entry* entries;
+	size_t entryCount;
+	size_t entryCapacity;
+
+	int packedFileCount;
+} src_context;
+
+// sets the output paths, the generated header goes into headerDir, which may be NULL
+void src_context_set_output(src_context* ctx, const char* outputPath, const char* headerDir);
+void src_context_free(src_context* ctx);
+int StartPacking(src_context* ctx);
+int src_pack_file(src_context* ctx, const src_file_entry* file);
+// tombstones only exist in the archive, they get no id in the generated header
+int src_pack_tombstone(src_context* ctx, const char* path);
+// length of the target directory prefix of path, the rootLen of its record
+uint16_t src_root_length(const src_context* ctx, const char* path);
+src_packed_entry* src_add_entry(src_context* ctx, const char* path, uint64_t offset, uint64_t recordSize, uint64_t size, uint8_t flags);
+// writes a resource record at the current position and returns its offset
+uint64_t src_write_record(FILE* out, const char* path, uint16_t rootLen, FILE* data, uint64_t size, uint8_t flags);
+// writes the header and name of a record whose size bytes of data the caller writes next
+uint64_t src_write_record_start(FILE* out, src_resource_header* header, const char* path, uint16_t rootLen, uint64_t size, uint8_t flags);
+// pads the data and rewrites the header, which now has the checksum
+void src_write_record_finish(FILE* out, uint64_t offset, const src_resource_header* header);
+// pads the output so the data of the next record for path starts at a multiple of alignment
+void src_align_record_data(FILE* out, const char* path, uint32_t alignment);
+// records the alignment in the header of the record at offset, the output stays at its end
+void src_mark_record_alignment(FILE* out, uint64_t offset, uint32_t alignment);
+// the alignment of the data of a record, at least SRC_RECORD_ALIGNMENT
+uint32_t src_record_alignment(const src_resource_header* header);
+uint64_t src_write_record_memory(FILE* out, const char* path, uint16_t rootLen, const void* data, uint64_t size, uint32_t checksum, uint8_t flags);
+// reads a whole file of known size, NULL on failure
+unsigned char* src_read_file(const char* path, uint64_t size);
+// appends the TOC of ctx->entries and returns its offset
+uint64_t src_write_toc(src_context* ctx);
+void src_write_header(src_context* ctx, uint64_t resourceCount, uint64_t tocOffset);
+int src_write_generated_header(src_context* ctx);
+
+// src_chunk.c
+// packs a file as a chunk list and the chunks not yet in the archive
+int src_pack_chunked(src_context* ctx, const src_file_entry* file);
+void src_chunk_store_free(struct src_chunk_store* store);
+void src_print_stats(const src_context* ctx, uint64_t archiveSize);
+
+// src_compress.c
+#define SRC_COMPRESS_OFF 0
+#define SRC_COMPRESS_ALL 1 // --compress, every file unless a rule sets compress=off
+#define SRC_COMPRESS_RULES 2 // only the files a rule sets compress=on for
+#define SRC_DICT_DEFAULT_SIZE (32 * 1024)
+#define SRC_FRAME_DEFAULT_SIZE (256 * 1024)
+#define SRC_FRAME_MAX_SIZE (64 * 1024 * 1024)
+// the encoder of src_lz_decompress, returns the compressed size, 0 if it doesn't fit capacity
+size_t src_lz_compress(const unsigned char* src, size_t size, unsigned char* dst, size_t capacity,
+	const unsigned char* dict, size_t dictSize);
+// samples the files of the list and trains ctx->dictionary
+int src_train_dictionary(src_context* ctx, const src_file_list* list);
+// files src_pack_file neither inlines nor chunks, which are small enough and compressed by ctx->compress
+int src_compressible(const src_context* ctx, const src_file_entry* file);
+// packs a file compressed, or as it is when that isn't smaller
+int src_pack_compressed(src_context* ctx, const src_file_entry* file);
+// appends the dictionary, it has to follow the TOC and group table
+void src_write_dictionary(src_context* ctx);
+
+// src_transform.c
+// adds "extension=name" of a built-in transform or, external, "extension=command"
+int src_add_transform(src_context* ctx, const char* spec, int external);
+// runs the transforms on the files of the list, which then refer to the results.
+// With fileShards only the files in shard are transformed, NULL transforms all.
+int src_run_transforms(src_context* ctx, src_file_list* list, const uint32_t* fileShards, uint32_t shard);
+
+// src_group.c
+// reads the group file and puts every file of the list into a group or SRC_GROUP_NONE
+int src_assign_groups(src_context* ctx, const src_file_list* list, uint32_t* fileGroups);
+// appends the group table, it has to follow the TOC
+void src_write_groups(src_context* ctx);
+void src_group_table_free(src_group_table* groups);
+
+// src_shard.c
+int src_pack_sharded(src_context* ctx);
+// path of a shard, the shard number goes in front of the extension of outputPath
+char* src_shard_path(const char* outputPath, uint32_t shard);
+
+// src_watch.c
+int src_watch(src_context* ctx);
+
+// src_verify.c
+int src_verify_main(int argc, char** argv);
+
+// src_merge.c
+int src_merge_main(int argc, char** argv);
+
+// src_analyze.c
+int src_analyze_main(int argc, char** argv);
+
+// src_patch.c
+int src_diff_main(int argc, char** argv);
+int src_patch_main(int argc, char** argv);
+
+#endif // SRC_TOOL_H
@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "simple_resource_compiler.h"
+#include "src_tool.h"
+#include "src_thread.h"
+
+///
+/// Transforms.
+///
+/// Usage: src.exe -t "resources/" -o "data.src" -s "include/" --transform .json=json-minify
+///            [--transform-cmd ".png=texconv --bc7"] [--cache "dir"]
+///
+/// Files are converted before they are packed, by the transform registered for
+/// their extension. --transform names a built-in one, --transform-cmd a command
+/// run by the shell which reads the file from stdin and writes the result to
+/// stdout. All transforms of a pack run in parallel on -j threads.
+///
+/// Results are stored in a content addressed cache, by default the directory
+/// "<output>.cache", under a key of the hash of the input, the transform and its
+/// version. A command is its own id, changing it runs it again. Unchanged files
+/// are packed from the cache without running the transform. Nothing is ever
+/// removed from the cache, it can be deleted at any time.
+///
+/// Built-in transforms:
+///
+///     json-minify      drops the whitespace outside of strings
+///     strip-comments   drops C style comments, e.g. of shaders, lines are kept
+///
+
+#if defined(_WIN32)
+#include <direct.h>
+#include <process.h>
+#define src_getpid _getpid
+#else
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define src_getpid getpid
+extern char** environ;
+#endif
+
+typedef struct {
+	const char* name;
+	uint32_t version; // bumped whenever the output changes
+	src_transform_func func;
+} src_builtin_transform;
+
+static unsigned char* JsonMinify(const unsigned char* data, size_t size, size_t* outSize)
+{
+	unsigned char* out = (unsigned char*)malloc(size + 1);
+	size_t n = 0;
+	int inString = 0;
+	for (size_t i = 0; i < size; i += 1) {
+		unsigned char c = data[i];
+		if (inString) {
+			out[n++] = c;
+			if (c == '\\' && i + 1 < size) out[n++] = data[++i];
+			else if (c == '"') inString = 0;
+		}
+		else if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+			out[n++] = c;
+			inString = c == '"';
+		}
+	}
+	*outSize = n;
+	return out;
+}
+
+static unsigned char* StripComments(const unsigned char* data, size_t size, size_t* outSize)
+{
+	unsigned char* out = (unsigned char*)malloc(size + 1);
+	size_t n = 0;
+	for (size_t i = 0; i < size; i += 1) {
+		unsigned char c = data[i];
+		if (c == '"') {
+			// string literals, e.g. of #include, keep what looks like comments
+			out[n++] = c;
+			for (i += 1; i < size && data[i] != '"' && data[i] != '\n'; i += 1) {
+				if (data[i] == '\\' && i + 1 < size) out[n++] = data[i++];
+				out[n++] = data[i];
+			}
+			if (i < size) out[n++] = data[i];
+		}
+		else if (c == '/' && i + 1 < size && data[i + 1] == '/') {
+			while (i + 1 < size && data[i + 1] != '\n') i += 1;
+		}
+		else if (c == '/' && i + 1 < size && data[i + 1] == '*') {
+			// a space keeps the tokens around it apart, the newlines the line numbers
+			out[n++] = ' ';
+			for (i += 2; i < size && !(data[i] == '*' && i + 1 < size && data[i + 1] == '/'); i += 1) {
+				if (data[i] == '\n') out[n++] = '\n';
+			}
+			i += 1;
+		}
+		else {
+			out[n++] = c;
+		}
+	}
+	*outSize = n;
+	return out;
+}
+
+static const src_builtin_transform BuiltinTransforms[] = {
+	{ "json-minify", 1, JsonMinify },
+	{ "strip-comments", 1, StripComments },
+};
+
+int src_add_transform(src_context* ctx, const char* spec, int external)
+{
+	const char* value = strchr(spec, '=');
+	if (!value || value == spec || !value[1]) {
+		LOGF_MSG("Expected extension=%s, got \"%s\"", external ? "command" : "transform", spec);
+		return 0;
+	}
+	src_transform transform = { 0 };
+	size_t extLen = (size_t)(value - spec);
+	int dot = spec[0] != '.';
+	char* extension = (char*)malloc(extLen + dot + 1);
+	extension[0] = '.';
+	memcpy(extension + dot, spec, extLen);
+	extension[extLen + dot] = '\0';
+	transform.extension = extension;
+	transform.id = value + 1;
+	for (size_t i = 0; !external && i < sizeof(BuiltinTransforms) / sizeof(BuiltinTransforms[0]); i += 1) {
+		if (strcmp(BuiltinTransforms[i].name, transform.id) == 0) {
+			transform.func = BuiltinTransforms[i].func;
+			transform.version = BuiltinTransforms[i].version;
+		}
+	}
+	if (!external && !transform.func) {
+		LOGF_MSG("Unknown transform \"%s\"", transform.id);
+		free(extension);
+		return 0;
+	}
+
+	ctx->transforms = (src_transform*)realloc(ctx->transforms, (ctx->transformCount + 1) * sizeof(src_transform));
+	ctx->transforms[ctx->transformCount++] = transform;
+	return 1;
+}
+
+static const src_transform* FindTransform(const src_context* ctx, const char* path)
+{
+	const char* name = path;
+	for (const char* c = path; *c; c += 1) {
+		if (*c == '/' || *c == '\\') name = c + 1;
+	}
+	const char* extension = strrchr(name, '.');
+	if (!extension) return NULL;
+	// the last one given wins
+	for (size_t i = ctx->transformCount; i > 0; i -= 1) {
+		if (strcmp(ctx->transforms[i - 1].extension, extension) == 0) return &ctx->transforms[i - 1];
+	}
+	return NULL;
+}
+
+static int MakeDirectory(const char* path)
+{
+#if defined(_WIN32)
+	return _mkdir(path) == 0 || errno == EEXIST;
+#else
+	return mkdir(path, 0777) == 0 || errno == EEXIST;
+#endif
+}
+
+// runs command with input on stdin and stdout going to output
+static int RunCommand(const char* command, const char* input, const char* output)
+{
+#if defined(_WIN32)
+	size_t len = strlen(command) + strlen(input) + strlen(output) + 16;
+	char* line = (char*)malloc(len);
+	snprintf(line, len, "%s < \"%s\" > \"%s\"", command, input, output);
+	int succ = system(line) == 0;
+	free(line);
+	return succ;
+#else
+	// posix_spawn, unlike system, may be called from several threads
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, 0, input, O_RDONLY, 0);
+	posix_spawn_file_actions_addopen(&actions, 1, output, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	char* argv[] = { (char*)"sh", (char*)"-c", (char*)command, NULL };
+	pid_t pid;
+	int succ = posix_spawn(&pid, "/bin/sh", &actions, NULL, argv, environ) == 0;
+	posix_spawn_file_actions_destroy(&actions);
+	int status = 0;
+	while (succ && waitpid(pid, &status, 0) < 0) {
+		succ = errno == EINTR;
+	}
+	return succ && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+static int WriteFile(const char* path, const unsigned char* data, size_t size)
+{
+	FILE* file = fopen(path, "wb");
+	if (!file) return 0;
+	int succ = fwrite(data, 1, size, file) == size;
+	succ = fclose(file) == 0 && succ;
+	return succ;
+}
+
+typedef struct {
+	src_file_list* list;
+	const char* cacheDir;
+	size_t* files; // indices of the files with a transform
+	const src_transform** transforms;
+	char** outputs; // the cached results
+	uint64_t* sizes;
+	volatile int64_t failed;
+	volatile int64_t hits;
+} src_transform_job;
+
+static void TransformFile(void* arg, int index)
+{
+	src_transform_job* job = (src_transform_job*)arg;
+	const src_file_entry* file = &job->list->files[job->files[index]];
+	const src_transform* transform = job->transforms[index];
+
+	unsigned char* data = src_read_file(file->path, file->size);
+	if (!data) {
+		LOGF_MSG("Failed to read \"%s\"", file->path);
+		src_atomic_add(&job->failed, 1);
+		return;
+	}
+	uint64_t transformHash = src_fnv1a64(transform->id, strlen(transform->id) + 1, SRC_FNV1A64_INIT);
+	transformHash = src_fnv1a64(&transform->version, sizeof(transform->version), transformHash);
+	size_t len = strlen(job->cacheDir) + 64;
+	char* output = (char*)malloc(len);
+	snprintf(output, len, "%s/%016llx%08x%016llx", job->cacheDir,
+		(unsigned long long)src_fnv1a64(data, (size_t)file->size, SRC_FNV1A64_INIT), src_crc32c(data, (size_t)file->size, 0),
+		(unsigned long long)transformHash);
+
+	int succ = 1;
+	FILE* cached = fopen(output, "rb");
+	if (cached) {
+		src_fseek64(cached, 0, SEEK_END);
+		job->sizes[index] = (uint64_t)src_ftell64(cached);
+		fclose(cached);
+		src_atomic_add(&job->hits, 1);
+	}
+	else {
+		// written next to the result and renamed, a cached file is always complete. The
+		// pid keeps the temporary files of src processes sharing the cache apart.
+		char* temp = (char*)malloc(len + 32);
+		snprintf(temp, len + 32, "%s.%ld.%d.tmp", output, (long)src_getpid(), index);
+		if (transform->func) {
+			size_t size = 0;
+			unsigned char* result = transform->func(data, (size_t)file->size, &size);
+			succ = result && WriteFile(temp, result, size);
+			free(result);
+		}
+		else {
+			succ = RunCommand(transform->id, file->path, temp);
+		}
+		if (succ && rename(temp, output) != 0) {
+			// another src may have stored the same result meanwhile
+			remove(output);
+			succ = rename(temp, output) == 0;
+		}
+		FILE* result = succ ? fopen(output, "rb") : NULL;
+		if (result) {
+			src_fseek64(result, 0, SEEK_END);
+			job->sizes[index] = (uint64_t)src_ftell64(result);
+			fclose(result);
+		}
+		succ = result != NULL;
+		if (!succ) {
+			LOGF_MSG("Transform \"%s\" failed on \"%s\"", transform->id, file->path);
+			remove(temp);
+			src_atomic_add(&job->failed, 1);
+		}
+		free(temp);
+	}
+	free(data);
+	job->outputs[index] = succ ? output : NULL;
+	if (!succ) free(output);
+}
+
+int src_run_transforms(src_context* ctx, src_file_list* list, const uint32_t* fileShards, uint32_t shard)
+{
+	if (ctx->transformCount == 0) return 1;
+
+	src_transform_job job = { 0 };
+	job.list = list;
+	job.files = (size_t*)malloc((list->count + 1) * sizeof(size_t));
+	job.transforms = (const src_transform**)malloc((list->count + 1) * sizeof(src_transform*));
+	size_t count = 0;
+	for (size_t i = 0; i < list->count; i += 1) {
+		if (fileShards && fileShards[i] != shard) continue;
+		const src_transform* transform = FindTransform(ctx, list->files[i].path);
+		if (!transform) continue;
+		job.files[count] = i;
+		job.transforms[count] = transform;
+		count += 1;
+	}
+
+	char* cacheDir = NULL;
+	if (ctx->cacheDir) {
+		cacheDir = strdup(ctx->cacheDir);
+	}
+	else {
+		size_t len = strlen(ctx->outputFilePath) + 8;
+		cacheDir = (char*)malloc(len);
+		snprintf(cacheDir, len, "%s.cache", ctx->outputFilePath);
+	}
+	job.cacheDir = cacheDir;
+	int succ = 1;
+	if (count > 0 && !MakeDirectory(cacheDir)) {
+		LOGF_MSG("Failed to create the cache \"%s\"", cacheDir);
+		succ = 0;
+	}
+
+	job.outputs = (char**)calloc(count + 1, sizeof(char*));
+	job.sizes = (uint64_t*)calloc(count + 1, sizeof(uint64_t));
+	if (succ && count > 0) {
+		src_parallel_for(ctx->threadCount, (int)count, TransformFile, &job);
+		succ = job.failed == 0;
+	}
+
+	// the results are packed in place of the files, the list owns their paths
+	list->blocks = (char**)realloc(list->blocks, (list->blockCount + count + 1) * sizeof(char*));
+	for (size_t i = 0; i < count; i += 1) {
+		if (!job.outputs[i]) continue;
+		src_file_entry* file = &list->files[job.files[i]];
+		file->source = job.outputs[i];
+		file->size = job.sizes[i];
+		list->blocks[list->blockCount++] = job.outputs[i];
+	}
+	if (succ) {
+		LOGF_MSG("Transformed %zu files, %lld from the cache", count, (long long)job.hits);
+	}
+
+	free(cacheDir);
+	free(job.files);
+	free(job.transforms);
+	free(job.outputs);
+	free(job.sizes);
+	return succ;
+}
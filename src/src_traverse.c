@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src_tool.h"
+#include "src_thread.h"
+
+///
+/// Parallel directory traversal.
+///
+/// Every worker owns a deque of directories. It pops its own work from the back
+/// (depth first, good locality) and steals from the front of the other deques
+/// once it runs dry. On Linux directories are read with getdents64 and entries
+/// are stat'ed relative to the directory fd, so the kernel never resolves a full
+/// path per file. File paths are kept in per worker arenas and merged into a
+/// list sorted by path at the end. The include and exclude rules are applied
+/// as entries are read, see src_rules.c.
+///
+
+#if defined(__linux__)
+#define SRC_USE_GETDENTS
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct src_linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+#else
+#include <errno.h>
+#define CUTE_FILES_IMPLEMENTATION
+#include "cute_files.h"
+#endif
+
+#define SRC_ARENA_BLOCK_SIZE (64 * 1024)
+#define SRC_DIRENT_BUFFER_SIZE (32 * 1024)
+
+typedef struct {
+	src_mutex lock;
+	// directories to scan, [head, tail) of a ring buffer
+	const char** jobs;
+	size_t head;
+	size_t tail;
+	size_t capacity;
+
+	src_file_entry* files;
+	size_t fileCount;
+	size_t fileCapacity;
+
+	const char** dirs;
+	size_t dirCount;
+	size_t dirCapacity;
+
+	char** blocks;
+	size_t blockCount;
+	size_t blockUsed;
+} src_traverse_worker;
+
+typedef struct {
+	src_traverse_worker* workers;
+	int workerCount;
+	const src_rules* rules;
+	// directories queued or being scanned
+	volatile int64_t pending;
+} src_traverse_context;
+
+static char* ArenaAlloc(src_traverse_worker* worker, size_t size)
+{
+	if (worker->blockCount == 0 || worker->blockUsed + size > SRC_ARENA_BLOCK_SIZE) {
+		size_t blockSize = size > SRC_ARENA_BLOCK_SIZE ? size : SRC_ARENA_BLOCK_SIZE;
+		worker->blocks = (char**)realloc(worker->blocks, (worker->blockCount + 1) * sizeof(char*));
+		worker->blocks[worker->blockCount++] = (char*)malloc(blockSize);
+		worker->blockUsed = 0;
+	}
+	char* mem = worker->blocks[worker->blockCount - 1] + worker->blockUsed;
+	worker->blockUsed += size;
+	return mem;
+}
+
+// same layout as the paths built by cute_files, ids are hashed from them
+static const char* JoinPath(src_traverse_worker* worker, const char* dir, const char* name)
+{
+	size_t dirLen = strlen(dir);
+	size_t nameLen = strlen(name);
+	char* path = ArenaAlloc(worker, dirLen + nameLen + 2);
+	memcpy(path, dir, dirLen);
+	path[dirLen] = '/';
+	memcpy(path + dirLen + 1, name, nameLen + 1);
+	return path;
+}
+
+static void AddFile(src_traverse_context* ctx, src_traverse_worker* worker, const char* path, uint64_t size)
+{
+	if (worker->fileCount == worker->fileCapacity) {
+		worker->fileCapacity = worker->fileCapacity ? worker->fileCapacity * 2 : 256;
+		worker->files = (src_file_entry*)realloc(worker->files, worker->fileCapacity * sizeof(src_file_entry));
+	}
+	src_file_entry* file = &worker->files[worker->fileCount];
+	memset(file, 0, sizeof(src_file_entry));
+	file->path = path;
+	file->size = size;
+	file->source = path;
+	file->compress = SRC_RULE_UNSET;
+	if (src_rules_match_file(ctx->rules, file)) {
+		worker->fileCount += 1;
+	}
+}
+
+static void AddDirectory(src_traverse_worker* worker, const char* path)
+{
+	if (worker->dirCount == worker->dirCapacity) {
+		worker->dirCapacity = worker->dirCapacity ? worker->dirCapacity * 2 : 64;
+		worker->dirs = (const char**)realloc(worker->dirs, worker->dirCapacity * sizeof(const char*));
+	}
+	worker->dirs[worker->dirCount++] = path;
+}
+
+static void PushJob(src_traverse_context* ctx, src_traverse_worker* worker, const char* path)
+{
+	src_atomic_add(&ctx->pending, 1);
+	src_mutex_lock(&worker->lock);
+	if (worker->tail - worker->head == worker->capacity) {
+		size_t capacity = worker->capacity ? worker->capacity * 2 : 64;
+		const char** jobs = (const char**)malloc(capacity * sizeof(const char*));
+		for (size_t i = worker->head; i < worker->tail; i += 1) {
+			jobs[i - worker->head] = worker->jobs[i % worker->capacity];
+		}
+		free(worker->jobs);
+		worker->jobs = jobs;
+		worker->tail -= worker->head;
+		worker->head = 0;
+		worker->capacity = capacity;
+	}
+	worker->jobs[worker->tail % worker->capacity] = path;
+	worker->tail += 1;
+	src_mutex_unlock(&worker->lock);
+}
+
+static const char* PopJob(src_traverse_worker* worker, int steal)
+{
+	const char* path = NULL;
+	src_mutex_lock(&worker->lock);
+	if (worker->head != worker->tail) {
+		if (steal) {
+			path = worker->jobs[worker->head % worker->capacity];
+			worker->head += 1;
+		}
+		else {
+			worker->tail -= 1;
+			path = worker->jobs[worker->tail % worker->capacity];
+		}
+	}
+	src_mutex_unlock(&worker->lock);
+	return path;
+}
+
+// excluded directories are never opened
+static void AddSubdirectory(src_traverse_context* ctx, src_traverse_worker* worker, const char* path)
+{
+	if (src_rules_match_dir(ctx->rules, path)) {
+		PushJob(ctx, worker, path);
+	}
+}
+
+#ifdef SRC_USE_GETDENTS
+static void ScanDirectory(src_traverse_context* ctx, src_traverse_worker* worker, const char* path)
+{
+	int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		LOGF_MSG("Failed to open \"%s\": %s", path, strerror(errno));
+		return;
+	}
+	AddDirectory(worker, path);
+
+	// 8 byte alignment for the dirent records
+	uint64_t buffer[SRC_DIRENT_BUFFER_SIZE / sizeof(uint64_t)];
+	for (;;) {
+		long read = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+		if (read <= 0) break;
+
+		for (long offset = 0; offset < read;) {
+			struct src_linux_dirent64* entry = (struct src_linux_dirent64*)((char*)buffer + offset);
+			offset += entry->d_reclen;
+
+			const char* name = entry->d_name;
+			if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+			unsigned char type = entry->d_type;
+			struct stat st;
+			if (type == DT_REG || type == DT_LNK || type == DT_UNKNOWN) {
+				// follows links like the stat in cute_files
+				if (fstatat(fd, name, &st, 0) != 0) continue;
+				type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+			}
+
+			if (type == DT_DIR && name[0] != '.') {
+				AddSubdirectory(ctx, worker, JoinPath(worker, path, name));
+			}
+			else if (type == DT_REG) {
+				AddFile(ctx, worker, JoinPath(worker, path, name), (uint64_t)st.st_size);
+			}
+		}
+	}
+	close(fd);
+}
+
+static int CanOpenDirectory(const char* path)
+{
+	int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) return 0;
+	close(fd);
+	return 1;
+}
+#else
+static void ScanDirectory(src_traverse_context* ctx, src_traverse_worker* worker, const char* path)
+{
+	cf_dir_t dir;
+	if (!cf_dir_open(&dir, path)) {
+		LOGF_MSG("Failed to open \"%s\"", path);
+		return;
+	}
+	AddDirectory(worker, path);
+
+	while (dir.has_next) {
+		cf_file_t file;
+		cf_read_file(&dir, &file);
+		if (file.is_dir && file.name[0] != '.') {
+			AddSubdirectory(ctx, worker, JoinPath(worker, path, file.name));
+		}
+		else if (!file.is_dir && file.is_reg) {
+			AddFile(ctx, worker, JoinPath(worker, path, file.name), (uint64_t)file.size);
+		}
+		cf_dir_next(&dir);
+	}
+	cf_dir_close(&dir);
+}
+
+static int CanOpenDirectory(const char* path)
+{
+	cf_dir_t dir;
+	if (!cf_dir_open(&dir, path)) return 0;
+	cf_dir_close(&dir);
+	return 1;
+}
+#endif
+
+static void TraverseWorker(void* arg, int index)
+{
+	src_traverse_context* ctx = (src_traverse_context*)arg;
+	src_traverse_worker* worker = &ctx->workers[index];
+	for (;;) {
+		const char* path = PopJob(worker, 0);
+		for (int i = 1; !path && i < ctx->workerCount; i += 1) {
+			path = PopJob(&ctx->workers[(index + i) % ctx->workerCount], 1);
+		}
+
+		if (path) {
+			ScanDirectory(ctx, worker, path);
+			src_atomic_add(&ctx->pending, -1);
+		}
+		else if (src_atomic_load(&ctx->pending) == 0) {
+			break;
+		}
+		else {
+			src_thread_yield();
+		}
+	}
+}
+
+static int CompareFilePath(const void* a, const void* b)
+{
+	return strcmp(((const src_file_entry*)a)->path, ((const src_file_entry*)b)->path);
+}
+
+static int CompareDirPath(const void* a, const void* b)
+{
+	return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+int src_collect_files(const char* root, int threadCount, const src_rules* rules, src_file_list* list)
+{
+	memset(list, 0, sizeof(src_file_list));
+	if (!CanOpenDirectory(root)) {
+		LOGF_MSG("Failed to open \"%s\"", root);
+		return 0;
+	}
+
+	src_traverse_context ctx = { 0 };
+	ctx.workerCount = threadCount > 0 ? threadCount : 1;
+	ctx.rules = rules;
+	ctx.workers = (src_traverse_worker*)calloc(ctx.workerCount, sizeof(src_traverse_worker));
+	for (int i = 0; i < ctx.workerCount; i += 1) {
+		src_mutex_init(&ctx.workers[i].lock);
+	}
+
+	// the root keeps its spelling, no trailing delimiter is stripped
+	size_t rootLen = strlen(root) + 1;
+	char* rootPath = ArenaAlloc(&ctx.workers[0], rootLen);
+	memcpy(rootPath, root, rootLen);
+	PushJob(&ctx, &ctx.workers[0], rootPath);
+
+	src_parallel_for(ctx.workerCount, ctx.workerCount, TraverseWorker, &ctx);
+
+	// merge the results of all workers
+	size_t fileCount = 0;
+	size_t dirCount = 0;
+	size_t blockCount = 0;
+	for (int i = 0; i < ctx.workerCount; i += 1) {
+		fileCount += ctx.workers[i].fileCount;
+		dirCount += ctx.workers[i].dirCount;
+		blockCount += ctx.workers[i].blockCount;
+	}
+	list->files = (src_file_entry*)malloc((fileCount + 1) * sizeof(src_file_entry));
+	list->dirs = (const char**)malloc((dirCount + 1) * sizeof(const char*));
+	list->blocks = (char**)malloc((blockCount + 1) * sizeof(char*));
+	for (int i = 0; i < ctx.workerCount; i += 1) {
+		src_traverse_worker* worker = &ctx.workers[i];
+		memcpy(list->files + list->count, worker->files, worker->fileCount * sizeof(src_file_entry));
+		list->count += worker->fileCount;
+		memcpy(list->dirs + list->dirCount, worker->dirs, worker->dirCount * sizeof(const char*));
+		list->dirCount += worker->dirCount;
+		memcpy(list->blocks + list->blockCount, worker->blocks, worker->blockCount * sizeof(char*));
+		list->blockCount += worker->blockCount;
+
+		free(worker->files);
+		free(worker->dirs);
+		free(worker->blocks);
+		free(worker->jobs);
+		src_mutex_destroy(&worker->lock);
+	}
+	free(ctx.workers);
+
+	qsort(list->files, list->count, sizeof(src_file_entry), CompareFilePath);
+	qsort(list->dirs, list->dirCount, sizeof(const char*), CompareDirPath);
+	return 1;
+}
+
+void src_file_list_free(src_file_list* list)
+{
+	for (size_t i = 0; i < list->blockCount; i += 1) {
+		free(list->blocks[i]);
+	}
+	free(list->blocks);
+	free(list->files);
+	free(list->dirs);
+	memset(list, 0, sizeof(src_file_list));
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "simple_resource_compiler.h"
+#include "src_tool.h"
+#include "src_thread.h"
+
+///
+/// Usage: src.exe verify "data.src" [-j threads]
+///
+/// Maps the archive, which checks the headers and the TOC checksum, then checks
+/// every resource against its checksum. Resources are split into ranges of
+/// similar byte size which are verified on all cores. A resource larger than a
+/// range is split into parts whose crcs are combined afterwards.
+///
+
+// minimum bytes per work item, keeps the scheduling overhead low for small resources
+#define SRC_VERIFY_MIN_RANGE (4 * 1024 * 1024)
+
+typedef struct {
+	size_t first;
+	size_t last; // exclusive
+	// a part of the resource first, length 0 for whole resources
+	uint64_t offset;
+	uint64_t length;
+	uint32_t crc;
+} src_verify_range;
+
+typedef struct {
+	src_archive* archive;
+	src_verify_range* ranges;
+} src_verify_context;
+
+static void VerifyRange(void* arg, int index)
+{
+	src_verify_context* ctx = (src_verify_context*)arg;
+	src_verify_range* range = &ctx->ranges[index];
+	if (range->length) {
+		const src_archive_entry* entry = &ctx->archive->entries[range->first];
+		range->crc = src_crc32c(entry->data + range->offset, (size_t)range->length, 0);
+		return;
+	}
+	for (size_t i = range->first; i < range->last; i += 1) {
+		src_entry_verify(&ctx->archive->entries[i]);
+	}
+}
+
+static double NowSeconds(void)
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int src_verify_main(int argc, char** argv)
+{
+	const char* path = NULL;
+	int threadCount = src_cpu_count();
+	for (int i = 1; i < argc; i += 1) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			threadCount = atoi(argv[i + 1]);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-v") == 0) {
+			verbose = 0;
+		}
+		else if (!path) {
+			path = argv[i];
+		}
+	}
+	if (!path) {
+		LOGR_MSG("Usage:\tsrc.exe verify \"data.src\" [-j threads]");
+		return -1;
+	}
+
+	double start = NowSeconds();
+	src_archive archive;
+	if (!src_archive_open(&archive, path)) {
+		printf("\"%s\": header or table of contents didn't validate.\n", path);
+		return -1;
+	}
+
+	uint64_t totalBytes = 0;
+	for (size_t i = 0; i < archive.entryCount; i += 1) {
+		totalBytes += archive.entries[i].header->resourceSize;
+	}
+	if (threadCount < 1) threadCount = 1;
+	uint64_t rangeBytes = totalBytes / ((uint64_t)threadCount * 16);
+	if (rangeBytes < SRC_VERIFY_MIN_RANGE) rangeBytes = SRC_VERIFY_MIN_RANGE;
+
+	src_verify_context ctx;
+	ctx.archive = &archive;
+	size_t maxRanges = archive.entryCount + 1;
+	for (size_t i = 0; i < archive.entryCount; i += 1) {
+		maxRanges += (size_t)(archive.entries[i].header->resourceSize / rangeBytes) + 1;
+	}
+	ctx.ranges = (src_verify_range*)calloc(maxRanges, sizeof(src_verify_range));
+	int rangeCount = 0;
+	for (size_t i = 0; i < archive.entryCount;) {
+		uint64_t size = archive.entries[i].header->resourceSize;
+		if (size > rangeBytes) {
+			for (uint64_t offset = 0; offset < size; offset += rangeBytes) {
+				src_verify_range* part = &ctx.ranges[rangeCount++];
+				part->first = i;
+				part->last = i + 1;
+				part->offset = offset;
+				part->length = size - offset < rangeBytes ? size - offset : rangeBytes;
+			}
+			i += 1;
+			continue;
+		}
+		uint64_t bytes = 0;
+		ctx.ranges[rangeCount].first = i;
+		while (i < archive.entryCount && bytes < rangeBytes && archive.entries[i].header->resourceSize <= rangeBytes) {
+			bytes += archive.entries[i].header->resourceSize;
+			i += 1;
+		}
+		ctx.ranges[rangeCount].last = i;
+		rangeCount += 1;
+	}
+	src_parallel_for(threadCount, rangeCount, VerifyRange, &ctx);
+
+	// joins the parts in order, the result is cached like src_entry_verify does
+	for (int r = 0; r < rangeCount;) {
+		if (!ctx.ranges[r].length) {
+			r += 1;
+			continue;
+		}
+		src_archive_entry* entry = &archive.entries[ctx.ranges[r].first];
+		uint32_t crc = ctx.ranges[r].crc;
+		for (r += 1; r < rangeCount && ctx.ranges[r].length && ctx.ranges[r].offset != 0; r += 1) {
+			crc = src_crc32c_combine(crc, ctx.ranges[r].crc, ctx.ranges[r].length);
+		}
+		SRC_ATOMIC_CAS(&entry->verifyState, SRC_VERIFY_UNKNOWN,
+			crc == entry->header->checksum ? SRC_VERIFY_OK : SRC_VERIFY_FAILED);
+	}
+	free(ctx.ranges);
+
+	size_t failed = 0;
+	for (size_t i = 0; i < archive.entryCount; i += 1) {
+		if (!src_entry_verify(&archive.entries[i])) {
+			printf("Checksum mismatch: \"%s\"\n", archive.entries[i].name);
+			failed += 1;
+		}
+	}
+
+	double seconds = NowSeconds() - start;
+	printf("Verified %zu resources, %.1f MiB in %.3f s (%.2f GiB/s), %zu failed\n",
+		archive.entryCount,
+		(double)totalBytes / (1024.0 * 1024.0),
+		seconds,
+		seconds > 0 ? (double)totalBytes / seconds / (1024.0 * 1024.0 * 1024.0) : 0.0,
+		failed);
+	src_archive_close(&archive);
+	return failed ? -1 : 0;
+}
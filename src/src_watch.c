@@ -0,0 +1,568 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simple_resource_compiler.h"
+#include "src_tool.h"
+
+///
+/// Watch mode: src.exe --watch -t "resources/" -o "data.src" -s "include/"
+///
+/// After the initial pack the file list and archive layout stay in memory.
+/// Bursts of filesystem events are debounced, then changed resources are
+/// appended to the archive followed by a new TOC. Once both are synced the
+/// tocOffset of the main header is swapped, so a reader opening the archive
+/// sees either the old or the new TOC, and readers which already mapped it
+/// keep valid records. The generated header has the offsets and sizes of the
+/// resources, it is rewritten after every update. Dead records are compacted
+/// away once they outweigh the live ones. Appended and compacted records keep
+/// the data alignment of the rules. When the kernel dropped events because its
+/// queue overflowed, the whole tree is compared with the archive instead.
+///
+
+#if defined(__linux__)
+#include <errno.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SRC_WATCH_DEBOUNCE_MS 50
+#define SRC_WATCH_MAX_DELAY_MS 500
+#define SRC_WATCH_COMPACT_MIN (1024 * 1024)
+// copies of a file which changed while it was copied
+#define SRC_WATCH_COPY_ATTEMPTS 3
+// entry flag only used while applying a burst
+#define SRC_WATCH_REMOVED 0x80
+#define SRC_WATCH_EVENT_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF)
+
+typedef struct {
+	int wd;
+	char* path;
+} src_watch_dir;
+
+typedef struct {
+	src_context* ctx;
+	int fd;
+
+	src_watch_dir* dirs;
+	size_t dirCount;
+	size_t dirCapacity;
+
+	// paths touched by the current burst of events
+	char** changed;
+	size_t changedCount;
+	size_t changedCapacity;
+
+	uint64_t liveBytes;
+	uint64_t deadBytes;
+	int layoutChanged; // offsets or sizes of the generated header changed
+	int overflowed; // events were dropped, the next update rescans the tree
+} src_watch_state;
+
+static uint64_t NowMs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static char* JoinPath(const char* dir, const char* name)
+{
+	size_t len = strlen(dir) + strlen(name) + 2;
+	char* path = (char*)malloc(len);
+	snprintf(path, len, "%s/%s", dir, name);
+	return path;
+}
+
+static uint64_t TocSize(size_t entryCount)
+{
+	return sizeof(src_toc_header) + entryCount * sizeof(src_toc_entry);
+}
+
+static void AddWatchRecursive(src_watch_state* state, const char* path)
+{
+	// excluded directories don't get events
+	if (!src_rules_match_dir(&state->ctx->rules, path)) return;
+	int wd = inotify_add_watch(state->fd, path, SRC_WATCH_EVENT_MASK);
+	if (wd < 0) {
+		LOGF_MSG("Failed to watch \"%s\": %s", path, strerror(errno));
+		return;
+	}
+
+	// the same directory may be reported again, e.g. when moved
+	src_watch_dir* dir = NULL;
+	for (size_t i = 0; i < state->dirCount; i += 1) {
+		if (state->dirs[i].wd == wd) dir = &state->dirs[i];
+	}
+	if (!dir) {
+		if (state->dirCount == state->dirCapacity) {
+			state->dirCapacity = state->dirCapacity ? state->dirCapacity * 2 : 64;
+			state->dirs = (src_watch_dir*)realloc(state->dirs, state->dirCapacity * sizeof(src_watch_dir));
+		}
+		dir = &state->dirs[state->dirCount++];
+		dir->wd = wd;
+	}
+	else {
+		free(dir->path);
+	}
+	dir->path = strdup(path);
+
+	DIR* handle = opendir(path);
+	if (!handle) return;
+	struct dirent* entry;
+	while ((entry = readdir(handle))) {
+		if (entry->d_name[0] == '.') continue;
+		char* child = JoinPath(path, entry->d_name);
+		struct stat st;
+		if (stat(child, &st) == 0 && S_ISDIR(st.st_mode)) {
+			AddWatchRecursive(state, child);
+		}
+		free(child);
+	}
+	closedir(handle);
+}
+
+static const char* FindWatchDir(src_watch_state* state, int wd)
+{
+	for (size_t i = 0; i < state->dirCount; i += 1) {
+		if (state->dirs[i].wd == wd) return state->dirs[i].path;
+	}
+	return NULL;
+}
+
+static void RemoveWatchDir(src_watch_state* state, int wd)
+{
+	for (size_t i = 0; i < state->dirCount; i += 1) {
+		if (state->dirs[i].wd == wd) {
+			free(state->dirs[i].path);
+			state->dirs[i] = state->dirs[--state->dirCount];
+			return;
+		}
+	}
+}
+
+static void MarkChanged(src_watch_state* state, char* path)
+{
+	if (state->changedCount == state->changedCapacity) {
+		state->changedCapacity = state->changedCapacity ? state->changedCapacity * 2 : 64;
+		state->changed = (char**)realloc(state->changed, state->changedCapacity * sizeof(char*));
+	}
+	state->changed[state->changedCount++] = path;
+}
+
+// returns 0 once no more events are pending
+static int ReadEvents(src_watch_state* state)
+{
+	// aligned for struct inotify_event
+	uint64_t buffer[4096 / sizeof(uint64_t)];
+	ssize_t len = read(state->fd, buffer, sizeof(buffer));
+	if (len <= 0) return 0;
+
+	for (char* ptr = (char*)buffer; ptr < (char*)buffer + len;) {
+		struct inotify_event* event = (struct inotify_event*)ptr;
+		ptr += sizeof(struct inotify_event) + event->len;
+
+		if (event->mask & IN_Q_OVERFLOW) {
+			if (!state->overflowed) LOGF_MSG("Events of \"%s\" were dropped, rescanning it", state->ctx->targetDir);
+			state->overflowed = 1;
+			continue;
+		}
+		if (event->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+			RemoveWatchDir(state, event->wd);
+			continue;
+		}
+		const char* dir = FindWatchDir(state, event->wd);
+		if (!dir || event->len == 0) continue;
+		if ((event->mask & IN_ISDIR) && event->name[0] == '.') continue;
+
+		char* path = JoinPath(dir, event->name);
+		if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+			AddWatchRecursive(state, path);
+		}
+		MarkChanged(state, path);
+	}
+	return 1;
+}
+
+static int CompareEntries(const void* a, const void* b)
+{
+	const src_packed_entry* ea = (const src_packed_entry*)a;
+	const src_packed_entry* eb = (const src_packed_entry*)b;
+	int ta = (ea->flags & SRC_RESOURCE_FLAG_TOMBSTONE) != 0;
+	int tb = (eb->flags & SRC_RESOURCE_FLAG_TOMBSTONE) != 0;
+	if (ta != tb) return ta - tb;
+	return strcmp(ea->path, eb->path);
+}
+
+static int ComparePath(const void* a, const void* b)
+{
+	return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+static src_packed_entry* FindEntry(src_context* ctx, const char* path)
+{
+	// resources are sorted, added ones follow the tombstones until the commit
+	src_packed_entry key = { 0 };
+	key.path = (char*)path;
+	src_packed_entry* entry = (src_packed_entry*)bsearch(&key, ctx->entries, (size_t)ctx->packedFileCount,
+		sizeof(src_packed_entry), CompareEntries);
+	for (size_t i = ctx->packedFileCount; !entry && i < ctx->entryCount; i += 1) {
+		if (!(ctx->entries[i].flags & SRC_RESOURCE_FLAG_TOMBSTONE)
+			&& strcmp(ctx->entries[i].path, path) == 0) {
+			entry = &ctx->entries[i];
+		}
+	}
+	return entry;
+}
+
+// appends the record of the file, 0 if it was truncated or grew while it was copied
+static int AppendRecord(src_context* ctx, const char* path, uint64_t size, uint32_t alignment, uint64_t* offset, uint64_t* recordSize)
+{
+	FILE* fileHandle = fopen(path, "rb");
+	if (!fileHandle) return 0;
+
+	src_fseek64(ctx->outputFile, 0, SEEK_END);
+	uint64_t end = (uint64_t)src_ftell64(ctx->outputFile);
+	if (alignment > SRC_RECORD_ALIGNMENT) {
+		src_align_record_data(ctx->outputFile, path, alignment);
+	}
+	*offset = src_write_record(ctx->outputFile, path, src_root_length(ctx, path), fileHandle, size, 0);
+	*recordSize = (uint64_t)src_ftell64(ctx->outputFile) - *offset;
+	if (alignment > SRC_RECORD_ALIGNMENT) {
+		src_mark_record_alignment(ctx->outputFile, *offset, alignment);
+	}
+	int complete = fgetc(fileHandle) == EOF && !ferror(fileHandle);
+	fclose(fileHandle);
+
+	src_resource_header header = { 0 };
+	header.nameLen = (uint16_t)(strlen(path) + 1);
+	header.resourceSize = size;
+	if (complete && *recordSize == src_record_size(&header)) return 1;
+
+	// nothing references the record yet, it is cut off again with its padding
+	if (fflush(ctx->outputFile) != 0 || ftruncate(fileno(ctx->outputFile), (off_t)end) != 0) {
+		LOGF_MSG("Failed to roll back the record of \"%s\"", path);
+	}
+	src_fseek64(ctx->outputFile, 0, SEEK_END);
+	return 0;
+}
+
+static int UpsertResource(src_watch_state* state, const char* path, uint64_t size, uint32_t alignment)
+{
+	src_context* ctx = state->ctx;
+	uint64_t offset = 0;
+	uint64_t recordSize = 0;
+	int attempt = 1;
+	while (!AppendRecord(ctx, path, size, alignment, &offset, &recordSize)) {
+		// usually saved again right away, the next event would pick the file up anyway
+		struct stat st;
+		if (attempt == SRC_WATCH_COPY_ATTEMPTS || stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+			LOGF_MSG("\"%s\" changed while it was copied, kept the previous version", path);
+			return 0;
+		}
+		struct timespec pause = { 0, SRC_WATCH_DEBOUNCE_MS * 1000000L };
+		nanosleep(&pause, NULL);
+		size = (uint64_t)st.st_size;
+		attempt += 1;
+	}
+
+	src_packed_entry* entry = FindEntry(ctx, path);
+	if (entry && (entry->flags & SRC_WATCH_REMOVED)) {
+		// removed earlier in this burst, its old record is already dead
+		entry->flags &= ~SRC_WATCH_REMOVED;
+	}
+	else if (entry) {
+		LOGF_MSG("Changed: \"%s\"", path);
+		state->deadBytes += entry->recordSize;
+		state->liveBytes -= entry->recordSize;
+	}
+	else {
+		LOGF_MSG("Added: \"%s\"", path);
+		if (ctx->entryCount == ctx->entryCapacity) {
+			ctx->entryCapacity = ctx->entryCapacity ? ctx->entryCapacity * 2 : 64;
+			ctx->entries = (src_packed_entry*)realloc(ctx->entries, ctx->entryCapacity * sizeof(src_packed_entry));
+		}
+		entry = &ctx->entries[ctx->entryCount++];
+		entry->path = strdup(path);
+		entry->inlineData = NULL;
+		entry->flags = 0;
+	}
+	entry->offset = offset;
+	entry->recordSize = recordSize;
+	entry->size = size;
+	entry->alignment = alignment > SRC_RECORD_ALIGNMENT ? alignment : 0;
+	state->liveBytes += recordSize;
+	state->layoutChanged = 1;
+	return 1;
+}
+
+// removes the resource at path or all resources below it
+static void RemoveResources(src_watch_state* state, const char* path)
+{
+	src_context* ctx = state->ctx;
+	size_t len = strlen(path);
+	for (size_t i = 0; i < ctx->entryCount; i += 1) {
+		src_packed_entry* entry = &ctx->entries[i];
+		if ((entry->flags & (SRC_RESOURCE_FLAG_TOMBSTONE | SRC_WATCH_REMOVED))
+			|| strncmp(entry->path, path, len) != 0
+			|| (entry->path[len] != '\0' && entry->path[len] != '/')) continue;
+
+		LOGF_MSG("Removed: \"%s\"", entry->path);
+		entry->flags |= SRC_WATCH_REMOVED;
+		state->deadBytes += entry->recordSize;
+		state->liveBytes -= entry->recordSize;
+		state->layoutChanged = 1;
+	}
+}
+
+static void ApplyChange(src_watch_state* state, const char* path)
+{
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		RemoveResources(state, path);
+	}
+	else if (S_ISDIR(st.st_mode)) {
+		src_file_list list;
+		if (!src_rules_match_dir(&state->ctx->rules, path)
+			|| !src_collect_files(path, state->ctx->threadCount, &state->ctx->rules, &list)) return;
+		for (size_t i = 0; i < list.count; i += 1) {
+			UpsertResource(state, list.files[i].path, list.files[i].size, list.files[i].alignment);
+		}
+		src_file_list_free(&list);
+	}
+	else if (S_ISREG(st.st_mode)) {
+		src_file_entry file = { .path = path, .size = (uint64_t)st.st_size, .source = path, .compress = SRC_RULE_UNSET };
+		if (!src_rules_match_file(&state->ctx->rules, &file)) return;
+		UpsertResource(state, path, (uint64_t)st.st_size, file.alignment);
+	}
+}
+
+// the record of the entry holds the current data of the file
+static int RecordMatchesFile(src_context* ctx, const src_packed_entry* entry, const char* path, uint64_t size)
+{
+	if (entry->size != size) return 0;
+	src_resource_header header;
+	src_fseek64(ctx->outputFile, entry->offset, SEEK_SET);
+	int succ = fread(&header, sizeof(header), 1, ctx->outputFile) == 1;
+	src_fseek64(ctx->outputFile, 0, SEEK_END);
+	FILE* file = succ ? fopen(path, "rb") : NULL;
+	if (!file) return 0;
+
+	char buffer[64 * 1024];
+	uint32_t crc = 0;
+	size_t read;
+	while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		crc = src_crc32c(buffer, read, crc);
+	}
+	succ = !ferror(file) && crc == header.checksum;
+	fclose(file);
+	return succ;
+}
+
+// compares the whole tree with the archive after the kernel dropped events
+static void Rescan(src_watch_state* state)
+{
+	src_context* ctx = state->ctx;
+	state->overflowed = 0;
+	// directories created meanwhile have no watch yet
+	AddWatchRecursive(state, ctx->targetDir);
+
+	src_file_list list;
+	if (!src_collect_files(ctx->targetDir, ctx->threadCount, &ctx->rules, &list)) {
+		LOGF_MSG("Failed to rescan \"%s\"", ctx->targetDir);
+		return;
+	}
+	char** paths = (char**)malloc((list.count + 1) * sizeof(char*));
+	for (size_t i = 0; i < list.count; i += 1) {
+		const src_file_entry* file = &list.files[i];
+		paths[i] = (char*)file->path;
+		src_packed_entry* entry = FindEntry(ctx, file->path);
+		if (!entry || !RecordMatchesFile(ctx, entry, file->path, file->size)) {
+			UpsertResource(state, file->path, file->size, file->alignment);
+		}
+	}
+	qsort(paths, list.count, sizeof(char*), ComparePath);
+	for (size_t i = 0; i < ctx->entryCount; i += 1) {
+		const char* path = ctx->entries[i].path;
+		if (!(ctx->entries[i].flags & (SRC_RESOURCE_FLAG_TOMBSTONE | SRC_WATCH_REMOVED))
+			&& !bsearch(&path, paths, list.count, sizeof(char*), ComparePath)) {
+			RemoveResources(state, path);
+		}
+	}
+	free(paths);
+	src_file_list_free(&list);
+}
+
+static int SyncArchive(src_context* ctx)
+{
+	return fflush(ctx->outputFile) == 0 && fdatasync(fileno(ctx->outputFile)) == 0;
+}
+
+static int CommitToc(src_watch_state* state)
+{
+	src_context* ctx = state->ctx;
+
+	// drop removed entries and restore the id order
+	size_t count = 0;
+	int resourceCount = 0;
+	for (size_t i = 0; i < ctx->entryCount; i += 1) {
+		if (ctx->entries[i].flags & SRC_WATCH_REMOVED) {
+			free(ctx->entries[i].path);
+			continue;
+		}
+		if (!(ctx->entries[i].flags & SRC_RESOURCE_FLAG_TOMBSTONE)) resourceCount += 1;
+		ctx->entries[count++] = ctx->entries[i];
+	}
+	ctx->entryCount = count;
+	ctx->packedFileCount = resourceCount;
+	qsort(ctx->entries, ctx->entryCount, sizeof(src_packed_entry), CompareEntries);
+
+	// records and TOC have to be on disk before the header points at them
+	uint64_t tocOffset = src_write_toc(ctx);
+	if (!SyncArchive(ctx)) return 0;
+	src_write_header(ctx, ctx->entryCount, tocOffset);
+	return SyncArchive(ctx);
+}
+
+static int Compact(src_watch_state* state)
+{
+	src_context* ctx = state->ctx;
+	size_t tmpPathLen = strlen(ctx->outputFilePath) + 8;
+	char* tmpPath = (char*)malloc(tmpPathLen);
+	snprintf(tmpPath, tmpPathLen, "%s.tmp", ctx->outputFilePath);
+
+	FILE* tmpFile = fopen(tmpPath, "wb+");
+	if (!tmpFile) {
+		LOGF_MSG("Failed to open \"%s\"", tmpPath);
+		free(tmpPath);
+		return 0;
+	}
+
+	FILE* archiveFile = ctx->outputFile;
+	ctx->outputFile = tmpFile;
+	src_write_header(ctx, 0, 0);
+	for (size_t i = 0; i < ctx->entryCount; i += 1) {
+		src_packed_entry* entry = &ctx->entries[i];
+		if (entry->alignment > SRC_RECORD_ALIGNMENT) {
+			src_align_record_data(tmpFile, entry->path, entry->alignment);
+		}
+		uint64_t offset = (uint64_t)src_ftell64(tmpFile);
+		src_fseek64(archiveFile, entry->offset, SEEK_SET);
+		CopyFileToFile(tmpFile, archiveFile, entry->recordSize);
+		entry->offset = offset;
+	}
+	uint64_t tocOffset = src_write_toc(ctx);
+	src_write_header(ctx, ctx->entryCount, tocOffset);
+
+	int succ = SyncArchive(ctx);
+	fclose(tmpFile);
+	fclose(archiveFile);
+	// readers which mapped the old file keep it alive
+	succ = succ && rename(tmpPath, ctx->outputFilePath) == 0;
+	free(tmpPath);
+
+	ctx->outputFile = fopen(ctx->outputFilePath, "rb+");
+	if (!succ || !ctx->outputFile) {
+		LOGR_MSG("Failed to compact the archive.");
+		return 0;
+	}
+	state->deadBytes = 0;
+	src_fseek64(ctx->outputFile, 0, SEEK_END);
+	LOGF_MSG("Compacted archive to %llu bytes", (unsigned long long)src_ftell64(ctx->outputFile));
+	return 1;
+}
+
+static int ProcessChanges(src_watch_state* state)
+{
+	src_context* ctx = state->ctx;
+	uint64_t start = NowMs();
+
+	qsort(state->changed, state->changedCount, sizeof(char*), ComparePath);
+	state->layoutChanged = 0;
+	state->deadBytes += TocSize(ctx->entryCount);
+	// the rescan covers the changes which were reported
+	for (size_t i = 0; i < state->changedCount && !state->overflowed; i += 1) {
+		if (i == 0 || strcmp(state->changed[i - 1], state->changed[i]) != 0) {
+			ApplyChange(state, state->changed[i]);
+		}
+	}
+	if (state->overflowed) {
+		Rescan(state);
+	}
+	for (size_t i = 0; i < state->changedCount; i += 1) {
+		free(state->changed[i]);
+	}
+	state->changedCount = 0;
+
+	if (!CommitToc(state)) {
+		LOGR_MSG("Failed to update the archive.");
+		return 0;
+	}
+	if (state->deadBytes > state->liveBytes && state->deadBytes > SRC_WATCH_COMPACT_MIN) {
+		if (!Compact(state)) return 0;
+	}
+	// compaction moves every record, it only happens after changes
+	if (state->layoutChanged && !src_write_generated_header(ctx)) {
+		return 0;
+	}
+
+	printf("Updated \"%s\" in %llu ms\n", ctx->outputFilePath, (unsigned long long)(NowMs() - start));
+	fflush(stdout);
+	return 1;
+}
+
+int src_watch(src_context* ctx)
+{
+	src_watch_state state = { 0 };
+	state.ctx = ctx;
+	for (size_t i = 0; i < ctx->entryCount; i += 1) {
+		state.liveBytes += ctx->entries[i].recordSize;
+	}
+
+	ctx->outputFile = fopen(ctx->outputFilePath, "rb+");
+	state.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (!ctx->outputFile || state.fd < 0) {
+		LOGF_MSG("Failed to start watching \"%s\"", ctx->targetDir);
+		return -1;
+	}
+	AddWatchRecursive(&state, ctx->targetDir);
+	printf("Watching \"%s\"\n", ctx->targetDir);
+	fflush(stdout);
+
+	struct pollfd pfd;
+	pfd.fd = state.fd;
+	pfd.events = POLLIN;
+	for (;;) {
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		// debounce, wait until the burst is over
+		uint64_t burstStart = NowMs();
+		for (;;) {
+			while (ReadEvents(&state)) {}
+			if (NowMs() - burstStart >= SRC_WATCH_MAX_DELAY_MS) break;
+			if (poll(&pfd, 1, SRC_WATCH_DEBOUNCE_MS) <= 0) break;
+		}
+
+		if ((state.changedCount || state.overflowed) && !ProcessChanges(&state)) {
+			break;
+		}
+	}
+
+	close(state.fd);
+	fclose(ctx->outputFile); ctx->outputFile = NULL;
+	return -1;
+}
+#else
+int src_watch(src_context* ctx)
+{
+	LOGR_MSG("--watch is only supported on Linux.");
+	return -1;
+}
+#endif
@@ -1,9 +1,20 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <malloc.h>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #define SIMPLE_RESOURCE_COMPILER_IMPLEMENTATION
 #include "simple_resource_compiler.h"
+#include "simple_resource_compiler.hpp"
+#ifdef __cpp_impl_coroutine
+#include "simple_resource_compiler_async.hpp"
+#endif
 
 #define SRC_RESOURCE_TEST_IMPLEMENTATION
 #include "test.src.h"
@@ -11,8 +22,63 @@
 #define SRC_RESOURCE_FOO_IMPLEMENTATION
 #include "foo.src.h"
 
+#define SRC_RESOURCE_SMALL_IMPLEMENTATION
+#include "small.src.h"
+
+#define SRC_RESOURCE_SHARDED_IMPLEMENTATION
+#include "sharded.src.h"
+
+#define SRC_RESOURCE_CHUNKED_IMPLEMENTATION
+#include "chunked.src.h"
+
 constexpr const char* TEST_SRC = "test.src";
 
+static int decodeCount = 0;
+
+#ifdef __cpp_impl_coroutine
+// starts right away and frees itself when done
+struct Detached {
+	struct promise_type {
+		Detached get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept {}
+	};
+};
+
+static Detached LoadEntry(const src::async_loader<>& loader, const src::archive& archive, size_t index,
+	std::stop_token stop, std::atomic<int>& matched, std::atomic<int>& done)
+{
+	std::optional<src::byte_view> data = co_await loader.load_async(index, stop);
+	if (stop.stop_requested() ? !data : data && data->data() == archive[index].data().data()) {
+		matched += 1;
+	}
+	done += 1;
+}
+#endif
+
+static int CopyEntry(void* user, void* dst, size_t size)
+{
+	decodeCount += 1;
+	memcpy(dst, ((const src_archive_entry*)user)->data, size);
+	return 1;
+}
+
+// replaces the file at to by a copy of from, the way a build publishes a new archive
+static bool ReplaceFile(const char* from, const char* to)
+{
+	FILE* in = fopen(from, "rb");
+	FILE* out = fopen("replaced.tmp", "wb");
+	bool succ = in && out;
+	char buffer[64 * 1024];
+	size_t len;
+	while (succ && (len = fread(buffer, 1, sizeof(buffer), in)) > 0) succ = fwrite(buffer, 1, len, out) == len;
+	if (in) fclose(in);
+	if (out) succ = fclose(out) == 0 && succ;
+	return succ && rename("replaced.tmp", to) == 0;
+}
+
 int main(int argc, char** argv) noexcept
 {
 	FILE* src = fopen(TEST_SRC, "rb");
@@ -28,7 +94,8 @@ int main(int argc, char** argv) noexcept
 	int nameBufSize = 1024;
 	char* nameBuf = (char*)malloc(nameBufSize);
 
-	for (int i = 0; i < srcHeader.subResourceCount; i += 1) {
+	for (uint64_t i = 0; i < srcHeader.subResourceCount; i += 1) {
+		long recordStart = ftell(src);
 		src_resource_header sub = { 0 };
 		fread(&sub, sizeof(src_resource_header), 1, src);
 		if (!src_validate_sub_header(&sub)) {
@@ -47,8 +114,8 @@ int main(int argc, char** argv) noexcept
 		
 		printf("Found resource: \"%s\"\n", nameBuf);
 
-		// skip data
-		fseek(src, sub.resourceSize, SEEK_CUR);
+		// skip data and padding
+		fseek(src, recordStart + (long)src_record_size(&sub), SEEK_SET);
 	}
 	free(nameBuf);
 	fclose(src);
@@ -65,8 +132,8 @@ int main(int argc, char** argv) noexcept
 	for(int32_t id=0; id < SRC_RESOURCE_TEST_ID::SRC_TEST_COUNT; id += 1) {
 		src_resource_header header = {0};
 		const char* nameFromTable = src_get_test_resource_name(id);
-		size_t offsetIntoFile = src_get_test_resource_offset(id);
-		fseek(src, offsetIntoFile, SEEK_SET);
+		uint64_t offsetIntoFile = src_get_test_resource_offset(id);
+		fseek(src, (long)offsetIntoFile, SEEK_SET);
 		if(ferror(src)) {
 			printf("Seek failed.\n");
 			return -1;
@@ -93,5 +160,527 @@ int main(int argc, char** argv) noexcept
 		}
 	}
 	fclose(src);
+
+	////////////////////////////////////////////////////////////
+	src_archive testArchive, fooArchive;
+	if (!src_archive_open(&testArchive, TEST_SRC) || !src_archive_open(&fooArchive, "foo.src")) {
+		printf("Error: Failed to map archives.\n");
+		return -1;
+	}
+	src_vfs vfs;
+	src_vfs_init(&vfs);
+	src_vfs_mount(&vfs, &testArchive, 0);
+	src_vfs_mount(&vfs, &fooArchive, 1);
+	// the vfs looks resources up by their path below the packed directory
+	for(int32_t id=0; id < SRC_RESOURCE_TEST_ID::SRC_TEST_COUNT; id += 1) {
+		const char* fullName = src_get_test_resource_name(id);
+		const char* name = src_entry_relative_name(&testArchive.entries[id]);
+		const src_archive_entry* entry = src_vfs_find(&vfs, name);
+		if (!entry || entry != &testArchive.entries[id] || name == fullName || name[0] == '/'
+			|| strcmp(fullName + strlen(fullName) - strlen(name), name) != 0) {
+			printf("Error: vfs lookup of \"%s\" failed.\n", fullName);
+			return -1;
+		}
+	}
+	for(int32_t id=0; id < SRC_RESOURCE_FOO_ID::SRC_FOO_COUNT; id += 1) {
+		const char* name = src_entry_relative_name(&fooArchive.entries[id]);
+		if (src_vfs_find_id(&vfs, djb2_hash((unsigned char*)name)) != &fooArchive.entries[id]) {
+			printf("Error: vfs lookup of \"%s\" failed.\n", name);
+			return -1;
+		}
+	}
+	src_vfs_free(&vfs);
+	src_archive_close(&fooArchive);
+
+	////////////////////////////////////////////////////////////
+	// an overlay packed from another directory replaces and deletes resources of the base
+	src_archive overlayArchive;
+	if (!src_archive_open(&overlayArchive, "overlay.src")) {
+		printf("Error: Failed to open \"overlay.src\".\n");
+		return -1;
+	}
+	for (int overlayPriority = 1; overlayPriority >= -1; overlayPriority -= 2) {
+		src_vfs_init(&vfs);
+		src_vfs_mount(&vfs, &testArchive, 0);
+		src_vfs_mount(&vfs, &overlayArchive, overlayPriority);
+		const src_archive_entry* settings = src_vfs_find(&vfs, "settings.json");
+		const src_archive_entry* vert = src_vfs_find(&vfs, "shaders/basic.vert");
+		const src_archive_entry* frag = src_vfs_find(&vfs, "shaders/basic.frag");
+		bool overlaid = overlayPriority > 0;
+		bool fromOverlay = settings && settings >= overlayArchive.entries && settings < overlayArchive.entries + overlayArchive.entryCount;
+		if (!settings || fromOverlay != overlaid || (vert == NULL) != overlaid
+			|| !frag || frag < testArchive.entries || frag >= testArchive.entries + testArchive.entryCount) {
+			printf("Error: overlay with priority %d didn't shadow the base.\n", overlayPriority);
+			return -1;
+		}
+		src_vfs_free(&vfs);
+	}
+	src_archive_close(&overlayArchive);
+	src_archive_close(&testArchive);
+
+	////////////////////////////////////////////////////////////
+	// the C++ layer sees the same entries and bytes as the C reader
+	src::archive archive(TEST_SRC, SRC_OPEN_VERIFY_ON_ACCESS);
+	src::archive moved = std::move(archive);
+	if (archive || !moved || moved.size() != SRC_RESOURCE_TEST_ID::SRC_TEST_COUNT) {
+		printf("Error: Failed to open \"%s\" as src::archive.\n", TEST_SRC);
+		return -1;
+	}
+	int32_t index = 0;
+	bool matches = std::all_of(moved.begin(), moved.end(), [&](src::entry e) {
+		std::optional<src::byte_view> data = moved.get(e);
+		return e.name() == src_get_test_resource_name(index++)
+			&& moved.find(e.name()).get() == e.get()
+			&& data && data->data() == e.data().data() && data->size() == e.size();
+	});
+	if (!matches || moved.end() - moved.begin() != (ptrdiff_t)moved.size() || moved.find("missing")) {
+		printf("Error: src::archive entries didn't match.\n");
+		return -1;
+	}
+
+#ifdef __cpp_impl_coroutine
+	////////////////////////////////////////////////////////////
+	// loads issued together complete, cancelled ones come back empty
+	{
+		src::io_pool pool(2);
+		src::inline_executor executor;
+		src::async_loader<> loader(moved, pool, executor);
+		std::stop_source cancelled;
+		cancelled.request_stop();
+		std::atomic<int> matched = 0;
+		std::atomic<int> done = 0;
+		int count = (int)moved.size() * 2;
+		for (int i = 0; i < count; i += 1) {
+			LoadEntry(loader, moved, i / 2, i % 2 ? cancelled.get_token() : std::stop_token(), matched, done);
+		}
+		for (int wait = 0; done < count && wait < 5000; wait += 1) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		if (matched != count) {
+			printf("Error: async loads failed, %d of %d matched.\n", matched.load(), count);
+			return -1;
+		}
+	}
+#endif
+
+	////////////////////////////////////////////////////////////
+	// small resources are inlined, the others come from the archive through src_archive_get
+	src_archive smallArchive;
+	if (!src_archive_open_ex(&smallArchive, "small.src", SRC_OPEN_VERIFY_ON_ACCESS | SRC_OPEN_COUNTERS)) {
+		printf("Error: Failed to map \"small.src\".\n");
+		return -1;
+	}
+	src_bind_small_archive(&smallArchive);
+	for(int32_t id=0; id < SRC_RESOURCE_SMALL_ID::SRC_SMALL_COUNT; id += 1) {
+		const char* name = src_get_small_resource_name(id);
+		src_view view = src_get_small_resource(id);
+		FILE* file = fopen(name, "rb");
+		if (!file) {
+			printf("Failed to open \"%s\"\n", name);
+			return -1;
+		}
+		char* content = (char*)malloc(view.size + 1);
+		size_t read = fread(content, 1, view.size + 1, file);
+		fclose(file);
+		if (!view.data || read != view.size || memcmp(content, view.data, view.size) != 0) {
+			printf("Error: content of \"%s\" didn't match.\n", name);
+			return -1;
+		}
+		free(content);
+		// inlined resources have no record
+		bool inlined = view.data < smallArchive.base || view.data >= smallArchive.base + smallArchive.size;
+		if ((src_get_small_resource_offset(id) == UINT64_MAX) != inlined) {
+			printf("Error: offset of \"%s\" didn't match.\n", name);
+			return -1;
+		}
+	}
+	src_archive_stats smallStats;
+	src_archive_get_stats(&smallArchive, &smallStats);
+	if (smallStats.accessCount != smallArchive.entryCount) {
+		printf("Error: the accessor counted %llu reads of %zu resources.\n", (unsigned long long)smallStats.accessCount, smallArchive.entryCount);
+		return -1;
+	}
+	src_archive_close(&smallArchive);
+
+	////////////////////////////////////////////////////////////
+	// the index of a sharded archive lists the same resources as the monolithic one
+	src_sharded_archive sharded;
+	if (!src_sharded_open(&sharded, "sharded.src") || sharded.entryCount != SRC_RESOURCE_SHARDED_ID::SRC_SHARDED_COUNT) {
+		printf("Error: Failed to open \"sharded.src\".\n");
+		return -1;
+	}
+	for(int32_t id=0; id < SRC_RESOURCE_SHARDED_ID::SRC_SHARDED_COUNT; id += 1) {
+		const src_archive_entry* entry = &sharded.entries[id];
+		if (strcmp(entry->name, src_get_sharded_resource_name(id)) != 0
+			|| strcmp(entry->name, src_get_test_resource_name(id)) != 0
+			|| sharded.entryShards[id] != src_get_sharded_resource_shard(id)
+			|| !src_entry_verify(entry)) {
+			printf("Error: sharded lookup of \"%s\" failed.\n", src_get_sharded_resource_name(id));
+			return -1;
+		}
+	}
+	// the accessor reads from the bound shards, the index of a resource is within its shard
+	src_bind_sharded_archive(sharded.shards);
+	for(int32_t id=0; id < SRC_RESOURCE_SHARDED_ID::SRC_SHARDED_COUNT; id += 1) {
+		const src_archive_entry* entry = &sharded.entries[id];
+		src_view view = src_get_sharded_resource(id);
+		if (view.data != entry->data || view.size != entry->header->resourceSize) {
+			printf("Error: sharded accessor of \"%s\" failed.\n", entry->name);
+			return -1;
+		}
+	}
+
+	////////////////////////////////////////////////////////////
+	// every resource is decoded once, the second pass only hits
+	src_shared_cache_unlink("/src_test_cache");
+	src_shared_cache cache;
+	if (!src_shared_cache_open(&cache, "/src_test_cache", 1 << 20, 64)) {
+		printf("Error: Failed to open the shared cache.\n");
+		return -1;
+	}
+	for (int pass = 0; pass < 2; pass += 1) {
+		for (size_t i = 0; i < sharded.entryCount; i += 1) {
+			const src_archive_entry* entry = &sharded.entries[i];
+			src_view view;
+			if (!src_shared_cache_get(&cache, src_shared_cache_key(entry), (size_t)entry->header->resourceSize, CopyEntry, (void*)entry, &view)
+				|| memcmp(view.data, entry->data, view.size) != 0) {
+				printf("Error: shared cache lookup of \"%s\" failed.\n", entry->name);
+				return -1;
+			}
+		}
+	}
+	if (decodeCount != (int)sharded.entryCount) {
+		printf("Error: shared cache decoded %d times.\n", decodeCount);
+		return -1;
+	}
+	src_shared_cache_close(&cache);
+	src_shared_cache_unlink("/src_test_cache");
+
+	// the slot of a filler whose process died is taken over, pids never get this large
+	src_shared_cache_unlink("/src_test_dead");
+	const src_archive_entry* deadEntry = &sharded.entries[0];
+	uint64_t deadKey = src_shared_cache_key(deadEntry);
+	if (!src_shared_cache_open(&cache, "/src_test_dead", 1 << 16, 16)) {
+		printf("Error: Failed to open the shared cache.\n");
+		return -1;
+	}
+	src_shared_cache_slot* deadSlot = &cache.slots[(uint32_t)(deadKey ^ (deadKey >> 32)) & (cache.header->slotCount - 1)];
+	deadSlot->key = deadKey;
+	deadSlot->state = (1ull << 40) | ((uint64_t)SRC_CACHE_SLOT_FILLING << 32) | 0x7ffffffeu;
+	src_view deadView;
+	if (!src_shared_cache_get(&cache, deadKey, (size_t)deadEntry->header->resourceSize, CopyEntry, (void*)deadEntry, &deadView)
+		|| memcmp(deadView.data, deadEntry->data, deadView.size) != 0
+		|| (uint32_t)(deadSlot->state >> 32) != ((2u << 8) | SRC_CACHE_SLOT_READY)) {
+		printf("Error: the dead filler wasn't taken over.\n");
+		return -1;
+	}
+	src_shared_cache_close(&cache);
+	src_shared_cache_unlink("/src_test_dead");
+
+#ifndef _WIN32
+	// a segment whose creator died before setting it up is set up by the next process
+	src_shared_cache_unlink("/src_test_stale");
+	int staleFd = shm_open("/src_test_stale", O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (staleFd < 0 || ftruncate(staleFd, 1 << 16) != 0 || close(staleFd) != 0
+		|| !src_shared_cache_open(&cache, "/src_test_stale", 1 << 20, 64)
+		|| !src_shared_cache_get(&cache, deadKey, (size_t)deadEntry->header->resourceSize, CopyEntry, (void*)deadEntry, &deadView)
+		|| memcmp(deadView.data, deadEntry->data, deadView.size) != 0) {
+		printf("Error: the segment of a dead creator wasn't set up again.\n");
+		return -1;
+	}
+	src_shared_cache_close(&cache);
+	src_shared_cache_unlink("/src_test_stale");
+#endif
+
+	////////////////////////////////////////////////////////////
+	// large files are stored as chunks, streamed back they match the plain archive
+	src_archive chunkedArchive;
+	if (!src_archive_open_ex(&chunkedArchive, "chunked.src", SRC_OPEN_VERIFY_ON_ACCESS)
+		|| chunkedArchive.entryCount != sharded.entryCount) {
+		printf("Error: Failed to open \"chunked.src\".\n");
+		return -1;
+	}
+	size_t chunkedCount = 0;
+	for (size_t i = 0; i < chunkedArchive.entryCount; i += 1) {
+		const src_archive_entry* entry = &chunkedArchive.entries[i];
+		const src_archive_entry* plain = &sharded.entries[i];
+		chunkedCount += (entry->header->flags & SRC_RESOURCE_FLAG_CHUNKED) != 0;
+		src_stream stream;
+		if (!src_stream_open(&stream, &chunkedArchive, entry) || src_entry_size(entry) != plain->header->resourceSize) {
+			printf("Error: Failed to stream \"%s\".\n", entry->name);
+			return -1;
+		}
+		// odd reads cross the chunk boundaries
+		char block[1000];
+		uint64_t position = 0;
+		size_t read;
+		while ((read = src_stream_read(&stream, block, sizeof(block))) > 0) {
+			if (memcmp(block, plain->data + position, read) != 0) break;
+			position += read;
+		}
+		if (stream.failed || position != plain->header->resourceSize
+			|| !src_stream_seek(&stream, position / 3) || src_stream_read(&stream, block, 1) != (position > 0)
+			|| (position > 0 && block[0] != (char)plain->data[position / 3])) {
+			printf("Error: streamed \"%s\" didn't match.\n", entry->name);
+			return -1;
+		}
+	}
+	if (chunkedCount == 0) {
+		printf("Error: \"chunked.src\" has no chunked resources.\n");
+		return -1;
+	}
+	// the accessor has no contiguous data of chunked resources, empty ones have data
+	src_bind_chunked_archive(&chunkedArchive);
+	for (int32_t id = 0; id < SRC_RESOURCE_CHUNKED_ID::SRC_CHUNKED_COUNT; id += 1) {
+		const src_archive_entry* entry = &chunkedArchive.entries[id];
+		bool chunked = (entry->header->flags & SRC_RESOURCE_FLAG_CHUNKED) != 0;
+		src_view view = src_get_chunked_resource(id);
+		if ((view.data == NULL) != chunked || (!chunked && view.size != entry->header->resourceSize)) {
+			printf("Error: the accessor of \"%s\" didn't match.\n", entry->name);
+			return -1;
+		}
+	}
+	src_archive_close(&chunkedArchive);
+
+	////////////////////////////////////////////////////////////
+	// groups are contiguous ranges, the TOC keeps the path order
+	src_archive groupedArchive;
+	if (!src_archive_open(&groupedArchive, "grouped.src") || groupedArchive.groupCount != 2
+		|| src_archive_find_group(&groupedArchive, "fonts") != 0
+		|| src_archive_find_group(&groupedArchive, "shaders") != 1
+		|| src_archive_find_group(&groupedArchive, "level3") != -1
+		|| groupedArchive.groups[0].offset != sizeof(src_main_header)) {
+		printf("Error: Failed to open the groups of \"grouped.src\".\n");
+		return -1;
+	}
+	for (size_t i = 0; i < groupedArchive.entryCount; i += 1) {
+		const src_archive_entry* entry = &groupedArchive.entries[i];
+		uint64_t offset = (uint64_t)((const unsigned char*)entry->header - groupedArchive.base);
+		int group = strstr(entry->name, "/font/") ? 0 : strstr(entry->name, "/shaders/") ? 1 : -1;
+		for (int g = 0; g < 2; g += 1) {
+			const src_group_entry* range = &groupedArchive.groups[g];
+			int inside = offset >= range->offset && offset + src_record_size(entry->header) <= range->offset + range->size;
+			if (inside != (g == group) || strcmp(entry->name, sharded.entries[i].name) != 0) {
+				printf("Error: \"%s\" isn't placed with its group.\n", entry->name);
+				return -1;
+			}
+		}
+	}
+	if (!src_archive_prefetch_group(&groupedArchive, "fonts") || !src_archive_release_group(&groupedArchive, "fonts")
+		|| src_archive_prefetch_group(&groupedArchive, "level3")) {
+		printf("Error: group hints failed.\n");
+		return -1;
+	}
+	// released pages are read again
+	for (size_t i = 0; i < groupedArchive.entryCount; i += 1) {
+		if (!src_entry_verify(&groupedArchive.entries[i])) {
+			printf("Error: \"%s\" didn't verify after its group was released.\n", groupedArchive.entries[i].name);
+			return -1;
+		}
+	}
+	src_archive_close(&groupedArchive);
+
+	////////////////////////////////////////////////////////////
+	// compressed resources are read back whole, the dictionary is loaded at open
+	src_archive compressedArchive;
+	if (!src_archive_open_ex(&compressedArchive, "compressed.src", SRC_OPEN_VERIFY_ON_ACCESS)
+		|| compressedArchive.entryCount != sharded.entryCount || compressedArchive.dictionary.size == 0) {
+		printf("Error: Failed to open \"compressed.src\".\n");
+		return -1;
+	}
+	size_t compressedCount = 0;
+	for (size_t i = 0; i < compressedArchive.entryCount; i += 1) {
+		const src_archive_entry* entry = &compressedArchive.entries[i];
+		const src_archive_entry* plain = &sharded.entries[i];
+		compressedCount += (entry->header->flags & SRC_RESOURCE_FLAG_COMPRESSED) != 0;
+		std::vector<unsigned char> data((size_t)plain->header->resourceSize + 1);
+		if (src_entry_size(entry) != plain->header->resourceSize
+			|| !src_archive_read(&compressedArchive, entry, data.data(), (size_t)plain->header->resourceSize)
+			|| memcmp(data.data(), plain->data, (size_t)plain->header->resourceSize) != 0) {
+			printf("Error: compressed \"%s\" didn't match.\n", entry->name);
+			return -1;
+		}
+	}
+	if (compressedCount == 0) {
+		printf("Error: \"compressed.src\" has no compressed resources.\n");
+		return -1;
+	}
+	src_archive_close(&compressedArchive);
+
+	////////////////////////////////////////////////////////////
+	// ranges of framed resources only decompress the frames they overlap, disjoint frames on several threads
+	src_archive framedArchive;
+	if (!src_archive_open_ex(&framedArchive, "framed.src", SRC_OPEN_VERIFY_ON_ACCESS) || framedArchive.entryCount != sharded.entryCount) {
+		printf("Error: Failed to open \"framed.src\".\n");
+		return -1;
+	}
+	size_t framedCount = 0;
+	for (size_t i = 0; i < framedArchive.entryCount; i += 1) {
+		const src_archive_entry* entry = &framedArchive.entries[i];
+		const src_archive_entry* plain = &sharded.entries[i];
+		size_t size = (size_t)plain->header->resourceSize;
+		size_t frameSize = src_entry_frame_size(entry);
+		std::vector<unsigned char> data(size + 1);
+		size_t offset = size / 3;
+		size_t length = size - offset - size / 5;
+		int matches = src_archive_read_range(&framedArchive, entry, offset, data.data(), length)
+			&& memcmp(data.data(), plain->data + offset, length) == 0
+			&& !src_archive_read_range(&framedArchive, entry, offset, data.data(), size - offset + 1);
+		if (frameSize) {
+			framedCount += 1;
+			std::atomic<int> failed = 0;
+			std::vector<std::thread> threads;
+			for (size_t begin = 0; begin < size; begin += 4 * frameSize) {
+				size_t len = std::min(4 * frameSize, size - begin);
+				threads.emplace_back([&, begin, len] {
+					if (!src_archive_read_range(&framedArchive, entry, begin, data.data() + begin, len)) failed += 1;
+				});
+			}
+			for (std::thread& thread : threads) thread.join();
+			matches = matches && failed == 0 && memcmp(data.data(), plain->data, size) == 0;
+		}
+		if (!matches) {
+			printf("Error: framed \"%s\" didn't match.\n", entry->name);
+			return -1;
+		}
+	}
+	if (framedCount == 0) {
+		printf("Error: \"framed.src\" has no framed resources.\n");
+		return -1;
+	}
+	src_archive_close(&framedArchive);
+
+	////////////////////////////////////////////////////////////
+	// the rules leave the shaders out and page align the fonts
+	src_archive filteredArchive;
+	if (!src_archive_open(&filteredArchive, "filtered.src") || filteredArchive.entryCount != sharded.entryCount - 2) {
+		printf("Error: Failed to open \"filtered.src\".\n");
+		return -1;
+	}
+	for (size_t i = 0; i < filteredArchive.entryCount; i += 1) {
+		const src_archive_entry* entry = &filteredArchive.entries[i];
+		uint64_t dataOffset = (uint64_t)(entry->data - filteredArchive.base);
+		if (strstr(entry->name, "/shaders/") || (strstr(entry->name, "/font/") && dataOffset % 4096 != 0)) {
+			printf("Error: \"%s\" didn't follow the rules.\n", entry->name);
+			return -1;
+		}
+	}
+	src_archive_close(&filteredArchive);
+
+	////////////////////////////////////////////////////////////
+	// the crcs of the two halves of a resource combine to its checksum
+	for (size_t i = 0; i < sharded.entryCount; i += 1) {
+		const src_archive_entry* entry = &sharded.entries[i];
+		size_t size = (size_t)entry->header->resourceSize;
+		uint32_t crc = src_crc32c_combine(src_crc32c(entry->data, size / 3, 0),
+			src_crc32c(entry->data + size / 3, size - size / 3, 0), size - size / 3);
+		if (crc != entry->header->checksum) {
+			printf("Error: combined crc of \"%s\" didn't match.\n", entry->name);
+			return -1;
+		}
+	}
+
+	////////////////////////////////////////////////////////////
+	// the json is packed minified, everything else as it is
+	src_archive transformedArchive;
+	if (!src_archive_open(&transformedArchive, "transformed.src") || transformedArchive.entryCount != sharded.entryCount) {
+		printf("Error: Failed to open \"transformed.src\".\n");
+		return -1;
+	}
+	for (size_t i = 0; i < transformedArchive.entryCount; i += 1) {
+		const src_archive_entry* entry = &transformedArchive.entries[i];
+		const src_archive_entry* plain = &sharded.entries[i];
+		uint64_t size = entry->header->resourceSize;
+		int matches = strstr(entry->name, ".json")
+			? size < plain->header->resourceSize && !memchr(entry->data, '\n', (size_t)size)
+			: size == plain->header->resourceSize && memcmp(entry->data, plain->data, (size_t)size) == 0;
+		if (!matches) {
+			printf("Error: transformed \"%s\" didn't match.\n", entry->name);
+			return -1;
+		}
+	}
+	src_archive_close(&transformedArchive);
+
+	////////////////////////////////////////////////////////////
+	// the mapping modes read the same bytes, the counters see every read
+	const uint32_t modes[] = {
+		SRC_OPEN_POPULATE | SRC_OPEN_LOCK_INDEX | SRC_OPEN_HUGE_PAGES_COPY | SRC_OPEN_COUNTERS,
+		SRC_OPEN_LOCK_ALL | SRC_OPEN_HUGE_PAGES | SRC_OPEN_COUNTERS,
+	};
+	for (uint32_t mode : modes) {
+		src_archive pinnedArchive;
+		if (!src_archive_open_ex(&pinnedArchive, "framed.src", mode) || pinnedArchive.entryCount != sharded.entryCount) {
+			printf("Error: Failed to open \"framed.src\" with modes %x.\n", mode);
+			return -1;
+		}
+		uint64_t readBytes = 0;
+		for (size_t i = 0; i < pinnedArchive.entryCount; i += 1) {
+			const src_archive_entry* plain = &sharded.entries[i];
+			size_t size = (size_t)plain->header->resourceSize;
+			std::vector<unsigned char> data(size + 1);
+			if (!src_archive_read(&pinnedArchive, &pinnedArchive.entries[i], data.data(), size) || memcmp(data.data(), plain->data, size) != 0) {
+				printf("Error: \"%s\" didn't match with modes %x.\n", plain->name, mode);
+				return -1;
+			}
+			readBytes += size;
+		}
+		src_archive_stats stats;
+		src_archive_get_stats(&pinnedArchive, &stats);
+		if (stats.accessCount != pinnedArchive.entryCount || stats.accessBytes != readBytes
+			|| stats.mappedBytes < pinnedArchive.size || stats.pageSize == 0) {
+			printf("Error: stats didn't match the reads with modes %x.\n", mode);
+			return -1;
+		}
+		src_archive_close(&pinnedArchive);
+	}
+	////////////////////////////////////////////////////////////
+	// a reload publishes the replaced file, acquired snapshots stay readable until released
+	src_archive_reloader reloader;
+	if (!ReplaceFile(TEST_SRC, "reloaded.src") || !src_reloader_init(&reloader, "reloaded.src")) {
+		printf("Error: Failed to open \"reloaded.src\".\n");
+		return -1;
+	}
+	src_archive_snapshot* first = src_reloader_acquire(&reloader);
+	if (src_reloader_poll(&reloader) || !ReplaceFile("foo.src", "reloaded.src") || !src_reloader_poll(&reloader)) {
+		printf("Error: polling didn't follow the replaced file.\n");
+		return -1;
+	}
+	src_archive_snapshot* second = src_reloader_acquire(&reloader);
+	if (second == first || first->archive.entryCount != sharded.entryCount || second->archive.entryCount == first->archive.entryCount
+		|| memcmp(first->archive.entries[0].data, sharded.entries[0].data, (size_t)sharded.entries[0].header->resourceSize) != 0) {
+		printf("Error: the snapshots didn't keep their versions.\n");
+		return -1;
+	}
+	src_snapshot_release(first);
+	// readers keep acquiring while the file is reloaded, none waits for another
+	std::atomic<bool> reloading{ true };
+	std::atomic<int> mismatches{ 0 };
+	std::vector<std::thread> readers;
+	for (int t = 0; t < 4; t += 1) {
+		readers.emplace_back([&]() {
+			while (reloading) {
+				src_archive_snapshot* snapshot = src_reloader_acquire(&reloader);
+				const src_archive_entry* entry = &snapshot->archive.entries[snapshot->archive.entryCount - 1];
+				if (src_crc32c(entry->data, (size_t)entry->header->resourceSize, 0) != entry->header->checksum) mismatches += 1;
+				src_snapshot_release(snapshot);
+			}
+		});
+	}
+	int reloads = 0;
+	for (int i = 0; i < 200; i += 1) reloads += src_reloader_reload(&reloader);
+	reloading = false;
+	for (std::thread& reader : readers) reader.join();
+	// the last snapshot outlives the reloader
+	src_archive_snapshot* last = src_reloader_acquire(&reloader);
+	src_reloader_free(&reloader);
+	if (mismatches != 0 || reloads == 0 || last->archive.entryCount != second->archive.entryCount) {
+		printf("Error: readers saw a broken snapshot while reloading.\n");
+		return -1;
+	}
+	src_snapshot_release(second);
+	src_snapshot_release(last);
+	remove("reloaded.src");
+
+	src_sharded_close(&sharded);
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,383 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+// libsrc holds the implementation of the reader
+#include "simple_resource_compiler.h"
+#include "src_builder.h"
+
+// runs the src executable in the working directory, returns its exit code
+static int RunSrc(const std::string& args)
+{
+	std::string command = std::string("\"") + SRC_EXECUTABLE + "\" " + args;
+	return std::system(command.c_str());
+}
+
+static bool ReadWholeFile(const char* path, std::vector<unsigned char>& data)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file) return false;
+	data.clear();
+	unsigned char buffer[64 * 1024];
+	size_t len;
+	while ((len = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		data.insert(data.end(), buffer, buffer + len);
+	}
+	fclose(file);
+	return true;
+}
+
+static bool SameFiles(const char* a, const char* b)
+{
+	std::vector<unsigned char> dataA, dataB;
+	return ReadWholeFile(a, dataA) && ReadWholeFile(b, dataB) && dataA == dataB;
+}
+
+static bool WriteWholeFile(const std::string& path, const std::string& data)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file) return false;
+	bool succ = fwrite(data.data(), 1, data.size(), file) == data.size();
+	return fclose(file) == 0 && succ;
+}
+
+static int CountInFile(const char* path, const char* text)
+{
+	std::vector<unsigned char> data;
+	if (!ReadWholeFile(path, data)) return 0;
+	std::string content(data.begin(), data.end());
+	int count = 0;
+	for (size_t pos = content.find(text); pos != std::string::npos; pos = content.find(text, pos + 1)) count += 1;
+	return count;
+}
+
+#if defined(__linux__)
+// waits until the log of src --watch has count lines containing text
+static bool WaitForLog(const char* text, int count)
+{
+	for (int wait = 0; wait < 1000; wait += 1) {
+		if (CountInFile("watch.log", text) >= count) return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return false;
+}
+
+// the numbers of a table of the generated header, one per line
+static std::vector<std::string> ReadHeaderTable(const std::string& header, const char* table)
+{
+	std::vector<std::string> values;
+	size_t pos = header.find(table);
+	if (pos == std::string::npos) return values;
+	pos = header.find('\n', pos) + 1;
+	for (size_t end = header.find('\n', pos); header.compare(pos, 2, "};") != 0 && end != std::string::npos; end = header.find('\n', pos)) {
+		std::string line = header.substr(pos, end - pos);
+		size_t begin = line.find_first_not_of("\t\"");
+		size_t last = line.find_last_not_of(",\"ULL");
+		values.push_back(line.substr(begin, last + 1 - begin));
+		pos = end + 1;
+	}
+	return values;
+}
+
+// the watched archive holds exactly the files, page aligned text, its generated header has their current offsets and sizes
+static bool CheckWatched(const std::map<std::string, std::string>& files)
+{
+	src_archive archive;
+	if (!src_archive_open(&archive, "watched.src")) return false;
+	bool matches = archive.entryCount == files.size();
+	for (size_t i = 0; i < archive.entryCount && matches; i += 1) {
+		const src_archive_entry* entry = &archive.entries[i];
+		auto file = files.find(src_entry_relative_name(entry));
+		bool text = strstr(entry->name, ".txt") != NULL;
+		matches = file != files.end() && file->second.size() == entry->header->resourceSize
+			&& memcmp(file->second.data(), entry->data, file->second.size()) == 0
+			&& (!text || (entry->data - archive.base) % 4096 == 0);
+	}
+
+	std::vector<unsigned char> data;
+	std::string header = ReadWholeFile("watched.src.h", data) ? std::string(data.begin(), data.end()) : "";
+	std::vector<std::string> names = ReadHeaderTable(header, "_RESOURCE_NAMES[]");
+	std::vector<std::string> offsets = ReadHeaderTable(header, "_RESOURCE_OFFSETS[]");
+	std::vector<std::string> sizes = ReadHeaderTable(header, "_RESOURCE_SIZES[]");
+	matches = matches && names.size() == archive.entryCount && offsets.size() == names.size() && sizes.size() == names.size();
+	for (size_t i = 0; i < names.size() && matches; i += 1) {
+		const src_archive_entry* entry = NULL;
+		for (size_t k = 0; k < archive.entryCount; k += 1) {
+			if (names[i] == archive.entries[k].name) entry = &archive.entries[k];
+		}
+		matches = entry && std::stoull(offsets[i]) == (uint64_t)((const unsigned char*)entry->header - archive.base)
+			&& std::stoull(sizes[i]) == entry->header->resourceSize;
+	}
+	src_archive_close(&archive);
+	return matches;
+}
+#endif
+
+int main(int argc, char** argv) noexcept
+{
+	////////////////////////////////////////////////////////////
+	// a patch rebuilds the new archive bit for bit and only applies to its old one
+	if (RunSrc("diff test.src transformed.src -o transformed.srcp") != 0
+		|| RunSrc("patch test.src transformed.srcp -o patched.src") != 0
+		|| !SameFiles("patched.src", "transformed.src")) {
+		printf("Error: patching \"test.src\" didn't give \"transformed.src\".\n");
+		return -1;
+	}
+	if (RunSrc("patch foo.src transformed.srcp -o patched.src") == 0) {
+		printf("Error: a patch applied to another archive.\n");
+		return -1;
+	}
+
+	////////////////////////////////////////////////////////////
+	// a differing settings.json fails the merge unless a policy picks one of the inputs
+	{
+		const char* pair = "merge test.src transformed.src";
+		bool succ = RunSrc(std::string(pair) + " -o merged.src") != 0
+			&& RunSrc(std::string(pair) + " -o mergedFirst.src --conflict first") == 0
+			&& RunSrc(std::string(pair) + " -o mergedLast.src --conflict last") == 0
+			&& RunSrc(std::string(pair) + " -o mergedWritten.src --conflict last --no-copy-range") == 0
+			&& SameFiles("mergedLast.src", "mergedWritten.src");
+		const char* merged[] = { "mergedFirst.src", "mergedLast.src" };
+		const char* origins[] = { "test.src", "transformed.src" };
+		for (int i = 0; i < 2 && succ; i += 1) {
+			src_archive archive = src_archive(), origin = src_archive();
+			succ = src_archive_open(&archive, merged[i]) && src_archive_open(&origin, origins[i]);
+			for (size_t k = 0; k < archive.entryCount && succ; k += 1) {
+				const src_archive_entry* entry = &archive.entries[k];
+				succ = k < origin.entryCount && strcmp(entry->name, origin.entries[k].name) == 0
+					&& entry->header->checksum == origin.entries[k].header->checksum && src_entry_verify(entry);
+			}
+			succ = succ && archive.entryCount == origin.entryCount;
+			src_archive_close(&archive);
+			src_archive_close(&origin);
+		}
+		// the page aligned fonts stay page aligned
+		src_archive aligned = src_archive();
+		succ = succ && RunSrc("merge filtered.src -o mergedAligned.src") == 0 && src_archive_open(&aligned, "mergedAligned.src");
+		for (size_t k = 0; k < aligned.entryCount && succ; k += 1) {
+			const src_archive_entry* entry = &aligned.entries[k];
+			succ = !strstr(entry->name, "/font/") || (entry->data - aligned.base) % 4096 == 0;
+		}
+		src_archive_close(&aligned);
+		// the group table isn't rebuilt, grouped inputs are refused
+		succ = succ && RunSrc("merge test.src grouped.src -o mergedGroups.src --conflict first") != 0;
+		// the inlined resources of an input are reported
+		succ = succ && RunSrc("merge small.src -o mergedSmall.src > merge.log") == 0 && CountInFile("merge.log", "inlined into") == 1;
+		if (!succ) {
+			printf("Error: merging didn't follow the conflict policy.\n");
+			return -1;
+		}
+	}
+
+	////////////////////////////////////////////////////////////
+	// the step writing one shard only transforms the files of that shard, the index step none
+	{
+		std::filesystem::remove_all("shardData");
+		std::filesystem::remove_all("shardStep.src.cache");
+		std::filesystem::create_directories("shardData/a");
+		std::filesystem::create_directories("shardData/b");
+		bool succ = WriteWholeFile("shardData/a/x.json", "{ \"a\": 1 }") && WriteWholeFile("shardData/b/y.json", "{ \"b\": 2 }")
+			&& RunSrc("-t shardData -o shardStep.src -s . --shard-by-dir --shard 1 --transform .json=json-minify") == 0;
+		// the index step only reads the shards, whether they were all written or not
+		succ = succ && (RunSrc("-t shardData -o shardStep.src -s . --shard-by-dir --shard-index --transform .json=json-minify"), true);
+		size_t cached = 0;
+		for (const auto& file : std::filesystem::directory_iterator("shardStep.src.cache")) cached += file.is_regular_file();
+		if (!succ || cached != 1) {
+			printf("Error: the shard step transformed %zu files instead of 1.\n", cached);
+			return -1;
+		}
+	}
+
+	////////////////////////////////////////////////////////////
+	// resources added from several threads all end up in the archive, empty ones too
+	{
+		std::map<std::string, std::string> resources;
+		for (int t = 0; t < 4; t += 1) {
+			for (int i = 0; i < 50; i += 1) {
+				resources["thread" + std::to_string(t) + "/" + std::to_string(i)] = std::string((size_t)(i * 37 % 301), (char)('a' + t));
+			}
+		}
+		resources["file.txt"] = "added from a file";
+		src_builder_desc desc = { "built.src", NULL, 0, 0 };
+		src_builder* builder = src_builder_create(&desc);
+		bool succ = builder && WriteWholeFile("builderInput.txt", resources["file.txt"])
+			&& src_builder_add_file(builder, "file.txt", "builderInput.txt");
+		std::vector<std::thread> threads;
+		std::atomic<int> added{ 0 };
+		for (int t = 0; t < 4 && builder; t += 1) {
+			threads.emplace_back([&, t]() {
+				std::string prefix = "thread" + std::to_string(t) + "/";
+				for (const auto& resource : resources) {
+					if (resource.first.compare(0, prefix.size(), prefix) != 0) continue;
+					added += src_builder_add_memory(builder, resource.first.c_str(), resource.second.data(), resource.second.size());
+				}
+			});
+		}
+		for (std::thread& thread : threads) thread.join();
+		succ = succ && added == 200 && src_builder_finish(builder);
+
+		src_archive archive;
+		succ = succ && src_archive_open(&archive, "built.src");
+		if (succ) {
+			succ = archive.entryCount == resources.size();
+			for (size_t i = 0; i < archive.entryCount && succ; i += 1) {
+				const src_archive_entry* entry = &archive.entries[i];
+				auto resource = resources.find(entry->name);
+				succ = resource != resources.end() && resource->second.size() == entry->header->resourceSize
+					&& memcmp(resource->second.data(), entry->data, resource->second.size()) == 0 && src_entry_verify(entry);
+			}
+			src_archive_close(&archive);
+		}
+		if (!succ) {
+			printf("Error: the builder didn't pack every resource.\n");
+			return -1;
+		}
+
+		// a resource added twice fails the archive and leaves no file behind
+		builder = src_builder_create(&desc);
+		if (!builder || !src_builder_add_memory(builder, "twice", "1", 1) || !src_builder_add_memory(builder, "twice", "2", 1)
+			|| src_builder_finish(builder) || std::filesystem::exists("built.src")) {
+			printf("Error: the builder accepted a resource twice.\n");
+			return -1;
+		}
+	}
+
+	////////////////////////////////////////////////////////////
+	// without --inline-threshold an empty file is a record like any other
+	{
+		std::filesystem::remove_all("emptyData");
+		std::filesystem::create_directories("emptyData");
+		src_archive archive;
+		bool succ = WriteWholeFile("emptyData/empty.txt", "") && RunSrc("-t emptyData -o empty.src -s .") == 0
+			&& src_archive_open(&archive, "empty.src");
+		if (succ) {
+			succ = archive.entryCount == 1 && archive.entries[0].header->resourceSize == 0;
+			src_archive_close(&archive);
+		}
+		if (!succ) {
+			printf("Error: the empty file wasn't packed.\n");
+			return -1;
+		}
+	}
+
+	////////////////////////////////////////////////////////////
+	// analyze totals the root level files, finds the copies and replays a trace
+	{
+		std::filesystem::remove_all("analyzeData");
+		std::filesystem::create_directories("analyzeData/a");
+		std::filesystem::create_directories("analyzeData/b");
+		std::string big(20000, 'x'), small(3000, 'y');
+		bool succ = WriteWholeFile("analyzeData/a/one.bin", big) && WriteWholeFile("analyzeData/b/two.bin", big)
+			&& WriteWholeFile("analyzeData/a/three.bin", small) && WriteWholeFile("analyzeData/b/four.bin", small)
+			&& WriteWholeFile("analyzeData/root.txt", "root") && RunSrc("-t analyzeData -o analyzed.src -s .") == 0
+			&& RunSrc("analyze analyzed.src -j 4 --json analyze.json --trace ../test/analyzeTrace.txt > analyze.log") == 0;
+		succ = succ && CountInFile("analyze.log", "(root)") == 1 && CountInFile("analyze.log", "Duplicates: 2 records") == 1
+			&& CountInFile("analyze.log", "2 reads") == 1 && CountInFile("analyze.log", "1 unknown") == 1;
+		succ = succ && CountInFile("analyze.json", "\"path\": \"(root)\", \"count\": 1") == 1 && CountInFile("analyze.json", "\"copyOf\"") == 2
+			&& CountInFile("analyze.json", "\"reads\": 2, \"unknown\": 1") == 1;
+		if (!succ) {
+			printf("Error: the analysis of analyzed.src is wrong.\n");
+			return -1;
+		}
+	}
+
+	////////////////////////////////////////////////////////////
+	// a resource larger than a range is checked in parts on several threads, a flipped byte in it fails
+	{
+		std::filesystem::remove_all("verifyData");
+		std::filesystem::create_directories("verifyData");
+		std::string large(9 * 1024 * 1024 + 17, '\0');
+		for (size_t i = 0; i < large.size(); i += 1) large[i] = (char)(i * 2654435761u >> 24);
+		bool succ = WriteWholeFile("verifyData/large.bin", large) && WriteWholeFile("verifyData/small.txt", "small")
+			&& RunSrc("-t verifyData -o verified.src -s .") == 0 && RunSrc("verify verified.src -j 4") == 0;
+		std::vector<unsigned char> data;
+		succ = succ && ReadWholeFile("verified.src", data);
+		if (succ) {
+			// the middle of the archive is inside the large resource, in another part than its first
+			data[data.size() / 2] ^= 1;
+			std::string corrupted(data.begin(), data.end());
+			succ = WriteWholeFile("verified.src", corrupted) && RunSrc("verify verified.src -j 4") != 0;
+		}
+		if (!succ) {
+			printf("Error: verifying a large resource in parts didn't find the flipped byte.\n");
+			return -1;
+		}
+	}
+
+#if defined(__linux__)
+	////////////////////////////////////////////////////////////
+	// --watch applies changes, debounces bursts, compacts dead records and keeps the header current
+	{
+		std::filesystem::remove_all("watchData");
+		std::filesystem::create_directories("watchData/sub");
+		std::map<std::string, std::string> files;
+		files["a.txt"] = "first";
+		files["sub/b.txt"] = "bee";
+		files["big.bin"] = std::string(700 * 1024, 'x');
+		for (const auto& file : files) WriteWholeFile("watchData/" + file.first, file.second);
+		WriteWholeFile("watchRules.txt", "set *.txt align=4096\n");
+		remove("watch.log");
+		RunSrc("--watch -t watchData -o watched.src -s . --rules watchRules.txt > watch.log 2>&1 & echo $! > watch.pid");
+
+		bool succ = WaitForLog("Watching", 1) && CheckWatched(files);
+		// a changed size moves the record
+		files["a.txt"] = "second version";
+		succ = succ && WriteWholeFile("watchData/a.txt", files["a.txt"]) && WaitForLog("Updated", 1) && CheckWatched(files);
+		// a burst of saves is one update
+		for (int i = 0; i < 10 && succ; i += 1) {
+			files["a.txt"] = "burst " + std::to_string(i);
+			succ = WriteWholeFile("watchData/a.txt", files["a.txt"]);
+		}
+		succ = succ && WaitForLog("Updated", 2);
+		std::this_thread::sleep_for(std::chrono::milliseconds(700));
+		succ = succ && CountInFile("watch.log", "Updated") == 2 && CheckWatched(files);
+		// added and removed files change the header
+		files["c.txt"] = "sea";
+		files.erase("sub/b.txt");
+		succ = succ && WriteWholeFile("watchData/c.txt", files["c.txt"]) && remove("watchData/sub/b.txt") == 0
+			&& WaitForLog("Updated", 3) && CheckWatched(files);
+		// two dead copies of big.bin outweigh the live records
+		for (int i = 0; i < 2 && succ; i += 1) {
+			files["big.bin"] = std::string(700 * 1024, (char)('a' + i));
+			succ = WriteWholeFile("watchData/big.bin", files["big.bin"]) && WaitForLog("Updated", 4 + i);
+		}
+		succ = succ && CountInFile("watch.log", "Compacted") == 1 && CheckWatched(files)
+			&& std::filesystem::file_size("watched.src") < 2 * 700 * 1024;
+		// more events than the kernel queues while the watcher is stopped, it rescans the tree
+		int queued = 16384;
+		if (FILE* limit = fopen("/proc/sys/fs/inotify/max_queued_events", "rb")) {
+			if (fscanf(limit, "%d", &queued) != 1) queued = 16384;
+			fclose(limit);
+		}
+		succ = succ && std::system("kill -STOP $(cat watch.pid)") == 0;
+		files["a.txt"] = "burst X";
+		files.erase("c.txt");
+		succ = succ && WriteWholeFile("watchData/a.txt", files["a.txt"]) && remove("watchData/c.txt") == 0;
+		// a create and a close per file
+		for (int i = 0; i < queued / 2 + 64 && succ; i += 1) {
+			std::string name = "sub/f" + std::to_string(i) + ".bin";
+			files[name] = std::to_string(i);
+			succ = WriteWholeFile("watchData/" + name, files[name]);
+		}
+		succ = succ && std::system("kill -CONT $(cat watch.pid)") == 0 && WaitForLog("Updated", 6);
+		std::this_thread::sleep_for(std::chrono::milliseconds(700));
+		succ = succ && CountInFile("watch.log", "rescanning") == 1 && CheckWatched(files);
+		std::system("kill $(cat watch.pid)");
+		if (!succ) {
+			printf("Error: the archive of src --watch didn't follow the files, see watch.log.\n");
+			return -1;
+		}
+	}
+#endif
+
+	printf("Tools test successful.\n");
+	return 0;
+}